@@ -0,0 +1,36 @@
+if (USE_BUNDLED_DJVULIBRE)
+  if (ANDROID)
+    set(DJVULIBRE_BUNDLED_ROOT "${CMAKE_SOURCE_DIR}/third_party/install/android/${ANDROID_ABI}/djvulibre")
+  else()
+    set(DJVULIBRE_BUNDLED_ROOT "${CMAKE_SOURCE_DIR}/third_party/install/djvulibre")
+  endif()
+endif()
+
+set(DJVULIBRE_AVAILABLE FALSE)
+
+if (USE_BUNDLED_DJVULIBRE)
+  set(_djvulibre_inc "${DJVULIBRE_BUNDLED_ROOT}/include")
+  set(_djvulibre_lib "${DJVULIBRE_BUNDLED_ROOT}/lib/libdjvulibre.so")
+  if (EXISTS "${_djvulibre_inc}/libdjvu/ddjvuapi.h" AND EXISTS "${_djvulibre_lib}")
+    add_library(DjVuLibre::DjVuLibre INTERFACE IMPORTED)
+    target_include_directories(DjVuLibre::DjVuLibre INTERFACE "${_djvulibre_inc}")
+    target_link_libraries(DjVuLibre::DjVuLibre INTERFACE "${_djvulibre_lib}")
+    set(DJVULIBRE_AVAILABLE TRUE)
+    add_compile_definitions(HAVE_DDJVUAPI=1)
+  endif()
+endif()
+
+if (NOT DJVULIBRE_AVAILABLE)
+  find_package(PkgConfig QUIET)
+  if (PkgConfig_FOUND)
+    pkg_check_modules(DDJVUAPI QUIET ddjvuapi)
+    if (DDJVUAPI_FOUND)
+      add_library(DjVuLibre::DjVuLibre INTERFACE IMPORTED)
+      target_include_directories(DjVuLibre::DjVuLibre INTERFACE ${DDJVUAPI_INCLUDE_DIRS})
+      target_link_directories(DjVuLibre::DjVuLibre INTERFACE ${DDJVUAPI_LIBRARY_DIRS})
+      target_link_libraries(DjVuLibre::DjVuLibre INTERFACE ${DDJVUAPI_LIBRARIES})
+      set(DJVULIBRE_AVAILABLE TRUE)
+      add_compile_definitions(HAVE_DDJVUAPI=1)
+    endif()
+  endif()
+endif()
@@ -0,0 +1,97 @@
+#include "PageImageProvider.h"
+
+#include <QMetaObject>
+#include <QMutexLocker>
+
+#include "PageImageCache.h"
+#include "ThumbnailAtlas.h"
+
+PageImageResponse::PageImageResponse(Source source, const QString &key, const QSize &requestedSize)
+    : m_delivery(std::make_shared<Delivery>()), m_source(source), m_requestedSize(requestedSize) {
+  m_delivery->response = this;
+  const std::shared_ptr<Delivery> delivery = m_delivery;
+  auto waiter = [delivery](const QImage &image) {
+    QMutexLocker locker(&delivery->mutex);
+    if (delivery->response) {
+      delivery->response->deliver(image);
+    }
+  };
+  const quint64 ticket =
+      source == Source::Thumbnails
+          ? ThumbnailAtlas::instance().subscribe(key.section('/', 0, 0), key.section('/', 1, 1).toInt(), waiter)
+          : PageImageCache::instance().subscribe(key, waiter);
+  QMutexLocker locker(&m_mutex);
+  if (!m_done) {
+    m_ticket = ticket;
+  }
+}
+
+PageImageResponse::~PageImageResponse() {
+  {
+    QMutexLocker locker(&m_delivery->mutex);
+    m_delivery->response = nullptr;
+  }
+  cancel();
+}
+
+QQuickTextureFactory *PageImageResponse::textureFactory() const {
+  QMutexLocker locker(&m_mutex);
+  return QQuickTextureFactory::textureFactoryForImage(m_image);
+}
+
+QString PageImageResponse::errorString() const {
+  QMutexLocker locker(&m_mutex);
+  return m_error;
+}
+
+void PageImageResponse::cancel() {
+  quint64 ticket = 0;
+  {
+    QMutexLocker locker(&m_mutex);
+    ticket = m_ticket;
+    m_ticket = 0;
+  }
+  if (ticket == 0) {
+    return;
+  }
+  if (m_source == Source::Thumbnails) {
+    ThumbnailAtlas::instance().unsubscribe(ticket);
+  } else {
+    PageImageCache::instance().unsubscribe(ticket);
+  }
+}
+
+// Runs on whichever thread inserted the page; finished() is queued so it is
+// never emitted before the engine has connected to this response.
+void PageImageResponse::deliver(const QImage &image) {
+  QImage scaled = image;
+  if (!scaled.isNull() && m_requestedSize.isValid() &&
+      (scaled.width() > m_requestedSize.width() || scaled.height() > m_requestedSize.height())) {
+    scaled = scaled.scaled(m_requestedSize, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+  }
+  {
+    QMutexLocker locker(&m_mutex);
+    if (m_done) {
+      return;
+    }
+    m_done = true;
+    m_ticket = 0;
+    m_image = std::move(scaled);
+    if (m_image.isNull()) {
+      m_error = "Page is no longer available";
+    }
+  }
+  QMetaObject::invokeMethod(this, &QQuickImageResponse::finished, Qt::QueuedConnection);
+}
+
+QQuickImageResponse *PageImageProvider::requestImageResponse(const QString &id,
+                                                             const QSize &requestedSize) {
+  // QML appends "?t=<reload token>" to force a refetch after a re-render.
+  const QString key = id.section('?', 0, 0);
+  return new PageImageResponse(PageImageResponse::Source::Pages, key, requestedSize);
+}
+
+QQuickImageResponse *ThumbnailImageProvider::requestImageResponse(const QString &id,
+                                                                  const QSize &requestedSize) {
+  return new PageImageResponse(PageImageResponse::Source::Thumbnails, id, requestedSize);
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <QImage>
+#include <QMutex>
+#include <QQuickAsyncImageProvider>
+#include <QSize>
+#include <QString>
+#include <memory>
+
+// Serves "image://pages/<documentId>/<index>" straight from PageImageCache.
+// A request for a page that is still rendering waits for the render worker
+// instead of failing, so QML never reads an intermediate file from disk.
+// "image://thumbs/<stripId>/<index>" works the same way on ThumbnailAtlas.
+class PageImageResponse final : public QQuickImageResponse {
+  Q_OBJECT
+
+public:
+  enum class Source { Pages, Thumbnails };
+
+  PageImageResponse(Source source, const QString &key, const QSize &requestedSize);
+  ~PageImageResponse() override;
+
+  QQuickTextureFactory *textureFactory() const override;
+  QString errorString() const override;
+  void cancel() override;
+
+private:
+  // Shared with the cache waiter so a delivery racing the destructor is dropped.
+  struct Delivery {
+    QMutex mutex;
+    PageImageResponse *response = nullptr;
+  };
+
+  void deliver(const QImage &image);
+
+  std::shared_ptr<Delivery> m_delivery;
+  Source m_source = Source::Pages;
+  mutable QMutex m_mutex;
+  QImage m_image;
+  QString m_error;
+  QSize m_requestedSize;
+  quint64 m_ticket = 0;
+  bool m_done = false;
+};
+
+class PageImageProvider final : public QQuickAsyncImageProvider {
+public:
+  QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+};
+
+class ThumbnailImageProvider final : public QQuickAsyncImageProvider {
+public:
+  QQuickImageResponse *requestImageResponse(const QString &id, const QSize &requestedSize) override;
+};
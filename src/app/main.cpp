@@ -12,10 +12,12 @@
 #include <QStandardPaths>
 
 #include "AppInfo.h"
+#include "AssetCache.h"
 #include "AnnotationModel.h"
 #include "LibraryModel.h"
 #include "Logger.h"
 #include "LicenseManager.h"
+#include "PageImageProvider.h"
 #include "ReaderController.h"
 #include "SettingsManager.h"
 #include "UpdateManager.h"
@@ -53,6 +55,7 @@ int main(int argc, char *argv[]) {
   QCoreApplication::setOrganizationName("MyEreader");
   QCoreApplication::setApplicationName(AppInfo::kName);
   QCoreApplication::setApplicationVersion(AppInfo::kVersion);
+  AssetCache::startGarbageCollection();
 
   qmlRegisterType<LibraryModel>("Ereader", 1, 0, "LibraryModel");
   qmlRegisterType<AnnotationModel>("Ereader", 1, 0, "AnnotationModel");
@@ -70,6 +73,8 @@ int main(int argc, char *argv[]) {
   }
 
   QQmlApplicationEngine engine;
+  engine.addImageProvider(QStringLiteral("pages"), new PageImageProvider);
+  engine.addImageProvider(QStringLiteral("thumbs"), new ThumbnailImageProvider);
   const QString flatpakQmlPath = "/app/share/my-ereader/qml";
   if (QFileInfo::exists(flatpakQmlPath)) {
     engine.addImportPath(flatpakQmlPath);
@@ -664,6 +664,11 @@ ApplicationWindow {
     if (reader.hasImages && reader.imageCount > 0) {
       return advanceComicImage(direction)
     }
+    if (reader.paginated) {
+      if (direction > 0) reader.nextPage()
+      else reader.prevPage()
+      return true
+    }
     if (reader.chapterCount > 0) {
       if (direction > 0) reader.nextChapter()
       else reader.prevChapter()
@@ -1016,9 +1021,40 @@ ApplicationWindow {
     return annotationModel.anchorsForPage(reader.currentImageIndex)
   }
 
+  // Highlight offsets are chapter positions; a page or block covers [offset, end).
+  function rangesInSpan(ranges, offset, end) {
+    if (!ranges || ranges.length === 0) return ranges
+    var out = []
+    for (var i = 0; i < ranges.length; ++i) {
+      const range = ranges[i]
+      if (range.end <= offset) continue
+      if (end !== undefined && range.start >= end) continue
+      const rangeEnd = end !== undefined ? Math.min(range.end, end) : range.end
+      out.push({ start: Math.max(0, range.start - offset), end: rangeEnd - offset, color: range.color })
+    }
+    return out
+  }
+
   function displayTextForReader() {
     var ranges = currentHighlightRanges()
-    var base = reader.currentTextIsRich ? reader.currentText : toHtmlFromPlain(reader.currentText)
+    var base
+    if (reader.pagedText) {
+      // Until the chapter is paginated show nothing rather than laying out all of it.
+      if (!reader.paginated) return ""
+      base = reader.currentPageText
+      ranges = rangesInSpan(ranges, reader.currentPageOffset)
+    } else {
+      base = reader.currentTextIsRich ? reader.currentText : toHtmlFromPlain(reader.currentText)
+    }
+    if (ranges && ranges.length > 0) {
+      base = applyHighlightsToHtml(base, ranges)
+    }
+    return wrapHtmlWithLineHeight(base)
+  }
+
+  function displayBlockText(html, start, length) {
+    var ranges = rangesInSpan(currentHighlightRanges(), start, start + length)
+    var base = html
     if (ranges && ranges.length > 0) {
       base = applyHighlightsToHtml(base, ranges)
     }
@@ -2645,40 +2681,122 @@ ApplicationWindow {
               font.pixelSize: 12
               font.family: root.uiFont
             }
+
+            Text {
+              visible: reader.paginated
+              text: reader.bookPageCount > 0
+                    ? qsTr("Page %1 of %2").arg(reader.bookPageNumber).arg(reader.bookPageCount)
+                    : qsTr("Page %1 / %2").arg(reader.currentPageIndex + 1).arg(reader.pageCount)
+              color: theme.textMuted
+              font.pixelSize: 12
+              font.family: root.uiFont
+            }
           }
         }
 
-        Flickable {
-          id: textScroll
+        Item {
           Layout.fillWidth: true
           Layout.fillHeight: true
-          contentWidth: textBlock.width
-          contentHeight: textBlock.height
-          flickableDirection: Flickable.VerticalFlick
-          clip: true
 
-          TextEdit {
-            id: textBlock
-            width: textScroll.width
-            height: contentHeight
-            readOnly: true
-            selectByMouse: !root.isAndroid
-            activeFocusOnPress: !root.isAndroid
-            cursorVisible: !root.isAndroid
-            text: root.displayTextForReader()
-            color: theme.textPrimary
-            font.pixelSize: root.textFontSizeFor(reader.currentFormat)
-            font.family: root.textFontFamilyFor(reader.currentFormat)
-            wrapMode: TextEdit.Wrap
-            textFormat: TextEdit.RichText
-            onSelectionStartChanged: {
-              root.textSelectionStart = selectionStart
-            }
-            onSelectionEndChanged: {
-              root.textSelectionEnd = selectionEnd
-              root.textSelectionText = selectedText
+          Flickable {
+            id: textScroll
+            anchors.fill: parent
+            visible: reader.pagedText
+            contentWidth: textBlock.width
+            contentHeight: textBlock.height
+            readonly property string pageLayoutKey: width + "x" + height + "|" + textBlock.font.family + "|"
+                                                    + textBlock.font.pixelSize + "|"
+                                                    + root.textLineHeightFor(reader.currentFormat)
+            onPageLayoutKeyChanged: pageLayoutTimer.restart()
+            Component.onCompleted: pageLayoutTimer.restart()
+
+            // Debounced so a window resize re-paginates once, not on every frame.
+            Timer {
+              id: pageLayoutTimer
+              interval: 150
+              onTriggered: reader.setPageLayout(Math.floor(textScroll.width),
+                                                Math.floor(textScroll.height),
+                                                textBlock.font.family,
+                                                textBlock.font.pixelSize,
+                                                root.textLineHeightFor(reader.currentFormat))
+            }
+            flickableDirection: Flickable.VerticalFlick
+            clip: true
+
+            TextEdit {
+              id: textBlock
+              width: textScroll.width
+              height: contentHeight
+              readOnly: true
+              selectByMouse: !root.isAndroid
+              activeFocusOnPress: !root.isAndroid
+              cursorVisible: !root.isAndroid
+              text: textScroll.visible ? root.displayTextForReader() : ""
+              color: theme.textPrimary
+              font.pixelSize: root.textFontSizeFor(reader.currentFormat)
+              font.family: root.textFontFamilyFor(reader.currentFormat)
+              wrapMode: TextEdit.Wrap
+              textFormat: TextEdit.RichText
+              onSelectionStartChanged: {
+                root.textSelectionStart = selectionStart + (reader.paginated ? reader.currentPageOffset : 0)
+              }
+              onSelectionEndChanged: {
+                root.textSelectionEnd = selectionEnd + (reader.paginated ? reader.currentPageOffset : 0)
+                root.textSelectionText = selectedText
+              }
+              clip: true
             }
+          }
+
+          // Scrolling mode: only the paragraphs in view are instantiated, so a
+          // multi-megabyte chapter never goes through a single TextEdit.
+          ListView {
+            id: blockList
+            anchors.fill: parent
+            visible: !reader.pagedText
             clip: true
+            model: reader.chapterBlocks
+            reuseItems: true
+            cacheBuffer: height
+
+            delegate: Item {
+              width: blockList.width
+              height: model.kind === "image" ? blockImage.height : blockText.height
+
+              Image {
+                id: blockImage
+                visible: model.kind === "image"
+                source: visible ? model.imageSource : ""
+                asynchronous: true
+                fillMode: Image.PreserveAspectFit
+                width: Math.min(parent.width, implicitWidth)
+                height: visible && implicitWidth > 0 ? width * implicitHeight / implicitWidth : 0
+                anchors.horizontalCenter: parent.horizontalCenter
+              }
+
+              TextEdit {
+                id: blockText
+                visible: model.kind !== "image"
+                width: parent.width
+                height: visible ? contentHeight : 0
+                readOnly: true
+                selectByMouse: !root.isAndroid
+                activeFocusOnPress: !root.isAndroid
+                text: visible ? root.displayBlockText(model.html, model.start, model.length) : ""
+                color: theme.textPrimary
+                font.pixelSize: root.textFontSizeFor(reader.currentFormat)
+                font.family: root.textFontFamilyFor(reader.currentFormat)
+                wrapMode: TextEdit.Wrap
+                textFormat: TextEdit.RichText
+                onSelectionStartChanged: {
+                  root.textSelectionStart = model.start + selectionStart
+                }
+                onSelectionEndChanged: {
+                  root.textSelectionEnd = model.start + selectionEnd
+                  root.textSelectionText = selectedText
+                }
+              }
+            }
           }
         }
       }
@@ -2715,6 +2833,38 @@ ApplicationWindow {
       property int lastImageIndex: -1
       property string lastPath: ""
       property int spreadSpacing: 12
+      property var pageTiles: []
+      function updateTiles() {
+        if (!reader.hasImages || reader.currentImageIndex < 0 || imageItem.status !== Image.Ready) {
+          pageTiles = []
+          return
+        }
+        const originX = imageRow.x + imageItem.x
+        const originY = imageRow.y + imageItem.y
+        const left = Math.max(0, imageFlick.contentX - originX)
+        const top = Math.max(0, imageFlick.contentY - originY)
+        const right = Math.min(imageItem.width, imageFlick.contentX + imageFlick.width - originX)
+        const bottom = Math.min(imageItem.height, imageFlick.contentY + imageFlick.height - originY)
+        if (right <= left || bottom <= top) {
+          pageTiles = []
+          return
+        }
+        // Base images are rendered in device pixels, so sharpness is judged there.
+        pageTiles = reader.pageTiles(reader.currentImageIndex, sourceW, sourceH,
+                                     effectiveScale * Screen.devicePixelRatio,
+                                     left / effectiveScale, top / effectiveScale,
+                                     (right - left) / effectiveScale, (bottom - top) / effectiveScale)
+      }
+      // Tells paged formats the box one page is fitted into so they render at
+      // that size; the unconstrained side of width/height fit is left at 0.
+      function updateViewport() {
+        const spacing = spreadActive ? spreadSpacing : 0
+        const pageW = Math.max(1, Math.floor((imageFlick.width - spacing) / (spreadActive ? 2 : 1)))
+        const pageH = Math.max(1, Math.floor(imageFlick.height))
+        reader.setImageViewport(fitMode === "height" ? 0 : pageW,
+                                fitMode === "width" ? 0 : pageH,
+                                Screen.devicePixelRatio)
+      }
       function clampZoom(value) {
         return Math.max(minZoom, Math.min(maxZoom, value))
       }
@@ -2798,9 +2948,42 @@ ApplicationWindow {
       }
       anchors.fill: parent
 
-      onWidthChanged: recomputeBase()
-      onHeightChanged: recomputeBase()
-      onSpreadActiveChanged: recomputeBase()
+      onWidthChanged: {
+        recomputeBase()
+        viewportTimer.restart()
+      }
+      onHeightChanged: {
+        recomputeBase()
+        viewportTimer.restart()
+      }
+      onSpreadActiveChanged: {
+        recomputeBase()
+        viewportTimer.restart()
+      }
+      onFitModeChanged: viewportTimer.restart()
+      onEffectiveScaleChanged: tileTimer.restart()
+      Component.onCompleted: updateViewport()
+
+      // Resizes settle before pages are re-rendered at the new size.
+      Timer {
+        id: viewportTimer
+        interval: 250
+        onTriggered: imageReaderView.updateViewport()
+      }
+
+      // Zoomed PDF pages get sharp tiles for the visible area once panning
+      // or zooming pauses; the base image stays underneath meanwhile.
+      Timer {
+        id: tileTimer
+        interval: 120
+        onTriggered: imageReaderView.updateTiles()
+      }
+
+      Connections {
+        target: imageFlick
+        function onContentXChanged() { tileTimer.restart() }
+        function onContentYChanged() { tileTimer.restart() }
+      }
 
       Connections {
         target: reader
@@ -2816,6 +2999,7 @@ ApplicationWindow {
           }
           if (reader.currentImageIndex !== imageReaderView.lastImageIndex) {
             imageReaderView.lastImageIndex = reader.currentImageIndex
+            imageReaderView.pageTiles = []
             if (settings.comicResetZoomOnPageChange) {
               imageReaderView.zoom = 1.0
             }
@@ -2929,12 +3113,46 @@ ApplicationWindow {
             }
 
             Slider {
+              id: imagePageSlider
               Layout.preferredWidth: root.isAndroid ? 120 : 180
               from: 1
               to: Math.max(1, reader.imageCount)
               stepSize: 1
               value: reader.imageCount > 0 ? reader.currentImageIndex + 1 : 1
-              onMoved: reader.goToImage(Math.max(0, Math.round(value - 1)))
+              readonly property int previewIndex: Math.max(0, Math.round(value - 1))
+              // With thumbnails the drag only previews; the page is opened on release.
+              onMoved: if (!reader.hasThumbnails) reader.goToImage(previewIndex)
+              onPressedChanged: if (!pressed && reader.hasThumbnails) reader.goToImage(previewIndex)
+
+              Popup {
+                parent: imagePageSlider.handle
+                x: (parent.width - width) / 2
+                y: parent.height + 6
+                visible: imagePageSlider.pressed && reader.hasThumbnails
+                closePolicy: Popup.NoAutoClose
+                padding: 4
+                background: Rectangle {
+                  color: theme.panel
+                  radius: 4
+                }
+                contentItem: Column {
+                  spacing: 2
+                  Image {
+                    source: reader.thumbnailUrl(imagePageSlider.previewIndex)
+                    height: 96
+                    width: Math.max(48, implicitWidth)
+                    fillMode: Image.PreserveAspectFit
+                    cache: false
+                  }
+                  Text {
+                    anchors.horizontalCenter: parent.horizontalCenter
+                    text: String(imagePageSlider.previewIndex + 1)
+                    color: theme.textMuted
+                    font.pixelSize: 12
+                    font.family: root.uiFont
+                  }
+                }
+              }
               visible: !root.isAndroid
             }
 
@@ -3098,6 +3316,21 @@ ApplicationWindow {
                 } else if (status === Image.Ready) {
                   console.info("Image loaded", source, sourceSize.width, sourceSize.height)
                   recomputeBase()
+                  tileTimer.restart()
+                }
+              }
+
+              Repeater {
+                model: imageReaderView.pageTiles
+                delegate: Image {
+                  x: Math.floor(modelData.x * effectiveScale)
+                  y: Math.floor(modelData.y * effectiveScale)
+                  width: Math.ceil((modelData.x + modelData.width) * effectiveScale) - x
+                  height: Math.ceil((modelData.y + modelData.height) * effectiveScale) - y
+                  source: modelData.url
+                  asynchronous: true
+                  cache: false
+                  smooth: true
                 }
               }
             }
@@ -3661,6 +3894,7 @@ ApplicationWindow {
       property var selectedIds: []
       property string viewMode: "list"
       property string pendingSearch: ""
+      property string pendingWarmPath: ""
       property bool filtersExpanded: false
       ListModel { id: collectionFilterModel }
       ListModel { id: tagFilterModel }
@@ -3672,6 +3906,26 @@ ApplicationWindow {
         onTriggered: libraryModel.searchQuery = libraryPage.pendingSearch
       }
 
+      Timer {
+        id: warmDebounce
+        interval: 300
+        repeat: false
+        onTriggered: reader.prewarm(pendingWarmPath)
+      }
+
+      function scheduleWarm(path) {
+        if (selectionMode || !path) return
+        pendingWarmPath = path
+        warmDebounce.restart()
+      }
+
+      // A row reached with a keyboard or D-pad is warmed before it is opened.
+      function warmFocused(view) {
+        if (view.activeFocus && view.currentIndex >= 0) {
+          scheduleWarm(libraryModel.get(view.currentIndex).path)
+        }
+      }
+
       function isSelected(id) {
         return selectedIds.indexOf(id) !== -1
       }
@@ -4125,6 +4379,9 @@ ApplicationWindow {
                   clip: true
                   spacing: 8
                   visible: viewMode === "list"
+                  activeFocusOnTab: true
+                  onCurrentIndexChanged: warmFocused(listView)
+                  onActiveFocusChanged: warmFocused(listView)
 
                   delegate: Rectangle {
                     radius: 12
@@ -4282,6 +4539,9 @@ ApplicationWindow {
                   visible: viewMode === "grid"
                   cellWidth: 232
                   cellHeight: 272
+                  activeFocusOnTab: true
+                  onCurrentIndexChanged: warmFocused(gridView)
+                  onActiveFocusChanged: warmFocused(gridView)
 
                   delegate: Rectangle {
                     width: gridView.cellWidth
@@ -6634,56 +6894,6 @@ ApplicationWindow {
                   }
                 }
 
-                RowLayout {
-                  Layout.fillWidth: true
-                  spacing: 12
-
-                  Text {
-                    text: "Cache pages"
-                    color: theme.textMuted
-                    font.pixelSize: 13
-                    font.family: root.uiFont
-                    Layout.preferredWidth: 120
-                  }
-
-                  Slider {
-                    Layout.fillWidth: true
-                    from: 5
-                    to: 120
-                    stepSize: 1
-                    value: settings.pdfCacheLimit
-                    onMoved: settings.pdfCacheLimit = Math.round(value)
-                  }
-
-                  SpinBox {
-                    from: 5
-                    to: 120
-                    value: settings.pdfCacheLimit
-                    editable: true
-                    onValueModified: settings.pdfCacheLimit = value
-                  }
-                }
-
-                RowLayout {
-                  Layout.fillWidth: true
-                  spacing: 12
-
-                  Text {
-                    text: "Cache policy"
-                    color: theme.textMuted
-                    font.pixelSize: 13
-                    font.family: root.uiFont
-                    Layout.preferredWidth: 120
-                  }
-
-                  ComboBox {
-                    Layout.fillWidth: true
-                    model: ["fifo", "lru"]
-                    currentIndex: model.indexOf(settings.pdfCachePolicy)
-                    onActivated: settings.pdfCachePolicy = model[currentIndex]
-                  }
-                }
-
                 RowLayout {
                   Layout.fillWidth: true
                   spacing: 12
@@ -6758,7 +6968,7 @@ ApplicationWindow {
 
                   ComboBox {
                     Layout.fillWidth: true
-                    model: ["forward", "symmetric", "backward"]
+                    model: ["adaptive", "forward", "symmetric", "backward"]
                     currentIndex: model.indexOf(settings.pdfPrefetchStrategy)
                     onActivated: settings.pdfPrefetchStrategy = model[currentIndex]
                   }
@@ -6891,57 +7101,6 @@ ApplicationWindow {
                   }
                 }
 
-                RowLayout {
-                  Layout.fillWidth: true
-                  spacing: 12
-
-                  Text {
-                    text: "Image format"
-                    color: theme.textMuted
-                    font.pixelSize: 13
-                    font.family: root.uiFont
-                    Layout.preferredWidth: 120
-                  }
-
-                  ComboBox {
-                    Layout.fillWidth: true
-                    model: ["png", "jpeg"]
-                    currentIndex: model.indexOf(settings.pdfImageFormat)
-                    onActivated: settings.pdfImageFormat = model[currentIndex]
-                  }
-                }
-
-                RowLayout {
-                  Layout.fillWidth: true
-                  spacing: 12
-                  enabled: settings.pdfImageFormat === "jpeg"
-
-                  Text {
-                    text: "JPEG quality"
-                    color: theme.textMuted
-                    font.pixelSize: 13
-                    font.family: root.uiFont
-                    Layout.preferredWidth: 120
-                  }
-
-                  Slider {
-                    Layout.fillWidth: true
-                    from: 1
-                    to: 100
-                    stepSize: 1
-                    value: settings.pdfJpegQuality
-                    onMoved: settings.pdfJpegQuality = Math.round(value)
-                  }
-
-                  SpinBox {
-                    from: 1
-                    to: 100
-                    value: settings.pdfJpegQuality
-                    editable: true
-                    onValueModified: settings.pdfJpegQuality = value
-                  }
-                }
-
                 RowLayout {
                   Layout.fillWidth: true
                   spacing: 12
@@ -7366,36 +7525,6 @@ ApplicationWindow {
                   }
                 }
 
-                RowLayout {
-                  Layout.fillWidth: true
-                  spacing: 12
-
-                  Text {
-                    text: "Cache pages"
-                    color: theme.textMuted
-                    font.pixelSize: 13
-                    font.family: root.uiFont
-                    Layout.preferredWidth: 120
-                  }
-
-                  Slider {
-                    Layout.fillWidth: true
-                    from: 5
-                    to: 120
-                    stepSize: 1
-                    value: settings.djvuCacheLimit
-                    onMoved: settings.djvuCacheLimit = Math.round(value)
-                  }
-
-                  SpinBox {
-                    from: 5
-                    to: 120
-                    value: settings.djvuCacheLimit
-                    editable: true
-                    onValueModified: settings.djvuCacheLimit = value
-                  }
-                }
-
                 RowLayout {
                   Layout.fillWidth: true
                   spacing: 12
@@ -7456,46 +7585,6 @@ ApplicationWindow {
                   }
                 }
 
-                RowLayout {
-                  Layout.fillWidth: true
-                  spacing: 12
-
-                  Text {
-                    text: "Cache policy"
-                    color: theme.textMuted
-                    font.pixelSize: 13
-                    font.family: root.uiFont
-                    Layout.preferredWidth: 120
-                  }
-
-                  ComboBox {
-                    Layout.fillWidth: true
-                    model: ["fifo", "lru"]
-                    currentIndex: model.indexOf(settings.djvuCachePolicy)
-                    onActivated: settings.djvuCachePolicy = model[currentIndex]
-                  }
-                }
-
-                RowLayout {
-                  Layout.fillWidth: true
-                  spacing: 12
-
-                  Text {
-                    text: "Output format"
-                    color: theme.textMuted
-                    font.pixelSize: 13
-                    font.family: root.uiFont
-                    Layout.preferredWidth: 120
-                  }
-
-                  ComboBox {
-                    Layout.fillWidth: true
-                    model: ["ppm", "tiff"]
-                    currentIndex: model.indexOf(settings.djvuImageFormat)
-                    onActivated: settings.djvuImageFormat = model[currentIndex]
-                  }
-                }
-
                 RowLayout {
                   Layout.fillWidth: true
                   spacing: 12
@@ -0,0 +1,223 @@
+#include "include/ChapterBlockModel.h"
+
+#include <QMetaObject>
+#include <QPointer>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTextDocumentFragment>
+#include <QTextImageFormat>
+#include <QThreadPool>
+#include <QUrl>
+#include <algorithm>
+
+namespace {
+// Longer paragraphs are cut at line breaks (or spaces) so no single delegate
+// has to lay out a whole wall of text.
+constexpr int kMaxBlockLength = 2000;
+
+QString bodyOf(const QString &html) {
+  const int bodyTag = html.indexOf("<body");
+  const int bodyStart = bodyTag >= 0 ? html.indexOf('>', bodyTag) : -1;
+  const int bodyEnd = html.lastIndexOf("</body>");
+  QString body = bodyStart >= 0 && bodyEnd > bodyStart
+                     ? html.mid(bodyStart + 1, bodyEnd - bodyStart - 1)
+                     : html;
+  body.remove("<!--StartFragment-->");
+  body.remove("<!--EndFragment-->");
+  return body.trimmed();
+}
+
+QString imageUrl(const QString &name) {
+  const QUrl url(name);
+  return url.scheme().isEmpty() ? QUrl::fromLocalFile(name).toString() : name;
+}
+
+// Splits [0, text.size()) into runs of roughly kMaxBlockLength characters,
+// preferring `preferred` separators and falling back to spaces.
+QVector<QPair<int, int>> splitRuns(const QString &text, QChar preferred) {
+  QVector<QPair<int, int>> runs;
+  int runStart = 0;
+  while (text.size() - runStart > kMaxBlockLength) {
+    int cut = text.indexOf(preferred, runStart + kMaxBlockLength);
+    if (cut < 0 || cut - runStart > kMaxBlockLength * 2) {
+      cut = text.indexOf(' ', runStart + kMaxBlockLength);
+    }
+    if (cut < 0) {
+      break;
+    }
+    runs.append({runStart, cut + 1 - runStart});
+    runStart = cut + 1;
+  }
+  runs.append({runStart, static_cast<int>(text.size()) - runStart});
+  return runs;
+}
+
+QVector<ChapterBlockModel::Block> plainBlocks(const QString &text, const CancelToken &cancel) {
+  QVector<ChapterBlockModel::Block> blocks;
+  int lineStart = 0;
+  while (lineStart <= text.size()) {
+    if (cancel.isCancelled()) {
+      return {};
+    }
+    int lineEnd = text.indexOf('\n', lineStart);
+    if (lineEnd < 0) {
+      lineEnd = text.size();
+    }
+    const QString line = text.mid(lineStart, lineEnd - lineStart);
+    for (const auto &run : splitRuns(line, ' ')) {
+      ChapterBlockModel::Block block;
+      block.kind = "paragraph";
+      block.html = line.mid(run.first, run.second).toHtmlEscaped();
+      block.start = lineStart + run.first;
+      block.length = run.second;
+      blocks.append(block);
+    }
+    // The newline becomes a line break in the chapter view and takes one
+    // position; the last line has none.
+    if (!blocks.isEmpty() && lineEnd < text.size()) {
+      blocks.last().length++;
+    }
+    lineStart = lineEnd + 1;
+  }
+  return blocks;
+}
+
+QVector<ChapterBlockModel::Block> richBlocks(const QString &html, const CancelToken &cancel) {
+  QVector<ChapterBlockModel::Block> blocks;
+  QTextDocument doc;
+  doc.setHtml(html);
+  for (QTextBlock textBlock = doc.begin(); textBlock.isValid(); textBlock = textBlock.next()) {
+    if (cancel.isCancelled()) {
+      return {};
+    }
+    const QString text = textBlock.text();
+    const int level = textBlock.blockFormat().headingLevel();
+    if (text.size() == 1 && text.at(0) == QChar::ObjectReplacementCharacter) {
+      const QTextCharFormat format = textBlock.begin().fragment().charFormat();
+      if (format.isImageFormat()) {
+        ChapterBlockModel::Block block;
+        block.kind = "image";
+        block.start = textBlock.position();
+        block.length = textBlock.length();
+        block.imageSource = imageUrl(format.toImageFormat().name());
+        blocks.append(block);
+        continue;
+      }
+    }
+    const auto runs = splitRuns(text, QChar::LineSeparator);
+    for (int i = 0; i < runs.size(); ++i) {
+      const auto &run = runs.at(i);
+      QTextCursor cursor(&doc);
+      cursor.setPosition(textBlock.position() + run.first);
+      cursor.setPosition(textBlock.position() + run.first + run.second, QTextCursor::KeepAnchor);
+      ChapterBlockModel::Block block;
+      block.kind = level > 0 ? "heading" : "paragraph";
+      block.level = level;
+      block.html = bodyOf(cursor.selection().toHtml());
+      block.start = textBlock.position() + run.first;
+      // The last run also owns the paragraph separator.
+      block.length = i + 1 < runs.size() ? run.second : textBlock.length() - run.first;
+      blocks.append(block);
+    }
+  }
+  return blocks;
+}
+} // namespace
+
+ChapterBlockModel::ChapterBlockModel(QObject *parent) : QAbstractListModel(parent) {}
+
+int ChapterBlockModel::rowCount(const QModelIndex &parent) const {
+  if (parent.isValid()) {
+    return 0;
+  }
+  return m_blocks.size();
+}
+
+QVariant ChapterBlockModel::data(const QModelIndex &index, int role) const {
+  if (!index.isValid() || index.row() < 0 || index.row() >= m_blocks.size()) {
+    return {};
+  }
+  const Block &block = m_blocks.at(index.row());
+  switch (role) {
+  case KindRole:
+    return block.kind;
+  case HtmlRole:
+    return block.html;
+  case StartRole:
+    return block.start;
+  case LengthRole:
+    return block.length;
+  case LevelRole:
+    return block.level;
+  case ImageSourceRole:
+    return block.imageSource;
+  default:
+    return {};
+  }
+}
+
+QHash<int, QByteArray> ChapterBlockModel::roleNames() const {
+  return {
+      {KindRole, "kind"},   {HtmlRole, "html"},   {StartRole, "start"},
+      {LengthRole, "length"}, {LevelRole, "level"}, {ImageSourceRole, "imageSource"}};
+}
+
+int ChapterBlockModel::count() const { return m_blocks.size(); }
+
+int ChapterBlockModel::chapter() const { return m_chapter; }
+
+QVector<ChapterBlockModel::Block> ChapterBlockModel::buildBlocks(const QString &text,
+                                                                 bool richText,
+                                                                 const CancelToken &cancel) {
+  return richText ? richBlocks(text, cancel) : plainBlocks(text, cancel);
+}
+
+void ChapterBlockModel::setChapter(int chapter, const QString &text, bool richText) {
+  m_cancel.cancel();
+  m_cancel = CancelToken();
+  const int generation = ++m_generation;
+  const CancelToken cancel = m_cancel;
+  QPointer<ChapterBlockModel> self(this);
+  QThreadPool::globalInstance()->start([self, generation, cancel, chapter, text, richText]() {
+    QVector<Block> blocks = buildBlocks(text, richText, cancel);
+    if (!self || cancel.isCancelled()) {
+      return;
+    }
+    QMetaObject::invokeMethod(self, [self, generation, chapter, blocks = std::move(blocks)]() mutable {
+      if (!self || generation != self->m_generation) {
+        return;
+      }
+      self->resetBlocks(chapter, std::move(blocks));
+    }, Qt::QueuedConnection);
+  });
+}
+
+void ChapterBlockModel::clear() {
+  m_cancel.cancel();
+  m_cancel = CancelToken();
+  ++m_generation;
+  if (m_blocks.isEmpty() && m_chapter < 0) {
+    return;
+  }
+  resetBlocks(-1, {});
+}
+
+void ChapterBlockModel::resetBlocks(int chapter, QVector<Block> blocks) {
+  beginResetModel();
+  m_blocks = std::move(blocks);
+  m_chapter = chapter;
+  endResetModel();
+  emit countChanged();
+}
+
+int ChapterBlockModel::blockAt(int offset) const {
+  const auto it = std::upper_bound(m_blocks.cbegin(), m_blocks.cend(), offset,
+                                   [](int value, const Block &block) { return value < block.start; });
+  if (it == m_blocks.cbegin()) {
+    return -1;
+  }
+  const int row = static_cast<int>(it - m_blocks.cbegin()) - 1;
+  const Block &block = m_blocks.at(row);
+  return offset < block.start + block.length ? row : -1;
+}
@@ -1424,7 +1424,7 @@ LibraryItem DbWorker::makeItemFromFile(const QString &filePath) {
   item.collection = "";
   item.coverPath = "";
   item.path = info.absoluteFilePath();
-  item.format = info.suffix().toLower();
+  item.format = FormatRegistry::instance().formatFor(filePath);
   item.fileHash = computeFileHash(filePath);
   item.addedAt = QDateTime::currentDateTimeUtc().toString(Qt::ISODate);
   item.updatedAt = item.addedAt;
@@ -1433,9 +1433,12 @@ LibraryItem DbWorker::makeItemFromFile(const QString &filePath) {
       (ext == "mobi" || ext == "azw" || ext == "azw3" || ext == "azw4" || ext == "prc" ||
        ext == "fb2" || ext == "epub");
   if (wantsMetadata) {
-    auto registry = FormatRegistry::createDefault();
+    // Library scans may reuse converted books but should not queue conversions.
+    OpenOptions options;
+    options.format = item.format;
+    options.parsedCache = ParsedCacheMode::ReadOnly;
     QString metaError;
-    auto doc = registry->open(item.path, &metaError);
+    auto doc = FormatRegistry::instance().open(item.path, &metaError, options);
     if (doc) {
       const QString docTitle = doc->title().trimmed();
       if (!docTitle.isEmpty()) {
@@ -0,0 +1,80 @@
+#include "include/DocumentCache.h"
+
+#include <QDebug>
+#include <QFileInfo>
+#include <algorithm>
+
+namespace {
+// Fixed overhead per parked document so cheap documents still count.
+constexpr qint64 kEntryOverhead = 1024 * 1024;
+
+qint64 textCacheCost(const QHash<int, QString> &cache) {
+  qint64 total = 0;
+  for (const QString &text : cache) {
+    total += static_cast<qint64>(text.size()) * 2;
+  }
+  return total;
+}
+} // namespace
+
+void DocumentCache::setBudget(qint64 bytes) {
+  m_budget = std::max<qint64>(0, bytes);
+  evict();
+}
+
+void DocumentCache::insert(const QString &path, CachedDocument entry) {
+  if (!entry.document || path.isEmpty()) {
+    return;
+  }
+  CachedDocument replaced;
+  take(path, &replaced);
+
+  const QFileInfo info(path);
+  Entry item;
+  item.path = path;
+  item.size = info.size();
+  item.modified = info.lastModified();
+  item.cost = kEntryOverhead + entry.document->approximateMemoryCost() +
+              textCacheCost(entry.chapterText) + textCacheCost(entry.chapterPlain);
+  item.cached = std::move(entry);
+  m_total += item.cost;
+  m_entries.push_back(std::move(item));
+  evict();
+}
+
+bool DocumentCache::take(const QString &path, CachedDocument *out) {
+  auto it = std::find_if(m_entries.begin(), m_entries.end(), [&path](const Entry &entry) {
+    return entry.path == path;
+  });
+  if (it == m_entries.end()) {
+    return false;
+  }
+  const QFileInfo info(path);
+  const bool unchanged = info.exists() && info.size() == it->size && info.lastModified() == it->modified;
+  m_total -= it->cost;
+  if (unchanged && out) {
+    *out = std::move(it->cached);
+  }
+  m_entries.erase(it);
+  return unchanged;
+}
+
+bool DocumentCache::contains(const QString &path) const {
+  return std::any_of(m_entries.begin(), m_entries.end(), [&path](const Entry &entry) {
+    return entry.path == path;
+  });
+}
+
+void DocumentCache::clear() {
+  m_entries.clear();
+  m_total = 0;
+}
+
+void DocumentCache::evict() {
+  while (!m_entries.empty() && m_total > m_budget) {
+    qInfo() << "DocumentCache: evicting" << m_entries.front().path
+            << "cost" << m_entries.front().cost;
+    m_total -= m_entries.front().cost;
+    m_entries.erase(m_entries.begin());
+  }
+}
@@ -0,0 +1,301 @@
+#include "include/Paginator.h"
+
+#include <QAbstractTextDocumentLayout>
+#include <QFont>
+#include <QMetaObject>
+#include <QPointer>
+#include <QTextBlock>
+#include <QTextCursor>
+#include <QTextDocument>
+#include <QTextDocumentFragment>
+#include <QTextLayout>
+#include <QThread>
+#include <QThreadPool>
+#include <algorithm>
+
+namespace {
+constexpr int kMaxCachedLayouts = 8;
+
+// Same markup the reader view builds for the whole chapter, so page breaks
+// match what TextEdit would have laid out.
+QString layoutHtml(const QString &text, bool richText, qreal lineHeight) {
+  QString html = richText ? text : text.toHtmlEscaped().replace('\n', "<br/>");
+  if (lineHeight > 0) {
+    html = QString("<div style=\"line-height:%1;\">").arg(lineHeight) + html + "</div>";
+  }
+  return html;
+}
+
+QString bodyOf(const QString &html) {
+  const int bodyTag = html.indexOf("<body");
+  const int bodyStart = bodyTag >= 0 ? html.indexOf('>', bodyTag) : -1;
+  const int bodyEnd = html.lastIndexOf("</body>");
+  QString body = bodyStart >= 0 && bodyEnd > bodyStart
+                     ? html.mid(bodyStart + 1, bodyEnd - bodyStart - 1)
+                     : html;
+  body.remove("<!--StartFragment-->");
+  body.remove("<!--EndFragment-->");
+  return body.trimmed();
+}
+} // namespace
+
+QString PageLayout::key() const {
+  return QString("%1|%2|%3|%4x%5")
+      .arg(fontFamily)
+      .arg(fontPixelSize)
+      .arg(lineHeight)
+      .arg(viewport.width())
+      .arg(viewport.height());
+}
+
+Paginator::Paginator(QObject *parent) : QObject(parent) {
+  m_countPool = std::make_unique<QThreadPool>();
+  m_countPool->setMaxThreadCount(1);
+  m_countPool->setThreadPriority(QThread::LowestPriority);
+}
+
+Paginator::~Paginator() {
+  m_cancel.cancel();
+  m_countPool->waitForDone();
+}
+
+ChapterPages Paginator::paginate(const QString &text,
+                                 bool richText,
+                                 const PageLayout &layout,
+                                 bool withHtml,
+                                 const CancelToken &cancel) {
+  ChapterPages out;
+  if (!layout.isValid()) {
+    return out;
+  }
+  QTextDocument doc;
+  QFont font(layout.fontFamily);
+  font.setPixelSize(layout.fontPixelSize);
+  doc.setDefaultFont(font);
+  doc.setDocumentMargin(0);
+  doc.setHtml(layoutHtml(text, richText, layout.lineHeight));
+  doc.setTextWidth(layout.viewport.width());
+  if (cancel.isCancelled()) {
+    return {};
+  }
+
+  QAbstractTextDocumentLayout *docLayout = doc.documentLayout();
+  const qreal pageHeight = layout.viewport.height();
+  qreal pageTop = 0;
+  out.starts.append(0);
+  for (QTextBlock block = doc.begin(); block.isValid(); block = block.next()) {
+    if (cancel.isCancelled()) {
+      return {};
+    }
+    const QRectF blockRect = docLayout->blockBoundingRect(block);
+    const QTextLayout *textLayout = block.layout();
+    for (int i = 0; textLayout && i < textLayout->lineCount(); ++i) {
+      const QTextLine line = textLayout->lineAt(i);
+      const qreal top = blockRect.top() + line.y();
+      const qreal bottom = top + line.height();
+      // A line taller than the viewport (e.g. a large image) gets a page of its own.
+      if (bottom - pageTop <= pageHeight || top <= pageTop) {
+        continue;
+      }
+      const int start = block.position() + line.textStart();
+      if (start > out.starts.last()) {
+        out.starts.append(start);
+      }
+      pageTop = top;
+    }
+  }
+
+  if (withHtml) {
+    const int end = doc.characterCount() - 1;
+    for (int i = 0; i < out.starts.size(); ++i) {
+      QTextCursor cursor(&doc);
+      cursor.setPosition(out.starts.at(i));
+      cursor.setPosition(i + 1 < out.starts.size() ? out.starts.at(i + 1) : end,
+                         QTextCursor::KeepAnchor);
+      out.html.append(bodyOf(cursor.selection().toHtml()));
+    }
+  }
+  return out;
+}
+
+void Paginator::setBook(const QString &bookKey, int chapterCount, bool richText) {
+  m_bookKey = bookKey;
+  m_chapterCount = std::max(0, chapterCount);
+  m_richText = richText;
+  restart();
+}
+
+void Paginator::setChapterCount(int count) {
+  m_chapterCount = std::max(0, count);
+  if (isActive()) {
+    counts();
+  }
+}
+
+void Paginator::setLayout(const PageLayout &layout) {
+  if (layout == m_layout) {
+    return;
+  }
+  m_layout = layout;
+  restart();
+}
+
+bool Paginator::isActive() const {
+  return !m_bookKey.isEmpty() && m_chapterCount > 0 && m_layout.isValid();
+}
+
+void Paginator::restart() {
+  m_cancel.cancel();
+  m_cancel = CancelToken();
+  m_generation++;
+  m_pages.clear();
+  m_pendingPages.clear();
+  m_countingChapter = -1;
+  if (isActive()) {
+    counts();
+  }
+}
+
+QVector<int> &Paginator::counts() {
+  const QString key = m_bookKey + '|' + m_layout.key();
+  m_countOrder.removeOne(key);
+  m_countOrder.append(key);
+  while (m_countOrder.size() > kMaxCachedLayouts) {
+    m_counts.remove(m_countOrder.takeFirst());
+  }
+  QVector<int> &entry = m_counts[key];
+  if (entry.size() < m_chapterCount) {
+    entry.resize(m_chapterCount, -1);
+  }
+  return entry;
+}
+
+const QVector<int> *Paginator::currentCounts() const {
+  if (!isActive()) {
+    return nullptr;
+  }
+  const auto it = m_counts.constFind(m_bookKey + '|' + m_layout.key());
+  return it == m_counts.constEnd() ? nullptr : &it.value();
+}
+
+void Paginator::storeCount(int chapter, int pageCount) {
+  QVector<int> &entry = counts();
+  if (chapter >= 0 && chapter < entry.size()) {
+    entry[chapter] = pageCount;
+  }
+}
+
+void Paginator::requestPages(int chapter, const QString &text) {
+  if (!isActive() || m_pages.contains(chapter) || m_pendingPages.contains(chapter)) {
+    return;
+  }
+  m_pendingPages.insert(chapter);
+  QPointer<Paginator> self(this);
+  const int generation = m_generation;
+  const CancelToken cancel = m_cancel;
+  const PageLayout layout = m_layout;
+  const bool richText = m_richText;
+  QThreadPool::globalInstance()->start([self, generation, cancel, layout, richText, chapter, text]() {
+    ChapterPages pages = paginate(text, richText, layout, true, cancel);
+    if (!self || cancel.isCancelled()) {
+      return;
+    }
+    QMetaObject::invokeMethod(self, [self, generation, chapter, pages = std::move(pages)]() mutable {
+      if (!self || generation != self->m_generation) {
+        return;
+      }
+      self->m_pendingPages.remove(chapter);
+      const int pageCount = pages.starts.size();
+      self->m_pages.insert(chapter, std::move(pages));
+      const bool countChanged = self->chapterPageCount(chapter) != pageCount;
+      self->storeCount(chapter, pageCount);
+      emit self->chapterReady(chapter);
+      if (countChanged) {
+        emit self->pageCountsChanged();
+      }
+    }, Qt::QueuedConnection);
+  });
+}
+
+const ChapterPages *Paginator::pages(int chapter) const {
+  const auto it = m_pages.constFind(chapter);
+  return it == m_pages.constEnd() ? nullptr : &it.value();
+}
+
+void Paginator::retainPages(int first, int last) {
+  for (auto it = m_pages.begin(); it != m_pages.end();) {
+    if (it.key() < first || it.key() > last) {
+      it = m_pages.erase(it);
+    } else {
+      ++it;
+    }
+  }
+}
+
+void Paginator::requestCount(int chapter, const QString &text) {
+  if (!isActive() || m_countingChapter >= 0 || chapterPageCount(chapter) >= 0) {
+    return;
+  }
+  m_countingChapter = chapter;
+  QPointer<Paginator> self(this);
+  const int generation = m_generation;
+  const CancelToken cancel = m_cancel;
+  const PageLayout layout = m_layout;
+  const bool richText = m_richText;
+  m_countPool->start([self, generation, cancel, layout, richText, chapter, text]() {
+    const int pageCount = paginate(text, richText, layout, false, cancel).starts.size();
+    if (!self || cancel.isCancelled()) {
+      return;
+    }
+    QMetaObject::invokeMethod(self, [self, generation, chapter, pageCount]() {
+      if (!self || generation != self->m_generation) {
+        return;
+      }
+      self->m_countingChapter = -1;
+      self->storeCount(chapter, pageCount);
+      emit self->pageCountsChanged();
+    }, Qt::QueuedConnection);
+  });
+}
+
+bool Paginator::isCounting() const {
+  return m_countingChapter >= 0;
+}
+
+int Paginator::nextUncountedChapter() const {
+  const QVector<int> *entry = currentCounts();
+  if (!entry) {
+    return -1;
+  }
+  for (int i = 0; i < m_chapterCount && i < entry->size(); ++i) {
+    if (entry->at(i) < 0 && !m_pendingPages.contains(i)) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+int Paginator::chapterPageCount(int chapter) const {
+  const QVector<int> *entry = currentCounts();
+  return entry ? entry->value(chapter, -1) : -1;
+}
+
+int Paginator::pagesBefore(int chapter) const {
+  const QVector<int> *entry = currentCounts();
+  if (!entry) {
+    return -1;
+  }
+  int total = 0;
+  for (int i = 0; i < chapter; ++i) {
+    const int count = entry->value(i, -1);
+    if (count < 0) {
+      return -1;
+    }
+    total += count;
+  }
+  return total;
+}
+
+int Paginator::bookPageCount() const {
+  return pagesBefore(m_chapterCount);
+}
@@ -1,5 +1,6 @@
 #include "include/ReaderController.h"
 
+#include <QDateTime>
 #include <QFileInfo>
 #include <QRegularExpression>
 #include <QDebug>
@@ -8,9 +9,13 @@
 #include <QSettings>
 #include <QDir>
 #include <QStandardPaths>
+#include <QThreadPool>
+#include <QTimer>
 #include <QUrl>
+#include <QVariantMap>
 #include <QCryptographicHash>
 #include <algorithm>
+#include <cstdlib>
 
 #ifdef Q_OS_ANDROID
 #include <QJniEnvironment>
@@ -19,7 +24,10 @@
 #endif
 
 #include "AsyncUtil.h"
+#include "BackgroundPool.h"
 #include "include/AppPaths.h"
+#include "PageImageCache.h"
+#include "ThumbnailAtlas.h"
 
 namespace {
 bool isMobiFormat(const QString &format) {
@@ -44,6 +52,41 @@ int preRenderPagesForFormat(const QString &format) {
   return clampInt(settings.value("render/pre_render_pages", 2).toInt(), 1, 12);
 }
 
+int chapterWindowSize() {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  return clampInt(settings.value("reading/chapter_window", 1).toInt(), 0, 5);
+}
+
+qint64 documentCacheBudget() {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  return static_cast<qint64>(clampInt(settings.value("reading/document_cache_mb", 256).toInt(), 0, 4096)) *
+         1024 * 1024;
+}
+
+bool pagedTextEnabled() {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  return settings.value("reading/paged_text", true).toBool();
+}
+
+QString positionKey(const QString &path, const char *group = "position") {
+  const QByteArray hash = QCryptographicHash::hash(path.toUtf8(), QCryptographicHash::Sha1).toHex();
+  return QString("reader/%1/%2").arg(QLatin1String(group), QString::fromUtf8(hash));
+}
+
+QString chapterKeySetting(const QString &path) {
+  return positionKey(path, "position_chapter");
+}
+
+int savedReadingPosition(const QString &path) {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  return std::max(0, settings.value(positionKey(path), 0).toInt());
+}
+
+QString savedChapterKey(const QString &path) {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  return settings.value(chapterKeySetting(path)).toString();
+}
+
 #ifdef Q_OS_ANDROID
 QString extensionFromMime(const QString &mime) {
   const QString lower = mime.toLower();
@@ -182,7 +225,25 @@ QString resolveContentUriToCache(const QString &uri, QString *error) {
 } // namespace
 
 ReaderController::ReaderController(QObject *parent) : QObject(parent) {
-  m_registry = FormatRegistry::createDefault();
+  // One low-priority thread keeps speculative opens out of the way of foreground work.
+  m_warmPool.reset(makeBackgroundPool());
+  m_positionTimer = new QTimer(this);
+  m_positionTimer->setSingleShot(true);
+  m_positionTimer->setInterval(2000);
+  connect(m_positionTimer, &QTimer::timeout, this, &ReaderController::flushReadingPosition);
+  m_paginator = new Paginator(this);
+  m_blockModel = new ChapterBlockModel(this);
+  connect(m_paginator, &Paginator::chapterReady, this, &ReaderController::onChapterPaginated);
+  connect(m_paginator, &Paginator::pageCountsChanged, this, [this]() {
+    emit pageChanged();
+    continuePageCount();
+  });
+}
+
+ReaderController::~ReaderController() {
+  flushReadingPosition();
+  m_warmCancel.cancel();
+  m_warmPool->waitForDone();
 }
 
 void ReaderController::clearImageState() {
@@ -196,11 +257,7 @@ void ReaderController::clearImageState() {
 }
 
 bool ReaderController::openFile(const QString &path) {
-  if (!m_registry) {
-    setLastError("Format registry not available");
-    qWarning() << "ReaderController: registry missing";
-    return false;
-  }
+  cancelPrewarm();
 
   QString error;
   QString resolvedPath = path;
@@ -213,8 +270,14 @@ bool ReaderController::openFile(const QString &path) {
     }
   }
 #endif
-  auto document = m_registry->open(resolvedPath, &error);
-  return applyDocument(std::move(document), resolvedPath, &error);
+  CachedDocument cached;
+  if (m_documentCache.take(QFileInfo(resolvedPath).absoluteFilePath(), &cached)) {
+    qInfo() << "ReaderController: reopened from document cache" << resolvedPath;
+    return applyDocument(std::move(cached), resolvedPath, &error);
+  }
+  cached.assets = AssetCache::hold(resolvedPath);
+  cached.document = FormatRegistry::instance().open(resolvedPath, &error);
+  return applyDocument(std::move(cached), resolvedPath, &error);
 }
 
 void ReaderController::openFileAsync(const QString &path) {
@@ -222,10 +285,38 @@ void ReaderController::openFileAsync(const QString &path) {
     setLastError("Path is empty");
     return;
   }
-  setBusy(true);
   const int requestId = ++m_openRequestId;
+  // Stop the superseded open instead of letting it run to completion.
+  m_openCancel.cancel();
+  m_openCancel = CancelToken();
+  const CancelToken cancel = m_openCancel;
+  if (!path.startsWith("content://")) {
+    const QString absPath = QFileInfo(path).absoluteFilePath();
+    CachedDocument cached;
+    if (m_documentCache.take(absPath, &cached)) {
+      qInfo() << "ReaderController: reopened from document cache" << absPath;
+      if (absPath != m_warmPath) {
+        cancelPrewarm();
+      }
+      QString error;
+      if (applyDocument(std::move(cached), absPath, &error)) {
+        // Warmed documents skip the build, and parking cancels a running one.
+        FormatRegistry::instance().buildParsedCache(m_currentPath, m_currentFormat);
+      }
+      setBusy(m_isOpen && m_restoreChapter >= 0);
+      return;
+    }
+    if (absPath == m_warmPath) {
+      // The speculative open of this book is still running; finishPrewarm() applies it.
+      setBusy(true);
+      m_warmOpenRequest = requestId;
+      return;
+    }
+  }
+  cancelPrewarm();
+  setBusy(true);
   const QString requestedPath = path;
-  runInBackground([this, requestId, requestedPath]() {
+  runInBackground([this, requestId, requestedPath, cancel]() {
     QString error;
     QString resolvedPath = requestedPath;
 #ifdef Q_OS_ANDROID
@@ -244,15 +335,22 @@ void ReaderController::openFileAsync(const QString &path) {
     }
 #endif
     const QString absPath = QFileInfo(resolvedPath).absoluteFilePath();
-    auto registry = FormatRegistry::createDefault();
-    auto document = registry->open(absPath, &error);
-    QMetaObject::invokeMethod(this, [this, requestId, absPath, error, doc = std::move(document)]() mutable {
+    OpenOptions options;
+    options.cancel = cancel;
+    CachedDocument opened;
+    opened.assets = AssetCache::hold(absPath);
+    opened.document = FormatRegistry::instance().open(absPath, &error, options);
+    if (cancel.isCancelled()) {
+      return;
+    }
+    QMetaObject::invokeMethod(this, [this, requestId, absPath, error, cached = std::move(opened)]() mutable {
       if (requestId != m_openRequestId) {
         return;
       }
       QString localError = error;
-      applyDocument(std::move(doc), absPath, &localError);
-      setBusy(false);
+      applyDocument(std::move(cached), absPath, &localError);
+      // Stay busy while the chapter to restore is still being discovered.
+      setBusy(m_isOpen && m_restoreChapter >= 0);
     }, Qt::QueuedConnection);
   });
 }
@@ -261,15 +359,22 @@ void ReaderController::close() {
   if (!m_isOpen) {
     return;
   }
+  parkDocument();
+  flushReadingPosition();
   m_document.reset();
+  m_documentAssets.reset();
+  m_documentGeneration++;
   m_currentTitle.clear();
   m_currentText.clear();
   m_currentPlainText.clear();
   m_currentPath.clear();
   m_currentFormat.clear();
   m_chapterTitles.clear();
-  m_chapterTexts.clear();
-  m_chapterPlainTexts.clear();
+  clearChapterCache();
+  m_chapterCount = 0;
+  m_restoreChapter = -1;
+  m_restoreChapterKey.clear();
+  m_documentLoading = false;
   m_tocTitles.clear();
   m_tocChapterIndices.clear();
   m_currentChapterIndex = -1;
@@ -280,6 +385,7 @@ void ReaderController::close() {
   m_textIsRich = false;
   m_isOpen = false;
   m_ttsAllowed = true;
+  resetPagination();
   qInfo() << "ReaderController: closed";
   emit currentChanged();
 }
@@ -298,7 +404,7 @@ QString ReaderController::currentChapterTitle() const {
   }
   return {};
 }
-int ReaderController::chapterCount() const { return m_chapterTexts.size(); }
+int ReaderController::chapterCount() const { return m_chapterCount; }
 int ReaderController::tocCount() const { return m_tocTitles.size(); }
 QString ReaderController::chapterTitle(int index) const {
   if (index >= 0 && index < m_chapterTitles.size()) {
@@ -319,6 +425,7 @@ int ReaderController::tocChapterIndex(int index) const {
   return -1;
 }
 bool ReaderController::hasImages() const { return !m_imagePaths.isEmpty(); }
+bool ReaderController::hasThumbnails() const { return !m_thumbnailId.isEmpty(); }
 int ReaderController::currentImageIndex() const { return m_currentImageIndex; }
 int ReaderController::imageCount() const { return m_imagePaths.size(); }
 QString ReaderController::currentImagePath() const {
@@ -332,6 +439,12 @@ QUrl ReaderController::currentImageUrl() const {
   if (path.isEmpty()) {
     return {};
   }
+  if (m_document) {
+    const QString key = m_document->pageImageKey(m_currentImageIndex);
+    if (!key.isEmpty()) {
+      return QUrl(QStringLiteral("image://pages/") + key);
+    }
+  }
   QFileInfo info(path);
   if (info.isAbsolute()) {
     return QUrl::fromLocalFile(path);
@@ -343,6 +456,12 @@ QUrl ReaderController::imageUrlAt(int index) const {
   if (index < 0 || index >= m_imagePaths.size()) {
     return {};
   }
+  if (m_document) {
+    const QString key = m_document->pageImageKey(index);
+    if (!key.isEmpty()) {
+      return QUrl(QStringLiteral("image://pages/") + key);
+    }
+  }
   const QString path = m_imagePaths.at(index);
   QFileInfo info(path);
   if (info.isAbsolute()) {
@@ -350,6 +469,112 @@ QUrl ReaderController::imageUrlAt(int index) const {
   }
   return QUrl(path);
 }
+
+QUrl ReaderController::thumbnailUrl(int index) const {
+  if (m_thumbnailId.isEmpty() || index < 0 || index >= m_imagePaths.size()) {
+    return {};
+  }
+  return QUrl(QString("image://thumbs/%1/%2").arg(m_thumbnailId).arg(index));
+}
+
+QVariantList ReaderController::pageTiles(int index,
+                                         int pageWidth,
+                                         int pageHeight,
+                                         qreal scale,
+                                         qreal x,
+                                         qreal y,
+                                         qreal width,
+                                         qreal height) {
+  if (!m_document || index < 0 || index >= m_imagePaths.size()) {
+    return {};
+  }
+  const QVector<PageTile> tiles = m_document->requestTiles(
+      index, QSize(pageWidth, pageHeight), scale, QRectF(x, y, width, height));
+  QVariantList out;
+  out.reserve(tiles.size());
+  for (const PageTile &tile : tiles) {
+    QVariantMap entry;
+    entry.insert("url", QUrl(QStringLiteral("image://pages/") + tile.key));
+    entry.insert("x", tile.rect.x());
+    entry.insert("y", tile.rect.y());
+    entry.insert("width", tile.rect.width());
+    entry.insert("height", tile.rect.height());
+    out.append(entry);
+  }
+  return out;
+}
+
+QVariantList ReaderController::pageWordBoxes(int index, const QString &query) {
+  if (!m_document || index < 0 || index >= m_imagePaths.size()) {
+    return {};
+  }
+  if (!m_document->isPageTextReady(index)) {
+    QPointer<ReaderController> self(this);
+    const int generation = m_documentGeneration;
+    m_document->requestPageText(index, [self, generation](int page) {
+      if (!self) {
+        return;
+      }
+      QMetaObject::invokeMethod(self, [self, generation, page]() {
+        if (self && generation == self->m_documentGeneration) {
+          emit self->pageTextReady(page);
+        }
+      }, Qt::QueuedConnection);
+    });
+    return {};
+  }
+  const QVector<PageWord> words = m_document->pageWords(index);
+  if (words.isEmpty()) {
+    return {};
+  }
+  const QString text = m_document->pageText(index);
+  QVariantList out;
+  for (const PageWord &word : words) {
+    const QString wordText = text.mid(word.start, word.length);
+    if (!query.isEmpty() && !wordText.contains(query, Qt::CaseInsensitive)) {
+      continue;
+    }
+    QVariantMap entry;
+    entry.insert("text", wordText);
+    entry.insert("line", word.line);
+    entry.insert("x", word.rect.x());
+    entry.insert("y", word.rect.y());
+    entry.insert("width", word.rect.width());
+    entry.insert("height", word.rect.height());
+    out.append(entry);
+  }
+  return out;
+}
+
+QVariantMap ReaderController::pageCacheStats() const {
+  const PageImageCache::Stats stats = PageImageCache::instance().stats();
+  QVariantMap out;
+  out.insert("memoryHits", stats.memoryHits);
+  out.insert("diskHits", stats.diskHits);
+  out.insert("misses", stats.misses);
+  out.insert("evictions", stats.evictions);
+  out.insert("spills", stats.spills);
+  out.insert("memoryBytes", stats.memoryBytes);
+  out.insert("memoryBudget", stats.memoryBudget);
+  out.insert("diskBytes", stats.diskBytes);
+  out.insert("diskBudget", stats.diskBudget);
+  out.insert("documents", stats.documents);
+  return out;
+}
+
+void ReaderController::setImageViewport(int width, int height, qreal devicePixelRatio) {
+  const qreal ratio = devicePixelRatio > 0 ? devicePixelRatio : 1.0;
+  const QSize target(std::max(0, qRound(width * ratio)), std::max(0, qRound(height * ratio)));
+  if (target == m_imageTarget) {
+    return;
+  }
+  m_imageTarget = target;
+  if (!m_document || m_currentImageIndex < 0) {
+    return;
+  }
+  m_document->ensureImage(m_currentImageIndex, m_imageTarget);
+}
+
 int ReaderController::imageReloadToken() const { return m_imageReloadToken; }
 QString ReaderController::currentCoverPath() const { return m_coverPath; }
 QUrl ReaderController::currentCoverUrl() const {
@@ -362,6 +587,7 @@ QUrl ReaderController::currentCoverUrl() const {
   }
   return QUrl(m_coverPath);
 }
+bool ReaderController::documentLoading() const { return m_documentLoading; }
 bool ReaderController::busy() const { return m_busy; }
 QString ReaderController::lastError() const { return m_lastError; }
 bool ReaderController::ttsAllowed() const { return m_ttsAllowed; }
@@ -374,16 +600,26 @@ void ReaderController::setLastError(const QString &error) {
   emit lastErrorChanged();
 }
 
-bool ReaderController::applyDocument(std::unique_ptr<FormatDocument> document,
+bool ReaderController::applyDocument(CachedDocument cached,
                                      const QString &path,
                                      QString *error) {
-  if (!document) {
+  if (!cached.document) {
     setLastError(error && !error->isEmpty() ? *error : "Failed to open document");
     qWarning() << "ReaderController: failed to open" << path << m_lastError;
     return false;
   }
 
-  m_document = std::move(document);
+  if (m_currentPath != QFileInfo(path).absoluteFilePath()) {
+    parkDocument();
+  }
+  stopThumbnails();
+  m_document = std::move(cached.document);
+  m_documentAssets = std::move(cached.assets);
+  m_documentGeneration++;
+  clearChapterCache();
+  m_chapterTextCache = std::move(cached.chapterText);
+  m_chapterPlainCache = std::move(cached.chapterPlain);
+  m_chapterWindow = chapterWindowSize();
   QPointer<ReaderController> self(this);
   m_document->setImageReadyCallback([self](int index) {
     if (!self) {
@@ -400,20 +636,35 @@ bool ReaderController::applyDocument(std::unique_ptr<FormatDocument> document,
       }
     }, Qt::QueuedConnection);
   });
+  const int generation = m_documentGeneration;
+  m_document->setStructureChangedCallback([self, generation]() {
+    if (!self) {
+      return;
+    }
+    QMetaObject::invokeMethod(self, [self, generation]() {
+      if (!self || generation != self->m_documentGeneration) {
+        return;
+      }
+      self->refreshStructure();
+    }, Qt::QueuedConnection);
+  });
   setLastError("");
   const QFileInfo fileInfo(path);
   m_currentPath = fileInfo.absoluteFilePath();
-  m_currentFormat = fileInfo.suffix().trimmed().toLower();
+  m_currentFormat = FormatRegistry::instance().formatFor(m_currentPath);
   m_currentTitle = m_document->title();
   m_chapterTitles = m_document->chapterTitles();
-  m_chapterTexts = m_document->chaptersText();
-  m_chapterPlainTexts = m_document->chaptersPlainText();
-  m_tocTitles = m_document->tocTitles();
-  m_tocChapterIndices = m_document->tocChapterIndices();
+  m_chapterCount = m_document->chapterCount();
+  m_documentLoading = m_document->isLoading();
+  m_restoreChapter = -1;
+  m_restoreChapterKey.clear();
+  flushReadingPosition();
+  const int savedPosition = savedReadingPosition(m_currentPath);
   m_imagePaths = m_document->imagePaths();
   m_coverPath = m_document->coverPath();
   m_textIsRich = m_document->isRichText();
   m_ttsAllowed = !m_document->ttsDisabled();
+  m_pagedText = pagedTextEnabled();
   if (!m_ttsAllowed) {
     qInfo() << "ReaderController: TTS disabled for this book";
   }
@@ -421,41 +672,44 @@ bool ReaderController::applyDocument(std::unique_ptr<FormatDocument> document,
     m_imagePaths.clear();
   }
   if (!m_imagePaths.isEmpty()) {
-    m_currentImageIndex = 0;
+    m_currentImageIndex = savedPosition < m_imagePaths.size() ? savedPosition : 0;
     m_imageReloadToken = 0;
-    const QString firstImage = m_imagePaths.at(0);
-    qInfo() << "ReaderController: loaded" << m_imagePaths.size()
-            << "image(s), first:" << firstImage
-            << "exists:" << QFileInfo::exists(firstImage);
-    const int warmCount = std::min(preRenderPagesForFormat(m_currentFormat),
-                                   static_cast<int>(m_imagePaths.size()));
-    for (int i = 0; i < warmCount; ++i) {
-      m_document->ensureImage(i);
+    const QString pageKey = m_document->pageImageKey(m_currentImageIndex);
+    qInfo() << "ReaderController: loaded" << m_imagePaths.size() << "image(s), current:"
+            << (pageKey.isEmpty() ? m_imagePaths.at(m_currentImageIndex) : pageKey);
+    m_document->setCurrentImage(m_currentImageIndex);
+    const int warmEnd = std::min(m_currentImageIndex + preRenderPagesForFormat(m_currentFormat),
+                                 static_cast<int>(m_imagePaths.size()));
+    for (int i = m_currentImageIndex; i < warmEnd; ++i) {
+      m_document->ensureImage(i, m_imageTarget);
     }
+    m_thumbnailId = ThumbnailAtlas::instance().start(m_document->thumbnailSource());
   } else {
     m_currentImageIndex = -1;
     m_imageReloadToken = 0;
   }
-  if (!m_chapterTexts.isEmpty()) {
-    m_currentChapterIndex = 0;
-    m_currentText = m_chapterTexts.at(0);
-    if (!m_chapterPlainTexts.isEmpty()) {
-      m_currentPlainText = m_chapterPlainTexts.at(0);
-    } else {
-      m_currentPlainText = m_document->readAllPlainText();
-    }
+  resetPagination();
+  const QString savedKey = m_chapterCount > 0 ? savedChapterKey(m_currentPath) : QString();
+  const int restoreChapter = m_chapterCount > 0 ? restoreTarget(savedPosition, savedKey) : -1;
+  if (restoreChapter >= 0) {
+    showChapter(restoreChapter);
+  } else if (m_chapterCount > 0) {
+    // The last-read chapter has not been discovered yet; refreshStructure()
+    // shows it as soon as the provider reports it.
+    m_currentChapterIndex = -1;
+    m_currentText.clear();
+    m_currentPlainText.clear();
+    m_restoreChapter = savedPosition;
+    m_restoreChapterKey = savedKey;
   } else {
     m_currentChapterIndex = -1;
     m_currentText = m_document->readAllText();
     m_currentPlainText = m_document->readAllPlainText();
+    updatePagination();
+    updateBlocks();
   }
-  if (m_tocTitles.isEmpty()) {
-    m_tocTitles = m_chapterTitles;
-    m_tocChapterIndices.clear();
-    for (int i = 0; i < m_chapterTitles.size(); ++i) {
-      m_tocChapterIndices.append(i);
-    }
-  } else {
+  refreshToc();
+  if (!m_tocTitles.isEmpty()) {
     qInfo() << "ReaderController: TOC entries" << m_tocTitles.size()
             << "first" << m_tocTitles.value(0);
   }
@@ -466,13 +720,243 @@ bool ReaderController::applyDocument(std::unique_ptr<FormatDocument> document,
   qInfo() << "ReaderController: format" << m_currentFormat
           << "hasImages" << !m_imagePaths.isEmpty()
           << "textRich" << m_textIsRich
-          << "chapters" << m_chapterTexts.size();
+          << "chapters" << m_chapterCount;
   m_isOpen = true;
   qInfo() << "ReaderController: opened" << m_currentTitle << m_currentPath;
   emit currentChanged();
   return true;
 }
 
+void ReaderController::prewarm(const QString &path) {
+  if (path.isEmpty() || path.startsWith("content://")) {
+    return;
+  }
+  const QString absPath = QFileInfo(path).absoluteFilePath();
+  if (absPath == m_warmPath || (m_isOpen && absPath == m_currentPath) ||
+      m_documentCache.contains(absPath) || !QFileInfo::exists(absPath)) {
+    return;
+  }
+  cancelPrewarm();
+  m_warmPath = absPath;
+  const CancelToken cancel = m_warmCancel;
+  const int savedPosition = savedReadingPosition(absPath);
+  const QString savedKey = savedChapterKey(absPath);
+  QPointer<ReaderController> self(this);
+  m_warmPool->start([self, absPath, cancel, savedPosition, savedKey, target = m_imageTarget]() {
+    OpenOptions options;
+    options.cancel = cancel;
+    options.format = FormatRegistry::instance().formatFor(absPath);
+    // A book that is only hovered does not earn a background reparse.
+    options.parsedCache = ParsedCacheMode::ReadOnly;
+    const int warmPages = std::min(2, preRenderPagesForFormat(options.format));
+    QString error;
+    CachedDocument cached;
+    cached.assets = AssetCache::hold(absPath);
+    cached.document = FormatRegistry::instance().open(absPath, &error, options);
+    if (cancel.isCancelled()) {
+      return;
+    }
+    if (cached.document) {
+      FormatDocument &doc = *cached.document;
+      const int imageCount = doc.imagePaths().size();
+      if (imageCount > 0 && !isMobiFormat(options.format)) {
+        // No focus page yet, so these queue on the Prefetch lane behind the
+        // open book's renders. A cancelled warm-up destroys the document,
+        // which drops whatever is still queued.
+        const int first = savedPosition < imageCount ? savedPosition : 0;
+        for (int i = first; i < std::min(first + warmPages, imageCount); ++i) {
+          doc.ensureImage(i, target);
+        }
+      } else {
+        const int count = doc.chapterCount();
+        int chapter = savedKey.isEmpty() ? -1 : doc.chapterIndexForKey(savedKey);
+        if (chapter < 0) {
+          chapter = savedPosition < count ? savedPosition : (doc.isLoading() ? -1 : 0);
+        }
+        if (chapter >= 0 && chapter < count) {
+          cached.chapterText.insert(chapter, doc.chapterText(chapter));
+          cached.chapterPlain.insert(chapter, doc.chapterPlainText(chapter));
+        }
+      }
+    }
+    if (cancel.isCancelled() || !self) {
+      return;
+    }
+    QMetaObject::invokeMethod(self, [self, absPath, cancel, error, cached = std::move(cached)]() mutable {
+      if (!self || cancel.isCancelled()) {
+        return;
+      }
+      self->finishPrewarm(absPath, std::move(cached), error);
+    }, Qt::QueuedConnection);
+  });
+}
+
+void ReaderController::cancelPrewarm() {
+  if (m_warmPath.isEmpty()) {
+    return;
+  }
+  m_warmCancel.cancel();
+  m_warmCancel = CancelToken();
+  m_warmPath.clear();
+  m_warmOpenRequest = -1;
+}
+
+void ReaderController::finishPrewarm(const QString &path, CachedDocument cached, const QString &error) {
+  m_warmPath.clear();
+  const bool requested = m_warmOpenRequest == m_openRequestId;
+  m_warmOpenRequest = -1;
+  if (requested) {
+    QString localError = error;
+    if (applyDocument(std::move(cached), path, &localError)) {
+      FormatRegistry::instance().buildParsedCache(m_currentPath, m_currentFormat);
+    }
+    setBusy(m_isOpen && m_restoreChapter >= 0);
+    return;
+  }
+  if (!cached.document || (m_isOpen && m_currentPath == path)) {
+    return;
+  }
+  qInfo() << "ReaderController: warmed" << path;
+  m_documentCache.setBudget(documentCacheBudget());
+  m_documentCache.insert(path, std::move(cached));
+}
+
+// Keeps the outgoing document (render state, page cache and converted chapters)
+// so switching back to it skips the reopen.
+void ReaderController::parkDocument() {
+  stopThumbnails();
+  if (!m_document || m_currentPath.isEmpty()) {
+    return;
+  }
+  saveReadingPosition();
+  flushReadingPosition();
+  FormatRegistry::instance().cancelBackgroundWork(m_currentPath);
+  m_document->setImageReadyCallback(nullptr);
+  m_document->setStructureChangedCallback(nullptr);
+  m_documentCache.setBudget(documentCacheBudget());
+  CachedDocument cached;
+  cached.document = std::move(m_document);
+  cached.assets = std::move(m_documentAssets);
+  cached.chapterText = m_chapterTextCache;
+  cached.chapterPlain = m_chapterPlainCache;
+  m_documentCache.insert(m_currentPath, std::move(cached));
+}
+
+void ReaderController::stopThumbnails() {
+  if (m_thumbnailId.isEmpty()) {
+    return;
+  }
+  ThumbnailAtlas::instance().stop(m_thumbnailId);
+  m_thumbnailId.clear();
+}
+
+void ReaderController::refreshToc() {
+  if (!m_document) {
+    return;
+  }
+  m_tocTitles = m_document->tocTitles();
+  m_tocChapterIndices = m_document->tocChapterIndices();
+  if (m_tocTitles.isEmpty()) {
+    m_tocTitles = m_chapterTitles;
+    m_tocChapterIndices.clear();
+    for (int i = 0; i < m_chapterTitles.size(); ++i) {
+      m_tocChapterIndices.append(i);
+    }
+  }
+}
+
+void ReaderController::refreshStructure() {
+  if (!m_document) {
+    return;
+  }
+  m_chapterTitles = m_document->chapterTitles();
+  m_chapterCount = m_document->chapterCount();
+  m_documentLoading = m_document->isLoading();
+  m_paginator->setChapterCount(std::max(1, m_chapterCount));
+  refreshToc();
+  if (m_restoreChapter >= 0) {
+    const int target = restoreTarget(m_restoreChapter, m_restoreChapterKey);
+    if (target >= 0) {
+      m_restoreChapter = -1;
+      m_restoreChapterKey.clear();
+      showChapter(target);
+      setBusy(false);
+    }
+  } else if (m_currentChapterIndex >= 0) {
+    updateChapterWindow();
+  } else if (m_chapterCount == 0) {
+    // Page formats finish their text layer in the background.
+    m_currentText = m_document->readAllText();
+    m_currentPlainText = m_document->readAllPlainText();
+    updatePagination();
+    updateBlocks();
+  }
+  if (!m_documentLoading) {
+    qInfo() << "ReaderController: document loaded, chapters" << m_chapterCount
+            << "toc" << m_tocTitles.size();
+  }
+  continuePageCount();
+  emit currentChanged();
+  emit pageChanged();
+}
+
+int ReaderController::restoreTarget(int chapter, const QString &chapterKey) const {
+  // The saved key wins: the index it was saved with may name another
+  // chapter in a list that is still growing.
+  const int found = chapterKey.isEmpty() ? -1 : m_document->chapterIndexForKey(chapterKey);
+  if (found >= 0) {
+    return found;
+  }
+  if (!chapterKey.isEmpty() && m_documentLoading) {
+    return -1;
+  }
+  if (chapter < m_chapterCount) {
+    return chapter;
+  }
+  return m_documentLoading ? -1 : 0;
+}
+
+void ReaderController::saveReadingPosition() {
+  if (m_currentPath.isEmpty() || m_restoreChapter >= 0) {
+    return;
+  }
+  const int position = !m_imagePaths.isEmpty() ? m_currentImageIndex : m_currentChapterIndex;
+  if (position < 0) {
+    return;
+  }
+  if (!m_unsavedPositionPath.isEmpty() && m_unsavedPositionPath != m_currentPath) {
+    flushReadingPosition();
+  }
+  m_unsavedPositionPath = m_currentPath;
+  m_unsavedPosition = position;
+  m_unsavedPositionKey =
+      m_imagePaths.isEmpty() && m_document ? m_document->chapterKey(position) : QString();
+  m_positionTimer->start();
+}
+
+void ReaderController::flushReadingPosition() {
+  m_positionTimer->stop();
+  if (m_unsavedPositionPath.isEmpty()) {
+    return;
+  }
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  const QString key = positionKey(m_unsavedPositionPath);
+  if (settings.value(key, 0).toInt() != m_unsavedPosition) {
+    settings.setValue(key, m_unsavedPosition);
+  }
+  const QString keySetting = chapterKeySetting(m_unsavedPositionPath);
+  if (m_unsavedPositionKey.isEmpty()) {
+    if (settings.contains(keySetting)) {
+      settings.remove(keySetting);
+    }
+  } else if (settings.value(keySetting).toString() != m_unsavedPositionKey) {
+    settings.setValue(keySetting, m_unsavedPositionKey);
+  }
+  m_unsavedPositionPath.clear();
+  m_unsavedPosition = -1;
+  m_unsavedPositionKey.clear();
+}
+
 void ReaderController::setBusy(bool busy) {
   if (m_busy == busy) {
     return;
@@ -503,34 +987,22 @@ bool ReaderController::jumpToLocator(const QString &locator) {
     return false;
   };
 
-  if (!m_chapterTexts.isEmpty()) {
+  if (m_chapterCount > 0) {
     int index = 0;
     if (parseIndex(&index)) {
       index -= 1; // user-friendly 1-based
-      if (index < 0 || index >= m_chapterTexts.size()) {
+      if (index < 0 || index >= m_chapterCount) {
         setLastError("Chapter index out of range");
         return false;
       }
-      m_currentChapterIndex = index;
-      m_currentText = m_chapterTexts.at(index);
-      if (index < m_chapterPlainTexts.size()) {
-        m_currentPlainText = m_chapterPlainTexts.at(index);
-      } else {
-        m_currentPlainText = m_document ? m_document->readAllPlainText() : m_currentText;
-      }
+      showChapter(index);
       emit currentChanged();
       return true;
     }
     // Try match by title (case-insensitive contains)
-    for (int i = 0; i < m_chapterTitles.size(); ++i) {
+    for (int i = 0; i < m_chapterTitles.size() && i < m_chapterCount; ++i) {
       if (m_chapterTitles.at(i).contains(trimmed, Qt::CaseInsensitive)) {
-        m_currentChapterIndex = i;
-        m_currentText = m_chapterTexts.at(i);
-        if (i < m_chapterPlainTexts.size()) {
-          m_currentPlainText = m_chapterPlainTexts.at(i);
-        } else {
-          m_currentPlainText = m_document ? m_document->readAllPlainText() : m_currentText;
-        }
+        showChapter(i);
         emit currentChanged();
         return true;
       }
@@ -554,17 +1026,17 @@ bool ReaderController::jumpToLocator(const QString &locator) {
 }
 
 bool ReaderController::nextChapter() {
-  if (m_chapterTexts.isEmpty()) {
+  if (m_chapterCount <= 0) {
     return false;
   }
-  if (m_currentChapterIndex + 1 >= m_chapterTexts.size()) {
+  if (m_currentChapterIndex + 1 >= m_chapterCount) {
     return false;
   }
   return goToChapter(m_currentChapterIndex + 1);
 }
 
 bool ReaderController::prevChapter() {
-  if (m_chapterTexts.isEmpty()) {
+  if (m_chapterCount <= 0) {
     return false;
   }
   if (m_currentChapterIndex - 1 < 0) {
@@ -574,24 +1046,91 @@ bool ReaderController::prevChapter() {
 }
 
 bool ReaderController::goToChapter(int index) {
-  if (m_chapterTexts.isEmpty()) {
+  if (m_chapterCount <= 0) {
     return false;
   }
-  if (index < 0 || index >= m_chapterTexts.size()) {
+  if (index < 0 || index >= m_chapterCount) {
     setLastError("Chapter index out of range");
     return false;
   }
+  showChapter(index);
+  emit currentChanged();
+  return true;
+}
+
+void ReaderController::clearChapterCache() {
+  m_chapterTextCache.clear();
+  m_chapterPlainCache.clear();
+  m_pendingChapters.clear();
+}
+
+bool ReaderController::showChapter(int index) {
+  if (!m_document || index < 0 || index >= m_chapterCount) {
+    return false;
+  }
   m_currentChapterIndex = index;
-  m_currentText = m_chapterTexts.at(index);
-  if (index < m_chapterPlainTexts.size()) {
-    m_currentPlainText = m_chapterPlainTexts.at(index);
+  m_currentPage = 0;
+  m_pendingPageOffset = -1;
+  if (m_chapterTextCache.contains(index)) {
+    m_currentText = m_chapterTextCache.value(index);
+    m_currentPlainText = m_chapterPlainCache.value(index);
   } else {
-    m_currentPlainText = m_document ? m_document->readAllPlainText() : m_currentText;
+    m_currentText = m_document->chapterText(index);
+    m_currentPlainText = m_document->chapterPlainText(index);
+    m_chapterTextCache.insert(index, m_currentText);
+    m_chapterPlainCache.insert(index, m_currentPlainText);
   }
-  emit currentChanged();
+  updateChapterWindow();
+  updatePagination();
+  updateBlocks();
+  saveReadingPosition();
   return true;
 }
 
+// Keeps only chapters within m_chapterWindow of the current one in memory and
+// asks the document for the missing neighbours in the background.
+void ReaderController::updateChapterWindow() {
+  const int first = std::max(0, m_currentChapterIndex - m_chapterWindow);
+  const int last = std::min(m_chapterCount - 1, m_currentChapterIndex + m_chapterWindow);
+  const QList<int> cached = m_chapterTextCache.keys();
+  for (int index : cached) {
+    if (index < first || index > last) {
+      m_chapterTextCache.remove(index);
+      m_chapterPlainCache.remove(index);
+    }
+  }
+  if (!m_document) {
+    return;
+  }
+  QPointer<ReaderController> self(this);
+  const int generation = m_documentGeneration;
+  for (int index = first; index <= last; ++index) {
+    if (m_chapterTextCache.contains(index) || m_pendingChapters.contains(index)) {
+      continue;
+    }
+    m_pendingChapters.insert(index);
+    m_document->requestChapter(index, [self, generation](int loaded, QString text, QString plain) {
+      if (!self) {
+        return;
+      }
+      QMetaObject::invokeMethod(self, [self, generation, loaded, text, plain]() {
+        if (!self || generation != self->m_documentGeneration) {
+          return;
+        }
+        self->m_pendingChapters.remove(loaded);
+        if (std::abs(loaded - self->m_currentChapterIndex) > self->m_chapterWindow) {
+          return;
+        }
+        self->m_chapterTextCache.insert(loaded, text);
+        self->m_chapterPlainCache.insert(loaded, plain);
+        if (std::abs(loaded - self->m_currentChapterIndex) == 1) {
+          self->m_paginator->requestPages(loaded, text);
+        }
+      }, Qt::QueuedConnection);
+    });
+  }
+}
+
 bool ReaderController::nextImage() {
   if (m_imagePaths.isEmpty()) {
     return false;
@@ -600,11 +1139,9 @@ bool ReaderController::nextImage() {
     return false;
   }
   m_currentImageIndex++;
-  if (m_currentImageIndex > 0) {
-    m_document->ensureImage(m_currentImageIndex - 1);
-  }
-  m_document->ensureImage(m_currentImageIndex);
-  m_document->ensureImage(m_currentImageIndex + 1);
+  m_document->setCurrentImage(m_currentImageIndex);
+  m_document->ensureImage(m_currentImageIndex, m_imageTarget);
+  saveReadingPosition();
   emit currentChanged();
   return true;
 }
@@ -617,11 +1154,9 @@ bool ReaderController::prevImage() {
     return false;
   }
   m_currentImageIndex--;
-  if (m_currentImageIndex > 0) {
-    m_document->ensureImage(m_currentImageIndex - 1);
-  }
-  m_document->ensureImage(m_currentImageIndex);
-  m_document->ensureImage(m_currentImageIndex + 1);
+  m_document->setCurrentImage(m_currentImageIndex);
+  m_document->ensureImage(m_currentImageIndex, m_imageTarget);
+  saveReadingPosition();
   emit currentChanged();
   return true;
 }
@@ -637,11 +1172,223 @@ bool ReaderController::goToImage(int index) {
     return true;
   }
   m_currentImageIndex = index;
-  if (m_currentImageIndex > 0) {
-    m_document->ensureImage(m_currentImageIndex - 1);
-  }
-  m_document->ensureImage(m_currentImageIndex);
-  m_document->ensureImage(m_currentImageIndex + 1);
+  m_document->setCurrentImage(m_currentImageIndex);
+  m_document->ensureImage(m_currentImageIndex, m_imageTarget);
+  saveReadingPosition();
   emit currentChanged();
   return true;
 }
+
+const ChapterPages *ReaderController::currentPages() const {
+  if (!m_paginator->isActive() || (m_chapterCount > 0 && m_currentChapterIndex < 0)) {
+    return nullptr;
+  }
+  const ChapterPages *pages = m_paginator->pages(std::max(0, m_currentChapterIndex));
+  return pages && !pages->html.isEmpty() ? pages : nullptr;
+}
+
+bool ReaderController::pagedText() const { return m_pagedText; }
+
+QAbstractListModel *ReaderController::chapterBlocks() const { return m_blockModel; }
+
+bool ReaderController::paginated() const { return currentPages() != nullptr; }
+
+int ReaderController::currentPageIndex() const { return currentPages() ? m_currentPage : 0; }
+
+int ReaderController::pageCount() const {
+  const ChapterPages *pages = currentPages();
+  return pages ? static_cast<int>(pages->starts.size()) : 0;
+}
+
+QString ReaderController::currentPageText() const {
+  const ChapterPages *pages = currentPages();
+  return pages ? pages->html.value(m_currentPage) : QString();
+}
+
+int ReaderController::currentPageOffset() const {
+  const ChapterPages *pages = currentPages();
+  return pages ? pages->starts.value(m_currentPage) : 0;
+}
+
+int ReaderController::bookPageNumber() const {
+  if (!currentPages()) {
+    return 0;
+  }
+  const int before = m_paginator->pagesBefore(std::max(0, m_currentChapterIndex));
+  return before < 0 ? 0 : before + m_currentPage + 1;
+}
+
+int ReaderController::bookPageCount() const {
+  if (!currentPages() || m_documentLoading) {
+    return 0;
+  }
+  return std::max(0, m_paginator->bookPageCount());
+}
+
+void ReaderController::setPageLayout(int width,
+                                     int height,
+                                     const QString &fontFamily,
+                                     int fontPixelSize,
+                                     qreal lineHeight) {
+  PageLayout layout;
+  layout.fontFamily = fontFamily;
+  layout.fontPixelSize = fontPixelSize;
+  layout.lineHeight = lineHeight;
+  layout.viewport = QSize(width, height);
+  if (layout == m_paginator->layout()) {
+    return;
+  }
+  // Stay on the page that holds the text currently at the top of the view.
+  if (const ChapterPages *pages = currentPages()) {
+    m_pendingPageOffset = pages->starts.value(m_currentPage);
+  }
+  m_paginator->setLayout(layout);
+  updatePagination();
+}
+
+bool ReaderController::nextPage() {
+  const ChapterPages *pages = currentPages();
+  if (pages && m_currentPage + 1 < pages->starts.size()) {
+    m_currentPage++;
+    emit pageChanged();
+    return true;
+  }
+  return nextChapter();
+}
+
+bool ReaderController::prevPage() {
+  const ChapterPages *pages = currentPages();
+  if (pages && m_currentPage > 0) {
+    m_currentPage--;
+    emit pageChanged();
+    return true;
+  }
+  m_pendingLastPage = pages != nullptr;
+  if (!prevChapter()) {
+    m_pendingLastPage = false;
+    return false;
+  }
+  return true;
+}
+
+bool ReaderController::goToPage(int index) {
+  const ChapterPages *pages = currentPages();
+  if (!pages || index < 0 || index >= pages->starts.size()) {
+    return false;
+  }
+  m_currentPage = index;
+  emit pageChanged();
+  return true;
+}
+
+void ReaderController::resetPagination() {
+  m_currentPage = 0;
+  m_pendingPageOffset = -1;
+  m_pendingLastPage = false;
+  m_countRequestChapter = -1;
+  QString bookKey;
+  if (m_document && m_imagePaths.isEmpty() && m_pagedText) {
+    const QFileInfo info(m_currentPath);
+    bookKey = QString("%1|%2|%3")
+                  .arg(m_currentPath)
+                  .arg(info.size())
+                  .arg(info.lastModified().toMSecsSinceEpoch());
+  }
+  m_paginator->setBook(bookKey, std::max(1, m_chapterCount), m_textIsRich);
+  m_blockModel->clear();
+  emit pageChanged();
+}
+
+// Splitting runs on the thread pool; the ListView shows the blocks once ready.
+void ReaderController::updateBlocks() {
+  if (!m_document || m_pagedText || !m_imagePaths.isEmpty()) {
+    m_blockModel->clear();
+    return;
+  }
+  const int chapter = std::max(0, m_currentChapterIndex);
+  if (m_blockModel->chapter() == chapter && m_blockModel->count() > 0) {
+    return;
+  }
+  m_blockModel->setChapter(chapter, m_currentText, m_textIsRich);
+}
+
+void ReaderController::updatePagination() {
+  if (!m_paginator->isActive() || (m_chapterCount > 0 && m_currentChapterIndex < 0)) {
+    emit pageChanged();
+    return;
+  }
+  const int chapter = std::max(0, m_currentChapterIndex);
+  m_paginator->retainPages(chapter - 1, chapter + 1);
+  if (m_paginator->pages(chapter)) {
+    onChapterPaginated(chapter);
+  } else {
+    m_paginator->requestPages(chapter, m_currentText);
+  }
+  // Neighbours that are already loaded get laid out too, so turning the page
+  // across a chapter boundary does not wait for layout.
+  for (const int neighbour : {chapter - 1, chapter + 1}) {
+    if (m_chapterTextCache.contains(neighbour)) {
+      m_paginator->requestPages(neighbour, m_chapterTextCache.value(neighbour));
+    }
+  }
+  continuePageCount();
+  emit pageChanged();
+}
+
+void ReaderController::onChapterPaginated(int chapter) {
+  if (chapter != std::max(0, m_currentChapterIndex)) {
+    return;
+  }
+  const ChapterPages *pages = currentPages();
+  if (!pages) {
+    return;
+  }
+  const int lastPage = static_cast<int>(pages->starts.size()) - 1;
+  if (m_pendingLastPage) {
+    m_currentPage = lastPage;
+  } else if (m_pendingPageOffset >= 0) {
+    const auto it = std::upper_bound(pages->starts.cbegin(), pages->starts.cend(), m_pendingPageOffset);
+    m_currentPage = static_cast<int>(it - pages->starts.cbegin()) - 1;
+  }
+  m_pendingLastPage = false;
+  m_pendingPageOffset = -1;
+  m_currentPage = clampInt(m_currentPage, 0, lastPage);
+  emit pageChanged();
+}
+
+// Counts the remaining chapters one at a time on the paginator's low-priority
+// thread so "page X of Y" covers the whole book without holding it in memory.
+void ReaderController::continuePageCount() {
+  if (!m_document || !m_paginator->isActive() || m_paginator->isCounting() ||
+      m_countRequestChapter >= 0) {
+    return;
+  }
+  const int chapter = m_paginator->nextUncountedChapter();
+  if (chapter < 0) {
+    return;
+  }
+  if (m_chapterCount == 0 || chapter == m_currentChapterIndex) {
+    m_paginator->requestCount(chapter, m_currentText);
+    return;
+  }
+  if (m_chapterTextCache.contains(chapter)) {
+    m_paginator->requestCount(chapter, m_chapterTextCache.value(chapter));
+    return;
+  }
+  m_countRequestChapter = chapter;
+  QPointer<ReaderController> self(this);
+  const int generation = m_documentGeneration;
+  m_document->requestChapter(chapter, [self, generation](int loaded, QString text, QString) {
+    if (!self) {
+      return;
+    }
+    QMetaObject::invokeMethod(self, [self, generation, loaded, text]() {
+      if (!self || generation != self->m_documentGeneration) {
+        return;
+      }
+      self->m_countRequestChapter = -1;
+      self->m_paginator->requestCount(loaded, text);
+      self->continuePageCount();
+    }, Qt::QueuedConnection);
+  });
+}
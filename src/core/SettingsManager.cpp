@@ -172,29 +172,22 @@ double SettingsManager::mobiParagraphIndent() const { return m_mobiParagraphInde
 int SettingsManager::mobiImageMaxWidth() const { return m_mobiImageMaxWidth; }
 double SettingsManager::mobiImageSpacing() const { return m_mobiImageSpacing; }
 int SettingsManager::pdfDpi() const { return m_pdfDpi; }
-int SettingsManager::pdfCacheLimit() const { return m_pdfCacheLimit; }
 int SettingsManager::pdfPrefetchDistance() const { return m_pdfPrefetchDistance; }
 int SettingsManager::pdfPreRenderPages() const { return m_pdfPreRenderPages; }
 QString SettingsManager::pdfPrefetchStrategy() const { return m_pdfPrefetchStrategy; }
-QString SettingsManager::pdfCachePolicy() const { return m_pdfCachePolicy; }
 QString SettingsManager::pdfRenderPreset() const { return m_pdfRenderPreset; }
 QString SettingsManager::pdfColorMode() const { return m_pdfColorMode; }
 QString SettingsManager::pdfBackgroundMode() const { return m_pdfBackgroundMode; }
 QString SettingsManager::pdfBackgroundColor() const { return m_pdfBackgroundColor; }
 int SettingsManager::pdfMaxWidth() const { return m_pdfMaxWidth; }
 int SettingsManager::pdfMaxHeight() const { return m_pdfMaxHeight; }
-QString SettingsManager::pdfImageFormat() const { return m_pdfImageFormat; }
-int SettingsManager::pdfJpegQuality() const { return m_pdfJpegQuality; }
 bool SettingsManager::pdfExtractText() const { return m_pdfExtractText; }
 int SettingsManager::pdfTileSize() const { return m_pdfTileSize; }
 bool SettingsManager::pdfProgressiveRendering() const { return m_pdfProgressiveRendering; }
 int SettingsManager::pdfProgressiveDpi() const { return m_pdfProgressiveDpi; }
 int SettingsManager::djvuDpi() const { return m_djvuDpi; }
-int SettingsManager::djvuCacheLimit() const { return m_djvuCacheLimit; }
 int SettingsManager::djvuPrefetchDistance() const { return m_djvuPrefetchDistance; }
 int SettingsManager::djvuPreRenderPages() const { return m_djvuPreRenderPages; }
-QString SettingsManager::djvuCachePolicy() const { return m_djvuCachePolicy; }
-QString SettingsManager::djvuImageFormat() const { return m_djvuImageFormat; }
 bool SettingsManager::djvuExtractText() const { return m_djvuExtractText; }
 int SettingsManager::djvuRotation() const { return m_djvuRotation; }
 double SettingsManager::comicMinZoom() const { return m_comicMinZoom; }
@@ -700,16 +693,6 @@ void SettingsManager::setPdfDpi(int value) {
   emit pdfDpiChanged();
 }
 
-void SettingsManager::setPdfCacheLimit(int value) {
-  value = clampInt(value, 5, 120);
-  if (m_pdfCacheLimit == value) {
-    return;
-  }
-  m_pdfCacheLimit = value;
-  saveFormatValue("pdf", "render/cache_limit", value);
-  emit pdfCacheLimitChanged();
-}
-
 void SettingsManager::setPdfPrefetchDistance(int value) {
   value = clampInt(value, 0, 6);
   if (m_pdfPrefetchDistance == value) {
@@ -732,8 +715,9 @@ void SettingsManager::setPdfPreRenderPages(int value) {
 
 void SettingsManager::setPdfPrefetchStrategy(const QString &value) {
   QString normalized = value.trimmed().toLower();
-  if (normalized != "forward" && normalized != "symmetric" && normalized != "backward") {
-    normalized = "symmetric";
+  if (normalized != "forward" && normalized != "symmetric" && normalized != "backward" &&
+      normalized != "adaptive") {
+    normalized = "adaptive";
   }
   if (m_pdfPrefetchStrategy == normalized) {
     return;
@@ -743,19 +727,6 @@ void SettingsManager::setPdfPrefetchStrategy(const QString &value) {
   emit pdfPrefetchStrategyChanged();
 }
 
-void SettingsManager::setPdfCachePolicy(const QString &value) {
-  QString normalized = value.trimmed().toLower();
-  if (normalized != "fifo" && normalized != "lru") {
-    normalized = "fifo";
-  }
-  if (m_pdfCachePolicy == normalized) {
-    return;
-  }
-  m_pdfCachePolicy = normalized;
-  saveFormatValue("pdf", "render/cache_policy", normalized);
-  emit pdfCachePolicyChanged();
-}
-
 void SettingsManager::setPdfRenderPreset(const QString &value) {
   QString normalized = value.trimmed().toLower();
   if (normalized != "custom" && normalized != "fast" && normalized != "balanced" && normalized != "high") {
@@ -828,32 +799,6 @@ void SettingsManager::setPdfMaxHeight(int value) {
   emit pdfMaxHeightChanged();
 }
 
-void SettingsManager::setPdfImageFormat(const QString &value) {
-  QString normalized = value.trimmed().toLower();
-  if (normalized != "png" && normalized != "jpeg" && normalized != "jpg") {
-    normalized = "png";
-  }
-  if (normalized == "jpg") {
-    normalized = "jpeg";
-  }
-  if (m_pdfImageFormat == normalized) {
-    return;
-  }
-  m_pdfImageFormat = normalized;
-  saveFormatValue("pdf", "render/image_format", normalized);
-  emit pdfImageFormatChanged();
-}
-
-void SettingsManager::setPdfJpegQuality(int value) {
-  value = clampInt(value, 1, 100);
-  if (m_pdfJpegQuality == value) {
-    return;
-  }
-  m_pdfJpegQuality = value;
-  saveFormatValue("pdf", "render/jpeg_quality", value);
-  emit pdfJpegQualityChanged();
-}
-
 void SettingsManager::setPdfExtractText(bool value) {
   if (m_pdfExtractText == value) {
     return;
@@ -902,16 +847,6 @@ void SettingsManager::setDjvuDpi(int value) {
   emit djvuDpiChanged();
 }
 
-void SettingsManager::setDjvuCacheLimit(int value) {
-  value = clampInt(value, 5, 120);
-  if (m_djvuCacheLimit == value) {
-    return;
-  }
-  m_djvuCacheLimit = value;
-  saveFormatValue("djvu", "render/cache_limit", value);
-  emit djvuCacheLimitChanged();
-}
-
 void SettingsManager::setDjvuPrefetchDistance(int value) {
   value = clampInt(value, 0, 6);
   if (m_djvuPrefetchDistance == value) {
@@ -932,32 +867,6 @@ void SettingsManager::setDjvuPreRenderPages(int value) {
   emit djvuPreRenderPagesChanged();
 }
 
-void SettingsManager::setDjvuCachePolicy(const QString &value) {
-  QString normalized = value.trimmed().toLower();
-  if (normalized != "fifo" && normalized != "lru") {
-    normalized = "fifo";
-  }
-  if (m_djvuCachePolicy == normalized) {
-    return;
-  }
-  m_djvuCachePolicy = normalized;
-  saveFormatValue("djvu", "render/cache_policy", normalized);
-  emit djvuCachePolicyChanged();
-}
-
-void SettingsManager::setDjvuImageFormat(const QString &value) {
-  QString normalized = value.trimmed().toLower();
-  if (normalized != "ppm" && normalized != "tiff") {
-    normalized = "ppm";
-  }
-  if (m_djvuImageFormat == normalized) {
-    return;
-  }
-  m_djvuImageFormat = normalized;
-  saveFormatValue("djvu", "render/format", normalized);
-  emit djvuImageFormatChanged();
-}
-
 void SettingsManager::setDjvuExtractText(bool value) {
   if (m_djvuExtractText == value) {
     return;
@@ -1140,29 +1049,22 @@ void SettingsManager::resetDefaults() {
   setMobiImageMaxWidth(100);
   setMobiImageSpacing(0.6);
   setPdfDpi(120);
-  setPdfCacheLimit(30);
   setPdfPrefetchDistance(1);
   setPdfPreRenderPages(2);
-  setPdfPrefetchStrategy("symmetric");
-  setPdfCachePolicy("fifo");
+  setPdfPrefetchStrategy("adaptive");
   setPdfRenderPreset("custom");
   setPdfColorMode("color");
   setPdfBackgroundMode("white");
   setPdfBackgroundColor("#202633");
   setPdfMaxWidth(0);
   setPdfMaxHeight(0);
-  setPdfImageFormat("png");
-  setPdfJpegQuality(85);
   setPdfExtractText(true);
   setPdfTileSize(0);
   setPdfProgressiveRendering(false);
   setPdfProgressiveDpi(72);
   setDjvuDpi(120);
-  setDjvuCacheLimit(30);
   setDjvuPrefetchDistance(1);
   setDjvuPreRenderPages(2);
-  setDjvuCachePolicy("fifo");
-  setDjvuImageFormat("ppm");
   setDjvuExtractText(true);
   setDjvuRotation(0);
   setComicDefaultFitMode("page");
@@ -1182,11 +1084,9 @@ void SettingsManager::resetDefaults() {
 void SettingsManager::resetPdfDefaults() {
   setPdfRenderPreset("custom");
   setPdfDpi(120);
-  setPdfCacheLimit(30);
-  setPdfCachePolicy("fifo");
   setPdfPrefetchDistance(1);
   setPdfPreRenderPages(2);
-  setPdfPrefetchStrategy("symmetric");
+  setPdfPrefetchStrategy("adaptive");
   setPdfProgressiveRendering(false);
   setPdfProgressiveDpi(72);
   setPdfColorMode("color");
@@ -1194,8 +1094,6 @@ void SettingsManager::resetPdfDefaults() {
   setPdfBackgroundColor("#202633");
   setPdfMaxWidth(0);
   setPdfMaxHeight(0);
-  setPdfImageFormat("png");
-  setPdfJpegQuality(85);
   setPdfExtractText(true);
   setPdfTileSize(0);
 }
@@ -1260,11 +1158,8 @@ void SettingsManager::resetComicDefaults() {
 
 void SettingsManager::resetDjvuDefaults() {
   setDjvuDpi(120);
-  setDjvuCacheLimit(30);
   setDjvuPrefetchDistance(1);
   setDjvuPreRenderPages(2);
-  setDjvuCachePolicy("fifo");
-  setDjvuImageFormat("ppm");
   setDjvuExtractText(true);
   setDjvuRotation(0);
 }
@@ -1339,22 +1234,15 @@ void SettingsManager::loadFromSettings() {
       clampDouble(readFormatValue("mobi", "render/image_spacing_em", 0.6).toDouble(), 0.0, 4.0);
 
   m_pdfDpi = clampInt(readFormatValue("pdf", "render/dpi", m_settings.value("pdf/dpi", 120)).toInt(), 72, 240);
-  m_pdfCacheLimit =
-      clampInt(readFormatValue("pdf", "render/cache_limit", m_settings.value("pdf/cache_limit", 30)).toInt(), 5, 120);
   m_pdfPrefetchDistance =
       clampInt(readFormatValue("pdf", "render/prefetch_distance", 1).toInt(), 0, 6);
   m_pdfPreRenderPages =
       clampInt(readFormatValue("pdf", "render/pre_render_pages", 2).toInt(), 1, 12);
   m_pdfPrefetchStrategy =
-      readFormatValue("pdf", "render/prefetch_strategy", "symmetric").toString().toLower();
+      readFormatValue("pdf", "render/prefetch_strategy", "adaptive").toString().toLower();
   if (m_pdfPrefetchStrategy != "forward" && m_pdfPrefetchStrategy != "symmetric" &&
-      m_pdfPrefetchStrategy != "backward") {
-    m_pdfPrefetchStrategy = "symmetric";
-  }
-  m_pdfCachePolicy =
-      readFormatValue("pdf", "render/cache_policy", "fifo").toString().toLower();
-  if (m_pdfCachePolicy != "fifo" && m_pdfCachePolicy != "lru") {
-    m_pdfCachePolicy = "fifo";
+      m_pdfPrefetchStrategy != "backward" && m_pdfPrefetchStrategy != "adaptive") {
+    m_pdfPrefetchStrategy = "adaptive";
   }
   m_pdfRenderPreset =
       readFormatValue("pdf", "render/preset", "custom").toString().toLower();
@@ -1379,16 +1267,6 @@ void SettingsManager::loadFromSettings() {
       clampInt(readFormatValue("pdf", "render/max_width", 0).toInt(), 0, 20000);
   m_pdfMaxHeight =
       clampInt(readFormatValue("pdf", "render/max_height", 0).toInt(), 0, 20000);
-  m_pdfImageFormat =
-      readFormatValue("pdf", "render/image_format", "png").toString().toLower();
-  if (m_pdfImageFormat == "jpg") {
-    m_pdfImageFormat = "jpeg";
-  }
-  if (m_pdfImageFormat != "png" && m_pdfImageFormat != "jpeg") {
-    m_pdfImageFormat = "png";
-  }
-  m_pdfJpegQuality =
-      clampInt(readFormatValue("pdf", "render/jpeg_quality", 85).toInt(), 1, 100);
   m_pdfExtractText =
       readFormatValue("pdf", "render/extract_text", true).toBool();
   m_pdfTileSize =
@@ -1400,22 +1278,10 @@ void SettingsManager::loadFromSettings() {
 
   m_djvuDpi =
       clampInt(readFormatValue("djvu", "render/dpi", 120).toInt(), 72, 240);
-  m_djvuCacheLimit =
-      clampInt(readFormatValue("djvu", "render/cache_limit", 30).toInt(), 5, 120);
   m_djvuPrefetchDistance =
       clampInt(readFormatValue("djvu", "render/prefetch_distance", 1).toInt(), 0, 6);
   m_djvuPreRenderPages =
       clampInt(readFormatValue("djvu", "render/pre_render_pages", 2).toInt(), 1, 12);
-  m_djvuCachePolicy =
-      readFormatValue("djvu", "render/cache_policy", "fifo").toString().toLower();
-  if (m_djvuCachePolicy != "fifo" && m_djvuCachePolicy != "lru") {
-    m_djvuCachePolicy = "fifo";
-  }
-  m_djvuImageFormat =
-      readFormatValue("djvu", "render/format", "ppm").toString().toLower();
-  if (m_djvuImageFormat != "ppm" && m_djvuImageFormat != "tiff") {
-    m_djvuImageFormat = "ppm";
-  }
   m_djvuExtractText =
       readFormatValue("djvu", "render/extract_text", true).toBool();
   m_djvuRotation =
@@ -1528,29 +1394,22 @@ void SettingsManager::loadFromSettings() {
   saveMobiFamilyValue("render/image_max_width_percent", m_mobiImageMaxWidth);
   saveMobiFamilyValue("render/image_spacing_em", m_mobiImageSpacing);
   saveFormatValue("pdf", "render/dpi", m_pdfDpi);
-  saveFormatValue("pdf", "render/cache_limit", m_pdfCacheLimit);
   saveFormatValue("pdf", "render/prefetch_distance", m_pdfPrefetchDistance);
   saveFormatValue("pdf", "render/pre_render_pages", m_pdfPreRenderPages);
   saveFormatValue("pdf", "render/prefetch_strategy", m_pdfPrefetchStrategy);
-  saveFormatValue("pdf", "render/cache_policy", m_pdfCachePolicy);
   saveFormatValue("pdf", "render/preset", m_pdfRenderPreset);
   saveFormatValue("pdf", "render/color_mode", m_pdfColorMode);
   saveFormatValue("pdf", "render/background_mode", m_pdfBackgroundMode);
   saveFormatValue("pdf", "render/background_color", m_pdfBackgroundColor);
   saveFormatValue("pdf", "render/max_width", m_pdfMaxWidth);
   saveFormatValue("pdf", "render/max_height", m_pdfMaxHeight);
-  saveFormatValue("pdf", "render/image_format", m_pdfImageFormat);
-  saveFormatValue("pdf", "render/jpeg_quality", m_pdfJpegQuality);
   saveFormatValue("pdf", "render/extract_text", m_pdfExtractText);
   saveFormatValue("pdf", "render/tile_size", m_pdfTileSize);
   saveFormatValue("pdf", "render/progressive", m_pdfProgressiveRendering);
   saveFormatValue("pdf", "render/progressive_dpi", m_pdfProgressiveDpi);
   saveFormatValue("djvu", "render/dpi", m_djvuDpi);
-  saveFormatValue("djvu", "render/cache_limit", m_djvuCacheLimit);
   saveFormatValue("djvu", "render/prefetch_distance", m_djvuPrefetchDistance);
   saveFormatValue("djvu", "render/pre_render_pages", m_djvuPreRenderPages);
-  saveFormatValue("djvu", "render/cache_policy", m_djvuCachePolicy);
-  saveFormatValue("djvu", "render/format", m_djvuImageFormat);
   saveFormatValue("djvu", "render/extract_text", m_djvuExtractText);
   saveFormatValue("djvu", "render/rotation", m_djvuRotation);
   saveComicValue("view/default_fit_mode", m_comicDefaultFitMode);
@@ -1603,29 +1462,22 @@ void SettingsManager::loadFromSettings() {
   emit mobiImageMaxWidthChanged();
   emit mobiImageSpacingChanged();
   emit pdfDpiChanged();
-  emit pdfCacheLimitChanged();
   emit pdfPrefetchDistanceChanged();
   emit pdfPreRenderPagesChanged();
   emit pdfPrefetchStrategyChanged();
-  emit pdfCachePolicyChanged();
   emit pdfRenderPresetChanged();
   emit pdfColorModeChanged();
   emit pdfBackgroundModeChanged();
   emit pdfBackgroundColorChanged();
   emit pdfMaxWidthChanged();
   emit pdfMaxHeightChanged();
-  emit pdfImageFormatChanged();
-  emit pdfJpegQualityChanged();
   emit pdfExtractTextChanged();
   emit pdfTileSizeChanged();
   emit pdfProgressiveRenderingChanged();
   emit pdfProgressiveDpiChanged();
   emit djvuDpiChanged();
-  emit djvuCacheLimitChanged();
   emit djvuPrefetchDistanceChanged();
   emit djvuPreRenderPagesChanged();
-  emit djvuCachePolicyChanged();
-  emit djvuImageFormatChanged();
   emit djvuExtractTextChanged();
   emit djvuRotationChanged();
   emit comicDefaultFitModeChanged();
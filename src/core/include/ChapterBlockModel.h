@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QAbstractListModel>
+#include <QString>
+#include <QVector>
+
+#include "CancelToken.h"
+
+// One chapter split into paragraph/heading/image blocks so QML can show it in
+// a virtualized ListView. `start`/`length` are positions in the whole-chapter
+// text, the same coordinates AnnotationModel uses for highlight ranges.
+class ChapterBlockModel : public QAbstractListModel {
+  Q_OBJECT
+  Q_PROPERTY(int count READ count NOTIFY countChanged)
+  Q_PROPERTY(int chapter READ chapter NOTIFY countChanged)
+
+public:
+  enum Roles {
+    KindRole = Qt::UserRole + 1,
+    HtmlRole,
+    StartRole,
+    LengthRole,
+    LevelRole,
+    ImageSourceRole
+  };
+
+  struct Block {
+    QString kind;
+    QString html;
+    int start = 0;
+    int length = 0;
+    int level = 0;
+    QString imageSource;
+  };
+
+  explicit ChapterBlockModel(QObject *parent = nullptr);
+
+  int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex &index, int role) const override;
+  QHash<int, QByteArray> roleNames() const override;
+
+  int count() const;
+  int chapter() const;
+
+  // Thread-safe; returns no blocks when cancelled.
+  static QVector<Block> buildBlocks(const QString &text,
+                                    bool richText,
+                                    const CancelToken &cancel = CancelToken());
+
+  // Splits `text` on the thread pool and resets the model when done.
+  void setChapter(int chapter, const QString &text, bool richText);
+  void clear();
+  // Row containing the chapter position `offset`, or -1.
+  Q_INVOKABLE int blockAt(int offset) const;
+
+signals:
+  void countChanged();
+
+private:
+  void resetBlocks(int chapter, QVector<Block> blocks);
+
+  QVector<Block> m_blocks;
+  int m_chapter = -1;
+  int m_generation = 0;
+  CancelToken m_cancel;
+};
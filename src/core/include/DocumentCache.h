@@ -0,0 +1,46 @@
+#pragma once
+
+#include <QDateTime>
+#include <QHash>
+#include <QString>
+#include <memory>
+#include <vector>
+
+#include "AssetCache.h"
+#include "FormatDocument.h"
+
+// A parked document together with the chapters the reader already converted.
+struct CachedDocument {
+  std::unique_ptr<FormatDocument> document;
+  // Keeps the document's extracted assets on disk while it is parked.
+  AssetCache::Lease assets;
+  QHash<int, QString> chapterText;
+  QHash<int, QString> chapterPlain;
+};
+
+// Bounded LRU of recently closed documents, keyed by absolute path. Entries are
+// evicted oldest-first once their approximate memory cost exceeds the budget.
+class DocumentCache {
+public:
+  void setBudget(qint64 bytes);
+  void insert(const QString &path, CachedDocument entry);
+  // Moves the entry out; fails when absent or the file changed on disk.
+  bool take(const QString &path, CachedDocument *out);
+  bool contains(const QString &path) const;
+  void clear();
+
+private:
+  struct Entry {
+    QString path;
+    qint64 size = 0;
+    QDateTime modified;
+    qint64 cost = 0;
+    CachedDocument cached;
+  };
+
+  void evict();
+
+  std::vector<Entry> m_entries;
+  qint64 m_budget = 0;
+  qint64 m_total = 0;
+};
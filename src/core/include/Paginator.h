@@ -0,0 +1,103 @@
+#pragma once
+
+#include <QHash>
+#include <QObject>
+#include <QSet>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <memory>
+
+#include "CancelToken.h"
+
+class QThreadPool;
+
+struct PageLayout {
+  QString fontFamily;
+  int fontPixelSize = 0;
+  qreal lineHeight = 0.0;
+  QSize viewport;
+
+  bool isValid() const {
+    return fontPixelSize > 0 && viewport.width() > 0 && viewport.height() > 0;
+  }
+  QString key() const;
+  bool operator==(const PageLayout &other) const {
+    return fontFamily == other.fontFamily && fontPixelSize == other.fontPixelSize &&
+           qFuzzyCompare(lineHeight + 1.0, other.lineHeight + 1.0) && viewport == other.viewport;
+  }
+  bool operator!=(const PageLayout &other) const { return !(*this == other); }
+};
+
+struct ChapterPages {
+  // Document position of the first character on each page.
+  QVector<int> starts;
+  // Rich-text fragment for each page; empty when the chapter was only counted.
+  QStringList html;
+};
+
+// Splits reflowable chapters into viewport-sized pages. Layout runs on worker
+// threads with QTextDocument, so the UI thread only ever shows one page of
+// text. Page counts are cached per (book, layout), which makes rotating back
+// or returning to an earlier font size free.
+class Paginator : public QObject {
+  Q_OBJECT
+
+public:
+  explicit Paginator(QObject *parent = nullptr);
+  ~Paginator() override;
+
+  // Thread-safe; returns no pages when cancelled or when the layout is invalid.
+  static ChapterPages paginate(const QString &text,
+                               bool richText,
+                               const PageLayout &layout,
+                               bool withHtml,
+                               const CancelToken &cancel = CancelToken());
+
+  // An empty key deactivates pagination (image books, closed reader).
+  void setBook(const QString &bookKey, int chapterCount, bool richText);
+  void setChapterCount(int count);
+  void setLayout(const PageLayout &layout);
+  const PageLayout &layout() const { return m_layout; }
+  bool isActive() const;
+
+  // Lays `chapter` out with page fragments on the global pool; emits chapterReady().
+  void requestPages(int chapter, const QString &text);
+  const ChapterPages *pages(int chapter) const;
+  void retainPages(int first, int last);
+
+  // Counts one chapter on a low-priority thread; emits pageCountsChanged().
+  void requestCount(int chapter, const QString &text);
+  bool isCounting() const;
+  int nextUncountedChapter() const;
+  int chapterPageCount(int chapter) const;
+  // -1 until every earlier chapter has been counted.
+  int pagesBefore(int chapter) const;
+  // -1 until every chapter has been counted.
+  int bookPageCount() const;
+
+signals:
+  void chapterReady(int chapter);
+  void pageCountsChanged();
+
+private:
+  void restart();
+  QVector<int> &counts();
+  const QVector<int> *currentCounts() const;
+  void storeCount(int chapter, int pageCount);
+
+  QString m_bookKey;
+  int m_chapterCount = 0;
+  bool m_richText = false;
+  PageLayout m_layout;
+  int m_generation = 0;
+  CancelToken m_cancel;
+  QHash<int, ChapterPages> m_pages;
+  QSet<int> m_pendingPages;
+  int m_countingChapter = -1;
+  // Page counts per "<book>|<layout>", least recently used first in m_countOrder.
+  QHash<QString, QVector<int>> m_counts;
+  QStringList m_countOrder;
+  std::unique_ptr<QThreadPool> m_countPool;
+};
@@ -1,13 +1,25 @@
 #pragma once
 
+#include <QAbstractListModel>
+#include <QHash>
 #include <QObject>
+#include <QSet>
+#include <QSize>
 #include <QString>
 #include <QUrl>
+#include <QVariantList>
+#include <QVariantMap>
 #include <QVector>
 #include <memory>
 
+#include "ChapterBlockModel.h"
+#include "DocumentCache.h"
+#include "Paginator.h"
 #include "FormatRegistry.h"
 
+class QThreadPool;
+class QTimer;
+
 class ReaderController : public QObject {
   Q_OBJECT
   Q_PROPERTY(QString currentTitle READ currentTitle NOTIFY currentChanged)
@@ -24,21 +36,36 @@ class ReaderController : public QObject {
   Q_PROPERTY(bool hasImages READ hasImages NOTIFY currentChanged)
   Q_PROPERTY(int currentImageIndex READ currentImageIndex NOTIFY currentChanged)
   Q_PROPERTY(int imageCount READ imageCount NOTIFY currentChanged)
+  Q_PROPERTY(bool hasThumbnails READ hasThumbnails NOTIFY currentChanged)
   Q_PROPERTY(QString currentImagePath READ currentImagePath NOTIFY currentChanged)
   Q_PROPERTY(QUrl currentImageUrl READ currentImageUrl NOTIFY currentChanged)
   Q_PROPERTY(int imageReloadToken READ imageReloadToken NOTIFY imageReloadTokenChanged)
   Q_PROPERTY(QString currentCoverPath READ currentCoverPath NOTIFY currentChanged)
   Q_PROPERTY(QUrl currentCoverUrl READ currentCoverUrl NOTIFY currentChanged)
+  Q_PROPERTY(bool documentLoading READ documentLoading NOTIFY currentChanged)
   Q_PROPERTY(bool busy READ busy NOTIFY busyChanged)
   Q_PROPERTY(QString lastError READ lastError NOTIFY lastErrorChanged)
   Q_PROPERTY(bool ttsAllowed READ ttsAllowed NOTIFY currentChanged)
+  Q_PROPERTY(bool pagedText READ pagedText NOTIFY currentChanged)
+  Q_PROPERTY(QAbstractListModel *chapterBlocks READ chapterBlocks CONSTANT)
+  Q_PROPERTY(bool paginated READ paginated NOTIFY pageChanged)
+  Q_PROPERTY(int currentPageIndex READ currentPageIndex NOTIFY pageChanged)
+  Q_PROPERTY(int pageCount READ pageCount NOTIFY pageChanged)
+  Q_PROPERTY(QString currentPageText READ currentPageText NOTIFY pageChanged)
+  Q_PROPERTY(int currentPageOffset READ currentPageOffset NOTIFY pageChanged)
+  Q_PROPERTY(int bookPageNumber READ bookPageNumber NOTIFY pageChanged)
+  Q_PROPERTY(int bookPageCount READ bookPageCount NOTIFY pageChanged)
 
 public:
   explicit ReaderController(QObject *parent = nullptr);
+  ~ReaderController() override;
 
   Q_INVOKABLE bool openFile(const QString &path);
   Q_INVOKABLE void openFileAsync(const QString &path);
   Q_INVOKABLE void close();
+  // Speculatively opens a book (e.g. the hovered library row) on a low-priority
+  // thread so a following openFileAsync() can use the warmed document.
+  Q_INVOKABLE void prewarm(const QString &path);
   Q_INVOKABLE bool jumpToLocator(const QString &locator);
   Q_INVOKABLE bool nextChapter();
   Q_INVOKABLE bool prevChapter();
@@ -50,6 +77,42 @@ public:
   Q_INVOKABLE bool prevImage();
   Q_INVOKABLE bool goToImage(int index);
   Q_INVOKABLE QUrl imageUrlAt(int index) const;
+  // Small preview of a page for the scrubber ("image://thumbs/..."); empty
+  // when the format has no thumbnails. Rendered in the background, requested
+  // pages first.
+  Q_INVOKABLE QUrl thumbnailUrl(int index) const;
+  // Sharp tiles for a zoomed page: the page's base image is pageWidth x
+  // pageHeight and shown `scale` times larger; x/y/width/height is the visible
+  // part in base image pixels. Entries are {url, x, y, width, height}.
+  Q_INVOKABLE QVariantList pageTiles(int index,
+                                     int pageWidth,
+                                     int pageHeight,
+                                     qreal scale,
+                                     qreal x,
+                                     qreal y,
+                                     qreal width,
+                                     qreal height);
+  // Words of a page's text layer containing `query` (case-insensitive; all
+  // words when empty), for highlighting on the page image. Entries are
+  // {text, line, x, y, width, height} with the box in 0..1 of the page.
+  // Empty until the page's text is indexed; pageTextReady(index) follows.
+  Q_INVOKABLE QVariantList pageWordBoxes(int index, const QString &query = QString());
+  // Counters of the shared page cache (hits per tier, misses, bytes held) for
+  // tuning cache/page_images_mb and cache/page_disk_mb.
+  Q_INVOKABLE QVariantMap pageCacheStats() const;
+  // Box one page of the image view is fitted into, in logical pixels; 0 on a
+  // side the fit mode leaves unconstrained. Paged formats render at this size.
+  Q_INVOKABLE void setImageViewport(int width, int height, qreal devicePixelRatio);
+  // Viewport and text style of the reflowable view; chapters are re-paginated
+  // in the background whenever one of them changes.
+  Q_INVOKABLE void setPageLayout(int width,
+                                 int height,
+                                 const QString &fontFamily,
+                                 int fontPixelSize,
+                                 qreal lineHeight);
+  Q_INVOKABLE bool nextPage();
+  Q_INVOKABLE bool prevPage();
+  Q_INVOKABLE bool goToPage(int index);
 
   QString currentTitle() const;
   QString currentText() const;
@@ -63,6 +126,7 @@ public:
   int chapterCount() const;
   int tocCount() const;
   bool hasImages() const;
+  bool hasThumbnails() const;
   int currentImageIndex() const;
   int imageCount() const;
   QString currentImagePath() const;
@@ -70,32 +134,74 @@ public:
   int imageReloadToken() const;
   QString currentCoverPath() const;
   QUrl currentCoverUrl() const;
+  bool documentLoading() const;
   bool busy() const;
   QString lastError() const;
   bool ttsAllowed() const;
+  bool pagedText() const;
+  QAbstractListModel *chapterBlocks() const;
+  bool paginated() const;
+  int currentPageIndex() const;
+  int pageCount() const;
+  QString currentPageText() const;
+  int currentPageOffset() const;
+  int bookPageNumber() const;
+  int bookPageCount() const;
 
 signals:
   void currentChanged();
   void imageReloadTokenChanged();
   void busyChanged();
   void lastErrorChanged();
+  void pageChanged();
+  void pageTextReady(int index);
 
 private:
   void setLastError(const QString &error);
-  bool applyDocument(std::unique_ptr<FormatDocument> document, const QString &path, QString *error);
+  bool applyDocument(CachedDocument cached, const QString &path, QString *error);
+  void parkDocument();
+  void stopThumbnails();
+  void cancelPrewarm();
+  void finishPrewarm(const QString &path, CachedDocument cached, const QString &error);
   void setBusy(bool busy);
   void clearImageState();
+  bool showChapter(int index);
+  void updateChapterWindow();
+  void clearChapterCache();
+  void refreshToc();
+  void refreshStructure();
+  // Chapter the saved position restores to, or -1 while the provider may
+  // still discover it.
+  int restoreTarget(int chapter, const QString &chapterKey) const;
+  // Notes the current position; it is written to settings.ini after a short
+  // pause in page turns, or at once by flushReadingPosition.
+  void saveReadingPosition();
+  void flushReadingPosition();
+  void resetPagination();
+  void updateBlocks();
+  void updatePagination();
+  void onChapterPaginated(int chapter);
+  void continuePageCount();
+  const ChapterPages *currentPages() const;
 
-  std::unique_ptr<FormatRegistry> m_registry;
   std::unique_ptr<FormatDocument> m_document;
+  AssetCache::Lease m_documentAssets;
+  DocumentCache m_documentCache;
   QString m_currentTitle;
   QString m_currentText;
   QString m_currentPlainText;
   QString m_currentPath;
   QString m_currentFormat;
   QStringList m_chapterTitles;
-  QStringList m_chapterTexts;
-  QStringList m_chapterPlainTexts;
+  int m_chapterCount = 0;
+  int m_chapterWindow = 1;
+  QHash<int, QString> m_chapterTextCache;
+  QHash<int, QString> m_chapterPlainCache;
+  QSet<int> m_pendingChapters;
+  int m_documentGeneration = 0;
+  int m_restoreChapter = -1;
+  QString m_restoreChapterKey;
+  bool m_documentLoading = false;
   QStringList m_tocTitles;
   QVector<int> m_tocChapterIndices;
   bool m_textIsRich = false;
@@ -103,10 +209,31 @@ private:
   QStringList m_imagePaths;
   int m_currentImageIndex = -1;
   int m_imageReloadToken = 0;
+  QString m_unsavedPositionPath;
+  int m_unsavedPosition = -1;
+  QString m_unsavedPositionKey;
+  QTimer *m_positionTimer = nullptr;
+  QSize m_imageTarget;
+  // ThumbnailAtlas strip of the current document.
+  QString m_thumbnailId;
   QString m_coverPath;
   QString m_lastError;
   bool m_ttsAllowed = true;
   bool m_isOpen = false;
   bool m_busy = false;
   int m_openRequestId = 0;
+  CancelToken m_openCancel;
+  std::unique_ptr<QThreadPool> m_warmPool;
+  CancelToken m_warmCancel;
+  QString m_warmPath;
+  int m_warmOpenRequest = -1;
+  Paginator *m_paginator = nullptr;
+  // Block view of the current chapter for the scrolling (non-paged) mode.
+  ChapterBlockModel *m_blockModel = nullptr;
+  bool m_pagedText = true;
+  int m_currentPage = 0;
+  // Document position to land on once the current chapter is re-paginated.
+  int m_pendingPageOffset = -1;
+  bool m_pendingLastPage = false;
+  int m_countRequestChapter = -1;
 };
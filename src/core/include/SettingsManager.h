@@ -49,29 +49,22 @@ class SettingsManager : public QObject {
   Q_PROPERTY(int mobiImageMaxWidth READ mobiImageMaxWidth WRITE setMobiImageMaxWidth NOTIFY mobiImageMaxWidthChanged)
   Q_PROPERTY(double mobiImageSpacing READ mobiImageSpacing WRITE setMobiImageSpacing NOTIFY mobiImageSpacingChanged)
   Q_PROPERTY(int pdfDpi READ pdfDpi WRITE setPdfDpi NOTIFY pdfDpiChanged)
-  Q_PROPERTY(int pdfCacheLimit READ pdfCacheLimit WRITE setPdfCacheLimit NOTIFY pdfCacheLimitChanged)
   Q_PROPERTY(int pdfPrefetchDistance READ pdfPrefetchDistance WRITE setPdfPrefetchDistance NOTIFY pdfPrefetchDistanceChanged)
   Q_PROPERTY(int pdfPreRenderPages READ pdfPreRenderPages WRITE setPdfPreRenderPages NOTIFY pdfPreRenderPagesChanged)
   Q_PROPERTY(QString pdfPrefetchStrategy READ pdfPrefetchStrategy WRITE setPdfPrefetchStrategy NOTIFY pdfPrefetchStrategyChanged)
-  Q_PROPERTY(QString pdfCachePolicy READ pdfCachePolicy WRITE setPdfCachePolicy NOTIFY pdfCachePolicyChanged)
   Q_PROPERTY(QString pdfRenderPreset READ pdfRenderPreset WRITE setPdfRenderPreset NOTIFY pdfRenderPresetChanged)
   Q_PROPERTY(QString pdfColorMode READ pdfColorMode WRITE setPdfColorMode NOTIFY pdfColorModeChanged)
   Q_PROPERTY(QString pdfBackgroundMode READ pdfBackgroundMode WRITE setPdfBackgroundMode NOTIFY pdfBackgroundModeChanged)
   Q_PROPERTY(QString pdfBackgroundColor READ pdfBackgroundColor WRITE setPdfBackgroundColor NOTIFY pdfBackgroundColorChanged)
   Q_PROPERTY(int pdfMaxWidth READ pdfMaxWidth WRITE setPdfMaxWidth NOTIFY pdfMaxWidthChanged)
   Q_PROPERTY(int pdfMaxHeight READ pdfMaxHeight WRITE setPdfMaxHeight NOTIFY pdfMaxHeightChanged)
-  Q_PROPERTY(QString pdfImageFormat READ pdfImageFormat WRITE setPdfImageFormat NOTIFY pdfImageFormatChanged)
-  Q_PROPERTY(int pdfJpegQuality READ pdfJpegQuality WRITE setPdfJpegQuality NOTIFY pdfJpegQualityChanged)
   Q_PROPERTY(bool pdfExtractText READ pdfExtractText WRITE setPdfExtractText NOTIFY pdfExtractTextChanged)
   Q_PROPERTY(int pdfTileSize READ pdfTileSize WRITE setPdfTileSize NOTIFY pdfTileSizeChanged)
   Q_PROPERTY(bool pdfProgressiveRendering READ pdfProgressiveRendering WRITE setPdfProgressiveRendering NOTIFY pdfProgressiveRenderingChanged)
   Q_PROPERTY(int pdfProgressiveDpi READ pdfProgressiveDpi WRITE setPdfProgressiveDpi NOTIFY pdfProgressiveDpiChanged)
   Q_PROPERTY(int djvuDpi READ djvuDpi WRITE setDjvuDpi NOTIFY djvuDpiChanged)
-  Q_PROPERTY(int djvuCacheLimit READ djvuCacheLimit WRITE setDjvuCacheLimit NOTIFY djvuCacheLimitChanged)
   Q_PROPERTY(int djvuPrefetchDistance READ djvuPrefetchDistance WRITE setDjvuPrefetchDistance NOTIFY djvuPrefetchDistanceChanged)
   Q_PROPERTY(int djvuPreRenderPages READ djvuPreRenderPages WRITE setDjvuPreRenderPages NOTIFY djvuPreRenderPagesChanged)
-  Q_PROPERTY(QString djvuCachePolicy READ djvuCachePolicy WRITE setDjvuCachePolicy NOTIFY djvuCachePolicyChanged)
-  Q_PROPERTY(QString djvuImageFormat READ djvuImageFormat WRITE setDjvuImageFormat NOTIFY djvuImageFormatChanged)
   Q_PROPERTY(bool djvuExtractText READ djvuExtractText WRITE setDjvuExtractText NOTIFY djvuExtractTextChanged)
   Q_PROPERTY(int djvuRotation READ djvuRotation WRITE setDjvuRotation NOTIFY djvuRotationChanged)
   Q_PROPERTY(double comicMinZoom READ comicMinZoom WRITE setComicMinZoom NOTIFY comicMinZoomChanged)
@@ -135,29 +128,22 @@ public:
   int mobiImageMaxWidth() const;
   double mobiImageSpacing() const;
   int pdfDpi() const;
-  int pdfCacheLimit() const;
   int pdfPrefetchDistance() const;
   int pdfPreRenderPages() const;
   QString pdfPrefetchStrategy() const;
-  QString pdfCachePolicy() const;
   QString pdfRenderPreset() const;
   QString pdfColorMode() const;
   QString pdfBackgroundMode() const;
   QString pdfBackgroundColor() const;
   int pdfMaxWidth() const;
   int pdfMaxHeight() const;
-  QString pdfImageFormat() const;
-  int pdfJpegQuality() const;
   bool pdfExtractText() const;
   int pdfTileSize() const;
   bool pdfProgressiveRendering() const;
   int pdfProgressiveDpi() const;
   int djvuDpi() const;
-  int djvuCacheLimit() const;
   int djvuPrefetchDistance() const;
   int djvuPreRenderPages() const;
-  QString djvuCachePolicy() const;
-  QString djvuImageFormat() const;
   bool djvuExtractText() const;
   int djvuRotation() const;
   double comicMinZoom() const;
@@ -227,29 +213,22 @@ public:
   void setMobiImageMaxWidth(int value);
   void setMobiImageSpacing(double value);
   void setPdfDpi(int value);
-  void setPdfCacheLimit(int value);
   void setPdfPrefetchDistance(int value);
   void setPdfPreRenderPages(int value);
   void setPdfPrefetchStrategy(const QString &value);
-  void setPdfCachePolicy(const QString &value);
   void setPdfRenderPreset(const QString &value);
   void setPdfColorMode(const QString &value);
   void setPdfBackgroundMode(const QString &value);
   void setPdfBackgroundColor(const QString &value);
   void setPdfMaxWidth(int value);
   void setPdfMaxHeight(int value);
-  void setPdfImageFormat(const QString &value);
-  void setPdfJpegQuality(int value);
   void setPdfExtractText(bool value);
   void setPdfTileSize(int value);
   void setPdfProgressiveRendering(bool value);
   void setPdfProgressiveDpi(int value);
   void setDjvuDpi(int value);
-  void setDjvuCacheLimit(int value);
   void setDjvuPrefetchDistance(int value);
   void setDjvuPreRenderPages(int value);
-  void setDjvuCachePolicy(const QString &value);
-  void setDjvuImageFormat(const QString &value);
   void setDjvuExtractText(bool value);
   void setDjvuRotation(int value);
   void setComicMinZoom(double value);
@@ -319,29 +298,22 @@ signals:
   void mobiImageMaxWidthChanged();
   void mobiImageSpacingChanged();
   void pdfDpiChanged();
-  void pdfCacheLimitChanged();
   void pdfPrefetchDistanceChanged();
   void pdfPreRenderPagesChanged();
   void pdfPrefetchStrategyChanged();
-  void pdfCachePolicyChanged();
   void pdfRenderPresetChanged();
   void pdfColorModeChanged();
   void pdfBackgroundModeChanged();
   void pdfBackgroundColorChanged();
   void pdfMaxWidthChanged();
   void pdfMaxHeightChanged();
-  void pdfImageFormatChanged();
-  void pdfJpegQualityChanged();
   void pdfExtractTextChanged();
   void pdfTileSizeChanged();
   void pdfProgressiveRenderingChanged();
   void pdfProgressiveDpiChanged();
   void djvuDpiChanged();
-  void djvuCacheLimitChanged();
   void djvuPrefetchDistanceChanged();
   void djvuPreRenderPagesChanged();
-  void djvuCachePolicyChanged();
-  void djvuImageFormatChanged();
   void djvuExtractTextChanged();
   void djvuRotationChanged();
   void comicMinZoomChanged();
@@ -412,29 +384,22 @@ private:
   int m_mobiImageMaxWidth = 100;
   double m_mobiImageSpacing = 0.6;
   int m_pdfDpi = 120;
-  int m_pdfCacheLimit = 30;
   int m_pdfPrefetchDistance = 1;
   int m_pdfPreRenderPages = 2;
-  QString m_pdfPrefetchStrategy = "symmetric";
-  QString m_pdfCachePolicy = "fifo";
+  QString m_pdfPrefetchStrategy = "adaptive";
   QString m_pdfRenderPreset = "custom";
   QString m_pdfColorMode = "color";
   QString m_pdfBackgroundMode = "white";
   QString m_pdfBackgroundColor = "#202633";
   int m_pdfMaxWidth = 0;
   int m_pdfMaxHeight = 0;
-  QString m_pdfImageFormat = "png";
-  int m_pdfJpegQuality = 85;
   bool m_pdfExtractText = true;
   int m_pdfTileSize = 0;
   bool m_pdfProgressiveRendering = false;
   int m_pdfProgressiveDpi = 72;
   int m_djvuDpi = 120;
-  int m_djvuCacheLimit = 30;
   int m_djvuPrefetchDistance = 1;
   int m_djvuPreRenderPages = 2;
-  QString m_djvuCachePolicy = "fifo";
-  QString m_djvuImageFormat = "ppm";
   bool m_djvuExtractText = true;
   int m_djvuRotation = 0;
   double m_comicMinZoom = 0.5;
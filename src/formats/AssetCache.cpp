@@ -0,0 +1,251 @@
+#include "include/AssetCache.h"
+#include "../core/include/AppPaths.h"
+#include "include/BackgroundPool.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QDirIterator>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSet>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QThreadPool>
+#include <QVector>
+#include <algorithm>
+#include <mutex>
+
+namespace {
+constexpr qint64 kSampleSize = 64 * 1024;
+const char kStampFile[] = ".last_used";
+
+int clampInt(int value, int minValue, int maxValue) {
+  return std::max(minValue, std::min(maxValue, value));
+}
+
+qint64 configuredQuota() {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  return static_cast<qint64>(clampInt(settings.value("cache/assets_mb", 2048).toInt(), 64, 65536)) *
+         1024 * 1024;
+}
+
+QString cacheRoot() {
+  return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("assets");
+}
+
+struct CacheState {
+  QMutex mutex;
+  // path|size|mtime -> fingerprint, so repeated lookups skip the reads.
+  QHash<QString, QString> fingerprints;
+  // Entries stamped by this process.
+  QSet<QString> used;
+  // Fingerprints of the books with a live Lease; their entries are kept.
+  QHash<QString, int> held;
+  bool gcQueued = false;
+};
+
+CacheState &state() {
+  static CacheState cacheState;
+  return cacheState;
+}
+
+// Size plus three 64 KiB samples: cheap even for a 1 GB comic, yet a copied
+// or renamed book still maps to the same entry.
+QString fingerprint(const QString &path) {
+  QFile file(path);
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  if (!file.open(QIODevice::ReadOnly)) {
+    hash.addData(QFileInfo(path).absoluteFilePath().toUtf8());
+    return QString::fromLatin1(hash.result().toHex());
+  }
+  const qint64 size = file.size();
+  hash.addData(QByteArray::number(size));
+  const qint64 offsets[] = {0, std::max<qint64>(0, size / 2 - kSampleSize / 2),
+                            std::max<qint64>(0, size - kSampleSize)};
+  for (const qint64 offset : offsets) {
+    if (file.seek(offset)) {
+      hash.addData(file.read(kSampleSize));
+    }
+  }
+  return QString::fromLatin1(hash.result().toHex());
+}
+
+void stamp(const QString &dir) {
+  QFile file(QDir(dir).filePath(kStampFile));
+  if (file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    file.write(QByteArray::number(QDateTime::currentSecsSinceEpoch()));
+  }
+}
+
+qint64 directorySize(const QString &dir) {
+  qint64 total = 0;
+  QDirIterator it(dir, QDir::Files | QDir::Hidden, QDirIterator::Subdirectories);
+  while (it.hasNext()) {
+    it.next();
+    total += it.fileInfo().size();
+  }
+  return total;
+}
+
+QString fingerprintFor(const QString &sourcePath) {
+  const QFileInfo info(sourcePath);
+  const QString memoKey = QString("%1|%2|%3")
+                              .arg(info.absoluteFilePath())
+                              .arg(info.size())
+                              .arg(info.lastModified().toMSecsSinceEpoch());
+  CacheState &cache = state();
+  {
+    QMutexLocker locker(&cache.mutex);
+    const QString print = cache.fingerprints.value(memoKey);
+    if (!print.isEmpty()) {
+      return print;
+    }
+  }
+  const QString print = fingerprint(sourcePath);
+  QMutexLocker locker(&cache.mutex);
+  cache.fingerprints.insert(memoKey, print);
+  return print;
+}
+
+// Entry directories are named <kind>_<fingerprint>.
+bool isHeld(const CacheState &cache, const QString &dir) {
+  return cache.held.contains(dir.section('_', -1));
+}
+
+void removeLegacyTempDirs() {
+  // Directories the providers wrote to the temp location before this cache.
+  const QDir temp(QStandardPaths::writableLocation(QStandardPaths::TempLocation));
+  const QFileInfoList legacy = temp.entryInfoList({"ereader_*"}, QDir::Dirs | QDir::NoDotAndDotDot);
+  for (const QFileInfo &dir : legacy) {
+    QDir(dir.absoluteFilePath()).removeRecursively();
+  }
+  if (!legacy.isEmpty()) {
+    qInfo() << "AssetCache: removed" << legacy.size() << "legacy temp dirs";
+  }
+}
+
+void collectGarbage() {
+  {
+    QMutexLocker locker(&state().mutex);
+    state().gcQueued = false;
+  }
+  struct Entry {
+    QString path;
+    qint64 bytes = 0;
+    QDateTime used;
+  };
+  const QString root = cacheRoot();
+  QVector<Entry> entries;
+  qint64 total = 0;
+  const QFileInfoList dirs = QDir(root).entryInfoList(QDir::Dirs | QDir::NoDotAndDotDot | QDir::Hidden);
+  for (const QFileInfo &dir : dirs) {
+    if (dir.fileName().startsWith(".trash")) {
+      QDir(dir.absoluteFilePath()).removeRecursively();
+      continue;
+    }
+    Entry entry;
+    entry.path = dir.absoluteFilePath();
+    entry.bytes = directorySize(entry.path);
+    const QFileInfo stampInfo(QDir(entry.path).filePath(kStampFile));
+    entry.used = stampInfo.exists() ? stampInfo.lastModified() : dir.lastModified();
+    total += entry.bytes;
+    entries.append(entry);
+  }
+
+  const qint64 quota = configuredQuota();
+  int removed = 0;
+  if (total > quota) {
+    std::sort(entries.begin(), entries.end(),
+              [](const Entry &a, const Entry &b) { return a.used < b.used; });
+    for (const Entry &entry : entries) {
+      if (total <= quota) {
+        break;
+      }
+      // Moved aside under the lock so an open cannot start using an entry
+      // that is half deleted.
+      const QString trash = QDir(root).filePath(QString(".trash-%1").arg(removed));
+      {
+        QMutexLocker locker(&state().mutex);
+        if (isHeld(state(), entry.path) || !QDir().rename(entry.path, trash)) {
+          continue;
+        }
+        state().used.remove(entry.path);
+      }
+      QDir(trash).removeRecursively();
+      total -= entry.bytes;
+      ++removed;
+    }
+  }
+  if (removed > 0) {
+    qInfo() << "AssetCache: removed" << removed << "entries, now" << total / (1024 * 1024) << "MB";
+  }
+}
+
+QThreadPool *gcPool() {
+  static QThreadPool *pool = makeBackgroundPool();
+  return pool;
+}
+
+// Coalesces requests while a pass is queued.
+void scheduleGarbageCollection() {
+  {
+    QMutexLocker locker(&state().mutex);
+    if (state().gcQueued) {
+      return;
+    }
+    state().gcQueued = true;
+  }
+  gcPool()->start(collectGarbage);
+}
+} // namespace
+
+namespace AssetCache {
+
+QString directoryFor(const QString &kind, const QString &sourcePath) {
+  const QString print = fingerprintFor(sourcePath);
+  const QString dir = QDir(cacheRoot()).filePath(QString("%1_%2").arg(kind, print));
+  CacheState &cache = state();
+  bool created = false;
+  {
+    QMutexLocker locker(&cache.mutex);
+    if (!cache.used.contains(dir)) {
+      created = !QFileInfo::exists(dir);
+      QDir().mkpath(dir);
+      stamp(dir);
+      cache.used.insert(dir);
+    }
+  }
+  if (created) {
+    scheduleGarbageCollection();
+  }
+  return dir;
+}
+
+Lease hold(const QString &sourcePath) {
+  const QString print = fingerprintFor(sourcePath);
+  {
+    QMutexLocker locker(&state().mutex);
+    ++state().held[print];
+  }
+  return Lease(nullptr, [print](void *) {
+    QMutexLocker locker(&state().mutex);
+    if (--state().held[print] <= 0) {
+      state().held.remove(print);
+    }
+  });
+}
+
+void startGarbageCollection() {
+  static std::once_flag once;
+  std::call_once(once, []() {
+    gcPool()->start(removeLegacyTempDirs);
+    scheduleGarbageCollection();
+  });
+}
+
+} // namespace AssetCache
@@ -0,0 +1,30 @@
+#include "CancelUtil.h"
+
+#include <QProcess>
+
+bool openCancelled(const CancelToken &cancel, QString *error) {
+  if (!cancel.isCancelled()) {
+    return false;
+  }
+  if (error) {
+    *error = "Open cancelled";
+  }
+  return true;
+}
+
+bool waitForProcess(QProcess &process, int timeoutMs, const CancelToken &cancel) {
+  for (int waited = 0; waited < timeoutMs; waited += 50) {
+    if (cancel.isCancelled()) {
+      break;
+    }
+    if (process.waitForFinished(50)) {
+      return true;
+    }
+    if (process.state() == QProcess::NotRunning) {
+      return false;
+    }
+  }
+  process.kill();
+  process.waitForFinished(1000);
+  return false;
+}
@@ -0,0 +1,14 @@
+#pragma once
+
+#include "include/CancelToken.h"
+
+#include <QString>
+
+class QProcess;
+
+// True once `cancel` fired; then sets `*error` to what a cancelled open reports.
+bool openCancelled(const CancelToken &cancel, QString *error);
+
+// Waits in short slices so cancelling kills the tool instead of blocking.
+// False on timeout, cancellation or a process that did not start.
+bool waitForProcess(QProcess &process, int timeoutMs, const CancelToken &cancel);
@@ -1,17 +1,37 @@
 #include "CbzProvider.h"
 #include "../core/include/AppPaths.h"
+#include "include/PageImageCache.h"
+#include "RenderScheduler.h"
+#include "include/AssetCache.h"
+#include "PagePostProcess.h"
+#include "PrefetchPlanner.h"
+#include "TilePlanner.h"
+#include "CancelUtil.h"
 
+#include <QAtomicInt>
+#include <QBuffer>
+#include <QDataStream>
+#include <QDateTime>
 #include <QDir>
-#include <QCryptographicHash>
+#include <QFile>
 #include <QFileInfo>
+#include <QHash>
+#include <QImageReader>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QSaveFile>
+#include <QSet>
 #include <QSettings>
-#include <QStandardPaths>
 #include <QCollator>
 #include <QProcess>
 #include <QDebug>
 #include <QDirIterator>
+#include <QtEndian>
+#include <cstring>
 #include <functional>
 #include <algorithm>
+#include <cmath>
+#include <memory>
 
 #ifdef HAVE_LIBARCHIVE
 #include <archive.h>
@@ -21,35 +41,787 @@
 #include "miniz.h"
 
 namespace {
+// Entries above this are not comic pages (or are zip bombs).
+constexpr qint64 kMaxEntryBytes = qint64(512) * 1024 * 1024;
+
+// Pages read from the comic file itself instead of extracted copies.
+// Implementations are safe to read from several decode jobs at once.
+class ComicArchive {
+public:
+  virtual ~ComicArchive() = default;
+
+  // Every entry, in archive order; `read` takes an index into this list.
+  const QStringList &names() const { return m_names; }
+  // The entry's contents, empty when it cannot be read.
+  virtual QByteArray read(int entry) const = 0;
+
+protected:
+  QStringList m_names;
+};
+
+// A CBZ read in place. Open indexes the central directory; pages are then
+// read from a memory map of the file, stored entries without a copy and
+// deflated ones inflated straight into memory.
+class ZipComicArchive final : public ComicArchive {
+public:
+  static std::shared_ptr<ZipComicArchive> open(const QString &path) {
+    std::shared_ptr<ZipComicArchive> archive(new ZipComicArchive());
+    archive->m_file.setFileName(path);
+    if (!archive->m_file.open(QIODevice::ReadOnly)) {
+      return nullptr;
+    }
+    archive->m_size = archive->m_file.size();
+    // Unmappable files (e.g. too large for a 32-bit address space) are read
+    // through the file instead.
+    archive->m_map = archive->m_file.map(0, archive->m_size);
+
+    mz_zip_archive zip;
+    memset(&zip, 0, sizeof(zip));
+    const bool ok = archive->m_map
+                        ? mz_zip_reader_init_mem(&zip, archive->m_map, static_cast<size_t>(archive->m_size), 0)
+                        : mz_zip_reader_init_file(&zip, path.toUtf8().constData(), 0);
+    if (!ok) {
+      return nullptr;
+    }
+    const int count = mz_zip_reader_get_num_files(&zip);
+    archive->m_entries.reserve(count);
+    for (int i = 0; i < count; ++i) {
+      mz_zip_archive_file_stat stat{};
+      if (!mz_zip_reader_file_stat(&zip, i, &stat) || stat.m_is_directory || stat.m_is_encrypted ||
+          !stat.m_is_supported || (stat.m_method != 0 && stat.m_method != MZ_DEFLATED) ||
+          static_cast<qint64>(stat.m_uncomp_size) > kMaxEntryBytes) {
+        continue;
+      }
+      // Local header: 30 fixed bytes, then the name and extra field whose
+      // lengths are at 26 and 28.
+      const qint64 headerOffset = static_cast<qint64>(stat.m_local_header_ofs);
+      const QByteArray header = archive->bytes(headerOffset, 30);
+      if (header.size() != 30 || qFromLittleEndian<quint32>(header.constData()) != 0x04034b50) {
+        continue;
+      }
+      Entry entry;
+      entry.offset = headerOffset + 30 + qFromLittleEndian<quint16>(header.constData() + 26) +
+                     qFromLittleEndian<quint16>(header.constData() + 28);
+      entry.compressedSize = static_cast<qint64>(stat.m_comp_size);
+      entry.size = static_cast<qint64>(stat.m_uncomp_size);
+      entry.deflated = stat.m_method == MZ_DEFLATED;
+      if (entry.offset + entry.compressedSize > archive->m_size) {
+        continue;
+      }
+      archive->m_names.append(QString::fromUtf8(stat.m_filename));
+      archive->m_entries.append(entry);
+    }
+    mz_zip_reader_end(&zip);
+    return archive;
+  }
+
+  // For stored entries the array refers to the mapped file, which lives as
+  // long as the archive.
+  QByteArray read(int index) const override {
+    if (index < 0 || index >= m_entries.size()) {
+      return {};
+    }
+    const Entry &entry = m_entries.at(index);
+    const QByteArray raw = bytes(entry.offset, entry.compressedSize);
+    if (!entry.deflated || raw.size() != entry.compressedSize) {
+      return raw.size() == entry.size ? raw : QByteArray();
+    }
+    QByteArray out(entry.size, Qt::Uninitialized);
+    const size_t written = tinfl_decompress_mem_to_mem(out.data(), static_cast<size_t>(out.size()),
+                                                       raw.constData(), static_cast<size_t>(raw.size()),
+                                                       TINFL_FLAG_USING_NON_WRAPPING_OUTPUT_BUF);
+    if (written != static_cast<size_t>(entry.size)) {
+      return {};
+    }
+    return out;
+  }
+
+private:
+  struct Entry {
+    // Of the entry's data in the file, past its local header.
+    qint64 offset = 0;
+    qint64 compressedSize = 0;
+    qint64 size = 0;
+    bool deflated = false;
+  };
+
+  ZipComicArchive() = default;
+
+  QByteArray bytes(qint64 offset, qint64 size) const {
+    if (offset < 0 || size < 0 || offset + size > m_size) {
+      return {};
+    }
+    if (m_map) {
+      return QByteArray::fromRawData(reinterpret_cast<const char *>(m_map + offset), size);
+    }
+    QMutexLocker locker(&m_fileMutex);
+    if (!m_file.seek(offset)) {
+      return {};
+    }
+    return m_file.read(size);
+  }
+
+  mutable QFile m_file;
+  // Serializes reads when the file could not be mapped.
+  mutable QMutex m_fileMutex;
+  uchar *m_map = nullptr;
+  qint64 m_size = 0;
+  QVector<Entry> m_entries;
+};
+
+#ifdef HAVE_LIBARCHIVE
+QString archiveEntryName(struct archive_entry *entry) {
+  if (const char *utf8 = archive_entry_pathname_utf8(entry)) {
+    return QString::fromUtf8(utf8);
+  }
+  const char *name = archive_entry_pathname(entry);
+  return name ? QString::fromLocal8Bit(name) : QString();
+}
+
+QByteArray readArchiveData(struct archive *ar) {
+  QByteArray out;
+  char buffer[64 * 1024];
+  for (;;) {
+    const la_ssize_t got = archive_read_data(ar, buffer, sizeof(buffer));
+    if (got < 0 || out.size() + got > kMaxEntryBytes) {
+      return {};
+    }
+    if (got == 0) {
+      return out;
+    }
+    out.append(buffer, static_cast<qsizetype>(got));
+  }
+}
+
+// Where a RAR 4/5 archive's own headers end and the file headers begin, and
+// whether it is solid. False for anything else (7z, tar, SFX stubs).
+bool parseRarStart(QFile &file, qint64 *prefix, bool *solid) {
+  if (!file.seek(0)) {
+    return false;
+  }
+  const QByteArray head = file.read(64);
+  if (head.startsWith(QByteArray("Rar!\x1a\x07\x01\x00", 8))) {
+    // Signature, header CRC32, then vints: size, type, flags, [extra size],
+    // [data size], archive flags.
+    int pos = 12;
+    auto vint = [&head, &pos](quint64 *value) {
+      *value = 0;
+      for (int shift = 0; pos < head.size() && shift < 64; shift += 7) {
+        const uchar byte = static_cast<uchar>(head.at(pos++));
+        *value |= quint64(byte & 0x7f) << shift;
+        if (!(byte & 0x80)) {
+          return true;
+        }
+      }
+      return false;
+    };
+    quint64 size = 0;
+    quint64 type = 0;
+    quint64 flags = 0;
+    quint64 skipped = 0;
+    quint64 archiveFlags = 0;
+    if (!vint(&size)) {
+      return false;
+    }
+    const int body = pos;
+    if (!vint(&type) || type != 1 || !vint(&flags) || ((flags & 0x1) && !vint(&skipped)) ||
+        ((flags & 0x2) && !vint(&skipped)) || !vint(&archiveFlags)) {
+      return false;
+    }
+    *prefix = body + static_cast<qint64>(size);
+    *solid = archiveFlags & 0x4;
+    return true;
+  }
+  if (head.startsWith(QByteArray("Rar!\x1a\x07\x00", 7)) && head.size() >= 14) {
+    // Marker block, then the main header: CRC, type 0x73, flags, size.
+    const char *main = head.constData() + 7;
+    if (static_cast<uchar>(main[2]) != 0x73) {
+      return false;
+    }
+    *prefix = 7 + qFromLittleEndian<quint16>(main + 5);
+    *solid = qFromLittleEndian<quint16>(main + 3) & 0x0008;
+    return true;
+  }
+  return false;
+}
+
+// Feeds libarchive the archive's own headers followed by the file from one
+// entry's header on, so a non-solid RAR entry is read without the ones
+// before it.
+struct SplicedSource {
+  QFile file;
+  qint64 prefix = 0;
+  qint64 start = 0;
+  qint64 position = 0;
+  QByteArray buffer;
+};
+
+la_ssize_t splicedRead(struct archive *, void *data, const void **out) {
+  auto *source = static_cast<SplicedSource *>(data);
+  const bool inPrefix = source->position < source->prefix;
+  const qint64 physical = inPrefix ? source->position : source->start + (source->position - source->prefix);
+  const qint64 limit = inPrefix ? std::min<qint64>(source->prefix - source->position, 64 * 1024) : 64 * 1024;
+  if (!source->file.seek(physical)) {
+    return ARCHIVE_FATAL;
+  }
+  source->buffer.resize(limit);
+  const qint64 got = source->file.read(source->buffer.data(), limit);
+  if (got < 0) {
+    return ARCHIVE_FATAL;
+  }
+  source->position += got;
+  *out = source->buffer.constData();
+  return got;
+}
+
+la_int64_t splicedSkip(struct archive *, void *data, la_int64_t request) {
+  static_cast<SplicedSource *>(data)->position += request;
+  return request;
+}
+
+// A CBR (or any archive libarchive reads) used in place. The first open
+// scans the headers once and saves names and header offsets as
+// `entries.bin` in the book's asset dir. Non-solid RAR entries are then read
+// on their own by splicing; solid archives, other formats and entries whose
+// splice fails are streamed by one shared reader that only restarts when a
+// page behind it is asked for.
+class RarComicArchive final : public ComicArchive {
+public:
+  static std::shared_ptr<RarComicArchive> open(const QString &path,
+                                               const QString &indexPath,
+                                               const CancelToken &cancel) {
+    std::shared_ptr<RarComicArchive> archive(new RarComicArchive());
+    archive->m_path = path;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+      return nullptr;
+    }
+    archive->m_fileSize = file.size();
+    archive->m_modified = QFileInfo(file).lastModified().toMSecsSinceEpoch();
+    bool solid = true;
+    archive->m_splice = parseRarStart(file, &archive->m_prefix, &solid) && !solid;
+    file.close();
+    if (archive->loadIndex(indexPath)) {
+      return archive;
+    }
+    if (!archive->scan(cancel)) {
+      return nullptr;
+    }
+    archive->saveIndex(indexPath);
+    return archive;
+  }
+
+  ~RarComicArchive() override {
+    if (m_stream) {
+      archive_read_free(m_stream);
+    }
+  }
+
+  QByteArray read(int entry) const override {
+    if (entry < 0 || entry >= m_names.size()) {
+      return {};
+    }
+    if (m_splice && !m_spliceFailed.loadRelaxed()) {
+      QByteArray out = readSpliced(entry);
+      if (!out.isEmpty() || m_sizes.at(entry) == 0) {
+        return out;
+      }
+      qWarning() << "CbzProvider: random access failed, streaming" << m_path;
+      m_spliceFailed.storeRelaxed(1);
+    }
+    return readStreamed(entry);
+  }
+
+private:
+  RarComicArchive() = default;
+
+  static struct archive *openReader() {
+    struct archive *ar = archive_read_new();
+    archive_read_support_format_all(ar);
+    archive_read_support_filter_all(ar);
+    return ar;
+  }
+
+  bool scan(const CancelToken &cancel) {
+    struct archive *ar = openReader();
+    if (archive_read_open_filename(ar, m_path.toUtf8().constData(), 64 * 1024) != ARCHIVE_OK) {
+      archive_read_free(ar);
+      return false;
+    }
+    struct archive_entry *entry = nullptr;
+    int status = ARCHIVE_OK;
+    while ((status = archive_read_next_header(ar, &entry)) == ARCHIVE_OK || status == ARCHIVE_WARN) {
+      if (cancel.isCancelled()) {
+        archive_read_free(ar);
+        return false;
+      }
+      m_names.append(archiveEntryName(entry));
+      // The first header is reported at 0, before the archive's own headers.
+      m_offsets.append(std::max<qint64>(archive_read_header_position(ar), m_prefix));
+      m_sizes.append(archive_entry_size(entry));
+      archive_read_data_skip(ar);
+    }
+    archive_read_free(ar);
+    return status == ARCHIVE_EOF && !m_names.isEmpty();
+  }
+
+  bool loadIndex(const QString &indexPath) {
+    QFile file(indexPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+      return false;
+    }
+    QDataStream in(&file);
+    quint32 magic = 0;
+    quint32 version = 0;
+    qint64 fileSize = 0;
+    qint64 modified = 0;
+    QStringList names;
+    QVector<qint64> offsets;
+    QVector<qint64> sizes;
+    in >> magic >> version;
+    if (in.status() != QDataStream::Ok || magic != kIndexMagic || version != kIndexVersion) {
+      return false;
+    }
+    in >> fileSize >> modified >> names >> offsets >> sizes;
+    if (in.status() != QDataStream::Ok || fileSize != m_fileSize || modified != m_modified ||
+        names.isEmpty() || offsets.size() != names.size() ||
+        sizes.size() != names.size()) {
+      return false;
+    }
+    m_names = std::move(names);
+    m_offsets = std::move(offsets);
+    m_sizes = std::move(sizes);
+    return true;
+  }
+
+  void saveIndex(const QString &indexPath) const {
+    QDir().mkpath(QFileInfo(indexPath).absolutePath());
+    QSaveFile file(indexPath);
+    if (!file.open(QIODevice::WriteOnly)) {
+      return;
+    }
+    QDataStream out(&file);
+    out << kIndexMagic << kIndexVersion << m_fileSize << m_modified << m_names << m_offsets
+        << m_sizes;
+    if (!file.commit()) {
+      qWarning() << "CbzProvider: could not write archive index" << indexPath;
+    }
+  }
+
+  QByteArray readSpliced(int entry) const {
+    SplicedSource source;
+    source.file.setFileName(m_path);
+    if (!source.file.open(QIODevice::ReadOnly)) {
+      return {};
+    }
+    source.prefix = m_prefix;
+    source.start = m_offsets.at(entry);
+    struct archive *ar = archive_read_new();
+    archive_read_support_format_rar(ar);
+    archive_read_support_format_rar5(ar);
+    archive_read_set_read_callback(ar, splicedRead);
+    archive_read_set_skip_callback(ar, splicedSkip);
+    archive_read_set_callback_data(ar, &source);
+    QByteArray out;
+    struct archive_entry *header = nullptr;
+    // The name check catches a stale or misread offset; the CRC check at the
+    // end of the data catches solid archives the header did not flag.
+    if (archive_read_open1(ar) == ARCHIVE_OK && archive_read_next_header(ar, &header) == ARCHIVE_OK &&
+        archiveEntryName(header) == m_names.at(entry)) {
+      out = readArchiveData(ar);
+    }
+    archive_read_free(ar);
+    return out;
+  }
+
+  QByteArray readStreamed(int entry) const {
+    QMutexLocker locker(&m_streamMutex);
+    if (m_stream && m_streamNext > entry) {
+      archive_read_free(m_stream);
+      m_stream = nullptr;
+    }
+    if (!m_stream) {
+      m_stream = openReader();
+      m_streamNext = 0;
+      if (archive_read_open_filename(m_stream, m_path.toUtf8().constData(), 64 * 1024) != ARCHIVE_OK) {
+        archive_read_free(m_stream);
+        m_stream = nullptr;
+        return {};
+      }
+    }
+    struct archive_entry *header = nullptr;
+    while (m_streamNext <= entry) {
+      const int status = archive_read_next_header(m_stream, &header);
+      if (status != ARCHIVE_OK && status != ARCHIVE_WARN) {
+        archive_read_free(m_stream);
+        m_stream = nullptr;
+        return {};
+      }
+      if (m_streamNext++ == entry) {
+        return readArchiveData(m_stream);
+      }
+      archive_read_data_skip(m_stream);
+    }
+    return {};
+  }
+
+  static constexpr quint32 kIndexMagic = 0x43425249; // "CBRI"
+  static constexpr quint32 kIndexVersion = 2;
+
+  QString m_path;
+  // Size and mtime of the archive the saved index must match; the asset dir
+  // it lives in only fingerprints samples of the file.
+  qint64 m_fileSize = 0;
+  qint64 m_modified = 0;
+  // Length of the RAR signature and main header, replayed before every
+  // spliced entry.
+  qint64 m_prefix = 0;
+  bool m_splice = false;
+  mutable QAtomicInt m_spliceFailed;
+  QVector<qint64> m_offsets;
+  QVector<qint64> m_sizes;
+  mutable QMutex m_streamMutex;
+  // Entry index the shared reader returns next.
+  mutable struct archive *m_stream = nullptr;
+  mutable int m_streamNext = 0;
+};
+#endif
+
+struct ComicDecodeState {
+  QStringList images;
+  // Pages are decoded into PageImageCache under this id.
+  QString imageId;
+  bool fitToView = true;
+  // Fixed at open; read without the mutex. Pages come from `archive` (entry
+  // `entries[index]`) or, for CBRs extracted by a tool, from the files in
+  // `images`.
+  QString assetDir;
+  std::shared_ptr<const ComicArchive> archive;
+  QVector<int> entries;
+  PagePostProcess::Options colors;
+  QSize targetSize;
+  QHash<int, QSize> decodedTarget;
+  QSet<int> inFlight;
+  int focusIndex = -1;
+  PrefetchPlanner prefetch;
+  bool zoomTiles = true;
+  QSet<QString> tilesInFlight;
+  // Full resolution of each decoded page; zoom tiles stop there.
+  QHash<int, QSize> sourceSize;
+  std::function<void(int)> onImageReady;
+  QMutex mutex;
+  bool alive = true;
+};
+
+constexpr int kZoomTileSize = 512;
+
+// Decodes straight to the size the page is shown at; a phone screen never
+// needs the full resolution of a 4000px scan. With `clip` (a zoom tile),
+// `target` is the exact size of the whole scaled page and only `clip` of it
+// is returned; JPEG decodes just that region.
+QImage decodeComicImage(QImageReader &reader,
+                        const QString &name,
+                        const QSize &target,
+                        const QRect &clip,
+                        QSize *sourceSize) {
+  reader.setAutoTransform(true);
+  const QSize full = reader.size();
+  // Clip rects are in stored pixels, so EXIF-rotated scans get no zoom tiles.
+  const bool upright = reader.transformation() == QImageIOHandler::TransformationNone;
+  if (sourceSize) {
+    *sourceSize = upright ? full : QSize();
+  }
+  if (clip.isValid()) {
+    if (!upright || !full.isValid() || target.width() > full.width() || target.height() > full.height()) {
+      return {};
+    }
+    if (target != full) {
+      reader.setScaledSize(target);
+    }
+    reader.setScaledClipRect(clip);
+  } else if (target.isValid() && full.isValid()) {
+    const int boxWidth = target.width() > 0 ? target.width() : full.width();
+    const int boxHeight = target.height() > 0 ? target.height() : full.height();
+    const QSize fitted = full.scaled(QSize(boxWidth, boxHeight), Qt::KeepAspectRatio);
+    if (fitted.width() < full.width() && !fitted.isEmpty()) {
+      reader.setScaledSize(fitted);
+    }
+  }
+  QImage image = reader.read();
+  if (image.isNull()) {
+    qWarning() << "CbzProvider: could not decode" << name << reader.errorString();
+  }
+  return image;
+}
+
+QImage decodeComicPage(const ComicDecodeState &state,
+                       int index,
+                       const QSize &target,
+                       const QRect &clip = QRect(),
+                       QSize *sourceSize = nullptr) {
+  if (index < 0 || index >= state.images.size()) {
+    return {};
+  }
+  if (!state.archive) {
+    QImageReader reader(state.images.at(index));
+    return decodeComicImage(reader, state.images.at(index), target, clip, sourceSize);
+  }
+  const int entry = state.entries.at(index);
+  const QString &name = state.archive->names().at(entry);
+  QByteArray bytes = state.archive->read(entry);
+  if (bytes.isEmpty()) {
+    qWarning() << "CbzProvider: could not read" << name;
+    return {};
+  }
+  QBuffer buffer(&bytes);
+  buffer.open(QIODevice::ReadOnly);
+  QImageReader reader(&buffer);
+  return decodeComicImage(reader, name, target, clip, sourceSize);
+}
+
 class CbzDocument final : public FormatDocument {
 public:
-  CbzDocument(QString title, QStringList images)
-      : m_title(std::move(title)), m_images(std::move(images)) {}
+  CbzDocument(QString title,
+              QStringList images,
+              QString assetDir,
+              std::shared_ptr<const ComicArchive> archive,
+              QVector<int> entries,
+              bool fitToView,
+              const PagePostProcess::Options &colors,
+              const PrefetchPlanner &prefetch,
+              bool zoomTiles)
+      : m_title(std::move(title)), m_state(std::make_shared<ComicDecodeState>()) {
+    m_state->images = std::move(images);
+    m_state->assetDir = std::move(assetDir);
+    m_state->archive = std::move(archive);
+    m_state->entries = std::move(entries);
+    m_state->imageId = PageImageCache::newDocumentId("comic");
+    m_state->fitToView = fitToView;
+    m_state->colors = colors;
+    m_state->prefetch = prefetch;
+    m_state->zoomTiles = zoomTiles;
+  }
+
+  ~CbzDocument() override {
+    {
+      QMutexLocker locker(&m_state->mutex);
+      m_state->alive = false;
+      m_state->onImageReady = nullptr;
+    }
+    RenderScheduler::instance().cancelAll(m_state.get());
+    PageImageCache::instance().removeDocument(m_state->imageId);
+  }
 
   QString title() const override { return m_title; }
   QStringList chapterTitles() const override { return {}; }
   QString readAllText() const override { return {}; }
-  QStringList imagePaths() const override { return m_images; }
+  QStringList imagePaths() const override { return m_state->images; }
+  QString pageImageKey(int index) const override {
+    return PageImageCache::key(m_state->imageId, index);
+  }
 
-private:
-  QString m_title;
-  QStringList m_images;
-};
+  bool ensureImage(int index, const QSize &targetSize) override {
+    const int total = m_state->images.size();
+    if (index < 0 || index >= total) {
+      return false;
+    }
+    PrefetchPlanner::Window window;
+    {
+      QMutexLocker locker(&m_state->mutex);
+      if (!m_state->alive) {
+        return false;
+      }
+      const QSize bucket = PageImageCache::targetBucket(targetSize);
+      if (m_state->fitToView && bucket.isValid()) {
+        m_state->targetSize = bucket;
+      }
+      window = m_state->prefetch.window();
+    }
+    return TilePlanner::queueWindow(index, total, window,
+                                    [this](int page) { return queueDecode(page); });
+  }
 
-struct ZipReader {
-  mz_zip_archive archive{};
-  bool ok = false;
+  QVector<PageTile> requestTiles(int index,
+                                 const QSize &pageSize,
+                                 qreal scale,
+                                 const QRectF &viewport) override {
+    std::shared_ptr<ComicDecodeState> state = m_state;
+    if (index < 0 || index >= state->images.size() || pageSize.isEmpty() ||
+        scale < TilePlanner::kMinScale) {
+      return {};
+    }
+    QSize source;
+    TilePlanner::Request request;
+    {
+      QMutexLocker locker(&state->mutex);
+      if (!state->alive || !state->zoomTiles) {
+        return {};
+      }
+      source = state->sourceSize.value(index);
+      request.visible = index == state->focusIndex;
+    }
+    // Past the scan's resolution a tile is no sharper than the base image.
+    const qreal native = source.isValid() ? qreal(source.width()) / pageSize.width() : 0.0;
+    if (native < TilePlanner::kMinScale) {
+      return {};
+    }
+    request.owner = state.get();
+    request.index = index;
+    request.pageKey = PageImageCache::key(state->imageId, index);
+    request.factor = std::min(TilePlanner::bucketScale(TilePlanner::zoomBucket(scale)), native);
+    request.full = request.factor == native
+                       ? source
+                       : QSize(static_cast<int>(std::ceil(pageSize.width() * request.factor)),
+                               static_cast<int>(std::ceil(pageSize.height() * request.factor)))
+                             .boundedTo(source);
+    request.viewport = viewport;
+    request.tileEdge = kZoomTileSize;
+    request.tagPrefix = QString("w%1").arg(request.full.width());
+    const QSize full = request.full;
+    return TilePlanner::requestTiles(
+        request,
+        [state](const QString &key) {
+          QMutexLocker locker(&state->mutex);
+          if (state->tilesInFlight.contains(key)) {
+            return false;
+          }
+          state->tilesInFlight.insert(key);
+          return true;
+        },
+        [state, index, full](const QRect &rect, const QString &key) -> std::function<void()> {
+          return [state, index, full, rect, key]() { decodeTile(state, index, full, rect, key); };
+        },
+        [state](const QString &key) {
+          QMutexLocker locker(&state->mutex);
+          state->tilesInFlight.remove(key);
+        });
+  }
 
-  explicit ZipReader(const QString &path) {
-    memset(&archive, 0, sizeof(archive));
-    ok = mz_zip_reader_init_file(&archive, path.toUtf8().constData(), 0) != 0;
+  void setCurrentImage(int index) override {
+    PrefetchPlanner::Window window;
+    {
+      QMutexLocker locker(&m_state->mutex);
+      m_state->focusIndex = index;
+      m_state->prefetch.observe(index);
+      window = m_state->prefetch.window();
+    }
+    RenderScheduler::instance().setFocus(m_state.get(), index, std::max({2, window.before, window.after}),
+                                         window.direction, window.confidence);
+  }
+
+  void setImageReadyCallback(std::function<void(int)> callback) override {
+    QMutexLocker locker(&m_state->mutex);
+    m_state->onImageReady = std::move(callback);
   }
 
-  ~ZipReader() {
-    if (ok) {
-      mz_zip_reader_end(&archive);
+  ThumbnailSource thumbnailSource() const override {
+    ThumbnailSource source;
+    std::shared_ptr<ComicDecodeState> state = m_state;
+    source.atlasPath = QDir(state->assetDir).filePath("thumbnails.bin");
+    source.signature = PagePostProcess::signature(state->colors);
+    source.pageCount = state->images.size();
+    source.render = [state](int index, int height) -> QImage {
+      {
+        QMutexLocker locker(&state->mutex);
+        if (!state->alive) {
+          return {};
+        }
+      }
+      return PagePostProcess::apply(decodeComicPage(*state, index, QSize(0, height)), state->colors);
+    };
+    return source;
+  }
+
+private:
+  // Decodes `rect` of the page scaled to `full` pixels, without the rest of it.
+  static void decodeTile(const std::shared_ptr<ComicDecodeState> &state,
+                         int index,
+                         const QSize &full,
+                         const QRect &rect,
+                         const QString &key) {
+    {
+      QMutexLocker locker(&state->mutex);
+      if (!state->alive) {
+        state->tilesInFlight.remove(key);
+        return;
+      }
+    }
+    const QImage image = PagePostProcess::apply(decodeComicPage(*state, index, full, rect), state->colors);
+    if (!image.isNull()) {
+      PageImageCache::instance().insert(key, image);
     }
+    QMutexLocker locker(&state->mutex);
+    state->tilesInFlight.remove(key);
   }
+
+  // Queues one page for decoding unless it is in flight or already decoded
+  // at the current target size.
+  bool queueDecode(int index) {
+    int focus = -1;
+    QSize target;
+    {
+      QMutexLocker locker(&m_state->mutex);
+      if (!m_state->alive) {
+        return false;
+      }
+      target = m_state->targetSize;
+      if (m_state->inFlight.contains(index)) {
+        return false;
+      }
+      if (m_state->decodedTarget.contains(index) && m_state->decodedTarget.value(index) == target &&
+          PageImageCache::instance().contains(PageImageCache::key(m_state->imageId, index))) {
+        return false;
+      }
+      m_state->inFlight.insert(index);
+      focus = m_state->focusIndex;
+    }
+
+    std::shared_ptr<ComicDecodeState> state = m_state;
+    const RenderScheduler::Lane lane = index == focus ? RenderScheduler::Lane::Visible
+                                                      : RenderScheduler::Lane::Prefetch;
+    auto decode = [state, index]() {
+      QSize target;
+      {
+        QMutexLocker locker(&state->mutex);
+        if (!state->alive) {
+          state->inFlight.remove(index);
+          return;
+        }
+        target = state->targetSize;
+      }
+      QSize source;
+      const QImage image =
+          PagePostProcess::apply(decodeComicPage(*state, index, target, QRect(), &source), state->colors);
+      const bool ok = !image.isNull();
+      if (ok) {
+        PageImageCache::instance().insert(PageImageCache::key(state->imageId, index), image);
+      }
+      std::function<void(int)> callback;
+      {
+        QMutexLocker locker(&state->mutex);
+        state->inFlight.remove(index);
+        if (!state->alive) {
+          return;
+        }
+        if (ok) {
+          state->decodedTarget.insert(index, target);
+          state->sourceSize.insert(index, source);
+        }
+        callback = state->onImageReady;
+      }
+      if (ok && callback) {
+        callback(index);
+      }
+    };
+    RenderScheduler::instance().submit(state.get(), index, lane, std::move(decode), [state, index]() {
+      QMutexLocker locker(&state->mutex);
+      state->inFlight.remove(index);
+    });
+    return true;
+  }
+
+  QString m_title;
+  std::shared_ptr<ComicDecodeState> m_state;
 };
 
 bool isHiddenPath(const QString &name) {
@@ -74,16 +846,14 @@ bool isImageFile(const QString &name) {
   return ext == "jpg" || ext == "jpeg" || ext == "png" || ext == "webp" || ext == "bmp";
 }
 
+// Per-book asset directory: thumbnails, the CBR entry index, and pages of
+// CBRs extracted by a tool, reused by the next open once marked complete.
 QString tempDirFor(const QFileInfo &info) {
-  const QString key = QString("%1|%2|%3")
-                          .arg(info.absoluteFilePath())
-                          .arg(info.size())
-                          .arg(info.lastModified().toSecsSinceEpoch());
-  const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
-  return QDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation))
-      .filePath(QString("ereader_cbz_%1").arg(QString::fromUtf8(hash)));
+  return AssetCache::directoryFor("comic", info.absoluteFilePath());
 }
 
+const char kExtractedMarker[] = ".complete";
+
 void naturalSort(QStringList &paths, const std::function<QString(const QString &)> &keyFn) {
   QCollator collator;
   collator.setNumericMode(true);
@@ -99,7 +869,7 @@ void naturalSort(QStringList &paths, const std::function<QString(const QString &
   });
 }
 
-bool extractCbrWithTool(const QString &archivePath, const QString &outDir) {
+bool extractCbrWithTool(const QString &archivePath, const QString &outDir, const CancelToken &cancel) {
   // Try common tools in order: bsdtar, unrar, unar
   struct Tool {
     QString program;
@@ -112,9 +882,12 @@ bool extractCbrWithTool(const QString &archivePath, const QString &outDir) {
   };
 
   for (const auto &tool : tools) {
+    if (cancel.isCancelled()) {
+      return false;
+    }
     QProcess process;
     process.start(tool.program, tool.args);
-    if (!process.waitForFinished(30000)) {
+    if (!waitForProcess(process, 30000, cancel)) {
       continue;
     }
     if (process.exitStatus() == QProcess::NormalExit && process.exitCode() == 0) {
@@ -143,6 +916,10 @@ QString formatSettingsPath(const QString &format) {
 struct ComicSettings {
   QString sortMode = "path";
   bool sortDescending = false;
+  bool fitToView = true;
+  PagePostProcess::Options colors;
+  PrefetchPlanner prefetch;
+  bool zoomTiles = true;
 };
 
 ComicSettings loadComicSettings(const QString &format) {
@@ -153,6 +930,13 @@ ComicSettings loadComicSettings(const QString &format) {
     out.sortMode = "path";
   }
   out.sortDescending = settings.value("render/sort_desc", false).toBool();
+  out.fitToView = settings.value("render/fit_to_view", true).toBool();
+  out.zoomTiles = settings.value("render/zoom_tiles", true).toBool();
+  out.colors.tint = PagePostProcess::parseTint(settings.value("render/tint", "none").toString());
+  out.colors.gamma = std::clamp(settings.value("render/gamma", 1.0).toDouble(), 0.5, 3.0);
+  const int prefetchDistance = std::clamp(settings.value("render/prefetch_distance", 1).toInt(), 0, 6);
+  out.prefetch.configure(settings.value("render/prefetch_strategy", "adaptive").toString(), prefetchDistance,
+                         std::clamp(settings.value("render/prefetch_max", 6).toInt(), prefetchDistance, 12));
   return out;
 }
 
@@ -178,124 +962,133 @@ QStringList sortImages(QStringList images, const ComicSettings &settings, bool s
   return images;
 }
 
-#ifdef HAVE_LIBARCHIVE
-bool extractWithLibarchive(const QString &archivePath, const QString &outDir) {
-  struct archive *ar = archive_read_new();
-  archive_read_support_format_all(ar);
-  archive_read_support_filter_all(ar);
-
-  if (archive_read_open_filename(ar, archivePath.toUtf8().constData(), 10240) != ARCHIVE_OK) {
-    archive_read_free(ar);
-    return false;
-  }
-
-  struct archive_entry *entry = nullptr;
-  while (archive_read_next_header(ar, &entry) == ARCHIVE_OK) {
-    const char *path = archive_entry_pathname(entry);
-    if (!path) {
-      archive_read_data_skip(ar);
+// Page paths name the archive's entries under the asset dir; nothing is
+// written there.
+std::unique_ptr<FormatDocument> openInPlace(const QString &path,
+                                            std::shared_ptr<const ComicArchive> archive,
+                                            const QString &outDir,
+                                            const ComicSettings &settings,
+                                            QString *error) {
+  QHash<QString, int> entryOf;
+  QStringList images;
+  const QStringList &names = archive->names();
+  for (int i = 0; i < names.size(); ++i) {
+    if (!isImageFile(names.at(i))) {
       continue;
     }
-    const QString name = QString::fromUtf8(path);
-    if (!isImageFile(name)) {
-      archive_read_data_skip(ar);
-      continue;
+    const QString pagePath = QDir(outDir).filePath(names.at(i));
+    if (!entryOf.contains(pagePath)) {
+      entryOf.insert(pagePath, i);
+      images.append(pagePath);
     }
-    const QString outPath = QDir(outDir).filePath(name);
-    QDir().mkpath(QFileInfo(outPath).absolutePath());
-    archive_entry_set_pathname(entry, outPath.toUtf8().constData());
-    archive_read_extract(ar, entry, ARCHIVE_EXTRACT_TIME);
   }
 
-  archive_read_close(ar);
-  archive_read_free(ar);
-  return true;
+  images = sortImages(std::move(images), settings, true);
+  if (images.isEmpty()) {
+    if (error) {
+      *error = "No images found in archive";
+    }
+    return nullptr;
+  }
+  QVector<int> entries;
+  entries.reserve(images.size());
+  for (const QString &image : std::as_const(images)) {
+    entries.append(entryOf.value(image));
+  }
+
+  const QString title = QFileInfo(path).completeBaseName();
+  return std::make_unique<CbzDocument>(title, images, outDir, std::move(archive), std::move(entries),
+                                       settings.fitToView, settings.colors, settings.prefetch,
+                                       settings.zoomTiles);
+}
+
+bool hasZipSignature(const QString &path) {
+  QFile file(path);
+  return file.open(QIODevice::ReadOnly) && file.read(4) == QByteArray("PK\x03\x04", 4);
 }
-#endif
 } // namespace
 
 QString CbzProvider::name() const { return "CBZ"; }
 
 QStringList CbzProvider::supportedExtensions() const { return {"cbz", "cbr"}; }
 
-std::unique_ptr<FormatDocument> CbzProvider::open(const QString &path, QString *error) {
+std::unique_ptr<FormatDocument> CbzProvider::open(const QString &path,
+                                                  QString *error,
+                                                  const OpenOptions &options) {
+  const CancelToken &cancel = options.cancel;
   const QFileInfo info(path);
-  const QString ext = info.suffix().toLower();
+  const QString ext = openFormatKey(path, options);
   const ComicSettings settings = loadComicSettings(ext);
-  if (ext == "cbr") {
-    const QString outDir = tempDirFor(info);
-    QDir().mkpath(outDir);
-    bool extracted = false;
-#ifdef HAVE_LIBARCHIVE
-    extracted = extractWithLibarchive(path, outDir);
-    if (extracted) {
-      qInfo() << "CbzProvider: extracted CBR via libarchive";
-    }
-#endif
-    if (!extracted) {
-      extracted = extractCbrWithTool(path, outDir);
-      if (extracted) {
-        qInfo() << "CbzProvider: extracted CBR via external tool";
-      }
-    }
-    if (!extracted) {
+  const QString outDir = tempDirFor(info);
+
+  // Pages stay in the archive and are decoded from it on demand. Comics are
+  // often misnamed, so the contents pick the reader, not the extension.
+  if (hasZipSignature(path)) {
+    std::shared_ptr<ZipComicArchive> archive = ZipComicArchive::open(path);
+    if (!archive) {
       if (error) {
-        *error = "CBR extraction failed (install libarchive/bsdtar/unrar/unar)";
+        *error = "Failed to open CBZ";
       }
-      qWarning() << "CbzProvider: CBR extraction failed";
       return nullptr;
     }
-    QStringList images = collectImagesRecursive(outDir);
-    images = sortImages(std::move(images), settings, false);
-    if (images.isEmpty()) {
-      if (error) {
-        *error = "No images found in CBR";
-      }
+    if (openCancelled(cancel, error)) {
       return nullptr;
     }
-    const QString title = info.completeBaseName();
-    return std::make_unique<CbzDocument>(title, images);
+    return openInPlace(path, std::move(archive), outDir, settings, error);
   }
 
-  ZipReader zip(path);
-  if (!zip.ok) {
+#ifdef HAVE_LIBARCHIVE
+  if (std::shared_ptr<RarComicArchive> archive =
+          RarComicArchive::open(path, QDir(outDir).filePath("entries.bin"), cancel)) {
+    return openInPlace(path, std::move(archive), outDir, settings, error);
+  }
+#endif
+  if (openCancelled(cancel, error)) {
+    return nullptr;
+  }
+  if (ext != "cbr") {
     if (error) {
       *error = "Failed to open CBZ";
     }
     return nullptr;
   }
 
-  const QString outDir = tempDirFor(info);
+  // Without libarchive (or for archives it cannot read) an external tool
+  // extracts the pages once.
   QDir().mkpath(outDir);
-
-  const int count = mz_zip_reader_get_num_files(&zip.archive);
-  QStringList extracted;
-  extracted.reserve(count);
-  for (int i = 0; i < count; ++i) {
-    mz_zip_archive_file_stat stat{};
-    if (!mz_zip_reader_file_stat(&zip.archive, i, &stat)) {
-      continue;
-    }
-    const QString name = QString::fromUtf8(stat.m_filename);
-    if (!isImageFile(name)) {
-      continue;
+  const QString marker = QDir(outDir).filePath(kExtractedMarker);
+  bool extracted = QFileInfo::exists(marker);
+  if (extracted) {
+    qInfo() << "CbzProvider: reusing extracted CBR";
+  } else {
+    extracted = extractCbrWithTool(path, outDir, cancel);
+    if (extracted) {
+      qInfo() << "CbzProvider: extracted CBR via external tool";
     }
-    const QString outPath = QDir(outDir).filePath(name);
-    QDir().mkpath(QFileInfo(outPath).absolutePath());
-    if (!mz_zip_reader_extract_to_file(&zip.archive, i, outPath.toUtf8().constData(), 0)) {
-      continue;
+  }
+  if (openCancelled(cancel, error)) {
+    return nullptr;
+  }
+  if (!extracted) {
+    if (error) {
+      *error = "CBR extraction failed (install libarchive/bsdtar/unrar/unar)";
     }
-    extracted.append(outPath);
+    qWarning() << "CbzProvider: CBR extraction failed";
+    return nullptr;
   }
-
-  extracted = sortImages(std::move(extracted), settings, true);
-  if (extracted.isEmpty()) {
+  QFile markerFile(marker);
+  if (markerFile.open(QIODevice::WriteOnly)) {
+    markerFile.close();
+  }
+  QStringList images = collectImagesRecursive(outDir);
+  images = sortImages(std::move(images), settings, false);
+  if (images.isEmpty()) {
     if (error) {
-      *error = "No images found in CBZ";
+      *error = "No images found in CBR";
     }
     return nullptr;
   }
-
-  const QString title = QFileInfo(path).completeBaseName();
-  return std::make_unique<CbzDocument>(title, extracted);
+  const QString title = info.completeBaseName();
+  return std::make_unique<CbzDocument>(title, images, outDir, nullptr, QVector<int>(), settings.fitToView,
+                                       settings.colors, settings.prefetch, settings.zoomTiles);
 }
@@ -1,10 +1,18 @@
 #include "DjvuProvider.h"
 #include "../core/include/AppPaths.h"
+#include "include/PageImageCache.h"
+#include "RenderScheduler.h"
+#include "include/AssetCache.h"
+#include "PagePostProcess.h"
+#include "PrefetchPlanner.h"
+#include "PageTextIndex.h"
+#include "TilePlanner.h"
+#include "CancelUtil.h"
 
-#include <QCryptographicHash>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
+#include <QHash>
 #include <QImage>
 #include <QList>
 #include <QMutex>
@@ -13,84 +21,163 @@
 #include <QSet>
 #include <QSettings>
 #include <QStandardPaths>
-#include <QThreadPool>
 #include <QDebug>
-#include <QRunnable>
+#include <QThreadPool>
 #include <QTransform>
 #include <algorithm>
 #include <functional>
 #include <memory>
+#include <vector>
+
+#ifdef HAVE_DDJVUAPI
+#include <libdjvu/ddjvuapi.h>
+#include <libdjvu/miniexp.h>
+#endif
 
 namespace {
 QString formatSettingsPath() {
   return AppPaths::configFile("djvu.ini");
 }
 
-QString repoRoot() {
-  QDir dir(QCoreApplication::applicationDirPath());
-  for (int i = 0; i < 6; ++i) {
-    if (QFileInfo::exists(dir.filePath("README.md"))) {
-      return dir.absolutePath();
-    }
-    if (!dir.cdUp()) {
-      break;
-    }
-  }
-  return QCoreApplication::applicationDirPath();
-}
-
 int clampInt(int value, int minValue, int maxValue) {
   return std::max(minValue, std::min(maxValue, value));
 }
 
 struct DjvuSettings {
   int dpi = 120;
-  int cacheLimit = 30;
   int prefetchDistance = 1;
-  QString cachePolicy = "fifo";
-  QString format = "ppm";
+  int prefetchMax = 6;
+  QString prefetchStrategy = "adaptive";
   bool extractText = true;
   int rotation = 0;
+  bool fitToView = true;
+  PagePostProcess::Tint tint = PagePostProcess::Tint::None;
+  double gamma = 1.0;
 };
 
 DjvuSettings loadDjvuSettings() {
   QSettings settings(formatSettingsPath(), QSettings::IniFormat);
   DjvuSettings out;
   out.dpi = clampInt(settings.value("render/dpi", 120).toInt(), 72, 240);
-  out.cacheLimit = clampInt(settings.value("render/cache_limit", 30).toInt(), 5, 120);
   out.prefetchDistance = clampInt(settings.value("render/prefetch_distance", 1).toInt(), 0, 6);
-  out.cachePolicy = settings.value("render/cache_policy", "fifo").toString().toLower();
-  if (out.cachePolicy != "fifo" && out.cachePolicy != "lru") {
-    out.cachePolicy = "fifo";
-  }
-  out.format = settings.value("render/format", "ppm").toString().toLower();
-  if (out.format != "ppm" && out.format != "tiff") {
-    out.format = "ppm";
-  }
+  out.prefetchMax = clampInt(settings.value("render/prefetch_max", 6).toInt(), out.prefetchDistance, 12);
+  out.prefetchStrategy = settings.value("render/prefetch_strategy", "adaptive").toString().toLower();
   out.extractText = settings.value("render/extract_text", true).toBool();
   out.rotation = clampInt(settings.value("render/rotation", 0).toInt(), 0, 270);
   if (out.rotation != 0 && out.rotation != 90 && out.rotation != 180 && out.rotation != 270) {
     out.rotation = 0;
   }
+  out.fitToView = settings.value("render/fit_to_view", true).toBool();
+  out.tint = PagePostProcess::parseTint(settings.value("render/tint", "none").toString());
+  out.gamma = std::clamp(settings.value("render/gamma", 1.0).toDouble(), 0.5, 3.0);
   return out;
 }
 
 QString tempDirFor(const QFileInfo &info) {
-  const QString key = QString("%1|%2|%3")
-                          .arg(info.absoluteFilePath())
-                          .arg(info.size())
-                          .arg(info.lastModified().toSecsSinceEpoch());
-  const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
-  return QDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation))
-      .filePath(QString("ereader_djvu_%1").arg(QString::fromUtf8(hash)));
+  return AssetCache::directoryFor("djvu", info.absoluteFilePath());
 }
 
-QString formatExtension(const QString &format) {
-  const QString normalized = format.trimmed().toLower();
-  if (normalized == "tiff") {
-    return "tiff";
+// Hidden-text zone as ddjvuapi returns it and djvused prints it:
+// (kind x0 y0 x1 y1 children-or-text...), in page pixels with y growing up.
+struct TextZone {
+  QByteArray kind;
+  int x0 = 0;
+  int y0 = 0;
+  int x1 = 0;
+  int y1 = 0;
+  QString text;
+  QVector<TextZone> children;
+};
+
+constexpr qreal kBoxUnit = 65535.0;
+
+using WordBox = PageTextIndex::WordBox;
+
+quint16 toBoxUnit(qreal value) {
+  return static_cast<quint16>(qRound(std::clamp(value, 0.0, 1.0) * kBoxUnit));
+}
+
+// Words are joined by spaces; every line, paragraph or region ends a line.
+void flattenZone(const TextZone &zone, const TextZone &page, PageTextIndex::Page &out, int &line) {
+  if (zone.children.isEmpty()) {
+    const QString word = zone.text.simplified();
+    if (word.isEmpty()) {
+      return;
+    }
+    if (!out.text.isEmpty() && !out.text.endsWith('\n')) {
+      out.text += ' ';
+    }
+    const qreal width = page.x1 - page.x0;
+    const qreal height = page.y1 - page.y0;
+    if (&zone != &page && width > 0 && height > 0) {
+      WordBox box;
+      box.start = out.text.size();
+      box.length = static_cast<quint16>(std::min<qsizetype>(word.size(), 0xffff));
+      box.line = static_cast<quint16>(std::min(line, 0xffff));
+      box.left = toBoxUnit((zone.x0 - page.x0) / width);
+      box.top = toBoxUnit((page.y1 - zone.y1) / height);
+      box.right = toBoxUnit((zone.x1 - page.x0) / width);
+      box.bottom = toBoxUnit((page.y1 - zone.y0) / height);
+      out.words.append(box);
+    }
+    out.text += word;
+    return;
+  }
+  for (const TextZone &child : zone.children) {
+    flattenZone(child, page, out, line);
+  }
+  if (zone.kind != "word" && !out.text.isEmpty() && !out.text.endsWith('\n')) {
+    out.text += '\n';
+    ++line;
   }
-  return "ppm";
+}
+
+PageTextIndex::Page flattenPage(const TextZone &page) {
+  PageTextIndex::Page out;
+  if (page.children.isEmpty()) {
+    // Page-level text only: no positions to keep.
+    out.text = page.text.trimmed();
+    return out;
+  }
+  int line = 0;
+  flattenZone(page, page, out, line);
+  while (out.text.endsWith('\n')) {
+    out.text.chop(1);
+  }
+  return out;
+}
+
+// The index keeps boxes of the unrotated page; render/rotation turns the
+// page image clockwise, so the boxes follow it here.
+QRectF displayedRect(const WordBox &word, int rotation) {
+  const qreal left = word.left / kBoxUnit;
+  const qreal top = word.top / kBoxUnit;
+  const qreal right = word.right / kBoxUnit;
+  const qreal bottom = word.bottom / kBoxUnit;
+  switch (rotation) {
+  case 90:
+    return QRectF(QPointF(1.0 - bottom, left), QPointF(1.0 - top, right));
+  case 180:
+    return QRectF(QPointF(1.0 - right, 1.0 - bottom), QPointF(1.0 - left, 1.0 - top));
+  case 270:
+    return QRectF(QPointF(top, 1.0 - right), QPointF(bottom, 1.0 - left));
+  default:
+    return QRectF(QPointF(left, top), QPointF(right, bottom));
+  }
+}
+
+#ifndef HAVE_DDJVUAPI
+QString repoRoot() {
+  QDir dir(QCoreApplication::applicationDirPath());
+  for (int i = 0; i < 6; ++i) {
+    if (QFileInfo::exists(dir.filePath("README.md"))) {
+      return dir.absolutePath();
+    }
+    if (!dir.cdUp()) {
+      break;
+    }
+  }
+  return QCoreApplication::applicationDirPath();
 }
 
 QString findTool(const QString &name) {
@@ -156,14 +243,13 @@ int parseFirstInt(const QString &text) {
   return ok ? value : 0;
 }
 
-int djvuPageCount(const QString &djvusedPath, const QString &path) {
+int djvuPageCount(const QString &djvusedPath, const QString &path, const CancelToken &cancel) {
   if (djvusedPath.isEmpty()) {
     return 0;
   }
   QProcess proc;
   proc.start(djvusedPath, {"-e", "n", path});
-  if (!proc.waitForFinished(10000)) {
-    proc.kill();
+  if (!waitForProcess(proc, 10000, cancel)) {
     return 0;
   }
   if (proc.exitStatus() != QProcess::NormalExit || proc.exitCode() != 0) {
@@ -173,187 +259,551 @@ int djvuPageCount(const QString &djvusedPath, const QString &path) {
   return parseFirstInt(out);
 }
 
-QString djvuText(const QString &djvutxtPath, const QString &path) {
-  if (djvutxtPath.isEmpty()) {
-    return {};
+// Reads djvused's S-expressions; strings may carry octal escapes.
+class SexpReader {
+public:
+  explicit SexpReader(const QByteArray &data) : m_data(data) {}
+
+  bool readZone(TextZone *out) {
+    skipSpace();
+    if (!take('(')) {
+      return false;
+    }
+    out->kind = readAtom();
+    int *coords[] = {&out->x0, &out->y0, &out->x1, &out->y1};
+    for (int *coord : coords) {
+      bool ok = false;
+      *coord = readAtom().toInt(&ok);
+      if (!ok) {
+        return false;
+      }
+    }
+    for (;;) {
+      skipSpace();
+      if (m_pos >= m_data.size()) {
+        return false;
+      }
+      if (take(')')) {
+        return true;
+      }
+      if (m_data.at(m_pos) == '"') {
+        out->text += QString::fromUtf8(readString());
+      } else if (m_data.at(m_pos) == '(') {
+        TextZone child;
+        if (!readZone(&child)) {
+          return false;
+        }
+        out->children.append(std::move(child));
+      } else {
+        readAtom();
+      }
+    }
   }
+
+private:
+  void skipSpace() {
+    while (m_pos < m_data.size() && QChar::isSpace(static_cast<uchar>(m_data.at(m_pos)))) {
+      ++m_pos;
+    }
+  }
+
+  bool take(char c) {
+    if (m_pos < m_data.size() && m_data.at(m_pos) == c) {
+      ++m_pos;
+      return true;
+    }
+    return false;
+  }
+
+  QByteArray readAtom() {
+    skipSpace();
+    const int start = m_pos;
+    while (m_pos < m_data.size() && m_data.at(m_pos) != '(' && m_data.at(m_pos) != ')' &&
+           m_data.at(m_pos) != '"' && !QChar::isSpace(static_cast<uchar>(m_data.at(m_pos)))) {
+      ++m_pos;
+    }
+    return m_data.mid(start, m_pos - start);
+  }
+
+  QByteArray readString() {
+    QByteArray out;
+    ++m_pos;
+    while (m_pos < m_data.size()) {
+      const char c = m_data.at(m_pos++);
+      if (c == '"') {
+        break;
+      }
+      if (c != '\\' || m_pos >= m_data.size()) {
+        out.append(c);
+        continue;
+      }
+      const char escaped = m_data.at(m_pos++);
+      if (escaped >= '0' && escaped <= '7') {
+        int value = escaped - '0';
+        for (int i = 0; i < 2 && m_pos < m_data.size() && m_data.at(m_pos) >= '0' && m_data.at(m_pos) <= '7';
+             ++i) {
+          value = value * 8 + (m_data.at(m_pos++) - '0');
+        }
+        out.append(static_cast<char>(value));
+      } else if (escaped == 'n') {
+        out.append('\n');
+      } else if (escaped == 't') {
+        out.append('\t');
+      } else if (escaped == 'r') {
+        out.append('\r');
+      } else {
+        out.append(escaped);
+      }
+    }
+    return out;
+  }
+
+  const QByteArray &m_data;
+  int m_pos = 0;
+};
+
+bool djvusedTextZone(const QString &djvusedPath,
+                     const QString &path,
+                     int index,
+                     TextZone *out,
+                     const CancelToken &cancel) {
   QProcess proc;
-  proc.start(djvutxtPath, {path});
-  if (!proc.waitForFinished(15000)) {
-    proc.kill();
-    return {};
+  proc.start(djvusedPath, {"-u", "-e", QString("select %1; print-txt").arg(index + 1), path});
+  if (!waitForProcess(proc, 15000, cancel)) {
+    return false;
   }
   if (proc.exitStatus() != QProcess::NormalExit || proc.exitCode() != 0) {
-    return {};
+    return false;
   }
-  return QString::fromUtf8(proc.readAllStandardOutput());
+  // Pages without a text layer print nothing.
+  const QByteArray output = proc.readAllStandardOutput();
+  return SexpReader(output).readZone(out);
 }
+#endif
 
-class DjvuRunnable final : public QRunnable {
+#ifdef HAVE_DDJVUAPI
+// One ddjvu context with the book open in it. Decoding progress arrives on
+// the context's message queue, so a handle is only used by one thread at a
+// time; concurrent renders each lease their own (DjvuLease).
+class DjvuHandle {
 public:
-  explicit DjvuRunnable(std::function<void()> task) : m_task(std::move(task)) {}
-  void run() override {
-    if (m_task) {
-      m_task();
+  static std::unique_ptr<DjvuHandle> open(const QString &path, const CancelToken *cancel = nullptr) {
+    std::unique_ptr<DjvuHandle> handle(new DjvuHandle());
+    handle->m_context = ddjvu_context_create("ereader");
+    if (!handle->m_context) {
+      return nullptr;
+    }
+    handle->m_document =
+        ddjvu_document_create_by_filename_utf8(handle->m_context, path.toUtf8().constData(), 1);
+    if (!handle->m_document) {
+      return nullptr;
+    }
+    ddjvu_document_t *document = handle->m_document;
+    handle->pump([document]() { return ddjvu_document_decoding_done(document); }, cancel);
+    if (!ddjvu_document_decoding_done(document) || ddjvu_document_decoding_error(document)) {
+      return nullptr;
+    }
+    return handle;
+  }
+
+  ~DjvuHandle() {
+    if (m_document) {
+      ddjvu_document_release(m_document);
+    }
+    if (m_context) {
+      ddjvu_context_release(m_context);
     }
   }
 
+  DjvuHandle(const DjvuHandle &) = delete;
+  DjvuHandle &operator=(const DjvuHandle &) = delete;
+
+  int pageCount() const { return ddjvu_document_get_pagenum(m_document); }
+
+  // Renders page `index` rotated clockwise by `rotation` degrees and scaled to
+  // fit `target` (0 on an unconstrained side), or at `dpi` without a target.
+  QImage render(int index, const QSize &target, int dpi, int rotation) {
+    ddjvu_page_t *page = ddjvu_page_create_by_pageno(m_document, index);
+    if (!page) {
+      return {};
+    }
+    pump([page]() { return ddjvu_page_decoding_done(page); });
+    QImage image;
+    if (!ddjvu_page_decoding_error(page)) {
+      image = renderDecoded(page, target, dpi, rotation);
+    } else {
+      qWarning() << "DjvuProvider: could not decode page" << (index + 1);
+    }
+    ddjvu_page_release(page);
+    return image;
+  }
+
+  // Hidden text of page `index` down to words; false when it has none.
+  bool textZone(int index, TextZone *out, const CancelToken &cancel) {
+    miniexp_t expr = miniexp_dummy;
+    while ((expr = ddjvu_document_get_pagetext(m_document, index, "word")) == miniexp_dummy) {
+      if (cancel.isCancelled()) {
+        return false;
+      }
+      ddjvu_message_wait(m_context);
+      drainMessages();
+    }
+    const bool ok = miniexp_consp(expr);
+    if (ok) {
+      *out = zoneFrom(expr);
+    }
+    ddjvu_miniexp_release(m_document, expr);
+    return ok;
+  }
+
 private:
-  std::function<void()> m_task;
-};
+  DjvuHandle() = default;
 
-void runDjvuTask(std::function<void()> task) {
-  auto *runnable = new DjvuRunnable(std::move(task));
-  runnable->setAutoDelete(true);
-  QThreadPool::globalInstance()->start(runnable);
-}
+  void drainMessages() {
+    while (const ddjvu_message_t *message = ddjvu_message_peek(m_context)) {
+      if (message->m_any.tag == DDJVU_ERROR) {
+        qWarning() << "DjvuProvider:" << message->m_error.message;
+      }
+      ddjvu_message_pop(m_context);
+    }
+  }
+
+  template <typename Done>
+  void pump(Done done, const CancelToken *cancel = nullptr) {
+    drainMessages();
+    while (!done() && !(cancel && cancel->isCancelled())) {
+      ddjvu_message_wait(m_context);
+      drainMessages();
+    }
+  }
+
+  static QImage renderDecoded(ddjvu_page_t *page, const QSize &target, int dpi, int rotation) {
+    // ddjvu counts quarter turns counter-clockwise, on top of the page's own
+    // orientation; page sizes below already include the rotation.
+    const int turns = (4 - rotation / 90) % 4;
+    ddjvu_page_set_rotation(
+        page, static_cast<ddjvu_page_rotation_t>((ddjvu_page_get_initial_rotation(page) + turns) % 4));
+    const QSize full(ddjvu_page_get_width(page), ddjvu_page_get_height(page));
+    if (full.isEmpty()) {
+      return {};
+    }
+    QSize size = full;
+    if (target.isValid()) {
+      const int boxWidth = target.width() > 0 ? target.width() : full.width() * 8;
+      const int boxHeight = target.height() > 0 ? target.height() : full.height() * 8;
+      size = full.scaled(QSize(boxWidth, boxHeight), Qt::KeepAspectRatio);
+    } else if (dpi > 0) {
+      const int resolution = ddjvu_page_get_resolution(page);
+      if (resolution > 0) {
+        size = full * (static_cast<qreal>(dpi) / resolution);
+      }
+    }
+    size = size.expandedTo(QSize(1, 1));
+
+    // 0xffRRGGBB words, i.e. QImage::Format_RGB32.
+    unsigned int masks[4] = {0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000};
+    ddjvu_format_t *format = ddjvu_format_create(DDJVU_FORMAT_RGBMASK32, 4, masks);
+    if (!format) {
+      return {};
+    }
+    ddjvu_format_set_row_order(format, 1);
+    ddjvu_format_set_y_direction(format, 1);
+    QImage image(size, QImage::Format_RGB32);
+    ddjvu_rect_t rect = {0, 0, static_cast<unsigned int>(size.width()), static_cast<unsigned int>(size.height())};
+    const bool ok = !image.isNull() &&
+                    ddjvu_page_render(page, DDJVU_RENDER_COLOR, &rect, &rect, format,
+                                      static_cast<unsigned long>(image.bytesPerLine()),
+                                      reinterpret_cast<char *>(image.bits()));
+    ddjvu_format_release(format);
+    return ok ? image : QImage();
+  }
+
+  static TextZone zoneFrom(miniexp_t expr) {
+    TextZone zone;
+    if (miniexp_symbolp(miniexp_car(expr))) {
+      zone.kind = miniexp_to_name(miniexp_car(expr));
+    }
+    miniexp_t rest = miniexp_cdr(expr);
+    int *coords[] = {&zone.x0, &zone.y0, &zone.x1, &zone.y1};
+    for (int *coord : coords) {
+      if (!miniexp_numberp(miniexp_car(rest))) {
+        return zone;
+      }
+      *coord = miniexp_to_int(miniexp_car(rest));
+      rest = miniexp_cdr(rest);
+    }
+    for (; miniexp_consp(rest); rest = miniexp_cdr(rest)) {
+      const miniexp_t item = miniexp_car(rest);
+      if (miniexp_stringp(item)) {
+        zone.text += QString::fromUtf8(miniexp_to_str(item));
+      } else if (miniexp_consp(item)) {
+        zone.children.append(zoneFrom(item));
+      }
+    }
+    return zone;
+  }
+
+  ddjvu_context_t *m_context = nullptr;
+  ddjvu_document_t *m_document = nullptr;
+};
+#endif
 
 struct DjvuRenderState {
   QString sourcePath;
   QStringList images;
   QString tempDir;
+#ifdef HAVE_DDJVUAPI
+  // Idle handles for render workers; at most one per scheduler thread.
+  std::vector<std::unique_ptr<DjvuHandle>> renderDocs;
+  int renderSlots = 2;
+#else
   QString ddjvuPath;
+  QString djvusedPath;
+#endif
   int dpi = 120;
-  int cacheLimit = 30;
-  int prefetchDistance = 1;
-  QString cachePolicy = "fifo";
-  QString format = "ppm";
+  // Pages around the focus to render; guarded by mutex.
+  PrefetchPlanner prefetch;
   int rotation = 0;
-  QSet<int> cached;
+  PagePostProcess::Options colors;
+  // Pages are decoded into PageImageCache under this id.
+  QString imageId = PageImageCache::newDocumentId("djvu");
+  // Device-pixel box pages are shown in; invalid until the view reports one.
+  bool fitToView = true;
+  QSize targetSize;
+  QHash<int, QSize> renderedTarget;
+  int focusIndex = -1;
   QSet<int> inFlight;
-  QList<int> cacheOrder;
   std::function<void(int)> onImageReady;
   QMutex mutex;
   bool alive = true;
+
+  // Null when render/extract_text is off.
+  std::shared_ptr<PageTextIndex> textIndex;
 };
 
-bool renderDjvuPage(const DjvuRenderState &state, int index) {
-  if (index < 0 || index >= state.images.size()) {
-    return false;
+#ifdef HAVE_DDJVUAPI
+// Holds one render handle exclusively; handles are opened lazily from the
+// source path and returned for reuse, like PdfProvider's Poppler documents.
+class DjvuLease {
+public:
+  explicit DjvuLease(DjvuRenderState &state) : m_state(state) {
+    QString sourcePath;
+    {
+      QMutexLocker locker(&m_state.mutex);
+      if (!m_state.alive) {
+        return;
+      }
+      if (!m_state.renderDocs.empty()) {
+        m_handle = std::move(m_state.renderDocs.back());
+        m_state.renderDocs.pop_back();
+        return;
+      }
+      sourcePath = m_state.sourcePath;
+    }
+    m_handle = DjvuHandle::open(sourcePath);
+    if (!m_handle) {
+      qWarning() << "DjvuProvider: could not load render document" << sourcePath;
+    }
   }
-  const QString outPath = state.images.at(index);
-  if (QFileInfo::exists(outPath)) {
-    return true;
+
+  ~DjvuLease() {
+    if (!m_handle) {
+      return;
+    }
+    QMutexLocker locker(&m_state.mutex);
+    if (m_state.alive && static_cast<int>(m_state.renderDocs.size()) < m_state.renderSlots) {
+      m_state.renderDocs.push_back(std::move(m_handle));
+    }
   }
-  QDir().mkpath(QFileInfo(outPath).absolutePath());
 
-  const QString format = state.format.trimmed().toLower();
-  QStringList args = {QString("-format=%1").arg(format.isEmpty() ? "ppm" : format),
-                      QString("-page=%1").arg(index + 1)};
-  if (state.dpi > 0) {
+  DjvuLease(const DjvuLease &) = delete;
+  DjvuLease &operator=(const DjvuLease &) = delete;
+
+  DjvuHandle *get() const { return m_handle.get(); }
+
+private:
+  DjvuRenderState &m_state;
+  std::unique_ptr<DjvuHandle> m_handle;
+};
+
+QImage renderDjvuPage(DjvuRenderState &state, int index, const QSize &target) {
+  if (index < 0 || index >= state.images.size()) {
+    return {};
+  }
+  DjvuLease lease(state);
+  if (!lease.get()) {
+    return {};
+  }
+  return PagePostProcess::apply(lease.get()->render(index, target, state.dpi, state.rotation), state.colors);
+}
+#else
+// Runs ddjvu with its PNM output on stdout and decodes it in memory.
+// With a target box the page is scaled to fit it; otherwise render/dpi applies.
+QImage runDdjvu(const DjvuRenderState &state, int index, const QSize &target, bool withScale) {
+  QStringList args = {QStringLiteral("-format=pnm"), QString("-page=%1").arg(index + 1)};
+  if (withScale && target.isValid()) {
+    QSize box = target;
+    if (state.rotation == 90 || state.rotation == 270) {
+      box.transpose();
+    }
+    // ddjvu needs both sides; an unconstrained one just must not bind.
+    const int width = box.width() > 0 ? box.width() : box.height() * 8;
+    const int height = box.height() > 0 ? box.height() : box.width() * 8;
+    args << QString("-size=%1x%2").arg(width).arg(height) << "-aspect=yes";
+  } else if (withScale && state.dpi > 0) {
     args << "-dpi" << QString::number(state.dpi);
   }
-  args << state.sourcePath << outPath;
+  args << state.sourcePath << "-";
 
   QProcess proc;
   proc.start(state.ddjvuPath, args);
   if (!proc.waitForFinished(30000)) {
     proc.kill();
-    return false;
+    return {};
   }
-  if (proc.exitStatus() == QProcess::NormalExit && proc.exitCode() == 0) {
-    if (!QFileInfo::exists(outPath)) {
-      return false;
-    }
-    if (state.rotation == 0) {
-      return true;
-    }
-    QImage image(outPath);
-    if (image.isNull()) {
-      qWarning() << "DjvuProvider: rotation load failed" << outPath;
-      return true;
-    }
-    QTransform transform;
-    transform.rotate(state.rotation);
-    QImage rotated = image.transformed(transform);
-    const QByteArray fmt = (format == "tiff") ? QByteArray("TIFF") : QByteArray("PPM");
-    if (!rotated.save(outPath, fmt.constData())) {
-      qWarning() << "DjvuProvider: rotation save failed" << outPath;
-    }
-    return true;
+  if (proc.exitStatus() != QProcess::NormalExit || proc.exitCode() != 0) {
+    qWarning() << "DjvuProvider: ddjvu failed"
+               << "page" << (index + 1)
+               << "exit" << proc.exitCode()
+               << proc.readAllStandardError();
+    return {};
   }
-  qWarning() << "DjvuProvider: ddjvu failed"
-             << "page" << (index + 1)
-             << "exit" << proc.exitCode()
-             << proc.readAllStandardError();
-
-  // Retry without dpi if the tool rejects the option.
-  QStringList fallbackArgs = {QString("-format=%1").arg(format.isEmpty() ? "ppm" : format),
-                              QString("-page=%1").arg(index + 1),
-                              state.sourcePath,
-                              outPath};
-  QProcess fallback;
-  fallback.start(state.ddjvuPath, fallbackArgs);
-  if (!fallback.waitForFinished(30000)) {
-    fallback.kill();
-    return false;
+  return QImage::fromData(proc.readAllStandardOutput());
+}
+
+QImage renderDjvuPage(const DjvuRenderState &state, int index, const QSize &target) {
+  if (index < 0 || index >= state.images.size()) {
+    return {};
   }
-  if (fallback.exitStatus() == QProcess::NormalExit && fallback.exitCode() == 0) {
-    if (!QFileInfo::exists(outPath)) {
-      return false;
-    }
-    if (state.rotation == 0) {
-      return true;
-    }
-    QImage image(outPath);
-    if (image.isNull()) {
-      qWarning() << "DjvuProvider: rotation load failed" << outPath;
-      return true;
-    }
+  QImage image = runDdjvu(state, index, target, true);
+  if (image.isNull()) {
+    // Retry without size/dpi if the tool rejects the option.
+    image = runDdjvu(state, index, target, false);
+  }
+  if (image.isNull()) {
+    return {};
+  }
+  image = PagePostProcess::apply(std::move(image), state.colors);
+  if (state.rotation != 0) {
     QTransform transform;
     transform.rotate(state.rotation);
-    QImage rotated = image.transformed(transform);
-    const QByteArray fmt = (format == "tiff") ? QByteArray("TIFF") : QByteArray("PPM");
-    if (!rotated.save(outPath, fmt.constData())) {
-      qWarning() << "DjvuProvider: rotation save failed" << outPath;
-    }
-    return true;
+    image = image.transformed(transform);
   }
-  qWarning() << "DjvuProvider: ddjvu fallback failed"
-             << "page" << (index + 1)
-             << "exit" << fallback.exitCode()
-             << fallback.readAllStandardError();
-  return false;
+  return image;
 }
+#endif
 
-void touchCache(DjvuRenderState &state, int index) {
-  if (state.cached.contains(index)) {
-    if (state.cachePolicy == "lru") {
-      state.cacheOrder.removeAll(index);
-      state.cacheOrder.append(index);
-    }
-    return;
+constexpr quint32 kTextIndexMagic = 0x44545849; // "DTXI"
+
+PageTextIndex::Page extractPageText(DjvuRenderState &state, int index, const CancelToken &cancel) {
+  TextZone page;
+#ifdef HAVE_DDJVUAPI
+  DjvuLease lease(state);
+  if (!lease.get() || !lease.get()->textZone(index, &page, cancel)) {
+    return {};
   }
-  state.cached.insert(index);
-  state.cacheOrder.append(index);
-  while (state.cacheOrder.size() > state.cacheLimit && !state.cacheOrder.isEmpty()) {
-    const int drop = state.cacheOrder.takeFirst();
-    state.cached.remove(drop);
-    if (drop >= 0 && drop < state.images.size()) {
-      QFile::remove(state.images.at(drop));
-    }
+#else
+  if (!djvusedTextZone(state.djvusedPath, state.sourcePath, index, &page, cancel)) {
+    return {};
   }
+#endif
+  return flattenPage(page);
+}
+
+std::shared_ptr<PageTextIndex> makeTextIndex(const std::shared_ptr<DjvuRenderState> &state) {
+  auto index = std::make_shared<PageTextIndex>(
+      kTextIndexMagic, QDir(state->tempDir).filePath("text_index.bin"), state->sourcePath,
+      state->images.size(),
+      [weak = std::weak_ptr<DjvuRenderState>(state)](int page, const CancelToken &cancel) {
+        const std::shared_ptr<DjvuRenderState> state = weak.lock();
+        return state ? extractPageText(*state, page, cancel) : PageTextIndex::Page{};
+      });
+  index->load();
+  return index;
 }
 
 class DjvuDocument final : public FormatDocument {
 public:
-  DjvuDocument(QString title, QString text, std::shared_ptr<DjvuRenderState> state)
-      : m_title(std::move(title)), m_text(std::move(text)), m_state(std::move(state)) {}
+  DjvuDocument(QString title, std::shared_ptr<DjvuRenderState> state)
+      : m_title(std::move(title)), m_state(std::move(state)) {}
 
   ~DjvuDocument() override {
     if (m_state) {
-      QMutexLocker locker(&m_state->mutex);
-      m_state->alive = false;
-      m_state->onImageReady = nullptr;
+      {
+        QMutexLocker locker(&m_state->mutex);
+        m_state->alive = false;
+        m_state->onImageReady = nullptr;
+      }
+      if (m_state->textIndex) {
+        m_state->textIndex->stop();
+      }
+      RenderScheduler::instance().cancelAll(m_state.get());
+      PageImageCache::instance().removeDocument(m_state->imageId);
     }
   }
 
   QString title() const override { return m_title; }
   QStringList chapterTitles() const override { return {}; }
-  QString readAllText() const override { return m_text; }
+  // Empty until the background text pass completes (see isLoading).
+  QString readAllText() const override {
+    if (!m_state || !m_state->textIndex) {
+      return {};
+    }
+    m_state->textIndex->start();
+    return m_state->textIndex->text();
+  }
+  QString pageText(int index) const override {
+    return m_state && m_state->textIndex ? m_state->textIndex->pageText(index) : QString();
+  }
+  bool isPageTextReady(int index) const override {
+    return !m_state || !m_state->textIndex || m_state->textIndex->isIndexed(index);
+  }
+  void requestPageText(int index, std::function<void(int)> callback) override {
+    if (m_state && m_state->textIndex) {
+      m_state->textIndex->request(index, std::move(callback));
+    } else if (callback) {
+      callback(index);
+    }
+  }
+  QVector<PageWord> pageWords(int index) const override {
+    if (!m_state || !m_state->textIndex) {
+      return {};
+    }
+    const QVector<WordBox> words = m_state->textIndex->pageWords(index);
+    QVector<PageWord> out;
+    out.reserve(words.size());
+    for (const WordBox &word : words) {
+      PageWord entry;
+      entry.start = word.start;
+      entry.length = word.length;
+      entry.line = word.line;
+      entry.rect = displayedRect(word, m_state->rotation);
+      out.append(entry);
+    }
+    return out;
+  }
+  bool isLoading() const override {
+    return m_state && m_state->textIndex && !m_state->textIndex->isComplete();
+  }
+  void setStructureChangedCallback(std::function<void()> callback) override {
+    if (!m_state || !m_state->textIndex) {
+      return;
+    }
+    const bool start = static_cast<bool>(callback);
+    m_state->textIndex->setCompletionCallback(std::move(callback));
+    if (start) {
+      m_state->textIndex->start();
+    }
+  }
   QStringList imagePaths() const override { return m_state ? m_state->images : QStringList{}; }
+  QString pageImageKey(int index) const override {
+    return m_state ? PageImageCache::key(m_state->imageId, index) : QString();
+  }
+  qint64 approximateMemoryCost() const override {
+    return m_state && m_state->textIndex ? m_state->textIndex->memoryCost() : 0;
+  }
 
-  bool ensureImage(int index) override {
+  bool ensureImage(int index, const QSize &targetSize) override {
     if (!m_state) {
       return false;
     }
@@ -361,15 +811,32 @@ public:
     if (index < 0 || index >= total) {
       return false;
     }
+    PrefetchPlanner::Window window;
+    {
+      QMutexLocker locker(&m_state->mutex);
+      const QSize target = PageImageCache::targetBucket(targetSize);
+      if (m_state->fitToView && target.isValid()) {
+        m_state->targetSize = target;
+      }
+      window = m_state->prefetch.window();
+    }
+    return TilePlanner::queueWindow(index, total, window,
+                                    [this](int page) { return queueRender(page); });
+  }
 
-    int start = std::max(0, index - m_state->prefetchDistance);
-    int end = std::min(total - 1, index + m_state->prefetchDistance);
-
-    bool queued = false;
-    for (int i = start; i <= end; ++i) {
-      queued = queueRender(i) || queued;
+  void setCurrentImage(int index) override {
+    if (!m_state) {
+      return;
+    }
+    PrefetchPlanner::Window window;
+    {
+      QMutexLocker locker(&m_state->mutex);
+      m_state->focusIndex = index;
+      m_state->prefetch.observe(index);
+      window = m_state->prefetch.window();
     }
-    return queued;
+    RenderScheduler::instance().setFocus(m_state.get(), index, std::max({2, window.before, window.after}),
+                                         window.direction, window.confidence);
   }
 
   void setImageReadyCallback(std::function<void(int)> callback) override {
@@ -380,28 +847,68 @@ public:
     m_state->onImageReady = std::move(callback);
   }
 
+  ThumbnailSource thumbnailSource() const override {
+    ThumbnailSource source;
+    if (!m_state) {
+      return source;
+    }
+    std::shared_ptr<DjvuRenderState> state = m_state;
+    source.atlasPath = QDir(state->tempDir).filePath("thumbnails.bin");
+    source.signature = QString("%1;rotation=%2").arg(PagePostProcess::signature(state->colors)).arg(state->rotation);
+    source.pageCount = state->images.size();
+    source.render = [state](int index, int height) -> QImage {
+      {
+        QMutexLocker locker(&state->mutex);
+        if (!state->alive) {
+          return {};
+        }
+      }
+      return renderDjvuPage(*state, index, QSize(0, height));
+    };
+    return source;
+  }
+
 private:
   bool queueRender(int index) {
     if (!m_state) {
       return false;
     }
+    int focus = -1;
     {
       QMutexLocker locker(&m_state->mutex);
       if (!m_state->alive) {
         return false;
       }
-      if (m_state->cached.contains(index) || m_state->inFlight.contains(index)) {
+      if (m_state->inFlight.contains(index)) {
+        return false;
+      }
+      if (m_state->renderedTarget.contains(index) &&
+          m_state->renderedTarget.value(index) == m_state->targetSize &&
+          PageImageCache::instance().contains(PageImageCache::key(m_state->imageId, index))) {
         return false;
       }
       m_state->inFlight.insert(index);
+      focus = m_state->focusIndex;
     }
 
     std::shared_ptr<DjvuRenderState> state = m_state;
-    runDjvuTask([state, index]() {
-      if (!state) {
-        return;
+    const RenderScheduler::Lane lane = index == focus ? RenderScheduler::Lane::Visible
+                                                      : RenderScheduler::Lane::Prefetch;
+    auto render = [state, index]() {
+      QSize target;
+      {
+        QMutexLocker locker(&state->mutex);
+        if (!state->alive) {
+          state->inFlight.remove(index);
+          return;
+        }
+        target = state->targetSize;
+      }
+      const QImage image = renderDjvuPage(*state, index, target);
+      const bool ok = !image.isNull();
+      if (ok) {
+        PageImageCache::instance().insert(PageImageCache::key(state->imageId, index), image);
       }
-      const bool ok = renderDjvuPage(*state, index);
       std::function<void(int)> callback;
       {
         QMutexLocker locker(&state->mutex);
@@ -410,20 +917,23 @@ private:
           return;
         }
         if (ok) {
-          touchCache(*state, index);
+          state->renderedTarget.insert(index, target);
         }
         callback = state->onImageReady;
       }
       if (ok && callback) {
         callback(index);
       }
+    };
+    RenderScheduler::instance().submit(state.get(), index, lane, std::move(render), [state, index]() {
+      QMutexLocker locker(&state->mutex);
+      state->inFlight.remove(index);
     });
 
     return true;
   }
 
   QString m_title;
-  QString m_text;
   std::shared_ptr<DjvuRenderState> m_state;
 };
 } // namespace
@@ -432,7 +942,11 @@ QString DjvuProvider::name() const { return "DJVU"; }
 
 QStringList DjvuProvider::supportedExtensions() const { return {"djvu", "djv"}; }
 
-std::unique_ptr<FormatDocument> DjvuProvider::open(const QString &path, QString *error) {
+std::unique_ptr<FormatDocument> DjvuProvider::open(const QString &path,
+                                                   QString *error,
+                                                   const OpenOptions &options) {
+  const CancelToken &cancel = options.cancel;
+#ifndef HAVE_DDJVUAPI
   const QString djvusedPath = findTool("djvused");
   const QString ddjvuPath = findTool("ddjvu");
   if (djvusedPath.isEmpty() || ddjvuPath.isEmpty()) {
@@ -442,8 +956,28 @@ std::unique_ptr<FormatDocument> DjvuProvider::open(const QString &path, QString
     qWarning() << "DjvuProvider: missing djvulibre tools";
     return nullptr;
   }
+#endif
 
-  const int pages = djvuPageCount(djvusedPath, path);
+#ifdef HAVE_DDJVUAPI
+  // Opened in-process; the handle becomes the first render document.
+  std::unique_ptr<DjvuHandle> handle = DjvuHandle::open(path, &cancel);
+  if (openCancelled(cancel, error)) {
+    return nullptr;
+  }
+  if (!handle) {
+    if (error) {
+      *error = "Failed to open DjVu document";
+    }
+    qWarning() << "DjvuProvider: could not open" << path;
+    return nullptr;
+  }
+  const int pages = handle->pageCount();
+#else
+  const int pages = djvuPageCount(djvusedPath, path, cancel);
+  if (openCancelled(cancel, error)) {
+    return nullptr;
+  }
+#endif
   if (pages <= 0) {
     if (error) {
       *error = "Failed to read DjVu page count";
@@ -458,41 +992,39 @@ std::unique_ptr<FormatDocument> DjvuProvider::open(const QString &path, QString
   const QString outDir = tempDirFor(info);
   QDir().mkpath(outDir);
 
-  const QString ext = formatExtension(settings.format);
   QStringList images;
   images.reserve(pages);
   for (int i = 0; i < pages; ++i) {
     images.append(QDir(outDir).filePath(QString("page_%1.%2")
                                             .arg(i + 1, 4, 10, QChar('0'))
-                                            .arg(ext)));
+                                            .arg("ppm")));
   }
 
   auto state = std::make_shared<DjvuRenderState>();
   state->sourcePath = info.absoluteFilePath();
   state->images = images;
   state->tempDir = outDir;
+#ifdef HAVE_DDJVUAPI
+  state->renderSlots = RenderScheduler::instance().maxThreads();
+  state->renderDocs.push_back(std::move(handle));
+#else
   state->ddjvuPath = ddjvuPath;
+  state->djvusedPath = djvusedPath;
+#endif
   state->dpi = settings.dpi;
-  state->cacheLimit = settings.cacheLimit;
-  state->prefetchDistance = settings.prefetchDistance;
-  state->cachePolicy = settings.cachePolicy;
-  state->format = settings.format;
+  state->prefetch.configure(settings.prefetchStrategy, settings.prefetchDistance, settings.prefetchMax);
   state->rotation = settings.rotation;
+  state->fitToView = settings.fitToView;
+  state->colors.tint = settings.tint;
+  state->colors.gamma = settings.gamma;
 
-  QString text;
   if (settings.extractText) {
-    const QString djvutxtPath = findTool("djvutxt");
-    if (djvutxtPath.isEmpty()) {
-      qWarning() << "DjvuProvider: djvutxt not available";
-    } else {
-      text = djvuText(djvutxtPath, path);
-    }
+    state->textIndex = makeTextIndex(state);
   }
   const QString title = info.completeBaseName();
 
   qInfo() << "DjvuProvider: pages" << pages << "dpi" << settings.dpi
-          << "format" << settings.format << "prefetch" << settings.prefetchDistance
-          << "cache" << settings.cacheLimit;
+          << "prefetch" << settings.prefetchStrategy << settings.prefetchDistance;
 
-  return std::make_unique<DjvuDocument>(title, text, state);
+  return std::make_unique<DjvuDocument>(title, state);
 }
@@ -1,18 +1,25 @@
 #include "EpubProvider.h"
 #include "../core/include/AppPaths.h"
+#include "include/AssetCache.h"
+#include "CancelUtil.h"
 
 #include <QFileInfo>
+#include <QDataStream>
+#include <QDateTime>
 #include <QDebug>
 #include <QDir>
-#include <QStandardPaths>
 #include <QVector>
 #include <QUrl>
 #include <QXmlStreamReader>
-#include <QCryptographicHash>
 #include <QSettings>
 #include <QRegularExpression>
 #include <QSet>
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QSaveFile>
+#include <QThreadPool>
 #include <algorithm>
+#include <memory>
 
 #include "miniz.h"
 
@@ -73,78 +80,10 @@ QString applyEpubStyles(const QString &html, const EpubRenderSettings &settings)
   return out;
 }
 
-class EpubDocument final : public FormatDocument {
-public:
-  EpubDocument(QString title,
-               QString text,
-               QString plainText,
-               QStringList chapters,
-               QStringList sections,
-               QStringList plainSections,
-               QStringList imagePaths,
-               QString coverPath,
-               QStringList tocTitles,
-               QVector<int> tocChapterIndices,
-               QString authors,
-               QString series,
-               QString publisher,
-               QString description,
-               bool richText)
-      : m_title(std::move(title)),
-        m_text(std::move(text)),
-        m_plainText(std::move(plainText)),
-        m_chapters(std::move(chapters)),
-        m_sections(std::move(sections)),
-        m_plainSections(std::move(plainSections)),
-        m_imagePaths(std::move(imagePaths)),
-        m_coverPath(std::move(coverPath)),
-        m_tocTitles(std::move(tocTitles)),
-        m_tocChapterIndices(std::move(tocChapterIndices)),
-        m_authors(std::move(authors)),
-        m_series(std::move(series)),
-        m_publisher(std::move(publisher)),
-        m_description(std::move(description)),
-        m_isRichText(richText) {}
-
-  QString title() const override { return m_title; }
-  QStringList chapterTitles() const override { return m_chapters; }
-  QString readAllText() const override { return m_text; }
-  QString readAllPlainText() const override { return m_plainText.isEmpty() ? m_text : m_plainText; }
-  QStringList chaptersText() const override { return m_sections; }
-  QStringList chaptersPlainText() const override {
-    return m_plainSections.isEmpty() ? m_sections : m_plainSections;
-  }
-  QStringList imagePaths() const override { return m_imagePaths; }
-  QString coverPath() const override { return m_coverPath; }
-  QStringList tocTitles() const override { return m_tocTitles; }
-  QVector<int> tocChapterIndices() const override { return m_tocChapterIndices; }
-  QString authors() const override { return m_authors; }
-  QString series() const override { return m_series; }
-  QString publisher() const override { return m_publisher; }
-  QString description() const override { return m_description; }
-  bool isRichText() const override { return m_isRichText; }
-
-private:
-  QString m_title;
-  QString m_text;
-  QString m_plainText;
-  QStringList m_chapters;
-  QStringList m_sections;
-  QStringList m_plainSections;
-  QStringList m_imagePaths;
-  QString m_coverPath;
-  QStringList m_tocTitles;
-  QVector<int> m_tocChapterIndices;
-  QString m_authors;
-  QString m_series;
-  QString m_publisher;
-  QString m_description;
-  bool m_isRichText = false;
-};
-
 struct ZipReader {
   mz_zip_archive archive{};
   bool ok = false;
+  QMutex mutex;
 
   explicit ZipReader(const QString &path) {
     memset(&archive, 0, sizeof(archive));
@@ -161,6 +100,7 @@ struct ZipReader {
     if (!ok) {
       return {};
     }
+    QMutexLocker locker(&mutex);
     const QByteArray nameUtf8 = name.toUtf8();
     int fileIndex = mz_zip_reader_locate_file(&archive, nameUtf8.constData(), nullptr, 0);
     if (fileIndex < 0) {
@@ -427,7 +367,33 @@ QString escapeHtmlAttribute(const QString &text) {
   return out;
 }
 
-QString writeAssetToTemp(const QFileInfo &info, const QString &href, const QByteArray &data) {
+// The asset dir is shared by every open copy of the book and by its
+// parsed-book cache entry, so a file already there is reused, not rewritten.
+// `created` tells whether this call made the file.
+bool writeAssetFile(const QString &outPath, const QByteArray &data, bool *created) {
+  if (created) {
+    *created = false;
+  }
+  const QFileInfo existing(outPath);
+  if (existing.exists() && existing.size() == data.size()) {
+    return true;
+  }
+  QFile outFile(outPath);
+  if (!outFile.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  outFile.write(data);
+  outFile.close();
+  if (created) {
+    *created = !existing.exists();
+  }
+  return true;
+}
+
+QString writeAssetToTemp(const QFileInfo &info,
+                         const QString &href,
+                         const QByteArray &data,
+                         bool *created = nullptr) {
   if (href.isEmpty() || data.isEmpty()) {
     return {};
   }
@@ -439,13 +405,7 @@ QString writeAssetToTemp(const QFileInfo &info, const QString &href, const QByte
   const QString outDir = tempDirForEpub(info);
   const QString outPath = QDir(outDir).filePath(safePath);
   QDir().mkpath(QFileInfo(outPath).path());
-  QFile outFile(outPath);
-  if (!outFile.open(QIODevice::WriteOnly)) {
-    return {};
-  }
-  outFile.write(data);
-  outFile.close();
-  return outPath;
+  return writeAssetFile(outPath, data, created) ? outPath : QString();
 }
 
 QString extractXhtmlRichText(const QByteArray &xhtml,
@@ -861,13 +821,7 @@ bool isXhtmlType(const QString &mediaType, const QString &href) {
 }
 
 QString tempDirForEpub(const QFileInfo &info) {
-  const QString key = QString("%1|%2|%3")
-                          .arg(info.absoluteFilePath())
-                          .arg(info.size())
-                          .arg(info.lastModified().toSecsSinceEpoch());
-  const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
-  return QDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation))
-      .filePath(QString("ereader_epub_%1").arg(QString::fromUtf8(hash)));
+  return AssetCache::directoryFor("epub", info.absoluteFilePath());
 }
 
 QString extractFirstImageHref(const QByteArray &xhtml) {
@@ -922,7 +876,10 @@ bool isImageMediaType(const QString &mediaType, const QString &href) {
          lower.endsWith(".webp") || lower.endsWith(".bmp") || lower.endsWith(".gif");
 }
 
-QString writeCoverToTemp(const QFileInfo &info, const QString &href, const QByteArray &data) {
+QString writeCoverToTemp(const QFileInfo &info,
+                         const QString &href,
+                         const QByteArray &data,
+                         bool *created) {
   if (href.isEmpty() || data.isEmpty()) {
     return {};
   }
@@ -930,22 +887,405 @@ QString writeCoverToTemp(const QFileInfo &info, const QString &href, const QByte
   QDir().mkpath(outDir);
   const QString filename = QFileInfo(href).fileName();
   const QString outPath = QDir(outDir).filePath(filename.isEmpty() ? "cover.bin" : filename);
-  QFile outFile(outPath);
-  if (!outFile.open(QIODevice::WriteOnly)) {
-    return {};
+  return writeAssetFile(outPath, data, created) ? outPath : QString();
+}
+
+struct EpubSpineEntry {
+  QString itemPath;
+  QString href;
+  bool linear = true;
+};
+
+// Chapters are converted on demand from the archive. The spine is scanned for
+// readable items on a pool thread after open returns, so the chapter list and
+// the TOC mapping grow while the book is already on screen. How far the scan
+// got is saved next to the book's assets, so a reopen starts from there.
+struct EpubContent {
+  explicit EpubContent(const QString &path) : zip(path), info(path) {}
+
+  ZipReader zip;
+  QFileInfo info;
+  EpubRenderSettings settings;
+  QVector<EpubSpineEntry> spine;
+  QHash<QString, QString> navTitles;
+  QVector<TocEntry> navEntries;
+  // Set when the document is destroyed; stops the background spine scan.
+  CancelToken cancel;
+
+  mutable QMutex mutex;
+  QStringList chapterPaths;
+  QStringList chapterTitles;
+  QHash<QString, int> chapterIndexByPath;
+  bool loading = false;
+  // Spine items up to here are in chapterPaths; -1 before the first scan.
+  int scannedThrough = -1;
+  bool includeNonLinear = false;
+  int savedThrough = -1;
+  std::function<void()> onStructureChanged;
+};
+
+constexpr quint32 kSpineScanMagic = 0x45505353; // "EPSS"
+// Bump whenever scanEpubSpine changes which items count or how they are titled.
+constexpr quint32 kSpineScanVersion = 1;
+
+QString spineScanPath(const QFileInfo &info) {
+  return QDir(tempDirForEpub(info)).filePath("spine_scan.bin");
+}
+
+// Seeds the chapter list from the saved scan of this version of the book.
+bool loadEpubSpineScan(EpubContent &content) {
+  QFile file(spineScanPath(content.info));
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
   }
-  outFile.write(data);
-  outFile.close();
-  return outPath;
+  QDataStream in(&file);
+  quint32 magic = 0;
+  quint32 version = 0;
+  qint64 size = -1;
+  qint64 modified = -1;
+  qint32 spineSize = -1;
+  qint32 scannedThrough = -1;
+  bool includeNonLinear = false;
+  QStringList paths;
+  QStringList titles;
+  in >> magic >> version;
+  if (in.status() != QDataStream::Ok || magic != kSpineScanMagic || version != kSpineScanVersion) {
+    return false;
+  }
+  in >> size >> modified >> spineSize >> scannedThrough >> includeNonLinear >> paths >> titles;
+  if (in.status() != QDataStream::Ok || size != content.info.size() ||
+      modified != content.info.lastModified().toMSecsSinceEpoch() ||
+      spineSize != content.spine.size() || scannedThrough < 0 || scannedThrough > spineSize ||
+      paths.isEmpty() || paths.size() != titles.size()) {
+    return false;
+  }
+  QMutexLocker locker(&content.mutex);
+  for (int i = 0; i < paths.size(); ++i) {
+    content.chapterIndexByPath.insert(paths.at(i), i);
+  }
+  content.chapterPaths = std::move(paths);
+  content.chapterTitles = std::move(titles);
+  content.scannedThrough = scannedThrough;
+  content.savedThrough = scannedThrough;
+  content.includeNonLinear = includeNonLinear;
+  return true;
 }
+
+void saveEpubSpineScan(EpubContent &content) {
+  QByteArray data;
+  {
+    QMutexLocker locker(&content.mutex);
+    if (content.chapterPaths.isEmpty() || content.scannedThrough <= content.savedThrough) {
+      return;
+    }
+    QDataStream out(&data, QIODevice::WriteOnly);
+    out << kSpineScanMagic << kSpineScanVersion << static_cast<qint64>(content.info.size())
+        << static_cast<qint64>(content.info.lastModified().toMSecsSinceEpoch())
+        << static_cast<qint32>(content.spine.size()) << static_cast<qint32>(content.scannedThrough)
+        << content.includeNonLinear << content.chapterPaths << content.chapterTitles;
+    content.savedThrough = content.scannedThrough;
+  }
+  QSaveFile file(spineScanPath(content.info));
+  if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit()) {
+    qWarning() << "EpubProvider: could not save the spine scan of" << content.info.fileName();
+  }
+}
+
+void notifyEpubStructure(EpubContent &content) {
+  std::function<void()> callback;
+  {
+    QMutexLocker locker(&content.mutex);
+    callback = content.onStructureChanged;
+  }
+  if (callback) {
+    callback();
+  }
+}
+
+// Records the spine items from `start` on that hold readable text and returns
+// the index after the last item examined. Stops early once either the document
+// or the caller's `cancel` is cancelled.
+int scanEpubSpine(EpubContent &content,
+                  int start,
+                  bool includeNonLinear,
+                  bool stopAfterFirst,
+                  const CancelToken &cancel) {
+  QElapsedTimer sinceNotify;
+  sinceNotify.start();
+  int index = start;
+  for (; index < content.spine.size(); ++index) {
+    if (content.cancel.isCancelled() || cancel.isCancelled()) {
+      break;
+    }
+    const EpubSpineEntry &entry = content.spine.at(index);
+    if (!includeNonLinear && !entry.linear) {
+      continue;
+    }
+    const QByteArray xhtml = content.zip.readFile(entry.itemPath);
+    if (xhtml.isEmpty()) {
+      continue;
+    }
+    // Only the plain pass runs here: it decides whether the item is a real
+    // chapter and supplies its heading. Rich conversion waits for the reader.
+    QString heading;
+    const QString plainNormalized = extractXhtmlText(xhtml, &heading).simplified();
+    if (plainNormalized.isEmpty()) {
+      continue;
+    }
+    if (looksLikeBoilerplate(plainNormalized)) {
+      continue;
+    }
+    QString chapterTitle = content.navTitles.value(entry.itemPath);
+    if (chapterTitle.isEmpty()) {
+      chapterTitle = cleanHeading(heading);
+    }
+    if (chapterTitle.isEmpty()) {
+      chapterTitle = normalizeTitle(QFileInfo(entry.href).completeBaseName());
+    }
+    chapterTitle = normalizeTitle(chapterTitle);
+    bool first = false;
+    {
+      QMutexLocker locker(&content.mutex);
+      content.chapterTitles.append(chapterTitle);
+      content.chapterPaths.append(entry.itemPath);
+      content.chapterIndexByPath.insert(entry.itemPath, content.chapterPaths.size() - 1);
+      content.scannedThrough = index + 1;
+      first = content.chapterPaths.size() == 1;
+    }
+    if (stopAfterFirst) {
+      return index + 1;
+    }
+    if (first || sinceNotify.elapsed() >= 100) {
+      notifyEpubStructure(content);
+      sinceNotify.restart();
+    }
+  }
+  if (!stopAfterFirst) {
+    QMutexLocker locker(&content.mutex);
+    content.scannedThrough = std::max(content.scannedThrough, index);
+  }
+  return index;
+}
+
+void finishEpubScan(const std::shared_ptr<EpubContent> &content, int start, bool includeNonLinear) {
+  scanEpubSpine(*content, start, includeNonLinear, false, content->cancel);
+  // Also when the document closed mid-scan: the next open resumes from here.
+  saveEpubSpineScan(*content);
+  int chapters = 0;
+  {
+    QMutexLocker locker(&content->mutex);
+    content->loading = false;
+    chapters = content->chapterPaths.size();
+  }
+  if (!content->cancel.isCancelled()) {
+    qInfo() << "EpubProvider: spine scan finished, chapters" << chapters;
+  }
+  notifyEpubStructure(*content);
+}
+
+void loadEpubChapter(EpubContent &content, int index, QString *text, QString *plainText) {
+  QString itemPath;
+  {
+    QMutexLocker locker(&content.mutex);
+    if (index < 0 || index >= content.chapterPaths.size()) {
+      return;
+    }
+    itemPath = content.chapterPaths.at(index);
+  }
+  const QByteArray xhtml = content.zip.readFile(itemPath);
+  if (xhtml.isEmpty()) {
+    return;
+  }
+  QString heading;
+  const QString richText =
+      extractXhtmlRichText(xhtml, itemPath, content.zip, content.info, content.settings, &heading);
+  const QString plain = extractXhtmlText(xhtml, &heading);
+  if (text) {
+    *text = richText.isEmpty() ? plain : applyEpubStyles(richText, content.settings);
+  }
+  if (plainText) {
+    *plainText = plain;
+  }
+}
+
+class EpubDocument final : public FormatDocument {
+public:
+  EpubDocument(QString title,
+               std::shared_ptr<EpubContent> content,
+               QStringList imagePaths,
+               QString coverPath,
+               QString authors,
+               QString series,
+               QString publisher,
+               QString description,
+               bool richText)
+      : m_title(std::move(title)),
+        m_content(std::move(content)),
+        m_imagePaths(std::move(imagePaths)),
+        m_coverPath(std::move(coverPath)),
+        m_authors(std::move(authors)),
+        m_series(std::move(series)),
+        m_publisher(std::move(publisher)),
+        m_description(std::move(description)),
+        m_isRichText(richText) {}
+
+  ~EpubDocument() override {
+    m_content->cancel.cancel();
+    QMutexLocker locker(&m_content->mutex);
+    m_content->onStructureChanged = nullptr;
+  }
+
+  QString title() const override { return m_title; }
+  QStringList chapterTitles() const override {
+    QMutexLocker locker(&m_content->mutex);
+    return m_content->chapterTitles;
+  }
+  QString readAllText() const override { return joinChapters(false); }
+  QString readAllPlainText() const override { return joinChapters(true); }
+  QStringList chaptersText() const override {
+    QStringList out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      out.append(chapterText(i));
+    }
+    return out;
+  }
+  QStringList chaptersPlainText() const override {
+    QStringList out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      out.append(chapterPlainText(i));
+    }
+    return out;
+  }
+  int chapterCount() const override {
+    QMutexLocker locker(&m_content->mutex);
+    return m_content->chapterPaths.size();
+  }
+  QString chapterText(int index) const override {
+    QString text;
+    loadEpubChapter(*m_content, index, &text, nullptr);
+    return text;
+  }
+  QString chapterPlainText(int index) const override {
+    QString plain;
+    loadEpubChapter(*m_content, index, nullptr, &plain);
+    return plain;
+  }
+  void requestChapter(int index, std::function<void(int, QString, QString)> callback) override {
+    if (!callback) {
+      return;
+    }
+    std::shared_ptr<EpubContent> content = m_content;
+    QThreadPool::globalInstance()->start([content, index, callback]() {
+      QString text;
+      QString plain;
+      loadEpubChapter(*content, index, &text, &plain);
+      callback(index, text, plain);
+    });
+  }
+  QString chapterKey(int index) const override {
+    QMutexLocker locker(&m_content->mutex);
+    return m_content->chapterPaths.value(index);
+  }
+  int chapterIndexForKey(const QString &key) const override {
+    QMutexLocker locker(&m_content->mutex);
+    return m_content->chapterIndexByPath.value(key, -1);
+  }
+  bool isLoading() const override {
+    QMutexLocker locker(&m_content->mutex);
+    return m_content->loading;
+  }
+  void setStructureChangedCallback(std::function<void()> callback) override {
+    QMutexLocker locker(&m_content->mutex);
+    m_content->onStructureChanged = std::move(callback);
+  }
+  QStringList tocTitles() const override {
+    QStringList titles;
+    mapToc(&titles, nullptr);
+    return titles;
+  }
+  QVector<int> tocChapterIndices() const override {
+    QVector<int> indices;
+    mapToc(nullptr, &indices);
+    return indices;
+  }
+  QStringList imagePaths() const override { return m_imagePaths; }
+  QString coverPath() const override { return m_coverPath; }
+  QString authors() const override { return m_authors; }
+  QString series() const override { return m_series; }
+  QString publisher() const override { return m_publisher; }
+  QString description() const override { return m_description; }
+  bool isRichText() const override { return m_isRichText; }
+
+private:
+  // Only nav entries whose chapter has been scanned so far are reported.
+  void mapToc(QStringList *titles, QVector<int> *indices) const {
+    QMutexLocker locker(&m_content->mutex);
+    for (const auto &entry : m_content->navEntries) {
+      if (entry.title.isEmpty()) {
+        continue;
+      }
+      const int chapterIndex = m_content->chapterIndexByPath.value(entry.href, -1);
+      if (chapterIndex < 0) {
+        continue;
+      }
+      if (titles) {
+        titles->append(entry.title);
+      }
+      if (indices) {
+        indices->append(chapterIndex);
+      }
+    }
+  }
+
+  QString joinChapters(bool plain) const {
+    QString out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      QString text;
+      QString plainText;
+      loadEpubChapter(*m_content, i, &text, &plainText);
+      if (!out.isEmpty()) {
+        out.append("\n\n");
+      }
+      out.append(plain ? plainText : text);
+    }
+    return out;
+  }
+
+  QString m_title;
+  std::shared_ptr<EpubContent> m_content;
+  QStringList m_imagePaths;
+  QString m_coverPath;
+  QString m_authors;
+  QString m_series;
+  QString m_publisher;
+  QString m_description;
+  bool m_isRichText = false;
+};
 } // namespace
 
 QString EpubProvider::name() const { return "EPUB"; }
 
 QStringList EpubProvider::supportedExtensions() const { return {"epub"}; }
 
-std::unique_ptr<FormatDocument> EpubProvider::open(const QString &path, QString *error) {
-  ZipReader zip(path);
+std::unique_ptr<FormatDocument> EpubProvider::open(const QString &path,
+                                                   QString *error,
+                                                   const OpenOptions &options) {
+  const CancelToken &cancel = options.cancel;
+  auto content = std::make_shared<EpubContent>(path);
+  // Only files this open created; a cancel must not delete assets that other
+  // copies of the book still reference.
+  QStringList writtenFiles;
+  bool coverCreated = false;
+  const auto cancelled = [&cancel, error, &writtenFiles]() {
+    if (!openCancelled(cancel, error)) {
+      return false;
+    }
+    for (const QString &file : writtenFiles) {
+      QFile::remove(file);
+    }
+    return true;
+  };
+  ZipReader &zip = content->zip;
   if (!zip.ok) {
     if (error) {
       *error = "Failed to open EPUB (zip)";
@@ -983,7 +1323,7 @@ std::unique_ptr<FormatDocument> EpubProvider::open(const QString &path, QString
 
   const OpfData opf = parseOpf(opfXml);
   const QString baseDir = dirOf(rootfile);
-  const QFileInfo info(path);
+  const QFileInfo &info = content->info;
   const QString fallbackTitle = normalizeTitle(QFileInfo(path).completeBaseName());
   QHash<QString, QString> navTitles;
   QVector<TocEntry> navEntries;
@@ -1005,6 +1345,9 @@ std::unique_ptr<FormatDocument> EpubProvider::open(const QString &path, QString
       qInfo() << "EpubProvider: ncx" << ncxPath << "entries" << navEntries.size();
     }
   }
+  if (cancelled()) {
+    return nullptr;
+  }
 
   QString coverHref = opf.coverHref;
   QString coverMediaType;
@@ -1051,11 +1394,14 @@ std::unique_ptr<FormatDocument> EpubProvider::open(const QString &path, QString
       }
     }
     if (isImageMediaType(coverMediaType, coverHref) && !coverData.isEmpty()) {
-      coverPath = writeCoverToTemp(info, coverHref, coverData);
+      coverPath = writeCoverToTemp(info, coverHref, coverData, &coverCreated);
     }
   }
   if (coverPath.isEmpty()) {
     for (const auto &item : opf.spine) {
+      if (cancelled()) {
+        return nullptr;
+      }
       const QString href = opf.manifest.value(item.idref);
       if (href.isEmpty()) {
         continue;
@@ -1077,93 +1423,73 @@ std::unique_ptr<FormatDocument> EpubProvider::open(const QString &path, QString
       if (imageData.isEmpty()) {
         continue;
       }
-      coverPath = writeCoverToTemp(info, resolved, imageData);
+      coverPath = writeCoverToTemp(info, resolved, imageData, &coverCreated);
       if (!coverPath.isEmpty()) {
         break;
       }
     }
   }
 
-  const EpubRenderSettings renderSettings = loadEpubSettings();
-  QStringList sections;
-  QStringList plainSections;
-  QStringList chapterTitles;
-  QHash<QString, int> chapterIndexByPath;
-  auto readSpine = [&](bool includeNonLinear) {
-    for (const auto &item : opf.spine) {
-      if (!includeNonLinear && !item.linear) {
-        continue;
-      }
-      const QString href = opf.manifest.value(item.idref);
-      if (href.isEmpty()) {
-        continue;
-      }
-      const QString mediaType = opf.manifestTypes.value(item.idref);
-      if (!isXhtmlType(mediaType, href)) {
-        continue;
-      }
-      const QString itemPath = QDir::cleanPath(joinPath(baseDir, href));
-      const QByteArray xhtml = zip.readFile(itemPath);
-      if (xhtml.isEmpty()) {
-        continue;
-      }
-      QString heading;
-      QString richText = extractXhtmlRichText(xhtml, itemPath, zip, info, renderSettings, &heading);
-      const QString plainText = extractXhtmlText(xhtml, &heading);
-      if (!plainText.isEmpty() || !richText.isEmpty()) {
-        const QString plainNormalized = plainText.simplified();
-        if (plainNormalized.isEmpty()) {
-          continue;
-        }
-        if (looksLikeBoilerplate(plainNormalized)) {
-          continue;
-        }
-        QString chapterTitle = navTitles.value(itemPath);
-        if (chapterTitle.isEmpty()) {
-          chapterTitle = cleanHeading(heading);
-        }
-        if (chapterTitle.isEmpty()) {
-          chapterTitle = normalizeTitle(QFileInfo(href).completeBaseName());
-        }
-        chapterTitle = normalizeTitle(chapterTitle);
-        chapterTitles.append(chapterTitle);
-        if (!richText.isEmpty()) {
-          richText = applyEpubStyles(richText, renderSettings);
-          sections.append(richText);
-        } else {
-          sections.append(plainText);
-        }
-        plainSections.append(plainText);
-        chapterIndexByPath.insert(itemPath, sections.size() - 1);
-      }
+  if (coverCreated) {
+    writtenFiles.append(coverPath);
+  }
+  if (cancelled()) {
+    return nullptr;
+  }
+
+  content->settings = loadEpubSettings();
+  content->navTitles = navTitles;
+  content->navEntries = navEntries;
+  for (const auto &item : opf.spine) {
+    const QString href = opf.manifest.value(item.idref);
+    if (href.isEmpty()) {
+      continue;
     }
-  };
+    const QString mediaType = opf.manifestTypes.value(item.idref);
+    if (!isXhtmlType(mediaType, href)) {
+      continue;
+    }
+    content->spine.append({QDir::cleanPath(joinPath(baseDir, href)), href, item.linear});
+  }
 
-  readSpine(false);
-  if (sections.isEmpty()) {
-    readSpine(true);
+  // Find the first readable chapter now so the reader has text to show, and
+  // leave the rest of the spine to a pool thread.
+  bool includeNonLinear = false;
+  int nextSpineIndex = 0;
+  if (loadEpubSpineScan(*content)) {
+    includeNonLinear = content->includeNonLinear;
+    nextSpineIndex = content->scannedThrough;
+  } else {
+    nextSpineIndex = scanEpubSpine(*content, 0, false, true, cancel);
+    if (content->chapterPaths.isEmpty()) {
+      includeNonLinear = true;
+      nextSpineIndex = scanEpubSpine(*content, 0, true, true, cancel);
+    }
+    content->includeNonLinear = includeNonLinear;
+  }
+  if (cancelled()) {
+    return nullptr;
+  }
+  if (!content->chapterPaths.isEmpty() && nextSpineIndex < content->spine.size()) {
+    content->loading = true;
+    QThreadPool::globalInstance()->start([content, nextSpineIndex, includeNonLinear]() {
+      finishEpubScan(content, nextSpineIndex, includeNonLinear);
+    });
   }
 
   const QString title = !opf.title.isEmpty() ? normalizeTitle(opf.title) : fallbackTitle;
-  const QString fullText = sections.join("\n\n");
-  const QString fullPlainText = plainSections.join("\n\n");
   QStringList imagePaths;
-  if (fullText.isEmpty()) {
+  if (content->chapterPaths.isEmpty()) {
     QSet<QString> seen;
-    auto collectImages = [&](bool includeNonLinear) {
-      for (const auto &item : opf.spine) {
-        if (!includeNonLinear && !item.linear) {
-          continue;
-        }
-        const QString href = opf.manifest.value(item.idref);
-        if (href.isEmpty()) {
-          continue;
+    auto collectImages = [&](bool withNonLinear) {
+      for (const auto &item : content->spine) {
+        if (cancel.isCancelled()) {
+          return;
         }
-        const QString mediaType = opf.manifestTypes.value(item.idref);
-        if (!isXhtmlType(mediaType, href)) {
+        if (!withNonLinear && !item.linear) {
           continue;
         }
-        const QString itemPath = QDir::cleanPath(joinPath(baseDir, href));
+        const QString &itemPath = item.itemPath;
         const QByteArray xhtml = zip.readFile(itemPath);
         if (xhtml.isEmpty()) {
           continue;
@@ -1178,12 +1504,16 @@ std::unique_ptr<FormatDocument> EpubProvider::open(const QString &path, QString
           if (imageData.isEmpty()) {
             continue;
           }
-          const QString outPath = writeAssetToTemp(info, resolved, imageData);
+          bool created = false;
+          const QString outPath = writeAssetToTemp(info, resolved, imageData, &created);
           if (outPath.isEmpty() || seen.contains(outPath)) {
             continue;
           }
           seen.insert(outPath);
           imagePaths.append(outPath);
+          if (created) {
+            writtenFiles.append(outPath);
+          }
         }
       }
     };
@@ -1191,6 +1521,9 @@ std::unique_ptr<FormatDocument> EpubProvider::open(const QString &path, QString
     if (imagePaths.isEmpty()) {
       collectImages(true);
     }
+    if (cancelled()) {
+      return nullptr;
+    }
     if (imagePaths.isEmpty()) {
       if (error) {
         *error = "No readable text in EPUB";
@@ -1207,35 +1540,10 @@ std::unique_ptr<FormatDocument> EpubProvider::open(const QString &path, QString
   }
   authorsList.removeAll(QString());
   const QString authors = authorsList.join("; ");
-  QStringList tocTitles;
-  QVector<int> tocIndices;
-  if (!navEntries.isEmpty()) {
-    for (const auto &entry : navEntries) {
-      if (entry.title.isEmpty()) {
-        continue;
-      }
-      const int chapterIndex = chapterIndexByPath.value(entry.href, -1);
-      if (chapterIndex < 0) {
-        continue;
-      }
-      tocTitles.append(entry.title);
-      tocIndices.append(chapterIndex);
-    }
-  }
-  if (!navEntries.isEmpty()) {
-    qInfo() << "EpubProvider: toc mapped" << tocTitles.size()
-            << "chapters" << chapterTitles.size();
-  }
   return std::make_unique<EpubDocument>(title,
-                                        fullText,
-                                        fullPlainText,
-                                        chapterTitles,
-                                        sections,
-                                        plainSections,
+                                        content,
                                         imagePaths,
                                         coverPath,
-                                        tocTitles,
-                                        tocIndices,
                                         authors,
                                         normalizeTitle(opf.series),
                                         opf.publisher,
@@ -6,5 +6,7 @@ class EpubProvider : public FormatProvider {
 public:
   QString name() const override;
   QStringList supportedExtensions() const override;
-  std::unique_ptr<FormatDocument> open(const QString &path, QString *error) override;
+  std::unique_ptr<FormatDocument> open(const QString &path,
+                                       QString *error,
+                                       const OpenOptions &options) override;
 };
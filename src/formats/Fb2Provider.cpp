@@ -1,83 +1,28 @@
 #include "Fb2Provider.h"
 #include "../core/include/AppPaths.h"
+#include "include/AssetCache.h"
+#include "CancelUtil.h"
 
 #include <QByteArray>
-#include <QCryptographicHash>
+#include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QHash>
+#include <QMutex>
 #include <QRegularExpression>
 #include <QSettings>
-#include <QStandardPaths>
+#include <QStringDecoder>
 #include <QStringList>
+#include <QThreadPool>
 #include <QUrl>
 #include <QXmlStreamReader>
 #include <QVector>
 #include <algorithm>
+#include <memory>
 #include <utility>
 
 namespace {
-class Fb2Document final : public FormatDocument {
-public:
-  Fb2Document(QString title,
-              QString htmlText,
-              QString plainText,
-              QStringList chapters,
-              QStringList chapterHtml,
-              QStringList chapterPlain,
-              QStringList tocTitles,
-              QVector<int> tocChapterIndices,
-              QString authors,
-              QString series,
-              QString publisher,
-              QString description,
-              QString coverPath)
-      : m_title(std::move(title)),
-        m_htmlText(std::move(htmlText)),
-        m_plainText(std::move(plainText)),
-        m_chapters(std::move(chapters)),
-        m_chapterHtml(std::move(chapterHtml)),
-        m_chapterPlain(std::move(chapterPlain)),
-        m_tocTitles(std::move(tocTitles)),
-        m_tocChapterIndices(std::move(tocChapterIndices)),
-        m_authors(std::move(authors)),
-        m_series(std::move(series)),
-        m_publisher(std::move(publisher)),
-        m_description(std::move(description)),
-        m_coverPath(std::move(coverPath)) {}
-
-  QString title() const override { return m_title; }
-  QStringList chapterTitles() const override { return m_chapters; }
-  QString readAllText() const override { return m_htmlText; }
-  QString readAllPlainText() const override { return m_plainText; }
-  QStringList chaptersText() const override { return m_chapterHtml; }
-  QStringList chaptersPlainText() const override { return m_chapterPlain; }
-  QStringList tocTitles() const override { return m_tocTitles; }
-  QVector<int> tocChapterIndices() const override { return m_tocChapterIndices; }
-  QString authors() const override { return m_authors; }
-  QString series() const override { return m_series; }
-  QString publisher() const override { return m_publisher; }
-  QString description() const override { return m_description; }
-  QString coverPath() const override { return m_coverPath; }
-  bool isRichText() const override { return true; }
-
-private:
-  QString m_title;
-  QString m_htmlText;
-  QString m_plainText;
-  QStringList m_chapters;
-  QStringList m_chapterHtml;
-  QStringList m_chapterPlain;
-  QStringList m_tocTitles;
-  QVector<int> m_tocChapterIndices;
-  QString m_authors;
-  QString m_series;
-  QString m_publisher;
-  QString m_description;
-  QString m_coverPath;
-};
-
 struct BinaryAsset {
   QByteArray bytes;
   QString contentType;
@@ -141,13 +86,7 @@ QString joinParts(const QStringList &parts) {
 }
 
 QString tempDirFor(const QFileInfo &info) {
-  const QString key = QString("%1|%2|%3")
-                          .arg(info.absoluteFilePath())
-                          .arg(info.size())
-                          .arg(info.lastModified().toSecsSinceEpoch());
-  const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
-  return QDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation))
-      .filePath(QString("ereader_fb2_%1").arg(QString::fromUtf8(hash)));
+  return AssetCache::directoryFor("fb2", info.absoluteFilePath());
 }
 
 QString formatSettingsPath() {
@@ -275,7 +214,7 @@ QString findHrefAttribute(const QXmlStreamAttributes &attrs) {
   return attrs.value("href").toString();
 }
 
-QHash<QString, BinaryAsset> extractBinaryAssets(const QByteArray &data) {
+QHash<QString, BinaryAsset> extractBinaryAssets(const QByteArray &data, const CancelToken &cancel) {
   QHash<QString, BinaryAsset> assets;
   QXmlStreamReader xml(data);
   QString currentId;
@@ -284,6 +223,9 @@ QHash<QString, BinaryAsset> extractBinaryAssets(const QByteArray &data) {
   bool inBinary = false;
 
   while (!xml.atEnd()) {
+    if (cancel.isCancelled()) {
+      return {};
+    }
     xml.readNext();
     if (xml.isStartElement()) {
       const QString name = xml.name().toString().toLower();
@@ -378,50 +320,48 @@ QString closeInlineTag(const QString &name) {
   }
   return {};
 }
-} // namespace
-
-QString Fb2Provider::name() const { return "FB2"; }
 
-QStringList Fb2Provider::supportedExtensions() const { return {"fb2"}; }
-
-std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *error) {
-  QFile file(path);
-  if (!file.open(QIODevice::ReadOnly)) {
-    if (error) {
-      *error = "Failed to open FB2";
-    }
-    return nullptr;
-  }
-
-  const QByteArray data = file.readAll();
-  if (data.isEmpty()) {
-    if (error) {
-      *error = "FB2 file is empty";
-    }
-    return nullptr;
-  }
-
-  const QFileInfo info(path);
-  const QString outDir = tempDirFor(info);
-  QDir().mkpath(outDir);
-
-  const Fb2RenderSettings renderSettings = loadFb2Settings();
-  QHash<QString, BinaryAsset> assets = extractBinaryAssets(data);
-  const QString fallbackImageId = assets.isEmpty() ? QString() : assets.constBegin().key();
-
-  QXmlStreamReader xml(data);
+struct Fb2ParseResult {
   QString title;
   QStringList authors;
   QString series;
   QString publisher;
   QString description;
   QString coverId;
-
   QStringList chapterTitles;
   QStringList chapterHtml;
   QStringList chapterPlain;
+  QStringList chapterSources;
   QStringList tocTitles;
   QVector<int> tocIndices;
+  QXmlStreamNamespaceDeclarations rootNamespaces;
+  bool hasText = false;
+  bool hasError = false;
+};
+
+// Without collectContent only metadata, titles and the TOC are gathered; when
+// `source` is the decoded text being parsed, each top-level section's markup is
+// kept so the chapter can be converted later with collectContent set. A
+// cancelled parse stops early and reports hasError.
+Fb2ParseResult parseFb2(QXmlStreamReader &xml,
+                        bool collectContent,
+                        const QString *source,
+                        const Fb2RenderSettings &renderSettings,
+                        QHash<QString, BinaryAsset> &assets,
+                        const QString &outDir,
+                        const CancelToken &cancel = CancelToken()) {
+  Fb2ParseResult out;
+  QString &title = out.title;
+  QStringList &authors = out.authors;
+  QString &series = out.series;
+  QString &publisher = out.publisher;
+  QString &description = out.description;
+  QString &coverId = out.coverId;
+  QStringList &chapterTitles = out.chapterTitles;
+  QStringList &chapterHtml = out.chapterHtml;
+  QStringList &chapterPlain = out.chapterPlain;
+  QStringList &tocTitles = out.tocTitles;
+  QVector<int> &tocIndices = out.tocIndices;
 
   QVector<SectionContext> stack;
   QString titleBuffer;
@@ -446,6 +386,7 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
   QString authorNick;
   QString authorField;
   int sectionDepth = 0;
+  qint64 chapterStart = -1;
 
   auto flushParagraph = [&]() {
     if (!inParagraph) {
@@ -460,7 +401,7 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
     SectionContext &ctx = stack.last();
     const QString plain = currentParagraphPlain.trimmed();
     const QString html = currentParagraphHtml.trimmed();
-    if (!plain.isEmpty() || !html.isEmpty()) {
+    if (collectContent && (!plain.isEmpty() || !html.isEmpty())) {
       QString blockHtml = html.isEmpty() ? escapeHtml(plain) : html;
       if (!blockHtml.startsWith('<')) {
         blockHtml = QString("<p>%1</p>").arg(blockHtml);
@@ -480,7 +421,7 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
                                   .arg(renderSettings.imageMaxWidthPercent)
                                   .arg(renderSettings.imageSpacingEm, 0, 'f', 2);
   auto appendImage = [&](const QString &id) {
-    if (!renderSettings.showImages) {
+    if (!collectContent || !renderSettings.showImages) {
       return;
     }
     if (stack.isEmpty()) {
@@ -500,9 +441,16 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
   };
 
   while (!xml.atEnd()) {
+    if (cancel.isCancelled()) {
+      out.hasError = true;
+      break;
+    }
     xml.readNext();
     if (xml.isStartElement()) {
       const QString name = xml.name().toString().toLower();
+      if (out.rootNamespaces.isEmpty() && name == QLatin1String("fictionbook")) {
+        out.rootNamespaces = xml.namespaceDeclarations();
+      }
       if (name == QLatin1String("binary")) {
         inBinary = true;
       } else if (name == QLatin1String("title-info")) {
@@ -551,6 +499,9 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
         inBodyNotes = (bodyType == QLatin1String("notes"));
         inBody = !inBodyNotes;
       } else if (!inBinary && inBody && name == QLatin1String("section")) {
+        if (stack.isEmpty() && source) {
+          chapterStart = source->lastIndexOf(QLatin1Char('<'), xml.characterOffset() - 1);
+        }
         SectionContext ctx;
         ctx.depth = ++sectionDepth;
         ctx.topIndex = stack.isEmpty() ? chapterTitles.size() : stack.last().topIndex;
@@ -562,7 +513,8 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
         inParagraph = true;
         currentParagraphPlain.clear();
         currentParagraphHtml.clear();
-      } else if (!inBinary && inBody && name == QLatin1String("empty-line") && !stack.isEmpty()) {
+      } else if (!inBinary && inBody && collectContent && name == QLatin1String("empty-line") &&
+                 !stack.isEmpty()) {
         stack.last().htmlBlocks.append("<br/>");
         stack.last().plainBlocks.append(QString());
       } else if (!inBinary && inBody && name == QLatin1String("image")) {
@@ -607,9 +559,12 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
       if (inAnnotation) {
         appendPlain(description, text);
       }
+      if (inSectionTitle || inParagraph) {
+        out.hasText = true;
+      }
       if (inSectionTitle) {
         appendPlain(titleBuffer, text);
-      } else if (inParagraph) {
+      } else if (inParagraph && collectContent) {
         appendText(currentParagraphPlain, currentParagraphHtml, text);
       }
     } else if (xml.isEndElement()) {
@@ -647,8 +602,10 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
           if (stack.last().title.isEmpty()) {
             stack.last().title = sectionTitle;
           }
-          stack.last().htmlBlocks.append(QString("<h2>%1</h2>").arg(escapeHtml(sectionTitle)));
-          stack.last().plainBlocks.append(sectionTitle);
+          if (collectContent) {
+            stack.last().htmlBlocks.append(QString("<h2>%1</h2>").arg(escapeHtml(sectionTitle)));
+            stack.last().plainBlocks.append(sectionTitle);
+          }
         }
         titleBuffer.clear();
       } else if (isParagraphElement(name)) {
@@ -667,12 +624,18 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
             chapterTitle = QString("Section %1").arg(chapterTitles.size() + 1);
           }
           chapterTitles.append(chapterTitle);
-          if (!sectionHtml.isEmpty()) {
-            chapterHtml.append(sectionHtml);
-          } else {
-            chapterHtml.append(escapeHtml(sectionPlain));
+          if (collectContent) {
+            if (!sectionHtml.isEmpty()) {
+              chapterHtml.append(sectionHtml);
+            } else {
+              chapterHtml.append(escapeHtml(sectionPlain));
+            }
+            chapterPlain.append(sectionPlain);
+          }
+          if (source && chapterStart >= 0) {
+            out.chapterSources.append(source->mid(chapterStart, xml.characterOffset() - chapterStart));
           }
-          chapterPlain.append(sectionPlain);
+          chapterStart = -1;
         }
         if (!ctx.title.trimmed().isEmpty() && ctx.topIndex >= 0) {
           tocTitles.append(ctx.title.trimmed());
@@ -693,68 +656,314 @@ std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path, QString *
     }
   }
 
-  if (xml.hasError()) {
+  out.hasError = xml.hasError();
+  return out;
+}
+
+QString decodeFb2Source(const QByteArray &data, bool *ok) {
+  *ok = false;
+  QByteArray encoding = "UTF-8";
+  static const QRegularExpression declRe("<\\?xml[^>]*encoding\\s*=\\s*[\"']([^\"']+)[\"']");
+  const auto match = declRe.match(QString::fromLatin1(data.left(256)));
+  if (match.hasMatch()) {
+    encoding = match.captured(1).trimmed().toLatin1();
+  }
+  QStringDecoder decoder(encoding.constData());
+  if (!decoder.isValid()) {
+    return {};
+  }
+  QString text = decoder.decode(data);
+  if (decoder.hasError()) {
+    return {};
+  }
+  *ok = true;
+  return text;
+}
+
+QString fragmentWrapperOpen(const QXmlStreamNamespaceDeclarations &namespaces) {
+  QString out = "<FictionBook";
+  for (const QXmlStreamNamespaceDeclaration &ns : namespaces) {
+    if (ns.prefix().isEmpty()) {
+      out.append(QString(" xmlns=\"%1\"").arg(escapeHtml(ns.namespaceUri().toString())));
+    } else {
+      out.append(QString(" xmlns:%1=\"%2\"")
+                     .arg(ns.prefix().toString(), escapeHtml(ns.namespaceUri().toString())));
+    }
+  }
+  out.append("><body>");
+  return out;
+}
+
+// Holds either the raw markup of every top-level section (converted on demand)
+// or, when the file's encoding could not be decoded up front, the eagerly
+// converted chapters.
+struct Fb2Content {
+  QMutex mutex;
+  QStringList chapterSources;
+  QString wrapperOpen;
+  QStringList eagerHtml;
+  QStringList eagerPlain;
+  QHash<QString, BinaryAsset> assets;
+  QString outDir;
+  Fb2RenderSettings settings;
+};
+
+void loadFb2Chapter(Fb2Content &content, int index, QString *html, QString *plain) {
+  QMutexLocker locker(&content.mutex);
+  if (!content.eagerHtml.isEmpty()) {
+    if (html) {
+      *html = content.eagerHtml.value(index);
+    }
+    if (plain) {
+      *plain = content.eagerPlain.value(index);
+    }
+    return;
+  }
+  if (index < 0 || index >= content.chapterSources.size()) {
+    return;
+  }
+  const QString wrapped =
+      content.wrapperOpen + content.chapterSources.at(index) + QStringLiteral("</body></FictionBook>");
+  QXmlStreamReader xml(wrapped);
+  const Fb2ParseResult parsed =
+      parseFb2(xml, true, nullptr, content.settings, content.assets, content.outDir);
+  const QString chapterPlain = parsed.chapterPlain.value(0);
+  QString chapterHtml = parsed.chapterHtml.value(0);
+  if (chapterHtml.isEmpty()) {
+    chapterHtml = escapeHtml(chapterPlain);
+  }
+  if (html) {
+    *html = applyStyles(chapterHtml, content.settings);
+  }
+  if (plain) {
+    *plain = chapterPlain;
+  }
+}
+
+class Fb2Document final : public FormatDocument {
+public:
+  Fb2Document(QString title,
+              QStringList chapters,
+              std::shared_ptr<Fb2Content> content,
+              QStringList tocTitles,
+              QVector<int> tocChapterIndices,
+              QString authors,
+              QString series,
+              QString publisher,
+              QString description,
+              QString coverPath)
+      : m_title(std::move(title)),
+        m_chapters(std::move(chapters)),
+        m_content(std::move(content)),
+        m_tocTitles(std::move(tocTitles)),
+        m_tocChapterIndices(std::move(tocChapterIndices)),
+        m_authors(std::move(authors)),
+        m_series(std::move(series)),
+        m_publisher(std::move(publisher)),
+        m_description(std::move(description)),
+        m_coverPath(std::move(coverPath)) {}
+
+  QString title() const override { return m_title; }
+  QStringList chapterTitles() const override { return m_chapters; }
+  QString readAllText() const override { return joinChapters(false); }
+  QString readAllPlainText() const override { return joinChapters(true); }
+  QStringList chaptersText() const override {
+    QStringList out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      out.append(chapterText(i));
+    }
+    return out;
+  }
+  QStringList chaptersPlainText() const override {
+    QStringList out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      out.append(chapterPlainText(i));
+    }
+    return out;
+  }
+  int chapterCount() const override { return m_chapters.size(); }
+  QString chapterText(int index) const override {
+    QString html;
+    loadFb2Chapter(*m_content, index, &html, nullptr);
+    return html;
+  }
+  QString chapterPlainText(int index) const override {
+    QString plain;
+    loadFb2Chapter(*m_content, index, nullptr, &plain);
+    return plain;
+  }
+  void requestChapter(int index, std::function<void(int, QString, QString)> callback) override {
+    if (!callback) {
+      return;
+    }
+    std::shared_ptr<Fb2Content> content = m_content;
+    QThreadPool::globalInstance()->start([content, index, callback]() {
+      QString html;
+      QString plain;
+      loadFb2Chapter(*content, index, &html, &plain);
+      callback(index, html, plain);
+    });
+  }
+  QStringList tocTitles() const override { return m_tocTitles; }
+  QVector<int> tocChapterIndices() const override { return m_tocChapterIndices; }
+  QString authors() const override { return m_authors; }
+  QString series() const override { return m_series; }
+  QString publisher() const override { return m_publisher; }
+  QString description() const override { return m_description; }
+  QString coverPath() const override { return m_coverPath; }
+  bool isRichText() const override { return true; }
+  qint64 approximateMemoryCost() const override {
+    QMutexLocker locker(&m_content->mutex);
+    qint64 total = 0;
+    for (const QString &source : m_content->chapterSources) {
+      total += static_cast<qint64>(source.size()) * 2;
+    }
+    for (int i = 0; i < m_content->eagerHtml.size(); ++i) {
+      total += static_cast<qint64>(m_content->eagerHtml.at(i).size() +
+                                   m_content->eagerPlain.value(i).size()) * 2;
+    }
+    for (const BinaryAsset &asset : m_content->assets) {
+      total += asset.bytes.size();
+    }
+    return total;
+  }
+
+private:
+  QString joinChapters(bool plainOnly) const {
+    QStringList parts;
+    for (int i = 0; i < chapterCount(); ++i) {
+      QString html;
+      QString plain;
+      loadFb2Chapter(*m_content, i, plainOnly ? nullptr : &html, &plain);
+      parts.append(plainOnly ? plain : html);
+    }
+    return parts.join("\n\n");
+  }
+
+  QString m_title;
+  QStringList m_chapters;
+  std::shared_ptr<Fb2Content> m_content;
+  QStringList m_tocTitles;
+  QVector<int> m_tocChapterIndices;
+  QString m_authors;
+  QString m_series;
+  QString m_publisher;
+  QString m_description;
+  QString m_coverPath;
+};
+} // namespace
+
+QString Fb2Provider::name() const { return "FB2"; }
+
+QStringList Fb2Provider::supportedExtensions() const { return {"fb2"}; }
+
+std::unique_ptr<FormatDocument> Fb2Provider::open(const QString &path,
+                                                  QString *error,
+                                                  const OpenOptions &options) {
+  const CancelToken &cancel = options.cancel;
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
     if (error) {
-      *error = "Invalid FB2";
+      *error = "Failed to open FB2";
     }
     return nullptr;
   }
 
-  if (title.isEmpty()) {
-    title = info.completeBaseName();
+  const QByteArray data = file.readAll();
+  if (data.isEmpty()) {
+    if (error) {
+      *error = "FB2 file is empty";
+    }
+    return nullptr;
   }
 
-  if (chapterHtml.isEmpty() && !chapterPlain.isEmpty()) {
-    for (const QString &plain : chapterPlain) {
-      chapterHtml.append(escapeHtml(plain));
+  const QFileInfo info(path);
+  auto content = std::make_shared<Fb2Content>();
+  content->outDir = tempDirFor(info);
+  // Images are only written on demand, so a cancelled open just drops the
+  // directory if it is still empty.
+  const auto cancelled = [&cancel, error, &content]() {
+    if (!openCancelled(cancel, error)) {
+      return false;
     }
+    QDir().rmdir(content->outDir);
+    return true;
+  };
+  QDir().mkpath(content->outDir);
+  content->settings = loadFb2Settings();
+  content->assets = extractBinaryAssets(data, cancel);
+  if (cancelled()) {
+    return nullptr;
+  }
+  const QString fallbackImageId =
+      content->assets.isEmpty() ? QString() : content->assets.constBegin().key();
+
+  bool decoded = false;
+  const QString source = decodeFb2Source(data, &decoded);
+  Fb2ParseResult parsed;
+  if (decoded) {
+    QXmlStreamReader xml(source);
+    parsed = parseFb2(xml, false, &source, content->settings, content->assets, content->outDir, cancel);
+    content->chapterSources = parsed.chapterSources;
+    content->wrapperOpen = fragmentWrapperOpen(parsed.rootNamespaces);
+  } else {
+    qInfo() << "Fb2Provider: converting all sections up front (encoding not decodable)";
+    QXmlStreamReader xml(data);
+    parsed = parseFb2(xml, true, nullptr, content->settings, content->assets, content->outDir, cancel);
+    for (int i = 0; i < parsed.chapterHtml.size(); ++i) {
+      content->eagerHtml.append(applyStyles(parsed.chapterHtml.at(i), content->settings));
+    }
+    content->eagerPlain = parsed.chapterPlain;
   }
 
-  for (int i = 0; i < chapterHtml.size(); ++i) {
-    chapterHtml[i] = applyStyles(chapterHtml.at(i), renderSettings);
+  if (cancelled()) {
+    return nullptr;
+  }
+  if (parsed.hasError) {
+    if (error) {
+      *error = "Invalid FB2";
+    }
+    return nullptr;
   }
 
-  QString fullHtml;
-  QString fullPlain;
-  if (!chapterHtml.isEmpty()) {
-    fullHtml = chapterHtml.join("\n\n");
-    fullPlain = chapterPlain.join("\n\n");
+  QString title = parsed.title;
+  if (title.isEmpty()) {
+    title = info.completeBaseName();
   }
 
-  if (fullPlain.trimmed().isEmpty()) {
+  if (!parsed.hasText || parsed.chapterTitles.isEmpty()) {
     if (error) {
       *error = "No readable text in FB2";
     }
     return nullptr;
   }
 
+  QStringList tocTitles = parsed.tocTitles;
+  QVector<int> tocIndices = parsed.tocIndices;
   if (tocTitles.isEmpty()) {
-    tocTitles = chapterTitles;
+    tocTitles = parsed.chapterTitles;
     tocIndices.clear();
-    for (int i = 0; i < chapterTitles.size(); ++i) {
+    for (int i = 0; i < parsed.chapterTitles.size(); ++i) {
       tocIndices.append(i);
     }
   }
 
   QString coverPath;
-  if (!coverId.isEmpty()) {
-    coverPath = ensureImageFile(coverId, assets, outDir);
+  if (!parsed.coverId.isEmpty()) {
+    coverPath = ensureImageFile(parsed.coverId, content->assets, content->outDir);
   }
   if (coverPath.isEmpty() && !fallbackImageId.isEmpty()) {
-    coverPath = ensureImageFile(fallbackImageId, assets, outDir);
+    coverPath = ensureImageFile(fallbackImageId, content->assets, content->outDir);
   }
 
   return std::make_unique<Fb2Document>(title,
-                                       fullHtml,
-                                       fullPlain,
-                                       chapterTitles,
-                                       chapterHtml,
-                                       chapterPlain,
+                                       parsed.chapterTitles,
+                                       content,
                                        tocTitles,
                                        tocIndices,
-                                       authors.join(", "),
-                                       series,
-                                       publisher,
-                                       description,
+                                       parsed.authors.join(", "),
+                                       parsed.series,
+                                       parsed.publisher,
+                                       parsed.description,
                                        coverPath);
 }
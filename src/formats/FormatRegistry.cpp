@@ -1,5 +1,6 @@
 #include "include/FormatRegistry.h"
 
+#include <QFile>
 #include <QFileInfo>
 
 #include "TxtProvider.h"
@@ -9,37 +10,154 @@
 #include "CbzProvider.h"
 #include "MobiProvider.h"
 #include "DjvuProvider.h"
+#include "ParsedBookCache.h"
+#include "include/AssetCache.h"
 
-std::unique_ptr<FormatRegistry> FormatRegistry::createDefault() {
-  auto registry = std::make_unique<FormatRegistry>();
-  registry->registerProvider(std::make_unique<TxtProvider>());
-  registry->registerProvider(std::make_unique<EpubProvider>());
-  registry->registerProvider(std::make_unique<PdfProvider>());
-  registry->registerProvider(std::make_unique<MobiProvider>());
-  registry->registerProvider(std::make_unique<Fb2Provider>());
-  registry->registerProvider(std::make_unique<CbzProvider>());
-  registry->registerProvider(std::make_unique<DjvuProvider>());
+namespace {
+// Identifies a container from its first bytes. Returns "zip" for archives that
+// are not EPUBs and an empty string when nothing matches.
+QString sniffFormat(const QString &path) {
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return {};
+  }
+  const QByteArray head = file.read(4096);
+  if (head.startsWith("%PDF")) {
+    return "pdf";
+  }
+  if (head.startsWith("AT&TFORM")) {
+    return "djvu";
+  }
+  if (head.startsWith(QByteArray("Rar!\x1a\x07", 6))) {
+    return "cbr";
+  }
+  if (head.startsWith("PK\x03\x04")) {
+    // EPUB requires an uncompressed "mimetype" entry first in the archive.
+    if (head.size() >= 30 && head.mid(30, 8) == "mimetype") {
+      const auto le16 = [&head](int at) {
+        return static_cast<quint8>(head[at]) | (static_cast<quint8>(head[at + 1]) << 8);
+      };
+      const int dataStart = 30 + le16(26) + le16(28);
+      if (head.mid(dataStart, 20) == "application/epub+zip") {
+        return "epub";
+      }
+    }
+    return "zip";
+  }
+  const QByteArray palmType = head.mid(60, 8);
+  if (palmType == "BOOKMOBI" || palmType == "TEXtREAd") {
+    return "mobi";
+  }
+  if (head.contains("<FictionBook")) {
+    return "fb2";
+  }
+  return {};
+}
+
+bool suffixMatchesSniffed(const QString &suffix, const QString &sniffed) {
+  if (sniffed == "zip") {
+    return suffix == "cbz" || suffix == "epub";
+  }
+  if (sniffed == "mobi") {
+    return suffix == "mobi" || suffix == "azw" || suffix == "azw3" || suffix == "azw4" ||
+           suffix == "prc";
+  }
+  if (sniffed == "djvu") {
+    return suffix == "djvu" || suffix == "djv";
+  }
+  return suffix == sniffed;
+}
+} // namespace
+
+const FormatRegistry &FormatRegistry::instance() {
+  static const FormatRegistry registry;
   return registry;
 }
 
+FormatRegistry::FormatRegistry() {
+  registerProvider(std::make_unique<TxtProvider>());
+  registerProvider(std::make_unique<EpubProvider>());
+  registerProvider(std::make_unique<PdfProvider>());
+  registerProvider(std::make_unique<MobiProvider>());
+  registerProvider(std::make_unique<Fb2Provider>());
+  registerProvider(std::make_unique<CbzProvider>());
+  registerProvider(std::make_unique<DjvuProvider>());
+}
+
 void FormatRegistry::registerProvider(std::unique_ptr<FormatProvider> provider) {
   if (!provider) {
     return;
   }
+  for (const QString &extension : provider->supportedExtensions()) {
+    if (!m_byExtension.contains(extension)) {
+      m_byExtension.insert(extension, provider.get());
+    }
+  }
   m_providers.push_back(std::move(provider));
 }
 
-std::unique_ptr<FormatDocument> FormatRegistry::open(const QString &path, QString *error) const {
-  const QString extension = QFileInfo(path).suffix().toLower();
-  for (const auto &provider : m_providers) {
-    const auto supported = provider->supportedExtensions();
-    if (supported.contains(extension)) {
-      return provider->open(path, error);
+QString FormatRegistry::formatFor(const QString &path) const {
+  const QString suffix = QFileInfo(path).suffix().toLower();
+  const QString sniffed = sniffFormat(path);
+  if (sniffed.isEmpty() || suffixMatchesSniffed(suffix, sniffed)) {
+    return suffix;
+  }
+  // Plain zips without an EPUB mimetype are treated as comic archives.
+  return sniffed == "zip" ? QString("cbz") : sniffed;
+}
+
+std::unique_ptr<FormatDocument> FormatRegistry::open(const QString &path,
+                                                     QString *error,
+                                                     const OpenOptions &options) const {
+  OpenOptions resolved = options;
+  if (resolved.format.isEmpty()) {
+    resolved.format = formatFor(path);
+  }
+  FormatProvider *provider = m_byExtension.value(resolved.format, nullptr);
+  if (!provider) {
+    if (error) {
+      *error = QString("No provider for format: %1").arg(resolved.format);
+    }
+    return nullptr;
+  }
+
+  const QString format = resolved.format;
+  const bool cacheable = resolved.parsedCache != ParsedCacheMode::Off &&
+                         ParsedBookCache::handles(format);
+  if (cacheable) {
+    if (auto cached = ParsedBookCache::load(path, format)) {
+      return cached;
     }
   }
+  // Keeps the entries the provider writes to through the open; callers that
+  // keep the document hold their own lease.
+  const AssetCache::Lease assets = AssetCache::hold(path);
+  auto document = provider->open(path, error, resolved);
+  if (document && cacheable && resolved.parsedCache == ParsedCacheMode::ReadWrite) {
+    buildParsedCache(path, format);
+  }
+  return document;
+}
 
-  if (error) {
-    *error = QString("No provider for extension: %1").arg(extension);
+void FormatRegistry::buildParsedCache(const QString &path, const QString &format) const {
+  if (!ParsedBookCache::handles(format)) {
+    return;
   }
-  return nullptr;
+  ParsedBookCache::storeInBackground(
+      path, format, [path, format](const CancelToken &cancel) -> std::unique_ptr<FormatDocument> {
+        // A warmed document may have come from a fresh entry already.
+        if (ParsedBookCache::load(path, format)) {
+          return nullptr;
+        }
+        OpenOptions buildOptions;
+        buildOptions.cancel = cancel;
+        buildOptions.format = format;
+        buildOptions.parsedCache = ParsedCacheMode::Off;
+        QString buildError;
+        return FormatRegistry::instance().open(path, &buildError, buildOptions);
+      });
+}
+
+void FormatRegistry::cancelBackgroundWork(const QString &path) const {
+  ParsedBookCache::cancelBuild(path);
 }
@@ -1,21 +1,24 @@
 #include "MobiProvider.h"
 #include "../core/include/AppPaths.h"
+#include "include/AssetCache.h"
+#include "CancelUtil.h"
 
-#include <QCryptographicHash>
 #include <QDebug>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QImageReader>
 #include <QHash>
+#include <QMutex>
+#include <QThreadPool>
 #include <QRegularExpression>
 #include <QSettings>
-#include <QStandardPaths>
 #include <QUrl>
 #include <QXmlStreamReader>
 #include <cstdlib>
 #include <optional>
 #include <algorithm>
+#include <memory>
 
 extern "C" {
 #include "index.h"
@@ -24,91 +27,6 @@ extern "C" {
 
 namespace {
 
-class MobiDocument : public FormatDocument {
-public:
-  MobiDocument(QString title,
-               QStringList chapterTitles,
-               QStringList chapterDisplayTexts,
-               QStringList chapterPlainTexts,
-               QStringList imagePaths,
-               QString coverPath,
-               QString authors,
-               QString series,
-               QString publisher,
-               QString description,
-               bool richText,
-               bool ttsDisabled)
-      : m_title(std::move(title)),
-        m_chapterTitles(std::move(chapterTitles)),
-        m_chapterDisplayTexts(std::move(chapterDisplayTexts)),
-        m_chapterPlainTexts(std::move(chapterPlainTexts)),
-        m_imagePaths(std::move(imagePaths)),
-        m_coverPath(std::move(coverPath)),
-        m_authors(std::move(authors)),
-        m_series(std::move(series)),
-        m_publisher(std::move(publisher)),
-        m_description(std::move(description)),
-        m_isRichText(richText),
-        m_ttsDisabled(ttsDisabled) {}
-
-  QString title() const override { return m_title; }
-  QStringList chapterTitles() const override { return m_chapterTitles; }
-  QString readAllText() const override {
-    if (!m_allDisplayText.isEmpty()) {
-      return m_allDisplayText;
-    }
-    QString joined;
-    for (const QString &chapter : m_chapterDisplayTexts) {
-      if (!joined.isEmpty()) {
-        joined.append("\n\n");
-      }
-      joined.append(chapter);
-    }
-    m_allDisplayText = joined;
-    return m_allDisplayText;
-  }
-  QString readAllPlainText() const override {
-    if (!m_allPlainText.isEmpty()) {
-      return m_allPlainText;
-    }
-    QString joined;
-    for (const QString &chapter : m_chapterPlainTexts) {
-      if (!joined.isEmpty()) {
-        joined.append("\n\n");
-      }
-      joined.append(chapter);
-    }
-    m_allPlainText = joined;
-    return m_allPlainText;
-  }
-  QStringList chaptersText() const override { return m_chapterDisplayTexts; }
-  QStringList chaptersPlainText() const override { return m_chapterPlainTexts; }
-  QStringList imagePaths() const override { return m_imagePaths; }
-  QString coverPath() const override { return m_coverPath; }
-  QString authors() const override { return m_authors; }
-  QString series() const override { return m_series; }
-  QString publisher() const override { return m_publisher; }
-  QString description() const override { return m_description; }
-  bool isRichText() const override { return m_isRichText; }
-  bool ttsDisabled() const override { return m_ttsDisabled; }
-
-private:
-  QString m_title;
-  QStringList m_chapterTitles;
-  QStringList m_chapterDisplayTexts;
-  QStringList m_chapterPlainTexts;
-  QStringList m_imagePaths;
-  mutable QString m_allDisplayText;
-  mutable QString m_allPlainText;
-  QString m_coverPath;
-  QString m_authors;
-  QString m_series;
-  QString m_publisher;
-  QString m_description;
-  bool m_isRichText = false;
-  bool m_ttsDisabled = false;
-};
-
 QString stripXhtml(const QByteArray &xhtml) {
   QByteArray cleaned = xhtml;
   cleaned.replace("&nbsp;", " ");
@@ -418,14 +336,25 @@ QString applyMobiStyles(const QString &html, const MobiRenderSettings &settings)
   return out;
 }
 
-QHash<size_t, ImageAsset> exportImageResources(const MOBIRawml *rawml, const QFileInfo &info) {
+QHash<size_t, ImageAsset> exportImageResources(const MOBIRawml *rawml,
+                                               const QFileInfo &info,
+                                               const CancelToken &cancel) {
   QHash<size_t, ImageAsset> assets;
   if (!rawml || !rawml->resources) {
     return assets;
   }
   const QString outDir = tempDirForMobi(info);
   QDir().mkpath(outDir);
+  QStringList written;
   for (MOBIPart *part = rawml->resources; part != nullptr; part = part->next) {
+    if (cancel.isCancelled()) {
+      // Drop what this open wrote; assets left by earlier opens stay reusable.
+      for (const QString &file : written) {
+        QFile::remove(file);
+      }
+      QDir().rmdir(outDir);
+      return {};
+    }
     if (!part->data || part->size == 0) {
       continue;
     }
@@ -445,6 +374,7 @@ QHash<size_t, ImageAsset> exportImageResources(const MOBIRawml *rawml, const QFi
         outFile.write(reinterpret_cast<const char *>(part->data),
                       static_cast<qint64>(part->size));
         outFile.close();
+        written.append(outPath);
       }
     }
     ImageAsset asset;
@@ -774,53 +704,45 @@ OpfMetadata extractOpfMetadata(const MOBIRawml *rawml) {
   return meta;
 }
 
-struct ChapterPayload {
-  QStringList display;
-  QStringList plain;
-  QStringList headings;
-};
-
-ChapterPayload extractMarkupContent(const MOBIRawml *rawml,
-                                    const QHash<size_t, ImageAsset> &assets,
-                                    bool richText,
-                                    const MobiRenderSettings &settings) {
-  ChapterPayload payload;
+QVector<const MOBIPart *> collectMarkupParts(const MOBIRawml *rawml) {
+  QVector<const MOBIPart *> parts;
   if (!rawml || !rawml->markup) {
-    return payload;
+    return parts;
   }
-  const MOBIPart *part = rawml->markup;
-  while (part) {
+  for (const MOBIPart *part = rawml->markup; part != nullptr; part = part->next) {
     if (part->data && part->size > 0) {
-      const QByteArray htmlBytes(reinterpret_cast<const char *>(part->data),
-                                 static_cast<int>(part->size));
-      const QString heading = extractHeading(htmlBytes);
-      const QString plain = stripXhtml(htmlBytes);
-      QString display;
-      if (richText) {
-        display = QString::fromUtf8(htmlBytes);
-        display = normalizeHtmlFragment(display);
-        display = replaceImageSources(display, rawml, assets, settings);
-        if (!display.contains("<html", Qt::CaseInsensitive)) {
-          display = QString("<div>%1</div>").arg(display);
-        }
-        display = applyMobiStyles(display, settings);
-      } else {
-        display = plain;
-      }
-      QString displayTrimmed = display.trimmed();
-      QString plainTrimmed = plain.trimmed();
-      if (!displayTrimmed.isEmpty() || !plainTrimmed.isEmpty()) {
-        if (displayTrimmed.isEmpty()) {
-          displayTrimmed = plainTrimmed;
-        }
-        payload.display.append(displayTrimmed);
-        payload.plain.append(plainTrimmed);
-        payload.headings.append(heading.trimmed());
-      }
+      parts.append(part);
     }
-    part = part->next;
   }
-  return payload;
+  return parts;
+}
+
+QByteArray markupPartBytes(const MOBIPart *part) {
+  return QByteArray(reinterpret_cast<const char *>(part->data), static_cast<int>(part->size));
+}
+
+void convertMarkupPart(const MOBIPart *part,
+                       const MOBIRawml *rawml,
+                       const QHash<size_t, ImageAsset> &assets,
+                       const MobiRenderSettings &settings,
+                       QString *displayOut,
+                       QString *plainOut) {
+  const QByteArray htmlBytes = markupPartBytes(part);
+  const QString plain = stripXhtml(htmlBytes).trimmed();
+  if (plainOut) {
+    *plainOut = plain;
+  }
+  if (!displayOut) {
+    return;
+  }
+  QString display = QString::fromUtf8(htmlBytes);
+  display = normalizeHtmlFragment(display);
+  display = replaceImageSources(display, rawml, assets, settings);
+  if (!display.contains("<html", Qt::CaseInsensitive)) {
+    display = QString("<div>%1</div>").arg(display);
+  }
+  display = applyMobiStyles(display, settings).trimmed();
+  *displayOut = display.isEmpty() ? plain : display;
 }
 
 QString decodeTitle(const MOBIData *data, const QString &fallback) {
@@ -914,13 +836,7 @@ QStringList autoChapterTitles(int count) {
 }
 
 QString tempDirForMobi(const QFileInfo &info) {
-  const QString key = QString("%1|%2|%3")
-                          .arg(info.absoluteFilePath())
-                          .arg(info.size())
-                          .arg(info.lastModified().toSecsSinceEpoch());
-  const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
-  return QDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation))
-      .filePath(QString("ereader_mobi_%1").arg(QString::fromUtf8(hash)));
+  return AssetCache::directoryFor("mobi", info.absoluteFilePath());
 }
 
 QString coverExtensionFromBytes(const unsigned char *data, size_t size) {
@@ -1009,6 +925,172 @@ QString extractCover(const MOBIData *data,
   return outPath;
 }
 
+// Owns the parsed libmobi handles so markup parts can be converted when the
+// reader asks for them instead of all at open.
+struct MobiContent {
+  ~MobiContent() {
+    if (rawml) {
+      mobi_free_rawml(rawml);
+    }
+    if (data) {
+      mobi_free(data);
+    }
+  }
+
+  QMutex mutex;
+  MOBIData *data = nullptr;
+  MOBIRawml *rawml = nullptr;
+  QVector<const MOBIPart *> parts;
+  QHash<size_t, ImageAsset> assets;
+  MobiRenderSettings settings;
+  QString fallbackText;
+  qint64 memoryCost = 0;
+};
+
+qint64 rawmlBytes(const MOBIRawml *rawml) {
+  qint64 total = 0;
+  if (!rawml) {
+    return total;
+  }
+  for (const MOBIPart *list : {rawml->flow, rawml->markup, rawml->resources}) {
+    for (const MOBIPart *part = list; part != nullptr; part = part->next) {
+      total += static_cast<qint64>(part->size);
+    }
+  }
+  return total;
+}
+
+int mobiChapterCount(const MobiContent &content) {
+  if (!content.parts.isEmpty()) {
+    return content.parts.size();
+  }
+  return content.fallbackText.isEmpty() ? 0 : 1;
+}
+
+void loadMobiChapter(MobiContent &content, int index, QString *display, QString *plain) {
+  QMutexLocker locker(&content.mutex);
+  if (content.parts.isEmpty()) {
+    if (index == 0) {
+      if (display) {
+        *display = content.fallbackText;
+      }
+      if (plain) {
+        *plain = content.fallbackText;
+      }
+    }
+    return;
+  }
+  if (index < 0 || index >= content.parts.size()) {
+    return;
+  }
+  convertMarkupPart(content.parts.at(index), content.rawml, content.assets, content.settings, display, plain);
+}
+
+class MobiDocument : public FormatDocument {
+public:
+  MobiDocument(QString title,
+               QStringList chapterTitles,
+               std::shared_ptr<MobiContent> content,
+               QStringList imagePaths,
+               QString coverPath,
+               QString authors,
+               QString series,
+               QString publisher,
+               QString description,
+               bool richText,
+               bool ttsDisabled)
+      : m_title(std::move(title)),
+        m_chapterTitles(std::move(chapterTitles)),
+        m_content(std::move(content)),
+        m_imagePaths(std::move(imagePaths)),
+        m_coverPath(std::move(coverPath)),
+        m_authors(std::move(authors)),
+        m_series(std::move(series)),
+        m_publisher(std::move(publisher)),
+        m_description(std::move(description)),
+        m_isRichText(richText),
+        m_ttsDisabled(ttsDisabled) {}
+
+  QString title() const override { return m_title; }
+  QStringList chapterTitles() const override { return m_chapterTitles; }
+  QString readAllText() const override { return joinChapters(false); }
+  QString readAllPlainText() const override { return joinChapters(true); }
+  QStringList chaptersText() const override {
+    QStringList out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      out.append(chapterText(i));
+    }
+    return out;
+  }
+  QStringList chaptersPlainText() const override {
+    QStringList out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      out.append(chapterPlainText(i));
+    }
+    return out;
+  }
+  int chapterCount() const override { return mobiChapterCount(*m_content); }
+  QString chapterText(int index) const override {
+    QString display;
+    loadMobiChapter(*m_content, index, &display, nullptr);
+    return display;
+  }
+  QString chapterPlainText(int index) const override {
+    QString plain;
+    loadMobiChapter(*m_content, index, nullptr, &plain);
+    return plain;
+  }
+  void requestChapter(int index, std::function<void(int, QString, QString)> callback) override {
+    if (!callback) {
+      return;
+    }
+    std::shared_ptr<MobiContent> content = m_content;
+    QThreadPool::globalInstance()->start([content, index, callback]() {
+      QString display;
+      QString plain;
+      loadMobiChapter(*content, index, &display, &plain);
+      callback(index, display, plain);
+    });
+  }
+  QStringList imagePaths() const override { return m_imagePaths; }
+  QString coverPath() const override { return m_coverPath; }
+  QString authors() const override { return m_authors; }
+  QString series() const override { return m_series; }
+  QString publisher() const override { return m_publisher; }
+  QString description() const override { return m_description; }
+  bool isRichText() const override { return m_isRichText; }
+  bool ttsDisabled() const override { return m_ttsDisabled; }
+  qint64 approximateMemoryCost() const override { return m_content->memoryCost; }
+
+private:
+  QString joinChapters(bool plainOnly) const {
+    QString joined;
+    for (int i = 0; i < chapterCount(); ++i) {
+      QString display;
+      QString plain;
+      loadMobiChapter(*m_content, i, plainOnly ? nullptr : &display, &plain);
+      const QString chapter = plainOnly ? plain : display;
+      if (!joined.isEmpty()) {
+        joined.append("\n\n");
+      }
+      joined.append(chapter);
+    }
+    return joined;
+  }
+
+  QString m_title;
+  QStringList m_chapterTitles;
+  std::shared_ptr<MobiContent> m_content;
+  QStringList m_imagePaths;
+  QString m_coverPath;
+  QString m_authors;
+  QString m_series;
+  QString m_publisher;
+  QString m_description;
+  bool m_isRichText = false;
+  bool m_ttsDisabled = false;
+};
+
 } // namespace
 
 QString MobiProvider::name() const { return "MOBI"; }
@@ -1017,7 +1099,10 @@ QStringList MobiProvider::supportedExtensions() const {
   return {"mobi", "azw", "azw3", "azw4", "prc"};
 }
 
-std::unique_ptr<FormatDocument> MobiProvider::open(const QString &path, QString *error) {
+std::unique_ptr<FormatDocument> MobiProvider::open(const QString &path,
+                                                   QString *error,
+                                                   const OpenOptions &options) {
+  const CancelToken &cancel = options.cancel;
   const QFileInfo info(path);
   if (!info.exists()) {
     if (error) {
@@ -1026,6 +1111,8 @@ std::unique_ptr<FormatDocument> MobiProvider::open(const QString &path, QString
     return nullptr;
   }
 
+  const auto cancelled = [&cancel, error]() { return openCancelled(cancel, error); };
+
   MOBIData *data = mobi_init();
   if (!data) {
     if (error) {
@@ -1045,6 +1132,10 @@ std::unique_ptr<FormatDocument> MobiProvider::open(const QString &path, QString
     mobi_free(data);
     return nullptr;
   }
+  if (cancelled()) {
+    mobi_free(data);
+    return nullptr;
+  }
 
   if (mobi_is_encrypted(data)) {
     if (error) {
@@ -1106,6 +1197,11 @@ std::unique_ptr<FormatDocument> MobiProvider::open(const QString &path, QString
     mobi_free(data);
     return nullptr;
   }
+  if (cancelled()) {
+    mobi_free_rawml(rawml);
+    mobi_free(data);
+    return nullptr;
+  }
 
   const bool rawmlKf8 = mobi_is_rawml_kf8(rawml);
   const RescMetadata rescMeta = extractRescMetadata(rawml);
@@ -1153,12 +1249,16 @@ std::unique_ptr<FormatDocument> MobiProvider::open(const QString &path, QString
 
   const QString series = opfMeta.series;
 
-  const QString formatKey = info.suffix().toLower().trimmed().isEmpty()
-                                ? QString("mobi")
-                                : info.suffix().toLower().trimmed();
+  const QString openKey = openFormatKey(path, options).trimmed();
+  const QString formatKey = openKey.isEmpty() ? QString("mobi") : openKey;
   const MobiRenderSettings renderSettings = loadMobiSettings(formatKey);
 
-  const auto assets = exportImageResources(rawml, info);
+  const auto assets = exportImageResources(rawml, info, cancel);
+  if (cancelled()) {
+    mobi_free_rawml(rawml);
+    mobi_free(data);
+    return nullptr;
+  }
   QString coverPath = extractCover(data, rawml, info, rescMeta, assets);
 
   const auto ttsDisableVal = decodeExthNumeric(data, EXTH_TTSDISABLE);
@@ -1185,56 +1285,44 @@ std::unique_ptr<FormatDocument> MobiProvider::open(const QString &path, QString
     qInfo() << "MobiProvider: EXTH_TTSDISABLE set";
   }
 
-  ChapterPayload payload = extractMarkupContent(rawml, assets, true, renderSettings);
-  QStringList chapterDisplay = payload.display;
-  QStringList chapterPlain = payload.plain;
-  QStringList chapterTitles;
-  QStringList tocTitles = extractNcxTitles(rawml);
-  if (tocTitles.isEmpty()) {
-    tocTitles = extractGuideTitles(rawml);
-  }
-  if (!tocTitles.isEmpty()) {
-    chapterTitles = tocTitles;
-  } else if (!payload.headings.isEmpty()) {
-    chapterTitles = payload.headings;
+  auto content = std::make_shared<MobiContent>();
+  content->data = data;
+  content->rawml = rawml;
+  content->assets = assets;
+  content->settings = renderSettings;
+  content->parts = collectMarkupParts(rawml);
+  if (content->parts.isEmpty()) {
+    content->fallbackText = fallbackRawmlText(data);
   }
+  // libmobi keeps both the raw records and the reconstructed parts in memory.
+  content->memoryCost = info.size() + rawmlBytes(rawml) +
+                        static_cast<qint64>(content->fallbackText.size()) * 2;
 
-  if (chapterDisplay.isEmpty() && chapterPlain.isEmpty()) {
-    const QString fallback = fallbackRawmlText(data);
-    if (!fallback.isEmpty()) {
-      chapterDisplay.append(fallback);
-      chapterPlain.append(fallback);
-    }
-  }
-
-  mobi_free_rawml(rawml);
-  mobi_free(data);
-
-  if (chapterDisplay.isEmpty() && chapterPlain.isEmpty()) {
+  const int chapterCount = mobiChapterCount(*content);
+  if (chapterCount == 0) {
     if (error) {
       *error = "No readable text found in MOBI";
     }
     return nullptr;
   }
 
-  const int chapterCount = std::max(chapterDisplay.size(), chapterPlain.size());
-  if (chapterDisplay.size() != chapterCount) {
-    chapterDisplay.resize(chapterCount);
-  }
-  if (chapterPlain.size() != chapterCount) {
-    chapterPlain.resize(chapterCount);
+  QStringList chapterTitles = extractNcxTitles(rawml);
+  if (chapterTitles.isEmpty()) {
+    chapterTitles = extractGuideTitles(rawml);
   }
   if (chapterTitles.size() > chapterCount) {
     chapterTitles = chapterTitles.mid(0, chapterCount);
   }
-  if (chapterTitles.size() < chapterCount) {
-    for (int i = chapterTitles.size(); i < chapterCount; ++i) {
-      QString fallback = (i < payload.headings.size()) ? payload.headings.at(i) : QString();
-      if (fallback.isEmpty()) {
-        fallback = QString("Section %1").arg(i + 1);
-      }
-      chapterTitles.append(fallback);
+  // Headings are only needed where the NCX/guide runs out of titles.
+  for (int i = chapterTitles.size(); i < chapterCount; ++i) {
+    if (cancelled()) {
+      return nullptr;
+    }
+    QString fallback;
+    if (i < content->parts.size()) {
+      fallback = extractHeading(markupPartBytes(content->parts.at(i))).trimmed();
     }
+    chapterTitles.append(fallback);
   }
   for (int i = 0; i < chapterTitles.size(); ++i) {
     if (chapterTitles.at(i).isEmpty()) {
@@ -1247,8 +1335,7 @@ std::unique_ptr<FormatDocument> MobiProvider::open(const QString &path, QString
   const bool richText = true;
   return std::make_unique<MobiDocument>(title,
                                         chapterTitles,
-                                        chapterDisplay,
-                                        chapterPlain,
+                                        content,
                                         imagePaths,
                                         coverPath,
                                         authors,
@@ -0,0 +1,457 @@
+#include "include/PageImageCache.h"
+#include "../core/include/AppPaths.h"
+
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QMutexLocker>
+#include <QSettings>
+#include <QStandardPaths>
+#include <algorithm>
+#include <atomic>
+#include <iterator>
+
+namespace {
+constexpr quint32 kRawPageMagic = 0x50474931; // "PGI1"
+
+int clampInt(int value, int minValue, int maxValue) {
+  return std::max(minValue, std::min(maxValue, value));
+}
+
+qint64 configuredBudget() {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  return static_cast<qint64>(clampInt(settings.value("cache/page_images_mb", 256).toInt(), 16, 4096)) *
+         1024 * 1024;
+}
+
+qint64 configuredDiskBudget() {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  return static_cast<qint64>(clampInt(settings.value("cache/page_disk_mb", 512).toInt(), 0, 16384)) *
+         1024 * 1024;
+}
+
+QString pageCacheDir() {
+  return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).filePath("page_cache");
+}
+
+// Spilled pages are stored uncompressed: reloading one is a single read,
+// which is the point of keeping it instead of rendering it again.
+bool writeRawPage(const QString &path, const QImage &image) {
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    return false;
+  }
+  QDataStream out(&file);
+  out << kRawPageMagic << qint32(image.width()) << qint32(image.height()) << qint32(image.format())
+      << qint32(image.bytesPerLine()) << image.colorTable();
+  if (out.status() != QDataStream::Ok) {
+    return false;
+  }
+  const qint64 size = image.sizeInBytes();
+  return file.write(reinterpret_cast<const char *>(image.constBits()), size) == size;
+}
+
+QImage readRawPage(const QString &path) {
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return {};
+  }
+  QDataStream in(&file);
+  quint32 magic = 0;
+  qint32 width = 0;
+  qint32 height = 0;
+  qint32 format = 0;
+  qint32 bytesPerLine = 0;
+  QList<QRgb> colors;
+  in >> magic >> width >> height >> format >> bytesPerLine >> colors;
+  if (in.status() != QDataStream::Ok || magic != kRawPageMagic || width <= 0 || height <= 0 ||
+      format <= QImage::Format_Invalid || format >= QImage::NImageFormats) {
+    return {};
+  }
+  QImage image(width, height, static_cast<QImage::Format>(format));
+  if (image.isNull() || image.bytesPerLine() != bytesPerLine) {
+    return {};
+  }
+  if (!colors.isEmpty()) {
+    image.setColorTable(colors);
+  }
+  const qint64 size = image.sizeInBytes();
+  if (file.read(reinterpret_cast<char *>(image.bits()), size) != size) {
+    return {};
+  }
+  return image;
+}
+} // namespace
+
+PageImageCache::PageImageCache()
+    : m_budget(configuredBudget()), m_diskDir(pageCacheDir()), m_diskBudget(configuredDiskBudget()) {
+  // Spilled pages belong to documents of an earlier run; nothing can name them.
+  QDir(m_diskDir).removeRecursively();
+  if (m_diskBudget > 0) {
+    QDir().mkpath(m_diskDir);
+  }
+}
+
+PageImageCache &PageImageCache::instance() {
+  static PageImageCache cache;
+  return cache;
+}
+
+QString PageImageCache::newDocumentId(const QString &prefix) {
+  static std::atomic<quint64> counter{0};
+  return QString("%1-%2").arg(prefix).arg(++counter);
+}
+
+QString PageImageCache::key(const QString &documentId, int index) {
+  return QString("%1/%2").arg(documentId).arg(index);
+}
+
+QSize PageImageCache::targetBucket(const QSize &size) {
+  auto bucket = [](int value) { return value <= 0 ? 0 : ((value + 127) / 128) * 128; };
+  const QSize out(bucket(size.width()), bucket(size.height()));
+  return (out.width() > 0 || out.height() > 0) ? out : QSize();
+}
+
+QString PageImageCache::documentOf(const QString &key) {
+  return key.section('/', 0, 0);
+}
+
+void PageImageCache::setBudget(qint64 bytes) {
+  QVector<Spill> spills;
+  QStringList doomed;
+  {
+    QMutexLocker locker(&m_mutex);
+    m_budget = std::max<qint64>(0, bytes);
+    evictLocked(spills, doomed);
+  }
+  finishSpills(spills, doomed);
+}
+
+void PageImageCache::setDiskBudget(qint64 bytes) {
+  QStringList doomed;
+  {
+    QMutexLocker locker(&m_mutex);
+    m_diskBudget = std::max<qint64>(0, bytes);
+    while (m_diskBytes > m_diskBudget && !m_diskOrder.empty()) {
+      dropDiskLocked(m_diskOrder.front(), doomed);
+    }
+  }
+  if (bytes > 0) {
+    QDir().mkpath(m_diskDir);
+  }
+  finishSpills({}, doomed);
+}
+
+void PageImageCache::insert(const QString &key, const QImage &image) {
+  if (image.isNull()) {
+    return;
+  }
+  QVector<Waiter> ready;
+  QVector<Spill> spills;
+  QStringList doomed;
+  {
+    QMutexLocker locker(&m_mutex);
+    storeLocked(key, image, spills, doomed);
+    for (auto it = m_waiters.begin(); it != m_waiters.end();) {
+      if (it->first == key) {
+        ready.append(std::move(it->second));
+        it = m_waiters.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  for (const Waiter &waiter : ready) {
+    waiter(image);
+  }
+  finishSpills(spills, doomed);
+}
+
+QImage PageImageCache::find(const QString &key) {
+  bool found = false;
+  return lookup(key, &found);
+}
+
+bool PageImageCache::contains(const QString &key) const {
+  QMutexLocker locker(&m_mutex);
+  return m_entries.contains(key) || m_disk.contains(key);
+}
+
+void PageImageCache::remove(const QString &key) {
+  QStringList doomed;
+  {
+    QMutexLocker locker(&m_mutex);
+    unlinkLocked(key);
+    dropDiskLocked(key, doomed);
+  }
+  finishSpills({}, doomed);
+}
+
+void PageImageCache::removeDocument(const QString &documentId) {
+  const QString prefix = documentId + '/';
+  QVector<Waiter> orphaned;
+  QStringList doomed;
+  {
+    QMutexLocker locker(&m_mutex);
+    const auto usage = m_documents.find(documentId);
+    if (usage != m_documents.end()) {
+      const std::list<QString> keys = usage->second.order;
+      for (const QString &key : keys) {
+        unlinkLocked(key);
+      }
+    }
+    QStringList onDisk;
+    for (auto it = m_disk.constBegin(); it != m_disk.constEnd(); ++it) {
+      if (it.key().startsWith(prefix)) {
+        onDisk.append(it.key());
+      }
+    }
+    for (const QString &key : onDisk) {
+      dropDiskLocked(key, doomed);
+    }
+    for (auto it = m_waiters.begin(); it != m_waiters.end();) {
+      if (it->first.startsWith(prefix)) {
+        orphaned.append(std::move(it->second));
+        it = m_waiters.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  finishSpills({}, doomed);
+  for (const Waiter &waiter : orphaned) {
+    waiter(QImage());
+  }
+}
+
+quint64 PageImageCache::subscribe(const QString &key, Waiter waiter) {
+  bool found = false;
+  QImage cached = lookup(key, &found);
+  if (!found) {
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_entries.find(key);
+    if (it == m_entries.end()) {
+      const quint64 ticket = m_nextTicket++;
+      m_waiters.insert(ticket, qMakePair(key, std::move(waiter)));
+      return ticket;
+    }
+    // Inserted while the lookup ran.
+    touchLocked(*it);
+    cached = it->image;
+  }
+  waiter(cached);
+  return 0;
+}
+
+void PageImageCache::unsubscribe(quint64 ticket) {
+  QMutexLocker locker(&m_mutex);
+  m_waiters.remove(ticket);
+}
+
+PageImageCache::Stats PageImageCache::stats() const {
+  QMutexLocker locker(&m_mutex);
+  Stats out;
+  out.memoryHits = m_memoryHits;
+  out.diskHits = m_diskHits;
+  out.misses = m_misses;
+  out.evictions = m_evictions;
+  out.spills = m_spills;
+  out.memoryBytes = m_bytes;
+  out.memoryBudget = m_budget;
+  out.diskBytes = m_diskBytes;
+  out.diskBudget = m_diskBudget;
+  out.documents = static_cast<int>(m_documents.size());
+  return out;
+}
+
+void PageImageCache::touchLocked(Entry &entry) {
+  m_order.splice(m_order.end(), m_order, entry.order);
+  const auto usage = m_documents.find(entry.document);
+  if (usage != m_documents.end()) {
+    usage->second.order.splice(usage->second.order.end(), usage->second.order, entry.documentOrder);
+  }
+}
+
+void PageImageCache::storeLocked(const QString &key,
+                                 const QImage &image,
+                                 QVector<Spill> &spills,
+                                 QStringList &doomed) {
+  unlinkLocked(key);
+  dropDiskLocked(key, doomed);
+  Entry entry;
+  entry.image = image;
+  entry.document = documentOf(key);
+  entry.bytes = image.sizeInBytes();
+  entry.order = m_order.insert(m_order.end(), key);
+  DocumentUsage &usage = m_documents[entry.document];
+  entry.documentOrder = usage.order.insert(usage.order.end(), key);
+  usage.bytes += entry.bytes;
+  m_bytes += entry.bytes;
+  m_entries.insert(key, std::move(entry));
+  evictLocked(spills, doomed);
+}
+
+void PageImageCache::unlinkLocked(const QString &key) {
+  const auto it = m_entries.find(key);
+  if (it == m_entries.end()) {
+    return;
+  }
+  m_order.erase(it->order);
+  const auto usage = m_documents.find(it->document);
+  if (usage != m_documents.end()) {
+    usage->second.order.erase(it->documentOrder);
+    usage->second.bytes -= it->bytes;
+    if (usage->second.order.empty()) {
+      m_documents.erase(usage);
+    }
+  }
+  m_bytes -= it->bytes;
+  m_entries.erase(it);
+}
+
+void PageImageCache::dropDiskLocked(const QString &key, QStringList &doomed) {
+  m_spilling.remove(key);
+  const auto it = m_disk.find(key);
+  if (it == m_disk.end()) {
+    return;
+  }
+  doomed.append(it->path);
+  m_diskOrder.erase(it->order);
+  m_diskBytes -= it->bytes;
+  m_disk.erase(it);
+}
+
+// The document over its share gives up its oldest page; otherwise plain LRU.
+// The newest page always stays, even when it alone exceeds the budget.
+QString PageImageCache::victimLocked() const {
+  const qint64 share = m_budget / static_cast<qint64>(std::max<size_t>(1, m_documents.size()));
+  const DocumentUsage *heaviest = nullptr;
+  for (const auto &usage : m_documents) {
+    if (!heaviest || usage.second.bytes > heaviest->bytes) {
+      heaviest = &usage.second;
+    }
+  }
+  if (heaviest && heaviest->bytes > share && heaviest->order.front() != m_order.back()) {
+    return heaviest->order.front();
+  }
+  return m_order.front();
+}
+
+void PageImageCache::evictLocked(QVector<Spill> &spills, QStringList &doomed) {
+  while (m_bytes > m_budget && m_entries.size() > 1) {
+    const QString key = victimLocked();
+    const auto it = m_entries.constFind(key);
+    const QImage image = it->image;
+    const qint64 bytes = it->bytes;
+    unlinkLocked(key);
+    ++m_evictions;
+    if (m_diskBudget <= 0 || bytes > m_diskBudget) {
+      continue;
+    }
+    DiskEntry disk;
+    disk.path = QDir(m_diskDir).filePath(QString("%1.page").arg(m_nextFile++));
+    disk.bytes = bytes;
+    disk.order = m_diskOrder.insert(m_diskOrder.end(), key);
+    m_disk.insert(key, disk);
+    m_diskBytes += bytes;
+    m_spilling.insert(key, image);
+    spills.append({key, disk.path, image});
+    ++m_spills;
+    while (m_diskBytes > m_diskBudget && !m_diskOrder.empty()) {
+      dropDiskLocked(m_diskOrder.front(), doomed);
+    }
+  }
+}
+
+QImage PageImageCache::lookup(const QString &key, bool *found) {
+  *found = false;
+  QVector<Spill> spills;
+  QStringList doomed;
+  QString path;
+  {
+    QMutexLocker locker(&m_mutex);
+    const auto it = m_entries.find(key);
+    if (it != m_entries.end()) {
+      touchLocked(*it);
+      ++m_memoryHits;
+      *found = true;
+      return it->image;
+    }
+    const auto spilling = m_spilling.constFind(key);
+    if (spilling != m_spilling.constEnd()) {
+      const QImage image = spilling.value();
+      ++m_diskHits;
+      storeLocked(key, image, spills, doomed);
+      locker.unlock();
+      finishSpills(spills, doomed);
+      *found = true;
+      return image;
+    }
+    const auto disk = m_disk.constFind(key);
+    if (disk == m_disk.constEnd()) {
+      ++m_misses;
+      return {};
+    }
+    path = disk->path;
+  }
+
+  QImage image = readRawPage(path);
+  {
+    QMutexLocker locker(&m_mutex);
+    const auto disk = m_disk.constFind(key);
+    const bool current = disk != m_disk.constEnd() && disk->path == path;
+    if (image.isNull()) {
+      if (current) {
+        dropDiskLocked(key, doomed);
+      }
+      ++m_misses;
+    } else {
+      ++m_diskHits;
+      *found = true;
+      const auto it = m_entries.find(key);
+      if (it != m_entries.end()) {
+        image = it->image;
+      } else if (current) {
+        // Otherwise the page was removed (or its document closed) during the
+        // read; the caller gets it once, but it does not come back.
+        storeLocked(key, image, spills, doomed);
+      }
+    }
+  }
+  finishSpills(spills, doomed);
+  return image;
+}
+
+// File I/O for the disk tier, run after the lock is released.
+void PageImageCache::finishSpills(const QVector<Spill> &spills, const QStringList &doomed) {
+  for (const QString &path : doomed) {
+    QFile::remove(path);
+  }
+  QStringList failed;
+  for (const Spill &spill : spills) {
+    const bool written = writeRawPage(spill.path, spill.image);
+    bool current = false;
+    {
+      QMutexLocker locker(&m_mutex);
+      const auto disk = m_disk.constFind(spill.key);
+      current = disk != m_disk.constEnd() && disk->path == spill.path;
+      if (current) {
+        m_spilling.remove(spill.key);
+        if (!written) {
+          dropDiskLocked(spill.key, failed);
+        }
+      }
+    }
+    if (!written) {
+      qWarning() << "PageImageCache: could not write" << spill.path;
+    }
+    if (!current) {
+      // Dropped while it was being written.
+      QFile::remove(spill.path);
+    }
+  }
+  for (const QString &path : failed) {
+    QFile::remove(path);
+  }
+}
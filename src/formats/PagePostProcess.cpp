@@ -0,0 +1,408 @@
+#include "PagePostProcess.h"
+
+#include <QtGlobal>
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define PAGE_POST_SSE2 1
+#include <emmintrin.h>
+#if defined(__GNUC__)
+// Built with a target attribute and picked at runtime, so the binary still
+// runs on CPUs without AVX2.
+#define PAGE_POST_AVX2 1
+#include <immintrin.h>
+#endif
+#endif
+
+#if (defined(__ARM_NEON) || defined(__ARM_NEON__)) && Q_BYTE_ORDER == Q_LITTLE_ENDIAN
+#define PAGE_POST_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace {
+// Luma weights in 1/128ths (BT.601, summing to 128) so every path, including
+// the 8-bit multiply-adds, produces the same value.
+constexpr uint kLumaRed = 38;
+constexpr uint kLumaGreen = 75;
+constexpr uint kLumaBlue = 15;
+
+const QRgb kSepiaInk = qRgb(0x5b, 0x46, 0x36);
+const QRgb kSepiaPaper = qRgb(0xf4, 0xec, 0xd8);
+
+// Rounded value / 255, exact for value <= 255 * 255.
+inline uint div255(uint value) {
+  value += 128;
+  return (value + (value >> 8)) >> 8;
+}
+
+inline uchar luma(QRgb pixel) {
+  return static_cast<uchar>(
+      (kLumaRed * qRed(pixel) + kLumaGreen * qGreen(pixel) + kLumaBlue * qBlue(pixel) + 64) >> 7);
+}
+
+// Rows are QRgb words. `straight` means colour is not premultiplied by
+// alpha (Format_ARGB32). Every pixel comes out opaque.
+void compositeScalar(quint32 *row, int count, QRgb background, bool straight) {
+  const uint red = qRed(background);
+  const uint green = qGreen(background);
+  const uint blue = qBlue(background);
+  for (int i = 0; i < count; ++i) {
+    const QRgb pixel = row[i];
+    const uint alpha = qAlpha(pixel);
+    const uint weight = straight ? alpha : 255;
+    const uint inverse = 255 - alpha;
+    row[i] = qRgb(div255(qRed(pixel) * weight + red * inverse),
+                  div255(qGreen(pixel) * weight + green * inverse),
+                  div255(qBlue(pixel) * weight + blue * inverse));
+  }
+}
+
+void lumaScalar(const quint32 *row, uchar *out, int count) {
+  for (int i = 0; i < count; ++i) {
+    out[i] = luma(row[i]);
+  }
+}
+
+#ifdef PAGE_POST_SSE2
+void compositeSse2(quint32 *row, int count, QRgb background, bool straight) {
+  const __m128i zero = _mm_setzero_si128();
+  const __m128i fill = _mm_unpacklo_epi8(_mm_set1_epi32(static_cast<int>(background | 0xff000000u)), zero);
+  const __m128i full = _mm_set1_epi16(255);
+  const __m128i half = _mm_set1_epi16(128);
+  const __m128i opaque = _mm_set1_epi32(static_cast<int>(0xff000000u));
+  // Two pixels as 16-bit lanes.
+  auto blend = [&](__m128i color) {
+    const __m128i alpha = _mm_shufflehi_epi16(_mm_shufflelo_epi16(color, _MM_SHUFFLE(3, 3, 3, 3)),
+                                              _MM_SHUFFLE(3, 3, 3, 3));
+    const __m128i weight = straight ? alpha : full;
+    __m128i value = _mm_add_epi16(_mm_mullo_epi16(color, weight),
+                                  _mm_mullo_epi16(fill, _mm_sub_epi16(full, alpha)));
+    value = _mm_add_epi16(value, half);
+    return _mm_srli_epi16(_mm_add_epi16(value, _mm_srli_epi16(value, 8)), 8);
+  };
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    auto *pixels = reinterpret_cast<__m128i *>(row + i);
+    const __m128i packed = _mm_loadu_si128(pixels);
+    const __m128i low = blend(_mm_unpacklo_epi8(packed, zero));
+    const __m128i high = blend(_mm_unpackhi_epi8(packed, zero));
+    _mm_storeu_si128(pixels, _mm_or_si128(_mm_packus_epi16(low, high), opaque));
+  }
+  compositeScalar(row + i, count - i, background, straight);
+}
+
+void lumaSse2(const quint32 *row, uchar *out, int count) {
+  const __m128i zero = _mm_setzero_si128();
+  const auto red = static_cast<short>(kLumaRed);
+  const auto green = static_cast<short>(kLumaGreen);
+  const auto blue = static_cast<short>(kLumaBlue);
+  const __m128i weights = _mm_setr_epi16(blue, green, red, 0, blue, green, red, 0);
+  const __m128i round = _mm_set1_epi32(64);
+  // madd leaves (b, g) and (r, a) partial sums per pixel; fold each pair.
+  auto sums = [&](__m128i pixels) {
+    const __m128i partial = _mm_madd_epi16(pixels, weights);
+    return _mm_shuffle_epi32(_mm_add_epi32(partial, _mm_srli_epi64(partial, 32)), _MM_SHUFFLE(3, 1, 2, 0));
+  };
+  int i = 0;
+  for (; i + 4 <= count; i += 4) {
+    const __m128i packed = _mm_loadu_si128(reinterpret_cast<const __m128i *>(row + i));
+    __m128i value = _mm_unpacklo_epi64(sums(_mm_unpacklo_epi8(packed, zero)),
+                                       sums(_mm_unpackhi_epi8(packed, zero)));
+    value = _mm_srli_epi32(_mm_add_epi32(value, round), 7);
+    value = _mm_packus_epi16(_mm_packs_epi32(value, value), zero);
+    const int bytes = _mm_cvtsi128_si32(value);
+    std::memcpy(out + i, &bytes, sizeof(bytes));
+  }
+  lumaScalar(row + i, out + i, count - i);
+}
+#endif
+
+#ifdef PAGE_POST_AVX2
+// Two pixels per 128-bit lane as 16-bit values.
+__attribute__((target("avx2"))) inline __m256i blendAvx2(__m256i color,
+                                                         __m256i fill,
+                                                         bool straight) {
+  const __m256i full = _mm256_set1_epi16(255);
+  const __m256i alpha = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(color, _MM_SHUFFLE(3, 3, 3, 3)),
+                                               _MM_SHUFFLE(3, 3, 3, 3));
+  const __m256i weight = straight ? alpha : full;
+  __m256i value = _mm256_add_epi16(_mm256_mullo_epi16(color, weight),
+                                   _mm256_mullo_epi16(fill, _mm256_sub_epi16(full, alpha)));
+  value = _mm256_add_epi16(value, _mm256_set1_epi16(128));
+  return _mm256_srli_epi16(_mm256_add_epi16(value, _mm256_srli_epi16(value, 8)), 8);
+}
+
+__attribute__((target("avx2"))) void compositeAvx2(quint32 *row, int count, QRgb background, bool straight) {
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i fill =
+      _mm256_unpacklo_epi8(_mm256_set1_epi32(static_cast<int>(background | 0xff000000u)), zero);
+  const __m256i opaque = _mm256_set1_epi32(static_cast<int>(0xff000000u));
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    auto *pixels = reinterpret_cast<__m256i *>(row + i);
+    const __m256i packed = _mm256_loadu_si256(pixels);
+    // Unpack and pack both stay within 128-bit lanes, so pixel order holds.
+    const __m256i low = blendAvx2(_mm256_unpacklo_epi8(packed, zero), fill, straight);
+    const __m256i high = blendAvx2(_mm256_unpackhi_epi8(packed, zero), fill, straight);
+    _mm256_storeu_si256(pixels, _mm256_or_si256(_mm256_packus_epi16(low, high), opaque));
+  }
+  compositeSse2(row + i, count - i, background, straight);
+}
+
+__attribute__((target("avx2"))) void lumaAvx2(const quint32 *row, uchar *out, int count) {
+  // Bytes b, g, r, a of each pixel times 15, 75, 38, 0.
+  const __m256i weights = _mm256_set1_epi32(static_cast<int>(kLumaBlue | (kLumaGreen << 8) | (kLumaRed << 16)));
+  const __m256i ones = _mm256_set1_epi16(1);
+  const __m256i round = _mm256_set1_epi32(64);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const __m256i packed = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(row + i));
+    __m256i value = _mm256_madd_epi16(_mm256_maddubs_epi16(packed, weights), ones);
+    value = _mm256_srli_epi32(_mm256_add_epi32(value, round), 7);
+    value = _mm256_packus_epi16(_mm256_packs_epi32(value, value), _mm256_setzero_si256());
+    const int low = _mm_cvtsi128_si32(_mm256_castsi256_si128(value));
+    const int high = _mm_cvtsi128_si32(_mm256_extracti128_si256(value, 1));
+    std::memcpy(out + i, &low, sizeof(low));
+    std::memcpy(out + i + 4, &high, sizeof(high));
+  }
+  lumaSse2(row + i, out + i, count - i);
+}
+
+bool hasAvx2() {
+  static const bool supported = __builtin_cpu_supports("avx2");
+  return supported;
+}
+#endif
+
+#ifdef PAGE_POST_NEON
+inline uint8x8_t blendNeon(uint8x8_t color, uint8x8_t weight, uint8x8_t fill, uint8x8_t inverse) {
+  uint16x8_t value = vmlal_u8(vmull_u8(color, weight), fill, inverse);
+  value = vaddq_u16(value, vdupq_n_u16(128));
+  return vshrn_n_u16(vaddq_u16(value, vshrq_n_u16(value, 8)), 8);
+}
+
+void compositeNeon(quint32 *row, int count, QRgb background, bool straight) {
+  auto *bytes = reinterpret_cast<uchar *>(row);
+  const uint8x8_t blue = vdup_n_u8(static_cast<uint8_t>(qBlue(background)));
+  const uint8x8_t green = vdup_n_u8(static_cast<uint8_t>(qGreen(background)));
+  const uint8x8_t red = vdup_n_u8(static_cast<uint8_t>(qRed(background)));
+  const uint8x8_t full = vdup_n_u8(255);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    uint8x8x4_t pixels = vld4_u8(bytes + i * 4);
+    const uint8x8_t alpha = pixels.val[3];
+    const uint8x8_t weight = straight ? alpha : full;
+    const uint8x8_t inverse = vsub_u8(full, alpha);
+    pixels.val[0] = blendNeon(pixels.val[0], weight, blue, inverse);
+    pixels.val[1] = blendNeon(pixels.val[1], weight, green, inverse);
+    pixels.val[2] = blendNeon(pixels.val[2], weight, red, inverse);
+    pixels.val[3] = full;
+    vst4_u8(bytes + i * 4, pixels);
+  }
+  compositeScalar(row + i, count - i, background, straight);
+}
+
+void lumaNeon(const quint32 *row, uchar *out, int count) {
+  const auto *bytes = reinterpret_cast<const uchar *>(row);
+  int i = 0;
+  for (; i + 8 <= count; i += 8) {
+    const uint8x8x4_t pixels = vld4_u8(bytes + i * 4);
+    uint16x8_t value = vmull_u8(pixels.val[2], vdup_n_u8(kLumaRed));
+    value = vmlal_u8(value, pixels.val[1], vdup_n_u8(kLumaGreen));
+    value = vmlal_u8(value, pixels.val[0], vdup_n_u8(kLumaBlue));
+    vst1_u8(out + i, vrshrn_n_u16(value, 7));
+  }
+  lumaScalar(row + i, out + i, count - i);
+}
+#endif
+
+struct Kernels {
+  void (*composite)(quint32 *, int, QRgb, bool) = compositeScalar;
+  void (*luma)(const quint32 *, uchar *, int) = lumaScalar;
+};
+
+const Kernels &kernels() {
+  static const Kernels selected = [] {
+    Kernels out;
+#if defined(PAGE_POST_NEON)
+    out.composite = compositeNeon;
+    out.luma = lumaNeon;
+#elif defined(PAGE_POST_SSE2)
+    out.composite = compositeSse2;
+    out.luma = lumaSse2;
+#endif
+#ifdef PAGE_POST_AVX2
+    if (hasAvx2()) {
+      out.composite = compositeAvx2;
+      out.luma = lumaAvx2;
+    }
+#endif
+    return out;
+  }();
+  return selected;
+}
+
+struct ToneTables {
+  bool identity = true;
+  // Gamma, then night inversion, per channel value.
+  std::array<uchar, 256> tone{};
+  // Gamma-corrected luma to a colour between sepia ink and paper.
+  std::array<QRgb, 256> sepia{};
+};
+
+ToneTables buildTables(const PagePostProcess::Options &options) {
+  ToneTables out;
+  const bool gamma = !qFuzzyCompare(options.gamma, 1.0);
+  out.identity = !gamma && options.tint == PagePostProcess::Tint::None;
+  for (int value = 0; value < 256; ++value) {
+    int toned = value;
+    if (gamma) {
+      toned = qRound(255.0 * std::pow(value / 255.0, 1.0 / options.gamma));
+    }
+    const double t = toned / 255.0;
+    out.sepia[value] = qRgb(qRound(qRed(kSepiaInk) + t * (qRed(kSepiaPaper) - qRed(kSepiaInk))),
+                            qRound(qGreen(kSepiaInk) + t * (qGreen(kSepiaPaper) - qGreen(kSepiaInk))),
+                            qRound(qBlue(kSepiaInk) + t * (qBlue(kSepiaPaper) - qBlue(kSepiaInk))));
+    if (options.tint == PagePostProcess::Tint::Night) {
+      toned = 255 - toned;
+    }
+    out.tone[value] = static_cast<uchar>(std::clamp(toned, 0, 255));
+  }
+  return out;
+}
+
+// `red`, `green` and `blue` are unpremultiplied.
+inline QRgb withAlpha(uint red, uint green, uint blue, uint alpha, bool premultiplied) {
+  if (premultiplied && alpha < 255) {
+    red = div255(red * alpha);
+    green = div255(green * alpha);
+    blue = div255(blue * alpha);
+  }
+  return qRgba(red, green, blue, alpha);
+}
+} // namespace
+
+namespace PagePostProcess {
+
+Tint parseTint(const QString &value) {
+  const QString normalized = value.trimmed().toLower();
+  if (normalized == "night") {
+    return Tint::Night;
+  }
+  if (normalized == "sepia") {
+    return Tint::Sepia;
+  }
+  return Tint::None;
+}
+
+bool isIdentity(const Options &options) {
+  return !options.background.isValid() && !options.grayscale && options.tint == Tint::None &&
+         qFuzzyCompare(options.gamma, 1.0);
+}
+
+QString signature(const Options &options) {
+  return QString("bg=%1;gray=%2;tint=%3;gamma=%4")
+      .arg(options.background.isValid() ? options.background.name(QColor::HexArgb) : QString("none"))
+      .arg(options.grayscale ? 1 : 0)
+      .arg(static_cast<int>(options.tint))
+      .arg(options.gamma, 0, 'f', 2);
+}
+
+QImage apply(QImage image, const Options &options) {
+  if (image.isNull() || isIdentity(options)) {
+    return image;
+  }
+  const bool sepia = options.tint == Tint::Sepia;
+  const bool grayOut = options.grayscale && !sepia;
+  const ToneTables tables = buildTables(options);
+  if (!grayOut && !sepia && tables.identity && !image.hasAlphaChannel()) {
+    // Only a background was asked for and there is nothing to show through.
+    return image;
+  }
+
+  if (image.format() == QImage::Format_Grayscale8 && grayOut) {
+    if (!tables.identity) {
+      for (int y = 0; y < image.height(); ++y) {
+        uchar *line = image.scanLine(y);
+        for (int x = 0; x < image.width(); ++x) {
+          line[x] = tables.tone[line[x]];
+        }
+      }
+    }
+    return image;
+  }
+  if (image.format() != QImage::Format_RGB32 && image.format() != QImage::Format_ARGB32 &&
+      image.format() != QImage::Format_ARGB32_Premultiplied) {
+    image = image.convertToFormat(QImage::Format_ARGB32_Premultiplied);
+  }
+
+  const Kernels &kernel = kernels();
+  const int width = image.width();
+  const int height = image.height();
+  const bool straight = image.format() == QImage::Format_ARGB32;
+  const bool premultiplied = image.format() == QImage::Format_ARGB32_Premultiplied;
+  const bool composite = options.background.isValid() && image.format() != QImage::Format_RGB32;
+  const QRgb background = options.background.rgb();
+
+  if (grayOut) {
+    QImage gray(image.size(), QImage::Format_Grayscale8);
+    if (gray.isNull()) {
+      return image;
+    }
+    gray.setDotsPerMeterX(image.dotsPerMeterX());
+    gray.setDotsPerMeterY(image.dotsPerMeterY());
+    // Composited in a scratch row so a shared source is never detached.
+    std::vector<quint32> scratch(composite ? width : 0);
+    for (int y = 0; y < height; ++y) {
+      const auto *row = reinterpret_cast<const quint32 *>(image.constScanLine(y));
+      if (composite) {
+        std::copy(row, row + width, scratch.begin());
+        kernel.composite(scratch.data(), width, background, straight);
+        row = scratch.data();
+      }
+      uchar *out = gray.scanLine(y);
+      kernel.luma(row, out, width);
+      if (!tables.identity) {
+        for (int x = 0; x < width; ++x) {
+          out[x] = tables.tone[out[x]];
+        }
+      }
+    }
+    return gray;
+  }
+
+  std::vector<uchar> lumaRow(sepia ? width : 0);
+  for (int y = 0; y < height; ++y) {
+    auto *row = reinterpret_cast<quint32 *>(image.scanLine(y));
+    if (composite) {
+      kernel.composite(row, width, background, straight);
+    }
+    if (sepia) {
+      kernel.luma(row, lumaRow.data(), width);
+      for (int x = 0; x < width; ++x) {
+        const QRgb tint = tables.sepia[lumaRow[x]];
+        row[x] = withAlpha(qRed(tint), qGreen(tint), qBlue(tint), qAlpha(row[x]), premultiplied);
+      }
+    } else if (!tables.identity) {
+      for (int x = 0; x < width; ++x) {
+        const QRgb pixel = row[x];
+        const uint alpha = qAlpha(pixel);
+        // Premultiplied colour must not exceed its alpha.
+        const uint limit = premultiplied ? alpha : 255;
+        row[x] = qRgba(std::min<uint>(tables.tone[qRed(pixel)], limit),
+                       std::min<uint>(tables.tone[qGreen(pixel)], limit),
+                       std::min<uint>(tables.tone[qBlue(pixel)], limit), alpha);
+      }
+    }
+  }
+  if (composite) {
+    image.reinterpretAsFormat(QImage::Format_RGB32);
+  }
+  return image;
+}
+
+} // namespace PagePostProcess
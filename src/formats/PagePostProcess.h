@@ -0,0 +1,37 @@
+#pragma once
+
+#include <QColor>
+#include <QImage>
+#include <QString>
+
+// Colour stage applied to a rendered page before it enters PageImageCache:
+// background fill, grayscale, night/sepia tint and gamma in one pass over the
+// renderer's pixels, vectorized with SSE2/AVX2/NEON where available. Shared by
+// PDF, DjVu and comic pages.
+namespace PagePostProcess {
+
+enum class Tint { None, Night, Sepia };
+
+struct Options {
+  // Composited under the page; invalid keeps the page's own alpha.
+  QColor background;
+  bool grayscale = false;
+  Tint tint = Tint::None;
+  // Applied before the tint; 1.0 leaves tones unchanged.
+  double gamma = 1.0;
+};
+
+// "none" | "night" | "sepia"; anything else is None.
+Tint parseTint(const QString &value);
+
+bool isIdentity(const Options &options);
+
+// Stable text form of `options`, for caches of processed pages.
+QString signature(const Options &options);
+
+// Works in place when it can. Returns Format_Grayscale8 for grayscale without
+// a sepia tint, Format_RGB32 when a background was filled, and the page's
+// ARGB format otherwise.
+QImage apply(QImage image, const Options &options);
+
+} // namespace PagePostProcess
@@ -0,0 +1,267 @@
+#include "PageTextIndex.h"
+#include "include/BackgroundPool.h"
+
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutexLocker>
+#include <QSaveFile>
+
+QDataStream &operator<<(QDataStream &out, const PageTextIndex::WordBox &word) {
+  return out << word.start << word.length << word.line << word.left << word.top << word.right
+             << word.bottom;
+}
+
+QDataStream &operator>>(QDataStream &in, PageTextIndex::WordBox &word) {
+  return in >> word.start >> word.length >> word.line >> word.left >> word.top >> word.right >>
+         word.bottom;
+}
+
+namespace {
+const QString kPageSeparator = QStringLiteral("\n\n");
+constexpr quint32 kIndexVersion = 3;
+
+QThreadPool *textPool() {
+  static QThreadPool *pool = makeBackgroundPool();
+  return pool;
+}
+} // namespace
+
+PageTextIndex::PageTextIndex(quint32 magic,
+                             QString indexPath,
+                             const QString &sourcePath,
+                             int pageCount,
+                             Extractor extract)
+    : m_magic(magic), m_indexPath(std::move(indexPath)), m_pageCount(pageCount),
+      m_extract(std::move(extract)) {
+  const QFileInfo source(sourcePath);
+  m_sourceSize = source.size();
+  m_sourceModified = source.lastModified().toMSecsSinceEpoch();
+  m_pageTexts.resize(pageCount);
+  m_pageKnown.resize(pageCount);
+  m_pageWords.resize(pageCount);
+}
+
+bool PageTextIndex::load() {
+  QFile file(m_indexPath);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  QDataStream in(&file);
+  quint32 magic = 0;
+  quint32 version = 0;
+  qint64 sourceSize = 0;
+  qint64 sourceModified = 0;
+  qint32 pageCount = 0;
+  QVector<qint32> starts;
+  QString text;
+  QVector<QVector<WordBox>> words;
+  in >> magic >> version;
+  if (in.status() != QDataStream::Ok || magic != m_magic || version != kIndexVersion) {
+    return false;
+  }
+  in >> sourceSize >> sourceModified >> pageCount >> starts >> text >> words;
+  if (in.status() != QDataStream::Ok || sourceSize != m_sourceSize ||
+      sourceModified != m_sourceModified || pageCount != m_pageCount ||
+      starts.size() != pageCount + 1 || starts.last() != text.size() + kPageSeparator.size() ||
+      words.size() != pageCount) {
+    return false;
+  }
+  QMutexLocker locker(&m_mutex);
+  m_text = std::move(text);
+  m_pageStarts = std::move(starts);
+  m_pageWords = std::move(words);
+  m_pageTexts.clear();
+  m_pageKnown.clear();
+  m_complete = true;
+  return true;
+}
+
+void PageTextIndex::save() const {
+  QDir().mkpath(QFileInfo(m_indexPath).absolutePath());
+  QSaveFile file(m_indexPath);
+  if (!file.open(QIODevice::WriteOnly)) {
+    return;
+  }
+  QDataStream out(&file);
+  {
+    QMutexLocker locker(&m_mutex);
+    out << m_magic << kIndexVersion << m_sourceSize << m_sourceModified
+        << static_cast<qint32>(m_pageCount) << m_pageStarts << m_text << m_pageWords;
+  }
+  if (!file.commit()) {
+    qWarning() << "PageTextIndex: could not write" << m_indexPath;
+  }
+}
+
+QString PageTextIndex::pageText(int index) {
+  if (index < 0 || index >= m_pageCount) {
+    return {};
+  }
+  {
+    QMutexLocker locker(&m_mutex);
+    if (m_complete) {
+      const qint32 start = m_pageStarts.at(index);
+      return m_text.mid(start, m_pageStarts.at(index + 1) - start - kPageSeparator.size());
+    }
+    if (m_stopped) {
+      return {};
+    }
+    if (m_pageKnown.testBit(index)) {
+      return m_pageTexts.at(index);
+    }
+  }
+  Page page = m_extract(index, m_cancel);
+  QMutexLocker locker(&m_mutex);
+  if (!m_complete && !m_pageKnown.testBit(index)) {
+    m_pageTexts[index] = page.text;
+    m_pageWords[index] = std::move(page.words);
+    m_pageKnown.setBit(index);
+  }
+  return page.text;
+}
+
+QVector<PageTextIndex::WordBox> PageTextIndex::pageWords(int index) {
+  pageText(index);
+  QMutexLocker locker(&m_mutex);
+  return m_pageWords.value(index);
+}
+
+bool PageTextIndex::isIndexed(int index) const {
+  if (index < 0 || index >= m_pageCount) {
+    return true;
+  }
+  QMutexLocker locker(&m_mutex);
+  return m_complete || m_stopped || m_pageKnown.testBit(index);
+}
+
+void PageTextIndex::request(int index, std::function<void(int)> callback) {
+  {
+    QMutexLocker locker(&m_mutex);
+    if (m_stopped) {
+      return;
+    }
+    if (!m_complete) {
+      m_requests.append({index, std::move(callback)});
+      callback = nullptr;
+    }
+  }
+  if (callback) {
+    callback(index);
+    return;
+  }
+  start();
+}
+
+QString PageTextIndex::text() const {
+  QMutexLocker locker(&m_mutex);
+  return m_complete ? m_text : QString();
+}
+
+bool PageTextIndex::isComplete() const {
+  QMutexLocker locker(&m_mutex);
+  return m_complete;
+}
+
+qint64 PageTextIndex::memoryCost() const {
+  QMutexLocker locker(&m_mutex);
+  qint64 words = 0;
+  for (const QVector<WordBox> &page : m_pageWords) {
+    words += page.size();
+  }
+  qint64 text = m_text.size();
+  for (const QString &page : m_pageTexts) {
+    text += page.size();
+  }
+  return text * 2 + words * static_cast<qint64>(sizeof(WordBox));
+}
+
+void PageTextIndex::start() {
+  {
+    QMutexLocker locker(&m_mutex);
+    if (m_complete || m_started || m_stopped) {
+      return;
+    }
+    m_started = true;
+  }
+  textPool()->start([self = shared_from_this()]() { self->runPass(); });
+}
+
+void PageTextIndex::setCompletionCallback(std::function<void()> callback) {
+  QMutexLocker locker(&m_mutex);
+  m_onComplete = std::move(callback);
+}
+
+void PageTextIndex::stop() {
+  m_cancel.cancel();
+  QMutexLocker locker(&m_mutex);
+  m_stopped = true;
+  m_onComplete = nullptr;
+  m_requests.clear();
+}
+
+void PageTextIndex::runPass() {
+  int next = 0;
+  for (;;) {
+    Request request{-1, nullptr};
+    {
+      QMutexLocker locker(&m_mutex);
+      if (m_stopped) {
+        return;
+      }
+      if (!m_requests.isEmpty()) {
+        request = m_requests.takeFirst();
+      } else {
+        while (next < m_pageCount && m_pageKnown.testBit(next)) {
+          ++next;
+        }
+        if (next == m_pageCount) {
+          break;
+        }
+        request.index = next;
+      }
+    }
+    pageText(request.index);
+    if (request.callback) {
+      request.callback(request.index);
+    }
+  }
+
+  std::function<void()> callback;
+  QVector<Request> late;
+  {
+    QMutexLocker locker(&m_mutex);
+    if (m_stopped) {
+      return;
+    }
+    QString text;
+    QVector<qint32> starts;
+    starts.reserve(m_pageCount + 1);
+    for (const QString &page : std::as_const(m_pageTexts)) {
+      starts.append(text.size());
+      text += page;
+      text += kPageSeparator;
+    }
+    starts.append(text.size());
+    text.chop(kPageSeparator.size());
+    m_text = std::move(text);
+    m_pageStarts = std::move(starts);
+    m_pageTexts.clear();
+    m_pageKnown.clear();
+    m_complete = true;
+    callback = m_onComplete;
+    late.swap(m_requests);
+  }
+  save();
+  for (const Request &request : std::as_const(late)) {
+    if (request.callback) {
+      request.callback(request.index);
+    }
+  }
+  if (callback) {
+    callback();
+  }
+}
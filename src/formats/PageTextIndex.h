@@ -0,0 +1,101 @@
+#pragma once
+
+#include "include/CancelToken.h"
+
+#include <QBitArray>
+#include <QMutex>
+#include <QString>
+#include <QVector>
+#include <functional>
+#include <memory>
+
+// Text layer of a paged document (PDF, DjVu). Pages are extracted on demand
+// and by one low-priority background pass. While it runs, the pages seen so
+// far are kept one by one; once every page is in, the text is kept as one
+// string plus page offsets and written to `indexPath` so the next open skips
+// extraction. Thread-safe; create with std::make_shared.
+class PageTextIndex : public std::enable_shared_from_this<PageTextIndex> {
+public:
+  // One word, 16 bytes: offsets into the page text and the box in 1/65535 of
+  // the unrotated page, top-left origin.
+  struct WordBox {
+    qint32 start = 0;
+    quint16 length = 0;
+    quint16 line = 0;
+    quint16 left = 0;
+    quint16 top = 0;
+    quint16 right = 0;
+    quint16 bottom = 0;
+  };
+
+  struct Page {
+    QString text;
+    // Empty when the format has no positions.
+    QVector<WordBox> words;
+  };
+
+  // Called from the background pass and from pageText callers, so it either
+  // is thread-safe or serializes itself. `cancel` fires when the index stops.
+  using Extractor = std::function<Page(int index, const CancelToken &cancel)>;
+
+  // `magic` tells the formats' index files apart. The saved index records
+  // the size and mtime of `sourcePath`, since the asset directory it lives
+  // in only fingerprints samples of the file.
+  PageTextIndex(quint32 magic,
+                QString indexPath,
+                const QString &sourcePath,
+                int pageCount,
+                Extractor extract);
+
+  // Reads the saved index; false when it is missing or was built from
+  // another version of the source file.
+  bool load();
+  // Extracts the page now if the background pass has not reached it yet.
+  QString pageText(int index);
+  QVector<WordBox> pageWords(int index);
+  // True when pageText(index) returns without extracting.
+  bool isIndexed(int index) const;
+  // Moves page `index` to the front of the background pass (starting it if
+  // needed); `callback` gets the index on the pass thread once it is in.
+  void request(int index, std::function<void(int)> callback);
+  // Empty until every page is in.
+  QString text() const;
+  bool isComplete() const;
+  qint64 memoryCost() const;
+
+  // Starts the background pass once; `callback` runs on its thread when the
+  // pass completes.
+  void start();
+  void setCompletionCallback(std::function<void()> callback);
+  // Ends the pass at the next page and drops the callback.
+  void stop();
+
+private:
+  struct Request {
+    int index = 0;
+    std::function<void(int)> callback;
+  };
+
+  void runPass();
+  void save() const;
+
+  const quint32 m_magic;
+  const QString m_indexPath;
+  qint64 m_sourceSize = 0;
+  qint64 m_sourceModified = 0;
+  const int m_pageCount;
+  const Extractor m_extract;
+  const CancelToken m_cancel;
+
+  mutable QMutex m_mutex;
+  bool m_started = false;
+  bool m_stopped = false;
+  bool m_complete = false;
+  QVector<QString> m_pageTexts;
+  QBitArray m_pageKnown;
+  QVector<QVector<WordBox>> m_pageWords;
+  QString m_text;
+  QVector<qint32> m_pageStarts;
+  QVector<Request> m_requests;
+  std::function<void()> m_onComplete;
+};
@@ -0,0 +1,502 @@
+#include "ParsedBookCache.h"
+#include "../core/include/AppPaths.h"
+#include "include/BackgroundPool.h"
+
+#include <QCryptographicHash>
+#include <QDataStream>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QRegularExpression>
+#include <QSaveFile>
+#include <QSemaphore>
+#include <QHash>
+#include <QSet>
+#include <QSettings>
+#include <QStandardPaths>
+#include <QSysInfo>
+#include <QThreadPool>
+#include <QUrl>
+#include <algorithm>
+
+namespace {
+constexpr quint32 kMagic = 0x45504243; // "EPBC"
+constexpr quint32 kFileVersion = 2;
+// Bump whenever the EPUB/MOBI/FB2 converters change their output.
+constexpr quint32 kConverterVersion = 1;
+// magic + file version + header length
+constexpr qint64 kPrefixSize = 16;
+
+int clampInt(int value, int minValue, int maxValue) {
+  return std::max(minValue, std::min(maxValue, value));
+}
+
+struct CacheSettings {
+  bool enabled = true;
+  qint64 quotaBytes = 256LL * 1024 * 1024;
+};
+
+CacheSettings loadCacheSettings() {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  CacheSettings out;
+  out.enabled = settings.value("cache/parsed_books", true).toBool();
+  out.quotaBytes =
+      static_cast<qint64>(clampInt(settings.value("cache/parsed_books_mb", 256).toInt(), 16, 4096)) *
+      1024 * 1024;
+  return out;
+}
+
+QString cacheDir() {
+  return QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation))
+      .filePath("parsed_books");
+}
+
+QString cacheFileFor(const QFileInfo &info) {
+  const QString key = QString("%1|%2|%3")
+                          .arg(info.absoluteFilePath())
+                          .arg(info.size())
+                          .arg(info.lastModified().toMSecsSinceEpoch());
+  const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
+  return QDir(cacheDir()).filePath(QString("%1.bin").arg(QString::fromUtf8(hash)));
+}
+
+// Hash of the render/ keys in the per-format ini the provider reads.
+QByteArray settingsFingerprint(const QString &format) {
+  QSettings settings(AppPaths::configFile(QString("%1.ini").arg(format)), QSettings::IniFormat);
+  QStringList keys = settings.allKeys();
+  keys.sort();
+  QCryptographicHash hash(QCryptographicHash::Sha1);
+  for (const QString &key : keys) {
+    if (!key.startsWith("render/")) {
+      continue;
+    }
+    hash.addData(key.toUtf8());
+    hash.addData(QByteArrayView("="));
+    hash.addData(settings.value(key).toString().toUtf8());
+    hash.addData(QByteArrayView("\n"));
+  }
+  return hash.result();
+}
+
+QStringList referencedAssets(const QString &html) {
+  static const QRegularExpression srcRe("src=\"(file:[^\"]+)\"");
+  QStringList out;
+  auto it = srcRe.globalMatch(html);
+  while (it.hasNext()) {
+    const QString local = QUrl(it.next().captured(1)).toLocalFile();
+    if (!local.isEmpty()) {
+      out.append(local);
+    }
+  }
+  return out;
+}
+
+// Offsets are in bytes from the start of the text area; lengths are in UTF-16 units.
+struct CachedChapter {
+  qint64 htmlOffset = 0;
+  qint64 htmlLength = 0;
+  qint64 plainOffset = 0;
+  qint64 plainLength = 0;
+};
+
+struct CachedBook {
+  QString title;
+  QString authors;
+  QString series;
+  QString publisher;
+  QString description;
+  QString coverPath;
+  bool richText = false;
+  bool ttsDisabled = false;
+  QStringList chapterTitles;
+  QStringList chapterKeys;
+  QStringList tocTitles;
+  QVector<int> tocIndices;
+  QStringList assets;
+  QVector<CachedChapter> chapters;
+};
+
+class CachedBookDocument final : public FormatDocument {
+public:
+  CachedBookDocument(std::unique_ptr<QFile> file, const uchar *text, CachedBook book)
+      : m_file(std::move(file)), m_text(text), m_book(std::move(book)) {}
+
+  QString title() const override { return m_book.title; }
+  QStringList chapterTitles() const override { return m_book.chapterTitles; }
+  QString readAllText() const override { return joinChapters(false); }
+  QString readAllPlainText() const override { return joinChapters(true); }
+  QStringList chaptersText() const override {
+    QStringList out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      out.append(chapterText(i));
+    }
+    return out;
+  }
+  QStringList chaptersPlainText() const override {
+    QStringList out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      out.append(chapterPlainText(i));
+    }
+    return out;
+  }
+  int chapterCount() const override { return m_book.chapters.size(); }
+  QString chapterText(int index) const override {
+    if (index < 0 || index >= m_book.chapters.size()) {
+      return {};
+    }
+    const CachedChapter &chapter = m_book.chapters.at(index);
+    return textAt(chapter.htmlOffset, chapter.htmlLength);
+  }
+  QString chapterPlainText(int index) const override {
+    if (index < 0 || index >= m_book.chapters.size()) {
+      return {};
+    }
+    const CachedChapter &chapter = m_book.chapters.at(index);
+    return textAt(chapter.plainOffset, chapter.plainLength);
+  }
+  QString chapterKey(int index) const override { return m_book.chapterKeys.value(index); }
+  int chapterIndexForKey(const QString &key) const override {
+    return key.isEmpty() ? -1 : static_cast<int>(m_book.chapterKeys.indexOf(key));
+  }
+  QString coverPath() const override { return m_book.coverPath; }
+  QString authors() const override { return m_book.authors; }
+  QString series() const override { return m_book.series; }
+  QString publisher() const override { return m_book.publisher; }
+  QString description() const override { return m_book.description; }
+  QStringList tocTitles() const override { return m_book.tocTitles; }
+  QVector<int> tocChapterIndices() const override { return m_book.tocIndices; }
+  bool isRichText() const override { return m_book.richText; }
+  bool ttsDisabled() const override { return m_book.ttsDisabled; }
+  qint64 approximateMemoryCost() const override { return m_file->size(); }
+
+private:
+  QString textAt(qint64 offset, qint64 length) const {
+    return QString(reinterpret_cast<const QChar *>(m_text + offset), static_cast<qsizetype>(length));
+  }
+
+  QString joinChapters(bool plain) const {
+    QString out;
+    for (int i = 0; i < chapterCount(); ++i) {
+      if (!out.isEmpty()) {
+        out.append("\n\n");
+      }
+      out.append(plain ? chapterPlainText(i) : chapterText(i));
+    }
+    return out;
+  }
+
+  // Owns the mapping that m_text points into.
+  std::unique_ptr<QFile> m_file;
+  const uchar *m_text = nullptr;
+  CachedBook m_book;
+};
+
+void writeBookHeader(QDataStream &out, const QFileInfo &info, const QString &format,
+                     const CachedBook &book) {
+  out << kConverterVersion
+      << static_cast<quint8>(QSysInfo::ByteOrder)
+      << settingsFingerprint(format)
+      << info.absoluteFilePath()
+      << static_cast<qint64>(info.size())
+      << static_cast<qint64>(info.lastModified().toMSecsSinceEpoch())
+      << book.title << book.authors << book.series << book.publisher << book.description
+      << book.coverPath << book.richText << book.ttsDisabled
+      << book.chapterTitles << book.chapterKeys << book.tocTitles << book.tocIndices
+      << book.assets;
+  out << static_cast<quint32>(book.chapters.size());
+  for (const CachedChapter &chapter : book.chapters) {
+    out << chapter.htmlOffset << chapter.htmlLength << chapter.plainOffset << chapter.plainLength;
+  }
+}
+
+bool readBookHeader(QDataStream &in, const QFileInfo &info, const QString &format,
+                    CachedBook *book) {
+  quint32 converterVersion = 0;
+  quint8 byteOrder = 0;
+  QByteArray fingerprint;
+  QString sourcePath;
+  qint64 size = -1;
+  qint64 modified = -1;
+  in >> converterVersion >> byteOrder >> fingerprint >> sourcePath >> size >> modified;
+  if (in.status() != QDataStream::Ok || converterVersion != kConverterVersion ||
+      byteOrder != static_cast<quint8>(QSysInfo::ByteOrder) ||
+      sourcePath != info.absoluteFilePath() || size != info.size() ||
+      modified != info.lastModified().toMSecsSinceEpoch()) {
+    return false;
+  }
+  if (fingerprint != settingsFingerprint(format)) {
+    qInfo() << "ParsedBookCache: render settings changed for" << info.fileName();
+    return false;
+  }
+  in >> book->title >> book->authors >> book->series >> book->publisher >> book->description
+     >> book->coverPath >> book->richText >> book->ttsDisabled
+     >> book->chapterTitles >> book->chapterKeys >> book->tocTitles >> book->tocIndices
+     >> book->assets;
+  quint32 chapterCount = 0;
+  in >> chapterCount;
+  if (in.status() != QDataStream::Ok) {
+    return false;
+  }
+  book->chapters.reserve(static_cast<qsizetype>(chapterCount));
+  for (quint32 i = 0; i < chapterCount; ++i) {
+    CachedChapter chapter;
+    in >> chapter.htmlOffset >> chapter.htmlLength >> chapter.plainOffset >> chapter.plainLength;
+    book->chapters.append(chapter);
+  }
+  return in.status() == QDataStream::Ok;
+}
+
+bool chapterInRange(qint64 offset, qint64 length, qint64 textSize) {
+  return offset >= 0 && length >= 0 && offset % 2 == 0 && offset + length * 2 <= textSize;
+}
+
+// Drops the least recently used entries until the directory fits the quota.
+void enforceQuota(qint64 quotaBytes) {
+  QFileInfoList entries = QDir(cacheDir()).entryInfoList({"*.bin"}, QDir::Files);
+  qint64 total = 0;
+  for (const QFileInfo &entry : entries) {
+    total += entry.size();
+  }
+  if (total <= quotaBytes) {
+    return;
+  }
+  std::sort(entries.begin(), entries.end(), [](const QFileInfo &a, const QFileInfo &b) {
+    return a.lastModified() < b.lastModified();
+  });
+  for (const QFileInfo &entry : entries) {
+    if (total <= quotaBytes) {
+      break;
+    }
+    if (QFile::remove(entry.absoluteFilePath())) {
+      total -= entry.size();
+    }
+  }
+}
+
+bool storeBook(const QFileInfo &info, const QString &format, const QString &cachePath,
+               FormatDocument &doc, qint64 quotaBytes, const CancelToken &cancel) {
+  CachedBook book;
+  book.title = doc.title();
+  book.authors = doc.authors();
+  book.series = doc.series();
+  book.publisher = doc.publisher();
+  book.description = doc.description();
+  book.coverPath = doc.coverPath();
+  book.richText = doc.isRichText();
+  book.ttsDisabled = doc.ttsDisabled();
+  book.chapterTitles = doc.chapterTitles();
+  book.tocTitles = doc.tocTitles();
+  book.tocIndices = doc.tocChapterIndices();
+
+  const int count = doc.chapterCount();
+  QStringList html;
+  QStringList plain;
+  QSet<QString> assets;
+  qint64 textSize = 0;
+  for (int i = 0; i < count; ++i) {
+    if (cancel.isCancelled()) {
+      return false;
+    }
+    html.append(doc.chapterText(i));
+    plain.append(doc.chapterPlainText(i));
+    book.chapterKeys.append(doc.chapterKey(i));
+    const QStringList referenced = referencedAssets(html.last());
+    for (const QString &asset : referenced) {
+      assets.insert(asset);
+    }
+    CachedChapter chapter;
+    chapter.htmlOffset = textSize;
+    chapter.htmlLength = html.last().size();
+    textSize += chapter.htmlLength * 2;
+    chapter.plainOffset = textSize;
+    chapter.plainLength = plain.last().size();
+    textSize += chapter.plainLength * 2;
+    book.chapters.append(chapter);
+  }
+  if (textSize > quotaBytes) {
+    return false;
+  }
+  if (!book.coverPath.isEmpty()) {
+    assets.insert(book.coverPath);
+  }
+  book.assets = QStringList(assets.begin(), assets.end());
+
+  QByteArray header;
+  {
+    QDataStream out(&header, QIODevice::WriteOnly);
+    out.setVersion(QDataStream::Qt_6_0);
+    writeBookHeader(out, info, format, book);
+  }
+  // Keep the text area 8-byte aligned so mapped UTF-16 is read in place.
+  header.append(QByteArray((8 - header.size() % 8) % 8, '\0'));
+
+  QDir().mkpath(cacheDir());
+  QSaveFile file(cachePath);
+  if (!file.open(QIODevice::WriteOnly)) {
+    return false;
+  }
+  {
+    QDataStream prefix(&file);
+    prefix << kMagic << kFileVersion << static_cast<quint64>(header.size());
+  }
+  file.write(header);
+  for (int i = 0; i < count; ++i) {
+    file.write(reinterpret_cast<const char *>(html.at(i).utf16()), html.at(i).size() * 2);
+    file.write(reinterpret_cast<const char *>(plain.at(i).utf16()), plain.at(i).size() * 2);
+  }
+  if (!file.commit()) {
+    return false;
+  }
+  qInfo() << "ParsedBookCache: stored" << info.fileName() << "chapters" << count
+          << "bytes" << (kPrefixSize + header.size() + textSize);
+  enforceQuota(quotaBytes);
+  return true;
+}
+
+QMutex &pendingMutex() {
+  static QMutex mutex;
+  return mutex;
+}
+
+// A queued or running build; cancelling it also wakes a job waiting for the
+// document to finish loading.
+struct PendingBuild {
+  CancelToken cancel;
+  std::shared_ptr<QSemaphore> wake = std::make_shared<QSemaphore>();
+};
+
+// Keyed by cache file.
+QHash<QString, PendingBuild> &pendingBuilds() {
+  static QHash<QString, PendingBuild> pending;
+  return pending;
+}
+
+QThreadPool *buildPool() {
+  static QThreadPool *pool = makeBackgroundPool();
+  return pool;
+}
+} // namespace
+
+namespace ParsedBookCache {
+
+bool handles(const QString &extension) {
+  const QString ext = extension.toLower();
+  return ext == "epub" || ext == "fb2" || ext == "mobi" || ext == "azw" || ext == "azw3" ||
+         ext == "azw4" || ext == "prc";
+}
+
+std::unique_ptr<FormatDocument> load(const QString &path, const QString &format) {
+  const QFileInfo info(path);
+  if (!handles(format) || !loadCacheSettings().enabled) {
+    return nullptr;
+  }
+  auto file = std::make_unique<QFile>(cacheFileFor(info));
+  if (!file->open(QIODevice::ReadOnly) || file->size() < kPrefixSize) {
+    return nullptr;
+  }
+  const qint64 fileSize = file->size();
+  const uchar *base = file->map(0, fileSize);
+  if (!base) {
+    return nullptr;
+  }
+
+  quint32 magic = 0;
+  quint32 version = 0;
+  quint64 headerSize = 0;
+  {
+    QDataStream prefix(QByteArray::fromRawData(reinterpret_cast<const char *>(base), kPrefixSize));
+    prefix >> magic >> version >> headerSize;
+  }
+  if (magic != kMagic || version != kFileVersion ||
+      headerSize > static_cast<quint64>(fileSize - kPrefixSize)) {
+    return nullptr;
+  }
+
+  CachedBook book;
+  {
+    QDataStream in(QByteArray::fromRawData(reinterpret_cast<const char *>(base + kPrefixSize),
+                                           static_cast<qsizetype>(headerSize)));
+    in.setVersion(QDataStream::Qt_6_0);
+    if (!readBookHeader(in, info, format, &book)) {
+      return nullptr;
+    }
+  }
+  const qint64 textStart = kPrefixSize + static_cast<qint64>(headerSize);
+  const qint64 textSize = fileSize - textStart;
+  for (const CachedChapter &chapter : book.chapters) {
+    if (!chapterInRange(chapter.htmlOffset, chapter.htmlLength, textSize) ||
+        !chapterInRange(chapter.plainOffset, chapter.plainLength, textSize)) {
+      qWarning() << "ParsedBookCache: corrupt entry for" << info.fileName();
+      return nullptr;
+    }
+  }
+  // Converted HTML points at extracted images; a cleared temp dir makes the entry stale.
+  for (const QString &asset : book.assets) {
+    if (!QFileInfo::exists(asset)) {
+      qInfo() << "ParsedBookCache: asset missing, reparsing" << info.fileName();
+      return nullptr;
+    }
+  }
+  if (book.chapters.isEmpty()) {
+    return nullptr;
+  }
+
+  file->setFileTime(QDateTime::currentDateTime(), QFileDevice::FileModificationTime);
+  qInfo() << "ParsedBookCache: hit" << info.fileName() << "chapters" << book.chapters.size();
+  const uchar *text = base + textStart;
+  return std::make_unique<CachedBookDocument>(std::move(file), text, std::move(book));
+}
+
+void storeInBackground(const QString &path,
+                       const QString &format,
+                       std::function<std::unique_ptr<FormatDocument>(const CancelToken &)> open) {
+  const CacheSettings settings = loadCacheSettings();
+  const QFileInfo info(path);
+  if (!settings.enabled || !open || !handles(format)) {
+    return;
+  }
+  const QString cachePath = cacheFileFor(info);
+  PendingBuild build;
+  {
+    QMutexLocker locker(&pendingMutex());
+    if (pendingBuilds().contains(cachePath)) {
+      return;
+    }
+    pendingBuilds().insert(cachePath, build);
+  }
+
+  buildPool()->start([info, format, cachePath, settings, open, build]() {
+    std::unique_ptr<FormatDocument> doc = build.cancel.isCancelled() ? nullptr : open(build.cancel);
+    if (doc && doc->imagePaths().isEmpty()) {
+      // Wait for providers that keep discovering chapters after open returns.
+      doc->setStructureChangedCallback([wake = build.wake]() { wake->release(); });
+      while (doc->isLoading() && !build.cancel.isCancelled()) {
+        build.wake->acquire();
+      }
+      doc->setStructureChangedCallback(nullptr);
+      if (!build.cancel.isCancelled() && doc->chapterCount() > 0 &&
+          !storeBook(info, format, cachePath, *doc, settings.quotaBytes, build.cancel) &&
+          !build.cancel.isCancelled()) {
+        qWarning() << "ParsedBookCache: could not store" << info.fileName();
+      }
+    }
+    QMutexLocker locker(&pendingMutex());
+    pendingBuilds().remove(cachePath);
+  });
+}
+
+void cancelBuild(const QString &path) {
+  QMutexLocker locker(&pendingMutex());
+  const auto it = pendingBuilds().constFind(cacheFileFor(QFileInfo(path)));
+  if (it == pendingBuilds().constEnd()) {
+    return;
+  }
+  it->cancel.cancel();
+  it->wake->release();
+}
+
+} // namespace ParsedBookCache
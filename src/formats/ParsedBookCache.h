@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QString>
+#include <functional>
+#include <memory>
+
+#include "include/CancelToken.h"
+#include "include/FormatDocument.h"
+
+// On-disk cache of converted EPUB/MOBI/FB2 books (chapter HTML, plain text,
+// TOC, metadata and referenced assets). Entries are keyed by path+size+mtime
+// and memory-mapped on reopen, so a cached book opens without parsing.
+namespace ParsedBookCache {
+
+bool handles(const QString &format);
+
+// Returns nullptr on a miss or when the entry is stale (converter version,
+// render settings or a referenced asset changed).
+// `format` is the detected format key; it selects the <format>.ini whose render
+// settings are fingerprinted.
+std::unique_ptr<FormatDocument> load(const QString &path, const QString &format);
+
+// Converts the whole book with `open` on a lowest-priority background thread
+// and writes the entry. `open` should stop early once its token is cancelled.
+void storeInBackground(const QString &path,
+                       const QString &format,
+                       std::function<std::unique_ptr<FormatDocument>(const CancelToken &)> open);
+
+// Abandons a queued or running build for `path`.
+void cancelBuild(const QString &path);
+
+} // namespace ParsedBookCache
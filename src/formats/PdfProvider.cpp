@@ -1,5 +1,13 @@
 #include "PdfProvider.h"
 #include "../core/include/AppPaths.h"
+#include "include/PageImageCache.h"
+#include "RenderScheduler.h"
+#include "include/AssetCache.h"
+#include "PagePostProcess.h"
+#include "PrefetchPlanner.h"
+#include "PageTextIndex.h"
+#include "TilePlanner.h"
+#include "CancelUtil.h"
 
 #ifdef HAVE_POPPLER_QT6
 #include <poppler-qt6.h>
@@ -10,29 +18,30 @@
 #include <QPdfSelection>
 #endif
 
-#include <QCryptographicHash>
 #include <QDir>
 #include <QFile>
 #include <QFileInfo>
 #include <QImage>
 #include <QPainter>
 #include <QSettings>
-#include <QStandardPaths>
 #include <QDebug>
+#include <QHash>
 #include <QList>
 #include <QMutex>
 #include <QMutexLocker>
 #include <QSet>
 #include <QColor>
+#include <QPointF>
 #include <QRect>
 #include <QSizeF>
 #include <QVariant>
+#include <QVector>
+#include <QThreadPool>
 #include <memory>
 #include <functional>
 #include <algorithm>
 #include <cmath>
-#include <QRunnable>
-#include <QThreadPool>
+#include <vector>
 
 namespace {
 QString settingsPath() {
@@ -49,24 +58,25 @@ int clampInt(int value, int minValue, int maxValue) {
 
 struct PdfSettings {
   int dpi = 120;
-  int cacheLimit = 30;
   int prefetchDistance = 1;
-  QString prefetchStrategy = "symmetric";
-  QString cachePolicy = "fifo";
+  int prefetchMax = 6;
+  QString prefetchStrategy = "adaptive";
   QString renderPreset = "custom";
   bool antialias = true;
   bool textAntialias = true;
   QString colorMode = "color";
   QString backgroundMode = "white";
   QColor backgroundColor = QColor("#202633");
+  PagePostProcess::Tint tint = PagePostProcess::Tint::None;
+  double gamma = 1.0;
   int maxWidth = 0;
   int maxHeight = 0;
-  QString imageFormat = "png";
-  int jpegQuality = 85;
   bool extractText = true;
   int tileSize = 0;
   bool progressive = false;
   int progressiveDpi = 72;
+  bool zoomTiles = true;
+  bool fitToView = true;
 };
 
 PdfSettings loadPdfSettings() {
@@ -95,17 +105,13 @@ PdfSettings loadPdfSettings() {
     out.textAntialias = true;
   }
 
-  out.cacheLimit = clampInt(
-      formatSettings.value("render/cache_limit", legacySettings.value("pdf/cache_limit", 30)).toInt(), 5, 120);
   out.prefetchDistance = clampInt(formatSettings.value("render/prefetch_distance", 1).toInt(), 0, 6);
-  out.prefetchStrategy = formatSettings.value("render/prefetch_strategy", "symmetric").toString().toLower();
+  out.prefetchMax =
+      clampInt(formatSettings.value("render/prefetch_max", 6).toInt(), out.prefetchDistance, 12);
+  out.prefetchStrategy = formatSettings.value("render/prefetch_strategy", "adaptive").toString().toLower();
   if (out.prefetchStrategy != "forward" && out.prefetchStrategy != "symmetric" &&
-      out.prefetchStrategy != "backward") {
-    out.prefetchStrategy = "symmetric";
-  }
-  out.cachePolicy = formatSettings.value("render/cache_policy", "fifo").toString().toLower();
-  if (out.cachePolicy != "fifo" && out.cachePolicy != "lru") {
-    out.cachePolicy = "fifo";
+      out.prefetchStrategy != "backward" && out.prefetchStrategy != "adaptive") {
+    out.prefetchStrategy = "adaptive";
   }
   out.colorMode = formatSettings.value("render/color_mode", "color").toString().toLower();
   if (out.colorMode != "color" && out.colorMode != "grayscale") {
@@ -121,45 +127,42 @@ PdfSettings loadPdfSettings() {
   if (!out.backgroundColor.isValid()) {
     out.backgroundColor = QColor("#202633");
   }
+  out.tint = PagePostProcess::parseTint(formatSettings.value("render/tint", "none").toString());
+  out.gamma = std::clamp(formatSettings.value("render/gamma", 1.0).toDouble(), 0.5, 3.0);
   out.maxWidth = clampInt(formatSettings.value("render/max_width", 0).toInt(), 0, 20000);
   out.maxHeight = clampInt(formatSettings.value("render/max_height", 0).toInt(), 0, 20000);
-  out.imageFormat = formatSettings.value("render/image_format", "png").toString().toLower();
-  if (out.imageFormat == "jpg") {
-    out.imageFormat = "jpeg";
-  }
-  if (out.imageFormat != "png" && out.imageFormat != "jpeg") {
-    out.imageFormat = "png";
-  }
-  out.jpegQuality = clampInt(formatSettings.value("render/jpeg_quality", 85).toInt(), 1, 100);
   out.extractText = formatSettings.value("render/extract_text", true).toBool();
   out.tileSize = clampInt(formatSettings.value("render/tile_size", 0).toInt(), 0, 8192);
   out.progressive = formatSettings.value("render/progressive", false).toBool();
   out.progressiveDpi = clampInt(formatSettings.value("render/progressive_dpi", 72).toInt(), 48, out.dpi);
+  out.zoomTiles = formatSettings.value("render/zoom_tiles", true).toBool();
+  out.fitToView = formatSettings.value("render/fit_to_view", true).toBool();
   return out;
 }
 
-class PdfRunnable final : public QRunnable {
-public:
-  explicit PdfRunnable(std::function<void()> task) : m_task(std::move(task)) {}
-  void run() override {
-    if (m_task) {
-      m_task();
+PagePostProcess::Options pageColors(const PdfSettings &settings) {
+  PagePostProcess::Options out;
+  if (settings.backgroundMode != "transparent") {
+    out.background = Qt::white;
+    if ((settings.backgroundMode == "theme" || settings.backgroundMode == "custom") &&
+        settings.backgroundColor.isValid()) {
+      out.background = settings.backgroundColor;
     }
   }
-
-private:
-  std::function<void()> m_task;
-};
-
-void runPdfTask(std::function<void()> task) {
-  auto *runnable = new PdfRunnable(std::move(task));
-  runnable->setAutoDelete(true);
-  QThreadPool::globalInstance()->start(runnable);
+  out.grayscale = settings.colorMode == "grayscale";
+  out.tint = settings.tint;
+  out.gamma = settings.gamma;
+  return out;
 }
 
 struct PdfRenderState {
 #ifdef HAVE_POPPLER_QT6
+  // Opened by PdfProvider::open for text and metadata; render workers lease
+  // their own instances from renderDocs instead of sharing it.
   std::unique_ptr<Poppler::Document> doc;
+  QString sourcePath;
+  std::vector<std::unique_ptr<Poppler::Document>> renderDocs;
+  int workerThreads = 2;
 #elif defined(HAVE_QT_PDF)
   std::unique_ptr<QPdfDocument> doc;
   QMutex renderMutex;
@@ -168,55 +171,219 @@ struct PdfRenderState {
 #endif
   QStringList images;
   QString tempDir;
-  int cacheLimit = 30;
+  // Rendered pages live in PageImageCache under this id; tempDir only holds
+  // the text index.
+  QString imageId = PageImageCache::newDocumentId("pdf");
+  qint64 sourceBytes = 0;
   double renderDpi = 120.0;
   double progressiveDpi = 72.0;
-  int prefetchDistance = 1;
-  QString prefetchStrategy = "symmetric";
-  QString cachePolicy = "fifo";
+  // Pages around the focus to render; guarded by mutex.
+  PrefetchPlanner prefetch;
   QString renderPreset = "custom";
   bool antialias = true;
   bool textAntialias = true;
   QString colorMode = "color";
-  QString backgroundMode = "white";
-  QColor backgroundColor = QColor("#202633");
+  // Background, grayscale, tint and gamma applied after every render.
+  PagePostProcess::Options colors;
   int maxWidth = 0;
   int maxHeight = 0;
-  QString imageFormat = "png";
-  int jpegQuality = 85;
   int tileSize = 0;
   bool progressive = false;
-  QSet<int> cached;
+  bool zoomTiles = true;
+  int zoomTileSize = 512;
+  // Device-pixel box the view shows pages in (PageImageCache::targetBucket);
+  // invalid until the view reports one, then renderDpi is only a fallback.
+  bool fitToView = true;
+  QSize targetSize;
+  QHash<int, QSize> renderedTarget;
+  QSet<QString> tilesInFlight;
+  int focusIndex = -1;
   QSet<int> highResCached;
-  QList<int> cacheOrder;
   QSet<int> inFlight;
   std::function<void(int)> onImageReady;
   QMutex mutex;
   bool alive = true;
+
+  // Null when render/extract_text is off.
+  std::shared_ptr<PageTextIndex> textIndex;
+  // Serializes text extraction on `doc`.
+  QMutex textMutex;
+};
+
+#ifdef HAVE_POPPLER_QT6
+// Poppler::Document is not thread-safe, so every render holds one document
+// exclusively. Instances are loaded lazily from the source path and returned
+// for reuse; the pool never keeps more than workerThreads of them.
+class PopplerLease {
+public:
+  explicit PopplerLease(std::shared_ptr<PdfRenderState> state) : m_state(std::move(state)) {
+    QString sourcePath;
+    bool antialias = true;
+    bool textAntialias = true;
+    {
+      QMutexLocker locker(&m_state->mutex);
+      if (!m_state->alive) {
+        return;
+      }
+      if (!m_state->renderDocs.empty()) {
+        m_doc = std::move(m_state->renderDocs.back());
+        m_state->renderDocs.pop_back();
+        return;
+      }
+      sourcePath = m_state->sourcePath;
+      antialias = m_state->antialias;
+      textAntialias = m_state->textAntialias;
+    }
+    m_doc = Poppler::Document::load(sourcePath);
+    if (!m_doc || m_doc->isLocked()) {
+      qWarning() << "PdfProvider: could not load render document" << sourcePath;
+      m_doc.reset();
+      return;
+    }
+    m_doc->setRenderHint(Poppler::Document::TextAntialiasing, textAntialias);
+    m_doc->setRenderHint(Poppler::Document::Antialiasing, antialias);
+  }
+
+  ~PopplerLease() {
+    if (!m_doc) {
+      return;
+    }
+    QMutexLocker locker(&m_state->mutex);
+    if (m_state->alive &&
+        static_cast<int>(m_state->renderDocs.size()) < m_state->workerThreads) {
+      m_state->renderDocs.push_back(std::move(m_doc));
+    }
+  }
+
+  PopplerLease(const PopplerLease &) = delete;
+  PopplerLease &operator=(const PopplerLease &) = delete;
+
+  Poppler::Document *get() const { return m_doc.get(); }
+
+private:
+  std::shared_ptr<PdfRenderState> m_state;
+  std::unique_ptr<Poppler::Document> m_doc;
 };
+#endif
+
+double dpiForTarget(const QSizeF &points, const QSize &target, double fallback) {
+  if (!target.isValid() || points.isEmpty()) {
+    return fallback;
+  }
+  double dpi = 0.0;
+  if (target.width() > 0) {
+    dpi = target.width() * 72.0 / points.width();
+  }
+  if (target.height() > 0) {
+    const double byHeight = target.height() * 72.0 / points.height();
+    dpi = dpi > 0.0 ? std::min(dpi, byHeight) : byHeight;
+  }
+  return dpi > 0.0 ? std::clamp(dpi, 36.0, 600.0) : fallback;
+}
+
+constexpr quint32 kTextIndexMagic = 0x50545849; // "PTXI"
+
+// Caller holds textMutex.
+QString extractPageText(PdfRenderState &state, int index) {
+#ifdef HAVE_POPPLER_QT6
+  std::unique_ptr<Poppler::Page> page(state.doc->page(index));
+  return page ? page->text(QRectF()) : QString();
+#elif defined(HAVE_QT_PDF)
+  QMutexLocker renderLock(&state.renderMutex);
+  return state.doc->getAllText(index).text();
+#else
+  Q_UNUSED(state)
+  Q_UNUSED(index)
+  return {};
+#endif
+}
+
+std::shared_ptr<PageTextIndex> makeTextIndex(const std::shared_ptr<PdfRenderState> &state,
+                                             const QString &sourcePath) {
+  auto index = std::make_shared<PageTextIndex>(
+      kTextIndexMagic, QDir(state->tempDir).filePath("text_index.bin"), sourcePath,
+      state->images.size(),
+      [weak = std::weak_ptr<PdfRenderState>(state)](int page,
+                                                     const CancelToken &) -> PageTextIndex::Page {
+        const std::shared_ptr<PdfRenderState> state = weak.lock();
+        if (!state) {
+          return {};
+        }
+        QMutexLocker locker(&state->textMutex);
+        return {extractPageText(*state, page), {}};
+      });
+  index->load();
+  return index;
+}
 
 class PdfDocument final : public FormatDocument {
 public:
-  PdfDocument(QString title,
-              QString text,
-              std::shared_ptr<PdfRenderState> state)
-      : m_title(std::move(title)),
-        m_text(std::move(text)),
-        m_state(std::move(state)) {}
+  PdfDocument(QString title, std::shared_ptr<PdfRenderState> state)
+      : m_title(std::move(title)), m_state(std::move(state)) {}
 
   ~PdfDocument() override {
     if (m_state) {
-      QMutexLocker locker(&m_state->mutex);
-      m_state->alive = false;
-      m_state->onImageReady = nullptr;
+      {
+        QMutexLocker locker(&m_state->mutex);
+        m_state->alive = false;
+        m_state->onImageReady = nullptr;
+      }
+      if (m_state->textIndex) {
+        m_state->textIndex->stop();
+      }
+      RenderScheduler::instance().cancelAll(m_state.get());
+      PageImageCache::instance().removeDocument(m_state->imageId);
     }
   }
 
   QString title() const override { return m_title; }
   QStringList chapterTitles() const override { return {}; }
-  QString readAllText() const override { return m_text; }
+  // Empty until the background text pass completes (see isLoading).
+  QString readAllText() const override {
+    if (!m_state || !m_state->textIndex) {
+      return {};
+    }
+    m_state->textIndex->start();
+    return m_state->textIndex->text();
+  }
+  QString pageText(int index) const override {
+    return m_state && m_state->textIndex ? m_state->textIndex->pageText(index) : QString();
+  }
+  bool isPageTextReady(int index) const override {
+    return !m_state || !m_state->textIndex || m_state->textIndex->isIndexed(index);
+  }
+  void requestPageText(int index, std::function<void(int)> callback) override {
+    if (m_state && m_state->textIndex) {
+      m_state->textIndex->request(index, std::move(callback));
+    } else if (callback) {
+      callback(index);
+    }
+  }
+  bool isLoading() const override {
+    return m_state && m_state->textIndex && !m_state->textIndex->isComplete();
+  }
+  void setStructureChangedCallback(std::function<void()> callback) override {
+    if (!m_state || !m_state->textIndex) {
+      return;
+    }
+    const bool start = static_cast<bool>(callback);
+    m_state->textIndex->setCompletionCallback(std::move(callback));
+    if (start) {
+      m_state->textIndex->start();
+    }
+  }
   QStringList imagePaths() const override { return m_state ? m_state->images : QStringList{}; }
-  bool ensureImage(int index) override {
+  QString pageImageKey(int index) const override {
+    return m_state ? PageImageCache::key(m_state->imageId, index) : QString();
+  }
+  qint64 approximateMemoryCost() const override {
+    // The backend keeps the parsed file around; rendered pages are budgeted by PageImageCache.
+    if (!m_state) {
+      return 0;
+    }
+    return (m_state->textIndex ? m_state->textIndex->memoryCost() : 0) + m_state->sourceBytes;
+  }
+  bool ensureImage(int index, const QSize &targetSize) override {
     if (!m_state) {
       return false;
     }
@@ -224,30 +391,80 @@ public:
     if (index < 0 || index >= total) {
       return false;
     }
-    int start = index;
-    int end = index;
+    PrefetchPlanner::Window window;
     {
       QMutexLocker locker(&m_state->mutex);
       if (!m_state->alive) {
         return false;
       }
-      const int dist = m_state->prefetchDistance;
-      if (m_state->prefetchStrategy == "forward") {
-        start = index;
-        end = std::min(total - 1, index + dist);
-      } else if (m_state->prefetchStrategy == "backward") {
-        start = std::max(0, index - dist);
-        end = index;
-      } else {
-        start = std::max(0, index - dist);
-        end = std::min(total - 1, index + dist);
+      const QSize target = PageImageCache::targetBucket(targetSize);
+      if (m_state->fitToView && target.isValid()) {
+        m_state->targetSize = target;
+      }
+      window = m_state->prefetch.window();
+    }
+    return TilePlanner::queueWindow(index, total, window,
+                                    [this](int page) { return queueRender(page); });
+  }
+  QVector<PageTile> requestTiles(int index,
+                                 const QSize &pageSize,
+                                 qreal scale,
+                                 const QRectF &viewport) override {
+    std::shared_ptr<PdfRenderState> state = m_state;
+    if (!state || index < 0 || index >= state->images.size() || pageSize.isEmpty() ||
+        scale < TilePlanner::kMinScale) {
+      return {};
+    }
+    TilePlanner::Request request;
+    {
+      QMutexLocker locker(&state->mutex);
+      if (!state->alive || !state->zoomTiles) {
+        return {};
       }
+      request.tileEdge = state->zoomTileSize;
+      request.visible = index == state->focusIndex;
+    }
+    const int bucket = TilePlanner::zoomBucket(scale);
+    request.owner = state.get();
+    request.index = index;
+    request.pageKey = PageImageCache::key(state->imageId, index);
+    request.factor = TilePlanner::bucketScale(bucket);
+    request.full = QSize(static_cast<int>(std::ceil(pageSize.width() * request.factor)),
+                         static_cast<int>(std::ceil(pageSize.height() * request.factor)));
+    request.viewport = viewport;
+    request.tagPrefix = QString("z%1").arg(bucket);
+    const QSize full = request.full;
+    return TilePlanner::requestTiles(
+        request,
+        [state](const QString &key) {
+          QMutexLocker locker(&state->mutex);
+          if (state->tilesInFlight.contains(key)) {
+            return false;
+          }
+          state->tilesInFlight.insert(key);
+          return true;
+        },
+        [state, index, full](const QRect &rect, const QString &key) -> std::function<void()> {
+          return [state, index, full, rect, key]() { renderTile(state, index, full, rect, key); };
+        },
+        [state](const QString &key) {
+          QMutexLocker locker(&state->mutex);
+          state->tilesInFlight.remove(key);
+        });
+  }
+  void setCurrentImage(int index) override {
+    if (!m_state) {
+      return;
     }
-    bool queued = false;
-    for (int i = start; i <= end; ++i) {
-      queued = queueRender(i) || queued;
+    PrefetchPlanner::Window window;
+    {
+      QMutexLocker locker(&m_state->mutex);
+      m_state->focusIndex = index;
+      m_state->prefetch.observe(index);
+      window = m_state->prefetch.window();
     }
-    return queued;
+    RenderScheduler::instance().setFocus(m_state.get(), index, std::max({2, window.before, window.after}),
+                                         window.direction, window.confidence);
   }
   void setImageReadyCallback(std::function<void(int)> callback) override {
     if (!m_state) {
@@ -257,18 +474,20 @@ public:
     m_state->onImageReady = std::move(callback);
   }
 
-private:
-  static void touchCache(const std::shared_ptr<PdfRenderState> &state, int index) {
-    if (!state || !state->cached.contains(index)) {
-      return;
-    }
-    if (state->cachePolicy != "lru") {
-      return;
+  ThumbnailSource thumbnailSource() const override {
+    ThumbnailSource source;
+    if (!m_state) {
+      return source;
     }
-    state->cacheOrder.removeAll(index);
-    state->cacheOrder.append(index);
+    std::shared_ptr<PdfRenderState> state = m_state;
+    source.atlasPath = QDir(state->tempDir).filePath("thumbnails.bin");
+    source.signature = PagePostProcess::signature(state->colors);
+    source.pageCount = state->images.size();
+    source.render = [state](int index, int height) { return renderThumbnail(state, index, height); };
+    return source;
   }
 
+private:
   bool queueRender(int index) {
     std::shared_ptr<PdfRenderState> state = m_state;
     if (!state) {
@@ -277,318 +496,383 @@ private:
     if (index < 0 || index >= state->images.size()) {
       return false;
     }
+    int focus = -1;
     {
       QMutexLocker locker(&state->mutex);
       if (!state->alive || !state->doc) {
         return false;
       }
-      const QString path = state->images.at(index);
       const bool needHigh = state->progressive && !state->highResCached.contains(index);
-      if (state->cached.contains(index) && QFileInfo::exists(path) && !needHigh) {
-        touchCache(state, index);
+      const bool cached = PageImageCache::instance().contains(PageImageCache::key(state->imageId, index));
+      const bool sized = state->renderedTarget.value(index) == state->targetSize;
+      if (cached && !needHigh && sized) {
         return true;
       }
       if (state->inFlight.contains(index)) {
         return false;
       }
       state->inFlight.insert(index);
+      focus = state->focusIndex;
     }
-    runPdfTask([state, index]() {
-      if (!state) {
-        return;
+    const RenderScheduler::Lane lane = index == focus ? RenderScheduler::Lane::Visible
+                                                      : RenderScheduler::Lane::Prefetch;
+    submitRender(state, index, lane);
+    return false;
+  }
+
+  static QImage renderThumbnail(const std::shared_ptr<PdfRenderState> &state, int index, int height) {
+    PagePostProcess::Options colors;
+    {
+      QMutexLocker locker(&state->mutex);
+      if (!state->alive || index < 0 || index >= state->images.size()) {
+        return {};
       }
+      colors = state->colors;
+    }
+    QImage image;
 #ifdef HAVE_POPPLER_QT6
+    {
+      PopplerLease lease(state);
       std::unique_ptr<Poppler::Page> page;
+      if (lease.get()) {
+        page = std::unique_ptr<Poppler::Page>(lease.get()->page(index));
+      }
+      const QSizeF points = page ? page->pageSizeF() : QSizeF();
+      if (!points.isEmpty()) {
+        const double dpi = height * 72.0 / points.height();
+        image = page->renderToImage(dpi, dpi);
+      }
+    }
+#elif defined(HAVE_QT_PDF)
+    {
+      QMutexLocker renderLock(&state->renderMutex);
+      const QSizeF points = state->doc ? state->doc->pagePointSize(index) : QSizeF();
+      if (!points.isEmpty()) {
+        const int width = std::max(1, qRound(points.width() * height / points.height()));
+        image = state->doc->render(index, QSize(width, height));
+      }
+    }
+#else
+    Q_UNUSED(height)
 #endif
-      QString path;
-      double highDpi = 120.0;
-      double lowDpi = 72.0;
-      bool progressive = false;
-      bool haveHigh = false;
-      bool antialias = true;
-      bool textAntialias = true;
-      QString colorMode;
-      QString backgroundMode;
-      QColor backgroundColor;
-      int maxWidth = 0;
-      int maxHeight = 0;
-      QString imageFormat;
-      int jpegQuality = 85;
-      int tileSize = 0;
-      {
-        QMutexLocker locker(&state->mutex);
-        if (!state->alive || !state->doc) {
-          state->inFlight.remove(index);
-          return;
-        }
-#ifdef HAVE_POPPLER_QT6
-        page = std::unique_ptr<Poppler::Page>(state->doc->page(index));
-#endif
-        path = state->images.at(index);
-        highDpi = state->renderDpi;
-        lowDpi = state->progressiveDpi;
-        progressive = state->progressive;
-        haveHigh = state->highResCached.contains(index);
-        antialias = state->antialias;
-        textAntialias = state->textAntialias;
-        colorMode = state->colorMode;
-        backgroundMode = state->backgroundMode;
-        backgroundColor = state->backgroundColor;
-        maxWidth = state->maxWidth;
-        maxHeight = state->maxHeight;
-        imageFormat = state->imageFormat;
-        jpegQuality = state->jpegQuality;
-        tileSize = state->tileSize;
+    return PagePostProcess::apply(std::move(image), colors);
+  }
+
+  // Renders `rect` of the page scaled to `full` pixels, without the rest of it.
+  static void renderTile(const std::shared_ptr<PdfRenderState> &state,
+                         int index,
+                         const QSize &full,
+                         const QRect &rect,
+                         const QString &key) {
+    QString colorMode;
+    PagePostProcess::Options colors;
+    bool antialias = true;
+    bool textAntialias = true;
+    {
+      QMutexLocker locker(&state->mutex);
+      if (!state->alive) {
+        state->tilesInFlight.remove(key);
+        return;
       }
+      colorMode = state->colorMode;
+      colors = state->colors;
+      antialias = state->antialias;
+      textAntialias = state->textAntialias;
+    }
+    QImage image;
 #ifdef HAVE_POPPLER_QT6
-      if (!page) {
-        QMutexLocker locker(&state->mutex);
-        state->inFlight.remove(index);
-        return;
+    {
+      PopplerLease lease(state);
+      std::unique_ptr<Poppler::Page> page;
+      if (lease.get()) {
+        page = std::unique_ptr<Poppler::Page>(lease.get()->page(index));
+      }
+      const QSizeF points = page ? page->pageSizeF() : QSizeF();
+      if (!points.isEmpty()) {
+        image = page->renderToImage(full.width() * 72.0 / points.width(),
+                                    full.height() * 72.0 / points.height(),
+                                    rect.x(), rect.y(), rect.width(), rect.height());
+      }
+    }
+    Q_UNUSED(antialias)
+    Q_UNUSED(textAntialias)
+#elif defined(HAVE_QT_PDF)
+    QPdfDocumentRenderOptions options;
+    QPdfDocumentRenderOptions::RenderFlags flags = {};
+    if (colorMode == "grayscale") {
+      flags |= QPdfDocumentRenderOptions::RenderFlag::Grayscale;
+    }
+    if (!antialias) {
+      flags |= QPdfDocumentRenderOptions::RenderFlag::ImageAliased;
+      flags |= QPdfDocumentRenderOptions::RenderFlag::PathAliased;
+    }
+    if (!textAntialias) {
+      flags |= QPdfDocumentRenderOptions::RenderFlag::TextAliased;
+    }
+    options.setRenderFlags(flags);
+    options.setScaledSize(full);
+    options.setScaledClipRect(rect);
+    {
+      QMutexLocker renderLock(&state->renderMutex);
+      if (state->doc) {
+        image = state->doc->render(index, rect.size(), options);
       }
+    }
+#else
+    Q_UNUSED(index)
+    Q_UNUSED(full)
+    Q_UNUSED(rect)
+    Q_UNUSED(antialias)
+    Q_UNUSED(textAntialias)
 #endif
+    image = PagePostProcess::apply(std::move(image), colors);
+    if (!image.isNull()) {
+      PageImageCache::instance().insert(key, image);
+    }
+    QMutexLocker locker(&state->mutex);
+    state->tilesInFlight.remove(key);
+  }
 
-      auto notifyReady = [state, index]() {
-        std::function<void(int)> callback;
-        {
+  static void submitRender(const std::shared_ptr<PdfRenderState> &state,
+                           int index,
+                           RenderScheduler::Lane lane) {
+    RenderScheduler::instance().submit(
+        state.get(), index, lane, [state, index]() { renderPage(state, index); },
+        [state, index]() {
           QMutexLocker locker(&state->mutex);
-          if (!state->alive) {
-            return;
-          }
-          callback = state->onImageReady;
-        }
-        if (callback) {
-          callback(index);
-        }
-      };
-
-      const bool fileExists = QFileInfo::exists(path);
-      const bool renderLow = progressive && !fileExists;
-      const bool renderHigh = !progressive || !haveHigh;
+          state->inFlight.remove(index);
+        });
+  }
 
-      auto renderPageImage = [&](double dpi) -> QImage {
+  static void renderPage(const std::shared_ptr<PdfRenderState> &state, int index) {
+    if (!state) {
+      return;
+    }
+    QString cacheKey;
+    QSize target;
+    double highDpi = 120.0;
+    double lowDpi = 72.0;
+    bool progressive = false;
+    bool haveHigh = false;
+    bool antialias = true;
+    bool textAntialias = true;
+    QString colorMode;
+    PagePostProcess::Options colors;
+    int maxWidth = 0;
+    int maxHeight = 0;
+    int tileSize = 0;
+    {
+      QMutexLocker locker(&state->mutex);
+      if (!state->alive || !state->doc) {
+        state->inFlight.remove(index);
+        return;
+      }
+      cacheKey = PageImageCache::key(state->imageId, index);
+      target = state->targetSize;
+      highDpi = state->renderDpi;
+      lowDpi = state->progressiveDpi;
+      progressive = state->progressive;
+      // A page the shared cache dropped, or rendered for another view size,
+      // has to be rendered again.
+      haveHigh = state->highResCached.contains(index) &&
+                 PageImageCache::instance().contains(cacheKey) &&
+                 state->renderedTarget.value(index) == target;
+      antialias = state->antialias;
+      textAntialias = state->textAntialias;
+      colorMode = state->colorMode;
+      colors = state->colors;
+      maxWidth = state->maxWidth;
+      maxHeight = state->maxHeight;
+      tileSize = state->tileSize;
+    }
 #ifdef HAVE_POPPLER_QT6
-        const QSizeF pageSize = page->pageSizeF();
-        const int pixelWidth = std::max(1, static_cast<int>(std::ceil(pageSize.width() * dpi / 72.0)));
-        const int pixelHeight = std::max(1, static_cast<int>(std::ceil(pageSize.height() * dpi / 72.0)));
-        QImage image;
-        if (tileSize > 0 && (pixelWidth > tileSize || pixelHeight > tileSize)) {
-          image = QImage(pixelWidth, pixelHeight, QImage::Format_ARGB32_Premultiplied);
-          image.fill(Qt::transparent);
-          QPainter painter(&image);
-          for (int y = 0; y < pixelHeight; y += tileSize) {
-            for (int x = 0; x < pixelWidth; x += tileSize) {
-              const int w = std::min(tileSize, pixelWidth - x);
-              const int h = std::min(tileSize, pixelHeight - y);
-              const QImage tile = page->renderToImage(dpi, dpi, x, y, w, h);
-              if (!tile.isNull()) {
-                painter.drawImage(x, y, tile);
-              }
-            }
-          }
-        } else {
-          image = page->renderToImage(dpi, dpi);
-        }
+    // Declared before the page, which points into the leased document.
+    PopplerLease lease(state);
+    std::unique_ptr<Poppler::Page> page;
+    if (lease.get()) {
+      page = std::unique_ptr<Poppler::Page>(lease.get()->page(index));
+    }
+    if (!page) {
+      QMutexLocker locker(&state->mutex);
+      state->inFlight.remove(index);
+      return;
+    }
+#endif
 
-        if (image.isNull()) {
-          return image;
-        }
+#ifdef HAVE_POPPLER_QT6
+    const QSizeF points = page->pageSizeF();
+#elif defined(HAVE_QT_PDF)
+    QSizeF points;
+    {
+      QMutexLocker renderLock(&state->renderMutex);
+      points = state->doc->pagePointSize(index);
+    }
+#else
+    const QSizeF points;
+#endif
+    highDpi = dpiForTarget(points, target, highDpi);
 
-        if (backgroundMode != "transparent") {
-          QColor fill = Qt::white;
-          if (backgroundMode == "theme" || backgroundMode == "custom") {
-            if (backgroundColor.isValid()) {
-              fill = backgroundColor;
-            }
-          }
-          QImage composed(image.size(), QImage::Format_ARGB32_Premultiplied);
-          composed.fill(fill);
-          QPainter painter(&composed);
-          painter.drawImage(0, 0, image);
-          image = composed;
-        }
+    auto markRendered = [&]() {
+      QMutexLocker locker(&state->mutex);
+      if (state->alive) {
+        state->highResCached.insert(index);
+        state->renderedTarget.insert(index, target);
+      }
+    };
 
-        if (colorMode == "grayscale") {
-          image = image.convertToFormat(QImage::Format_Grayscale8);
+    auto notifyReady = [state, index]() {
+      std::function<void(int)> callback;
+      {
+        QMutexLocker locker(&state->mutex);
+        if (!state->alive) {
+          return;
         }
+        callback = state->onImageReady;
+      }
+      if (callback) {
+        callback(index);
+      }
+    };
 
-        if ((maxWidth > 0 && image.width() > maxWidth) ||
-            (maxHeight > 0 && image.height() > maxHeight)) {
-          const int targetW = maxWidth > 0 ? maxWidth : image.width();
-          const int targetH = maxHeight > 0 ? maxHeight : image.height();
-          image = image.scaled(targetW, targetH, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-        }
+    const bool renderLow = progressive && !haveHigh && lowDpi < highDpi &&
+                           !PageImageCache::instance().contains(cacheKey);
+    const bool renderHigh = !progressive || !haveHigh;
 
+    // Downscales to render/max_width x max_height first, so the colour pass
+    // (PagePostProcess) touches as few pixels as possible.
+    auto finishPageImage = [&](QImage image) -> QImage {
+      if (image.isNull()) {
         return image;
-#elif defined(HAVE_QT_PDF)
-        if (!state->doc) {
-          return {};
-        }
-        const QSizeF pageSize = state->doc->pagePointSize(index);
-        if (pageSize.isEmpty()) {
-          return {};
-        }
-        const int pixelWidth = std::max(1, static_cast<int>(std::ceil(pageSize.width() * dpi / 72.0)));
-        const int pixelHeight = std::max(1, static_cast<int>(std::ceil(pageSize.height() * dpi / 72.0)));
-
-        QPdfDocumentRenderOptions options;
-        QPdfDocumentRenderOptions::RenderFlags flags = {};
-        if (colorMode == "grayscale") {
-          flags |= QPdfDocumentRenderOptions::RenderFlag::Grayscale;
-        }
-        if (!antialias) {
-          flags |= QPdfDocumentRenderOptions::RenderFlag::ImageAliased;
-          flags |= QPdfDocumentRenderOptions::RenderFlag::PathAliased;
-        }
-        if (!textAntialias) {
-          flags |= QPdfDocumentRenderOptions::RenderFlag::TextAliased;
-        }
-        if (flags != QPdfDocumentRenderOptions::RenderFlags()) {
-          options.setRenderFlags(flags);
-        }
-
-        auto renderWithOptions = [&](const QSize &size,
-                                     const QPdfDocumentRenderOptions &renderOptions) -> QImage {
-          QMutexLocker renderLock(&state->renderMutex);
-          return state->doc->render(index, size, renderOptions);
-        };
-
-        QImage image;
-        if (tileSize > 0 && (pixelWidth > tileSize || pixelHeight > tileSize)) {
-          image = QImage(pixelWidth, pixelHeight, QImage::Format_ARGB32_Premultiplied);
-          image.fill(Qt::transparent);
-          QPainter painter(&image);
-          const QSize fullSize(pixelWidth, pixelHeight);
-          for (int y = 0; y < pixelHeight; y += tileSize) {
-            for (int x = 0; x < pixelWidth; x += tileSize) {
-              const int w = std::min(tileSize, pixelWidth - x);
-              const int h = std::min(tileSize, pixelHeight - y);
-              QPdfDocumentRenderOptions tileOptions = options;
-              tileOptions.setScaledSize(fullSize);
-              tileOptions.setScaledClipRect(QRect(x, y, w, h));
-              const QImage tile = renderWithOptions(QSize(w, h), tileOptions);
-              if (!tile.isNull()) {
-                painter.drawImage(x, y, tile);
-              }
-            }
-          }
-        } else {
-          image = renderWithOptions(QSize(pixelWidth, pixelHeight), options);
-        }
-
-        if (image.isNull()) {
-          return image;
-        }
+      }
+      if ((maxWidth > 0 && image.width() > maxWidth) ||
+          (maxHeight > 0 && image.height() > maxHeight)) {
+        const int targetW = maxWidth > 0 ? maxWidth : image.width();
+        const int targetH = maxHeight > 0 ? maxHeight : image.height();
+        image = image.scaled(targetW, targetH, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+      }
+      return PagePostProcess::apply(std::move(image), colors);
+    };
 
-        if (backgroundMode != "transparent") {
-          QColor fill = Qt::white;
-          if (backgroundMode == "theme" || backgroundMode == "custom") {
-            if (backgroundColor.isValid()) {
-              fill = backgroundColor;
+    auto renderPageImage = [&](double dpi) -> QImage {
+#ifdef HAVE_POPPLER_QT6
+      const QSizeF pageSize = page->pageSizeF();
+      const int pixelWidth = std::max(1, static_cast<int>(std::ceil(pageSize.width() * dpi / 72.0)));
+      const int pixelHeight = std::max(1, static_cast<int>(std::ceil(pageSize.height() * dpi / 72.0)));
+      QImage image;
+      if (tileSize > 0 && (pixelWidth > tileSize || pixelHeight > tileSize)) {
+        image = QImage(pixelWidth, pixelHeight, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        QPainter painter(&image);
+        for (int y = 0; y < pixelHeight; y += tileSize) {
+          for (int x = 0; x < pixelWidth; x += tileSize) {
+            const int w = std::min(tileSize, pixelWidth - x);
+            const int h = std::min(tileSize, pixelHeight - y);
+            const QImage tile = page->renderToImage(dpi, dpi, x, y, w, h);
+            if (!tile.isNull()) {
+              painter.drawImage(x, y, tile);
             }
           }
-          QImage composed(image.size(), QImage::Format_ARGB32_Premultiplied);
-          composed.fill(fill);
-          QPainter painter(&composed);
-          painter.drawImage(0, 0, image);
-          image = composed;
         }
+      } else {
+        image = page->renderToImage(dpi, dpi);
+      }
 
-        if (colorMode == "grayscale") {
-          image = image.convertToFormat(QImage::Format_Grayscale8);
-        }
+      return finishPageImage(std::move(image));
+#elif defined(HAVE_QT_PDF)
+      if (!state->doc) {
+        return {};
+      }
+      const QSizeF pageSize = state->doc->pagePointSize(index);
+      if (pageSize.isEmpty()) {
+        return {};
+      }
+      const int pixelWidth = std::max(1, static_cast<int>(std::ceil(pageSize.width() * dpi / 72.0)));
+      const int pixelHeight = std::max(1, static_cast<int>(std::ceil(pageSize.height() * dpi / 72.0)));
 
-        if ((maxWidth > 0 && image.width() > maxWidth) ||
-            (maxHeight > 0 && image.height() > maxHeight)) {
-          const int targetW = maxWidth > 0 ? maxWidth : image.width();
-          const int targetH = maxHeight > 0 ? maxHeight : image.height();
-          image = image.scaled(targetW, targetH, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-        }
+      QPdfDocumentRenderOptions options;
+      QPdfDocumentRenderOptions::RenderFlags flags = {};
+      if (colorMode == "grayscale") {
+        flags |= QPdfDocumentRenderOptions::RenderFlag::Grayscale;
+      }
+      if (!antialias) {
+        flags |= QPdfDocumentRenderOptions::RenderFlag::ImageAliased;
+        flags |= QPdfDocumentRenderOptions::RenderFlag::PathAliased;
+      }
+      if (!textAntialias) {
+        flags |= QPdfDocumentRenderOptions::RenderFlag::TextAliased;
+      }
+      if (flags != QPdfDocumentRenderOptions::RenderFlags()) {
+        options.setRenderFlags(flags);
+      }
 
-        return image;
-#else
-        Q_UNUSED(dpi)
-        return {};
-#endif
+      auto renderWithOptions = [&](const QSize &size,
+                                   const QPdfDocumentRenderOptions &renderOptions) -> QImage {
+        QMutexLocker renderLock(&state->renderMutex);
+        return state->doc->render(index, size, renderOptions);
       };
 
-      if (renderLow) {
-        const QImage image = renderPageImage(lowDpi);
-        if (!image.isNull()) {
-          QDir().mkpath(state->tempDir);
-          const QByteArray format = imageFormat == "jpeg" ? QByteArray("JPEG") : QByteArray("PNG");
-          const bool saved = (imageFormat == "jpeg")
-                                 ? image.save(path, format.constData(), jpegQuality)
-                                 : image.save(path, format.constData());
-          if (saved) {
-            QMutexLocker locker(&state->mutex);
-            if (state->alive) {
-              addToCache(state, index);
+      QImage image;
+      if (tileSize > 0 && (pixelWidth > tileSize || pixelHeight > tileSize)) {
+        image = QImage(pixelWidth, pixelHeight, QImage::Format_ARGB32_Premultiplied);
+        image.fill(Qt::transparent);
+        QPainter painter(&image);
+        const QSize fullSize(pixelWidth, pixelHeight);
+        for (int y = 0; y < pixelHeight; y += tileSize) {
+          for (int x = 0; x < pixelWidth; x += tileSize) {
+            const int w = std::min(tileSize, pixelWidth - x);
+            const int h = std::min(tileSize, pixelHeight - y);
+            QPdfDocumentRenderOptions tileOptions = options;
+            tileOptions.setScaledSize(fullSize);
+            tileOptions.setScaledClipRect(QRect(x, y, w, h));
+            const QImage tile = renderWithOptions(QSize(w, h), tileOptions);
+            if (!tile.isNull()) {
+              painter.drawImage(x, y, tile);
             }
           }
-          notifyReady();
         }
+      } else {
+        image = renderWithOptions(QSize(pixelWidth, pixelHeight), options);
       }
 
+      return finishPageImage(std::move(image));
+#else
+      Q_UNUSED(dpi)
+      return {};
+#endif
+    };
+
+    if (renderLow) {
+      const QImage image = renderPageImage(lowDpi);
+      if (!image.isNull()) {
+        PageImageCache::instance().insert(cacheKey, image);
+        notifyReady();
+      }
       if (renderHigh) {
-        const QImage image = renderPageImage(highDpi);
-        if (!image.isNull()) {
-          QDir().mkpath(state->tempDir);
-          const QByteArray format = imageFormat == "jpeg" ? QByteArray("JPEG") : QByteArray("PNG");
-          const bool saved = (imageFormat == "jpeg")
-                                 ? image.save(path, format.constData(), jpegQuality)
-                                 : image.save(path, format.constData());
-          if (saved) {
-            QMutexLocker locker(&state->mutex);
-            if (state->alive) {
-              addToCache(state, index);
-              state->highResCached.insert(index);
-            }
-          }
-          notifyReady();
-        }
+        // The sharp pass queues behind other visible pages; inFlight stays set.
+        submitRender(state, index, RenderScheduler::Lane::HighRes);
+        return;
       }
-
-      QMutexLocker locker(&state->mutex);
-      state->inFlight.remove(index);
-    });
-    return false;
-  }
-
-  static void addToCache(const std::shared_ptr<PdfRenderState> &state, int index) {
-    if (!state || state->cached.contains(index)) {
-      touchCache(state, index);
-      return;
     }
-    state->cached.insert(index);
-    state->cacheOrder.append(index);
-    if (state->cachePolicy == "lru") {
-      state->cacheOrder.removeAll(index);
-      state->cacheOrder.append(index);
-    }
-    while (state->cacheOrder.size() > state->cacheLimit) {
-      const int evict = state->cacheOrder.takeFirst();
-      state->cached.remove(evict);
-      state->highResCached.remove(evict);
-      if (evict >= 0 && evict < state->images.size()) {
-        QFile::remove(state->images.at(evict));
+
+    if (renderHigh) {
+      const QImage image = renderPageImage(highDpi);
+      if (!image.isNull()) {
+        PageImageCache::instance().insert(cacheKey, image);
+        markRendered();
+        notifyReady();
       }
     }
+
+    QMutexLocker locker(&state->mutex);
+    state->inFlight.remove(index);
   }
 
   QString m_title;
-  QString m_text;
   std::shared_ptr<PdfRenderState> m_state;
 };
 
 QString tempDirForPdf(const QFileInfo &info) {
-  const QString key = QString("%1|%2|%3")
-                          .arg(info.absoluteFilePath())
-                          .arg(info.size())
-                          .arg(info.lastModified().toSecsSinceEpoch());
-  const QByteArray hash = QCryptographicHash::hash(key.toUtf8(), QCryptographicHash::Sha1).toHex();
-  return QDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation))
-      .filePath(QString("ereader_pdf_%1").arg(QString::fromUtf8(hash)));
+  return AssetCache::directoryFor("pdf", info.absoluteFilePath());
 }
 } // namespace
 
@@ -596,7 +880,10 @@ QString PdfProvider::name() const { return "PDF"; }
 
 QStringList PdfProvider::supportedExtensions() const { return {"pdf"}; }
 
-std::unique_ptr<FormatDocument> PdfProvider::open(const QString &path, QString *error) {
+std::unique_ptr<FormatDocument> PdfProvider::open(const QString &path,
+                                                  QString *error,
+                                                  const OpenOptions &options) {
+  const CancelToken &cancel = options.cancel;
 #if defined(HAVE_POPPLER_QT6)
   std::unique_ptr<Poppler::Document> doc(Poppler::Document::load(path));
   if (!doc) {
@@ -611,27 +898,21 @@ std::unique_ptr<FormatDocument> PdfProvider::open(const QString &path, QString *
   doc->setRenderHint(Poppler::Document::TextAntialiasing, pdfSettings.textAntialias);
   doc->setRenderHint(Poppler::Document::Antialiasing, pdfSettings.antialias);
 
-  QStringList pages;
   QStringList images;
   const int pageCount = doc->numPages();
-  pages.reserve(pageCount);
   images.reserve(pageCount);
   const QFileInfo info(path);
   const QString outDir = tempDirForPdf(info);
   QDir().mkpath(outDir);
-  const int cacheLimit = pdfSettings.cacheLimit;
   const double renderDpi = static_cast<double>(pdfSettings.dpi);
-  const QString imageExt = pdfSettings.imageFormat == "jpeg" ? "jpg" : "png";
   for (int i = 0; i < pageCount; ++i) {
-    std::unique_ptr<Poppler::Page> page(doc->page(i));
-    if (!page) {
-      continue;
-    }
-    if (pdfSettings.extractText) {
-      pages.append(page->text(QRectF()));
+    if (openCancelled(cancel, error)) {
+      // Page images are rendered lazily, so only an empty directory is ours to drop.
+      QDir().rmdir(outDir);
+      return nullptr;
     }
     const QString outPath =
-        QDir(outDir).filePath(QString("page_%1.%2").arg(i + 1, 4, 10, QLatin1Char('0')).arg(imageExt));
+        QDir(outDir).filePath(QString("page_%1.%2").arg(i + 1, 4, 10, QLatin1Char('0')).arg("png"));
     images.append(outPath);
   }
 
@@ -639,28 +920,32 @@ std::unique_ptr<FormatDocument> PdfProvider::open(const QString &path, QString *
                                                      : QFileInfo(path).completeBaseName();
   auto state = std::make_shared<PdfRenderState>();
   state->doc = std::move(doc);
+  state->sourcePath = info.absoluteFilePath();
+  state->workerThreads = RenderScheduler::instance().maxThreads();
   state->images = images;
   state->tempDir = outDir;
-  state->cacheLimit = cacheLimit;
+  state->sourceBytes = info.size();
   state->renderDpi = renderDpi;
-  state->prefetchDistance = pdfSettings.prefetchDistance;
-  state->prefetchStrategy = pdfSettings.prefetchStrategy;
-  state->cachePolicy = pdfSettings.cachePolicy;
+  state->prefetch.configure(pdfSettings.prefetchStrategy, pdfSettings.prefetchDistance, pdfSettings.prefetchMax);
   state->renderPreset = pdfSettings.renderPreset;
   state->antialias = pdfSettings.antialias;
   state->textAntialias = pdfSettings.textAntialias;
   state->colorMode = pdfSettings.colorMode;
-  state->backgroundMode = pdfSettings.backgroundMode;
-  state->backgroundColor = pdfSettings.backgroundColor;
+  state->colors = pageColors(pdfSettings);
   state->maxWidth = pdfSettings.maxWidth;
   state->maxHeight = pdfSettings.maxHeight;
-  state->imageFormat = pdfSettings.imageFormat;
-  state->jpegQuality = pdfSettings.jpegQuality;
   state->tileSize = pdfSettings.tileSize;
+  state->zoomTiles = pdfSettings.zoomTiles;
+  state->fitToView = pdfSettings.fitToView;
+  state->zoomTileSize = pdfSettings.tileSize > 0 ? std::max(128, pdfSettings.tileSize) : 512;
   state->progressive = pdfSettings.progressive;
   state->progressiveDpi = pdfSettings.progressiveDpi;
 
-  return std::make_unique<PdfDocument>(title, pages.join("\n\n"), state);
+  if (pdfSettings.extractText) {
+    state->textIndex = makeTextIndex(state, info.absoluteFilePath());
+  }
+
+  return std::make_unique<PdfDocument>(title, state);
 #elif defined(HAVE_QT_PDF)
   auto doc = std::make_unique<QPdfDocument>();
   const QPdfDocument::Error loadError = doc->load(path);
@@ -674,24 +959,21 @@ std::unique_ptr<FormatDocument> PdfProvider::open(const QString &path, QString *
 
   const PdfSettings pdfSettings = loadPdfSettings();
 
-  QStringList pages;
   QStringList images;
   const int pageCount = doc->pageCount();
-  pages.reserve(pageCount);
   images.reserve(pageCount);
   const QFileInfo info(path);
   const QString outDir = tempDirForPdf(info);
   QDir().mkpath(outDir);
-  const int cacheLimit = pdfSettings.cacheLimit;
   const double renderDpi = static_cast<double>(pdfSettings.dpi);
-  const QString imageExt = pdfSettings.imageFormat == "jpeg" ? "jpg" : "png";
   for (int i = 0; i < pageCount; ++i) {
-    if (pdfSettings.extractText) {
-      const QPdfSelection selection = doc->getAllText(i);
-      pages.append(selection.text());
+    if (openCancelled(cancel, error)) {
+      // Page images are rendered lazily, so only an empty directory is ours to drop.
+      QDir().rmdir(outDir);
+      return nullptr;
     }
     const QString outPath =
-        QDir(outDir).filePath(QString("page_%1.%2").arg(i + 1, 4, 10, QLatin1Char('0')).arg(imageExt));
+        QDir(outDir).filePath(QString("page_%1.%2").arg(i + 1, 4, 10, QLatin1Char('0')).arg("png"));
     images.append(outPath);
   }
 
@@ -707,32 +989,35 @@ std::unique_ptr<FormatDocument> PdfProvider::open(const QString &path, QString *
   state->doc = std::move(doc);
   state->images = images;
   state->tempDir = outDir;
-  state->cacheLimit = cacheLimit;
+  state->sourceBytes = info.size();
   state->renderDpi = renderDpi;
-  state->prefetchDistance = pdfSettings.prefetchDistance;
-  state->prefetchStrategy = pdfSettings.prefetchStrategy;
-  state->cachePolicy = pdfSettings.cachePolicy;
+  state->prefetch.configure(pdfSettings.prefetchStrategy, pdfSettings.prefetchDistance, pdfSettings.prefetchMax);
   state->renderPreset = pdfSettings.renderPreset;
   state->antialias = pdfSettings.antialias;
   state->textAntialias = pdfSettings.textAntialias;
   state->colorMode = pdfSettings.colorMode;
-  state->backgroundMode = pdfSettings.backgroundMode;
-  state->backgroundColor = pdfSettings.backgroundColor;
+  state->colors = pageColors(pdfSettings);
   state->maxWidth = pdfSettings.maxWidth;
   state->maxHeight = pdfSettings.maxHeight;
-  state->imageFormat = pdfSettings.imageFormat;
-  state->jpegQuality = pdfSettings.jpegQuality;
   state->tileSize = pdfSettings.tileSize;
+  state->zoomTiles = pdfSettings.zoomTiles;
+  state->fitToView = pdfSettings.fitToView;
+  state->zoomTileSize = pdfSettings.tileSize > 0 ? std::max(128, pdfSettings.tileSize) : 512;
   state->progressive = pdfSettings.progressive;
   state->progressiveDpi = pdfSettings.progressiveDpi;
 
-  return std::make_unique<PdfDocument>(title, pages.join("\n\n"), state);
+  if (pdfSettings.extractText) {
+    state->textIndex = makeTextIndex(state, info.absoluteFilePath());
+  }
+
+  return std::make_unique<PdfDocument>(title, state);
 #else
   if (error) {
     *error = "No PDF backend available (Poppler Qt6 or QtPdf required)";
   }
   qWarning() << "PdfProvider: No PDF backend available";
   Q_UNUSED(path)
+  Q_UNUSED(cancel)
   return nullptr;
 #endif
 }
@@ -0,0 +1,100 @@
+#include "PrefetchPlanner.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+namespace {
+// Weight of the newest turn in the moving averages.
+constexpr qreal kSmoothing = 0.3;
+// Turns of up to this many pages are sequential; 2 covers two-page spreads.
+constexpr int kSequentialStep = 2;
+// Turning pages at least this often earns the full adaptive window.
+constexpr qreal kFastIntervalMs = 1500.0;
+// Longer pauses count as idle; they are clamped so one break does not
+// outweigh the turns before it.
+constexpr qreal kIdleIntervalMs = 60000.0;
+} // namespace
+
+PrefetchPlanner::PrefetchPlanner() { m_clock.start(); }
+
+void PrefetchPlanner::configure(const QString &strategy, int distance, int maxDistance) {
+  const QString normalized = strategy.trimmed().toLower();
+  if (normalized == "forward") {
+    m_strategy = Strategy::Forward;
+  } else if (normalized == "symmetric") {
+    m_strategy = Strategy::Symmetric;
+  } else if (normalized == "backward") {
+    m_strategy = Strategy::Backward;
+  } else {
+    m_strategy = Strategy::Adaptive;
+  }
+  m_distance = std::max(0, distance);
+  m_maxDistance = std::max(m_distance, maxDistance);
+}
+
+void PrefetchPlanner::observe(int index) {
+  const qint64 now = m_clock.elapsed();
+  const int delta = index - m_lastIndex;
+  if (m_lastIndex < 0 || delta == 0) {
+    m_lastIndex = index;
+    m_lastTurn = now;
+    return;
+  }
+  if (std::abs(delta) <= kSequentialStep) {
+    const qreal interval = std::min<qreal>(static_cast<qreal>(now - m_lastTurn), kIdleIntervalMs);
+    m_interval = m_interval <= 0.0 ? interval : m_interval + kSmoothing * (interval - m_interval);
+    m_direction += kSmoothing * ((delta > 0 ? 1.0 : -1.0) - m_direction);
+    m_jumps -= kSmoothing * m_jumps;
+  } else {
+    // A jump (TOC, search, slider) says little about where reading goes next.
+    m_jumps += kSmoothing * (1.0 - m_jumps);
+    m_direction *= 1.0 - kSmoothing;
+  }
+  m_lastIndex = index;
+  m_lastTurn = now;
+}
+
+// The page after the current one is always included: two-page spreads show it.
+PrefetchPlanner::Window PrefetchPlanner::window() const {
+  Window out;
+  switch (m_strategy) {
+  case Strategy::Forward:
+    out.before = 1;
+    out.after = std::max(1, m_distance);
+    out.direction = 1;
+    out.confidence = 1.0;
+    return out;
+  case Strategy::Backward:
+    out.before = std::max(1, m_distance);
+    out.after = 1;
+    out.direction = -1;
+    out.confidence = 1.0;
+    return out;
+  case Strategy::Symmetric:
+    out.before = std::max(1, m_distance);
+    out.after = out.before;
+    return out;
+  case Strategy::Adaptive:
+    break;
+  }
+
+  out.direction = m_direction > 0.0 ? 1 : (m_direction < 0.0 ? -1 : 0);
+  out.confidence = std::clamp(std::abs(m_direction) * (1.0 - m_jumps), 0.0, 1.0);
+  qreal speed = m_interval > 0.0 ? std::clamp(kFastIntervalMs / m_interval, 0.0, 1.0) : 0.0;
+  if (m_lastTurn >= 0 && m_clock.elapsed() - m_lastTurn > kIdleIntervalMs) {
+    speed = 0.0;
+  }
+  const int lead = m_distance + qRound((m_maxDistance - m_distance) * out.confidence * speed);
+  const int trail = qRound(m_distance * (1.0 - out.confidence));
+  if (out.direction < 0) {
+    out.before = lead;
+    out.after = std::max(1, trail);
+  } else if (out.direction > 0) {
+    out.before = trail;
+    out.after = std::max(1, lead);
+  } else {
+    out.before = m_distance;
+    out.after = std::max(1, m_distance);
+  }
+  return out;
+}
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <QElapsedTimer>
+#include <QString>
+
+// Decides how many pages around the current one a paged document prefetches.
+// The static strategies ("forward", "symmetric", "backward") always use
+// `distance`. "adaptive" watches the page turns of this session: steady
+// turns in one direction widen the window ahead (up to `maxDistance` for fast
+// readers) and drop pages behind; jumps, direction changes and long pauses
+// shrink it back. Not thread-safe; providers call it under their state mutex.
+class PrefetchPlanner {
+public:
+  // Pages to prefetch below and above the current index.
+  struct Window {
+    int before = 1;
+    int after = 1;
+    // +1 reading forward, -1 backward, 0 unknown.
+    int direction = 0;
+    // 0..1, how sure the planner is about `direction`; RenderScheduler makes
+    // pages against it cost more.
+    qreal confidence = 0.0;
+  };
+
+  PrefetchPlanner();
+
+  // Parses "forward" | "symmetric" | "backward" | "adaptive"; anything else is
+  // "adaptive".
+  void configure(const QString &strategy, int distance, int maxDistance);
+  // Records that page `index` is now on screen.
+  void observe(int index);
+  Window window() const;
+
+private:
+  enum class Strategy { Forward, Symmetric, Backward, Adaptive };
+
+  Strategy m_strategy = Strategy::Adaptive;
+  int m_distance = 1;
+  int m_maxDistance = 6;
+  QElapsedTimer m_clock;
+  int m_lastIndex = -1;
+  qint64 m_lastTurn = -1;
+  // Moving averages: turn interval in ms, direction in -1..1 and the share of
+  // turns that were jumps in 0..1.
+  qreal m_interval = 0.0;
+  qreal m_direction = 0.0;
+  qreal m_jumps = 0.0;
+};
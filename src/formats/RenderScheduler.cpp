@@ -0,0 +1,187 @@
+#include "RenderScheduler.h"
+#include "../core/include/AppPaths.h"
+
+#include <QMutexLocker>
+#include <QSettings>
+#include <QThread>
+#include <QVector>
+#include <algorithm>
+#include <cstdlib>
+#include <limits>
+
+RenderScheduler::RenderScheduler() {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  // 0 picks half the cores (at most 4) so prefetch never starves the UI.
+  const int threads = std::clamp(settings.value("render/worker_threads", 0).toInt(), 0, 16);
+  m_pool.setMaxThreadCount(threads > 0 ? threads : std::clamp(QThread::idealThreadCount() / 2, 1, 4));
+}
+
+RenderScheduler &RenderScheduler::instance() {
+  static RenderScheduler scheduler;
+  return scheduler;
+}
+
+int RenderScheduler::maxThreads() const {
+  return m_pool.maxThreadCount();
+}
+
+bool RenderScheduler::submit(const void *owner,
+                             int index,
+                             Lane lane,
+                             std::function<void()> job,
+                             std::function<void()> dropped,
+                             const QString &tag) {
+  {
+    QMutexLocker locker(&m_mutex);
+    for (Job &queued : m_queue) {
+      if (queued.owner == owner && queued.index == index && queued.tag == tag) {
+        queued.lane = std::min(queued.lane, lane);
+        return false;
+      }
+    }
+    Job entry;
+    entry.owner = owner;
+    entry.index = index;
+    entry.tag = tag;
+    entry.lane = lane;
+    entry.sequence = m_nextSequence++;
+    entry.run = std::move(job);
+    entry.dropped = std::move(dropped);
+    m_queue.append(std::move(entry));
+  }
+  // One runnable per job; each picks the best queued job when it starts, not
+  // the one that scheduled it.
+  m_pool.start([this]() { runNext(); });
+  return true;
+}
+
+void RenderScheduler::setFocus(const void *owner, int index, int keepDistance, int direction, qreal confidence) {
+  QVector<std::function<void()>> dropped;
+  {
+    QMutexLocker locker(&m_mutex);
+    Focus updated;
+    updated.owner = owner;
+    updated.index = index;
+    updated.direction = direction;
+    updated.confidence = std::clamp(confidence, 0.0, 1.0);
+    auto existing = std::find_if(m_focus.begin(), m_focus.end(),
+                                 [owner](const Focus &focus) { return focus.owner == owner; });
+    if (existing != m_focus.end()) {
+      *existing = updated;
+    } else {
+      m_focus.append(updated);
+    }
+    for (auto it = m_queue.begin(); it != m_queue.end();) {
+      if (it->owner != owner) {
+        ++it;
+        continue;
+      }
+      if (it->index == index) {
+        it->lane = Lane::Visible;
+        ++it;
+        continue;
+      }
+      it->lane = Lane::Prefetch;
+      if (std::abs(it->index - index) > keepDistance) {
+        if (it->dropped) {
+          dropped.append(std::move(it->dropped));
+        }
+        it = m_queue.erase(it);
+        continue;
+      }
+      ++it;
+    }
+  }
+  for (const auto &callback : dropped) {
+    callback();
+  }
+}
+
+void RenderScheduler::cancelTagged(const void *owner, int index) {
+  QVector<std::function<void()>> dropped;
+  {
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_queue.begin(); it != m_queue.end();) {
+      if (it->owner == owner && it->index == index && !it->tag.isEmpty()) {
+        if (it->dropped) {
+          dropped.append(std::move(it->dropped));
+        }
+        it = m_queue.erase(it);
+      } else {
+        ++it;
+      }
+    }
+  }
+  for (const auto &callback : dropped) {
+    callback();
+  }
+}
+
+void RenderScheduler::cancelAll(const void *owner) {
+  QVector<std::function<void()>> dropped;
+  {
+    QMutexLocker locker(&m_mutex);
+    for (auto it = m_queue.begin(); it != m_queue.end();) {
+      if (it->owner == owner) {
+        if (it->dropped) {
+          dropped.append(std::move(it->dropped));
+        }
+        it = m_queue.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    m_focus.erase(std::remove_if(m_focus.begin(), m_focus.end(),
+                                 [owner](const Focus &focus) { return focus.owner == owner; }),
+                  m_focus.end());
+  }
+  for (const auto &callback : dropped) {
+    callback();
+  }
+}
+
+// In quarter pages, so a confident reading direction can weigh pages behind.
+int RenderScheduler::distanceLocked(const Job &job) const {
+  for (const Focus &focus : m_focus) {
+    if (focus.owner == job.owner) {
+      const int offset = job.index - focus.index;
+      int cost = std::abs(offset) * 4;
+      if (focus.direction != 0 && offset * focus.direction < 0) {
+        cost += std::abs(offset) * qRound(8 * focus.confidence);
+      }
+      return cost;
+    }
+  }
+  return std::numeric_limits<int>::max();
+}
+
+void RenderScheduler::runNext() {
+  std::function<void()> run;
+  {
+    QMutexLocker locker(&m_mutex);
+    if (m_queue.isEmpty()) {
+      return;
+    }
+    auto best = m_queue.begin();
+    int bestDistance = distanceLocked(*best);
+    for (auto it = std::next(m_queue.begin()); it != m_queue.end(); ++it) {
+      const int distance = distanceLocked(*it);
+      if (it->lane != best->lane) {
+        if (it->lane < best->lane) {
+          best = it;
+          bestDistance = distance;
+        }
+        continue;
+      }
+      if (distance < bestDistance || (distance == bestDistance && it->sequence < best->sequence)) {
+        best = it;
+        bestDistance = distance;
+      }
+    }
+    run = std::move(best->run);
+    m_queue.erase(best);
+  }
+  if (run) {
+    run();
+  }
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <QList>
+#include <QMutex>
+#include <QString>
+#include <QThreadPool>
+#include <functional>
+
+// Shared priority queue for PDF/DjVu page renders and comic page decodes.
+// Jobs are keyed by (owner, page) and run in lane order, nearest to the
+// owner's current page first, so after a long jump the visible page does not
+// wait behind stale prefetches. Providers mark a page in-flight before submitting and clear it
+// in either the job or its `dropped` callback.
+class RenderScheduler {
+public:
+  enum class Lane { Visible = 0, HighRes = 1, Prefetch = 2 };
+
+  static RenderScheduler &instance();
+
+  // Fixed at startup from settings.ini `render/worker_threads`. Providers
+  // that keep one document handle per render thread size their pools by it.
+  int maxThreads() const;
+
+  // A page that is already queued for `owner` moves to the better of the two
+  // lanes and keeps its original job; returns false in that case. `tag`
+  // tells several jobs of one page apart (e.g. zoom tiles).
+  bool submit(const void *owner,
+              int index,
+              Lane lane,
+              std::function<void()> job,
+              std::function<void()> dropped,
+              const QString &tag = QString());
+
+  // Moves the owner's focus to `index`: its queued job becomes Visible, other
+  // Visible/HighRes jobs fall back to Prefetch and prefetches farther than
+  // `keepDistance` pages are dropped. With a reading `direction` (+1/-1),
+  // prefetches against it count as up to three times farther, scaled by
+  // `confidence` (0..1), so the pages the reader is heading to render first.
+  void setFocus(const void *owner, int index, int keepDistance, int direction = 0, qreal confidence = 0.0);
+
+  // Drops the queued tagged jobs of one page, e.g. tiles of a stale zoom.
+  void cancelTagged(const void *owner, int index);
+
+  // Drops every queued job of a closed document.
+  void cancelAll(const void *owner);
+
+private:
+  struct Focus {
+    const void *owner = nullptr;
+    int index = -1;
+    int direction = 0;
+    qreal confidence = 0.0;
+  };
+  struct Job {
+    const void *owner = nullptr;
+    int index = -1;
+    QString tag;
+    Lane lane = Lane::Prefetch;
+    quint64 sequence = 0;
+    std::function<void()> run;
+    std::function<void()> dropped;
+  };
+
+  RenderScheduler();
+  void runNext();
+  int distanceLocked(const Job &job) const;
+
+  QThreadPool m_pool;
+  QMutex m_mutex;
+  QList<Job> m_queue;
+  QList<Focus> m_focus;
+  quint64 m_nextSequence = 0;
+};
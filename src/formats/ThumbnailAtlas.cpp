@@ -0,0 +1,333 @@
+#include "include/ThumbnailAtlas.h"
+#include "../core/include/AppPaths.h"
+#include "include/BackgroundPool.h"
+
+#include <QBuffer>
+#include <QDataStream>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QImageWriter>
+#include <QList>
+#include <QMutexLocker>
+#include <QPainter>
+#include <QPoint>
+#include <QRect>
+#include <QSaveFile>
+#include <QSettings>
+#include <QThreadPool>
+#include <QVector>
+#include <algorithm>
+
+namespace {
+constexpr quint32 kAtlasMagic = 0x54484d42; // "THMB"
+constexpr quint32 kAtlasVersion = 2;
+constexpr int kSheetSize = 2048;
+// Thumbnails start on the 16 px grid of JPEG's (4:2:0) blocks, so no block
+// mixes two of them.
+constexpr int kBlock = 16;
+static_assert(ThumbnailAtlas::kHeight % kBlock == 0 && kSheetSize % kBlock == 0);
+// Wide pages (spreads) are capped at twice the strip height.
+constexpr int kMaxWidth = ThumbnailAtlas::kHeight * 2;
+// Values of Strip::sheetOf for pages without a thumbnail.
+constexpr qint32 kPending = -1;
+constexpr qint32 kFailed = -2;
+
+bool thumbnailsEnabled() {
+  QSettings settings(AppPaths::configFile("settings.ini"), QSettings::IniFormat);
+  return settings.value("cache/thumbnails", true).toBool();
+}
+
+QThreadPool *thumbnailPool() {
+  static QThreadPool *pool = makeBackgroundPool();
+  return pool;
+}
+
+struct AtlasData {
+  QVector<QImage> sheets;
+  QVector<qint32> sheetOf;
+  QVector<QRect> rects;
+  QPoint cursor;
+};
+
+bool loadAtlas(const ThumbnailSource &source, AtlasData *out) {
+  QFile file(source.atlasPath);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  QDataStream in(&file);
+  quint32 magic = 0;
+  quint32 version = 0;
+  QString signature;
+  qint32 height = 0;
+  qint32 pageCount = 0;
+  QVector<QByteArray> encoded;
+  AtlasData data;
+  in >> magic >> version >> signature >> height >> pageCount >> data.sheetOf >> data.rects >>
+      data.cursor >> encoded;
+  if (in.status() != QDataStream::Ok || magic != kAtlasMagic || version != kAtlasVersion ||
+      signature != source.signature || height != ThumbnailAtlas::kHeight ||
+      pageCount != source.pageCount || data.sheetOf.size() != pageCount ||
+      data.rects.size() != pageCount) {
+    return false;
+  }
+  for (const QByteArray &bytes : encoded) {
+    QImage sheet = QImage::fromData(bytes, "JPG");
+    if (sheet.isNull()) {
+      return false;
+    }
+    data.sheets.append(sheet.convertToFormat(QImage::Format_RGB888));
+  }
+  for (int i = 0; i < pageCount; ++i) {
+    const qint32 sheet = data.sheetOf.at(i);
+    if (sheet >= data.sheets.size() ||
+        (sheet >= 0 && !data.sheets.at(sheet).rect().contains(data.rects.at(i)))) {
+      return false;
+    }
+    // Failures may have been transient; try those pages again.
+    if (sheet == kFailed) {
+      data.sheetOf[i] = kPending;
+    }
+  }
+  *out = std::move(data);
+  return true;
+}
+
+void saveAtlas(const ThumbnailSource &source, const AtlasData &data) {
+  QVector<QByteArray> encoded;
+  for (const QImage &sheet : data.sheets) {
+    QByteArray bytes;
+    QBuffer buffer(&bytes);
+    buffer.open(QIODevice::WriteOnly);
+    QImageWriter writer(&buffer, "JPG");
+    writer.setQuality(85);
+    if (!writer.write(sheet)) {
+      return;
+    }
+    encoded.append(bytes);
+  }
+  QDir().mkpath(QFileInfo(source.atlasPath).absolutePath());
+  QSaveFile file(source.atlasPath);
+  if (!file.open(QIODevice::WriteOnly)) {
+    return;
+  }
+  QDataStream out(&file);
+  out << kAtlasMagic << kAtlasVersion << source.signature << static_cast<qint32>(ThumbnailAtlas::kHeight)
+      << static_cast<qint32>(source.pageCount) << data.sheetOf << data.rects << data.cursor << encoded;
+  if (!file.commit()) {
+    qWarning() << "ThumbnailAtlas: could not write" << source.atlasPath;
+  }
+}
+} // namespace
+
+struct ThumbnailAtlas::Strip {
+  QString id;
+  ThumbnailSource source;
+  // Everything below is guarded by ThumbnailAtlas::m_mutex.
+  AtlasData atlas;
+  // page -> (ticket -> waiter)
+  QHash<int, QHash<quint64, Waiter>> waiters;
+  // Requested pages, most recent first; rendered before `next`.
+  QList<int> wanted;
+  int next = 0;
+  bool stopped = false;
+  bool dirty = false;
+};
+
+ThumbnailAtlas &ThumbnailAtlas::instance() {
+  static ThumbnailAtlas atlas;
+  return atlas;
+}
+
+QString ThumbnailAtlas::start(const ThumbnailSource &source) {
+  if (!source.render || source.pageCount <= 0 || source.atlasPath.isEmpty() || !thumbnailsEnabled()) {
+    return {};
+  }
+  auto strip = std::make_shared<Strip>();
+  strip->source = source;
+  strip->atlas.sheetOf.fill(kPending, source.pageCount);
+  strip->atlas.rects.resize(source.pageCount);
+  {
+    QMutexLocker locker(&m_mutex);
+    strip->id = QString("t%1").arg(m_nextId++);
+    m_strips.insert(strip->id, strip);
+  }
+  thumbnailPool()->start([this, strip]() { run(strip); });
+  return strip->id;
+}
+
+void ThumbnailAtlas::stop(const QString &id) {
+  QVector<Waiter> orphaned;
+  {
+    QMutexLocker locker(&m_mutex);
+    const std::shared_ptr<Strip> strip = m_strips.take(id);
+    if (!strip) {
+      return;
+    }
+    strip->stopped = true;
+    for (auto page = strip->waiters.begin(); page != strip->waiters.end(); ++page) {
+      for (auto it = page->begin(); it != page->end(); ++it) {
+        m_tickets.remove(it.key());
+        orphaned.append(it.value());
+      }
+    }
+    strip->waiters.clear();
+  }
+  for (const Waiter &waiter : orphaned) {
+    waiter(QImage());
+  }
+}
+
+quint64 ThumbnailAtlas::subscribe(const QString &id, int index, Waiter waiter) {
+  QImage ready;
+  {
+    QMutexLocker locker(&m_mutex);
+    const std::shared_ptr<Strip> strip = m_strips.value(id);
+    if (strip && index >= 0 && index < strip->source.pageCount) {
+      const qint32 sheet = strip->atlas.sheetOf.at(index);
+      if (sheet >= 0) {
+        ready = strip->atlas.sheets.at(sheet).copy(strip->atlas.rects.at(index));
+      } else if (sheet == kPending) {
+        const quint64 ticket = m_nextTicket++;
+        strip->waiters[index].insert(ticket, std::move(waiter));
+        strip->wanted.removeAll(index);
+        strip->wanted.prepend(index);
+        m_tickets.insert(ticket, qMakePair(id, index));
+        return ticket;
+      }
+    }
+  }
+  waiter(ready);
+  return 0;
+}
+
+void ThumbnailAtlas::unsubscribe(quint64 ticket) {
+  QMutexLocker locker(&m_mutex);
+  const QPair<QString, int> page = m_tickets.take(ticket);
+  const std::shared_ptr<Strip> strip = m_strips.value(page.first);
+  if (!strip) {
+    return;
+  }
+  auto waiting = strip->waiters.find(page.second);
+  if (waiting == strip->waiters.end()) {
+    return;
+  }
+  waiting->remove(ticket);
+  if (waiting->isEmpty()) {
+    // Scrubbed past: nobody is looking at this page any more.
+    strip->waiters.erase(waiting);
+    strip->wanted.removeAll(page.second);
+  }
+}
+
+void ThumbnailAtlas::run(const std::shared_ptr<Strip> &strip) {
+  using Delivery = QPair<Waiter, QImage>;
+  auto takeWaiters = [&](int index, QVector<Delivery> &out) {
+    const QHash<quint64, Waiter> waiting = strip->waiters.take(index);
+    if (waiting.isEmpty()) {
+      return;
+    }
+    const qint32 sheet = strip->atlas.sheetOf.at(index);
+    const QImage image = sheet >= 0 ? strip->atlas.sheets.at(sheet).copy(strip->atlas.rects.at(index)) : QImage();
+    for (auto it = waiting.begin(); it != waiting.end(); ++it) {
+      m_tickets.remove(it.key());
+      out.append(qMakePair(it.value(), image));
+    }
+  };
+  auto deliver = [](const QVector<Delivery> &deliveries) {
+    for (const Delivery &delivery : deliveries) {
+      delivery.first(delivery.second);
+    }
+  };
+
+  AtlasData saved;
+  if (loadAtlas(strip->source, &saved)) {
+    QVector<Delivery> ready;
+    {
+      QMutexLocker locker(&m_mutex);
+      strip->atlas = std::move(saved);
+      const QList<int> requested = strip->waiters.keys();
+      for (const int index : requested) {
+        if (strip->atlas.sheetOf.at(index) != kPending) {
+          takeWaiters(index, ready);
+        }
+      }
+    }
+    deliver(ready);
+  }
+
+  for (;;) {
+    int index = -1;
+    {
+      QMutexLocker locker(&m_mutex);
+      if (strip->stopped) {
+        break;
+      }
+      while (!strip->wanted.isEmpty() && index < 0) {
+        const int candidate = strip->wanted.takeFirst();
+        if (strip->atlas.sheetOf.at(candidate) == kPending) {
+          index = candidate;
+        }
+      }
+      while (index < 0 && strip->next < strip->source.pageCount) {
+        if (strip->atlas.sheetOf.at(strip->next) == kPending) {
+          index = strip->next;
+        }
+        ++strip->next;
+      }
+    }
+    if (index < 0) {
+      break;
+    }
+
+    QImage image = strip->source.render(index, kHeight);
+    if (!image.isNull() && (image.height() > kHeight || image.width() > kMaxWidth)) {
+      image = image.scaled(kMaxWidth, kHeight, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    }
+
+    QVector<Delivery> ready;
+    {
+      QMutexLocker locker(&m_mutex);
+      if (strip->stopped) {
+        break;
+      }
+      AtlasData &atlas = strip->atlas;
+      if (image.isNull()) {
+        atlas.sheetOf[index] = kFailed;
+      } else {
+        // Shelf packing: every thumbnail is at most kHeight tall.
+        if (atlas.cursor.x() + image.width() > kSheetSize) {
+          atlas.cursor = QPoint(0, atlas.cursor.y() + kHeight);
+        }
+        if (atlas.sheets.isEmpty() || atlas.cursor.y() + kHeight > kSheetSize) {
+          QImage sheet(kSheetSize, kSheetSize, QImage::Format_RGB888);
+          sheet.fill(Qt::white);
+          atlas.sheets.append(sheet);
+          atlas.cursor = QPoint(0, 0);
+        }
+        QPainter painter(&atlas.sheets.last());
+        painter.drawImage(atlas.cursor, image);
+        painter.end();
+        atlas.sheetOf[index] = atlas.sheets.size() - 1;
+        atlas.rects[index] = QRect(atlas.cursor, image.size());
+        atlas.cursor.rx() += (image.width() + kBlock - 1) / kBlock * kBlock;
+      }
+      strip->dirty = true;
+      takeWaiters(index, ready);
+    }
+    deliver(ready);
+  }
+
+  AtlasData snapshot;
+  {
+    QMutexLocker locker(&m_mutex);
+    if (!strip->dirty) {
+      return;
+    }
+    strip->dirty = false;
+    // Sheets are implicitly shared; the copy is cheap and stays consistent.
+    snapshot = strip->atlas;
+  }
+  saveAtlas(strip->source, snapshot);
+}
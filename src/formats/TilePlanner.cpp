@@ -0,0 +1,83 @@
+#include "TilePlanner.h"
+#include "include/PageImageCache.h"
+#include "RenderScheduler.h"
+
+#include <QPointF>
+#include <QSizeF>
+#include <algorithm>
+#include <cmath>
+
+namespace {
+constexpr int kMaxZoomBucket = 6;
+} // namespace
+
+namespace TilePlanner {
+
+int zoomBucket(qreal scale) {
+  return std::clamp(static_cast<int>(std::ceil(std::log2(scale) * 2.0)), 1, kMaxZoomBucket);
+}
+
+qreal bucketScale(int bucket) {
+  return std::pow(2.0, bucket / 2.0);
+}
+
+QVector<PageTile> requestTiles(const Request &request,
+                               const std::function<bool(const QString &key)> &claim,
+                               const TileJob &job,
+                               const std::function<void(const QString &key)> &release) {
+  const qreal factor = request.factor;
+  const int edge = request.tileEdge;
+  const QRectF visible = QRectF(request.viewport.topLeft() * factor, request.viewport.size() * factor)
+                             .intersected(QRectF(QPointF(0, 0), QSizeF(request.full)));
+  if (visible.isEmpty() || edge <= 0) {
+    return {};
+  }
+
+  RenderScheduler &scheduler = RenderScheduler::instance();
+  scheduler.cancelTagged(request.owner, request.index);
+  const RenderScheduler::Lane lane = request.visible ? RenderScheduler::Lane::Visible
+                                                     : RenderScheduler::Lane::Prefetch;
+  const int firstCol = static_cast<int>(visible.left()) / edge;
+  const int lastCol = (static_cast<int>(std::ceil(visible.right())) - 1) / edge;
+  const int firstRow = static_cast<int>(visible.top()) / edge;
+  const int lastRow = (static_cast<int>(std::ceil(visible.bottom())) - 1) / edge;
+  QVector<PageTile> tiles;
+  for (int row = firstRow; row <= lastRow; ++row) {
+    for (int col = firstCol; col <= lastCol; ++col) {
+      const QRect rect(col * edge,
+                       row * edge,
+                       std::min(edge, request.full.width() - col * edge),
+                       std::min(edge, request.full.height() - row * edge));
+      const QString tag = QString("%1/%2_%3").arg(request.tagPrefix).arg(col).arg(row);
+      const QString key = request.pageKey + '/' + tag;
+      tiles.append({key, QRectF(rect.x() / factor, rect.y() / factor,
+                                rect.width() / factor, rect.height() / factor)});
+      if (PageImageCache::instance().contains(key) || !claim(key)) {
+        continue;
+      }
+      scheduler.submit(request.owner, request.index, lane, job(rect, key),
+                       [release, key]() { release(key); }, tag);
+    }
+  }
+  return tiles;
+}
+
+bool queueWindow(int index,
+                 int total,
+                 const PrefetchPlanner::Window &window,
+                 const std::function<bool(int index)> &queue) {
+  const int start = std::max(0, index - window.before);
+  const int end = std::min(total - 1, index + window.after);
+  bool queued = queue(index);
+  for (int step = 1; index - step >= start || index + step <= end; ++step) {
+    if (index + step <= end) {
+      queued = queue(index + step) || queued;
+    }
+    if (index - step >= start) {
+      queued = queue(index - step) || queued;
+    }
+  }
+  return queued;
+}
+
+} // namespace TilePlanner
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "include/FormatDocument.h"
+#include "PrefetchPlanner.h"
+
+#include <QRect>
+#include <QRectF>
+#include <QSize>
+#include <QString>
+#include <QVector>
+#include <functional>
+
+// Which pages and zoom tiles a paged document (PDF, DjVu, comics) queues, and
+// in what order. Rendering, decoding and the in-flight bookkeeping stay with
+// the provider.
+namespace TilePlanner {
+
+// Below this magnification the base image is sharp enough.
+constexpr qreal kMinScale = 1.2;
+
+// Zoom tiles are rendered in steps of sqrt(2), up to 8x the base image, so
+// small pinch changes keep reusing the tiles already cached.
+int zoomBucket(qreal scale);
+qreal bucketScale(int bucket);
+
+struct Request {
+  const void *owner = nullptr;
+  int index = 0;
+  // Tiles of the page on screen go to the Visible lane, others to Prefetch.
+  bool visible = false;
+  // PageImageCache key of the page; tile keys append "/<tag>".
+  QString pageKey;
+  // Size of the whole page at the tile zoom and its ratio to the base image.
+  QSize full;
+  qreal factor = 1.0;
+  // Visible part of the page in base image pixels.
+  QRectF viewport;
+  int tileEdge = 512;
+  // Tells zoom levels apart in the tile tags, e.g. "z3".
+  QString tagPrefix;
+};
+
+// Job rendering `rect` of the page at `request.full` into PageImageCache under `key`.
+using TileJob = std::function<std::function<void()>(const QRect &rect, const QString &key)>;
+
+// Returns the tiles covering the viewport. Queued tiles of the page from an
+// earlier zoom or scroll position are dropped first; the ones still needed
+// and missing from PageImageCache are submitted again. `claim(key)` is false
+// for a tile already in flight; `release(key)` runs for a tile dropped unrun.
+QVector<PageTile> requestTiles(const Request &request,
+                               const std::function<bool(const QString &key)> &claim,
+                               const TileJob &job,
+                               const std::function<void(const QString &key)> &release);
+
+// Calls `queue` on `index` and then on the pages of `window` outwards from
+// it, so the queue order matches need. True when any call returned true.
+bool queueWindow(int index,
+                 int total,
+                 const PrefetchPlanner::Window &window,
+                 const std::function<bool(int index)> &queue);
+
+} // namespace TilePlanner
@@ -1,5 +1,6 @@
 #include "TxtProvider.h"
 #include "../core/include/AppPaths.h"
+#include "CancelUtil.h"
 
 #include <QDir>
 #include <QFile>
@@ -194,11 +195,45 @@ QString normalizeText(const QString &input, const TxtSettings &settings) {
   return out.join('\n');
 }
 
+struct TextSpan {
+  int start = 0;
+  int length = 0;
+};
+
+// A chapter is one or more slices of the normalized text joined by newlines,
+// so chapter strings are only built when the reader asks for them.
+using ChapterSpans = QVector<TextSpan>;
+
 struct ChapterSplit {
   QStringList titles;
-  QStringList texts;
+  QVector<ChapterSpans> spans;
 };
 
+QString joinSpans(const QString &text, const ChapterSpans &spans) {
+  QString out;
+  qsizetype total = 0;
+  for (const TextSpan &span : spans) {
+    total += span.length + 1;
+  }
+  out.reserve(total);
+  for (int i = 0; i < spans.size(); ++i) {
+    if (i > 0) {
+      out.append('\n');
+    }
+    out.append(QStringView(text).mid(spans.at(i).start, spans.at(i).length));
+  }
+  return out;
+}
+
+bool spansBlank(const QString &text, const ChapterSpans &spans) {
+  for (const TextSpan &span : spans) {
+    if (!QStringView(text).mid(span.start, span.length).trimmed().isEmpty()) {
+      return false;
+    }
+  }
+  return true;
+}
+
 QString cleanHeadingTitle(QString title) {
   title = title.trimmed();
   title.remove(QRegularExpression("^#+\\s*"));
@@ -282,41 +317,42 @@ ChapterSplit splitChaptersFromHeadings(const QString &text) {
     return out;
   }
 
+  QVector<int> lineStarts(lines.size() + 1, 0);
+  for (int i = 0; i < lines.size(); ++i) {
+    lineStarts[i + 1] = lineStarts.at(i) + lines.at(i).size() + 1;
+  }
+
+  auto collectSpans = [&](int startLine, int endLine) {
+    ChapterSpans spans;
+    int runStart = -1;
+    for (int lineIndex = startLine; lineIndex <= endLine; ++lineIndex) {
+      const bool keep = lineIndex < endLine && !skipLines.contains(lineIndex);
+      if (keep && runStart < 0) {
+        runStart = lineIndex;
+      } else if (!keep && runStart >= 0) {
+        const int start = lineStarts.at(runStart);
+        spans.append({start, lineStarts.at(lineIndex) - 1 - start});
+        runStart = -1;
+      }
+    }
+    return spans;
+  };
+
   auto appendChapter = [&](int startLine, int endLine, const QString &title) {
     if (endLine <= startLine) {
       return;
     }
-    QStringList segmentLines;
-    segmentLines.reserve(endLine - startLine);
-    for (int lineIndex = startLine; lineIndex < endLine; ++lineIndex) {
-      if (skipLines.contains(lineIndex)) {
-        continue;
-      }
-      segmentLines.append(lines.at(lineIndex));
-    }
-    const QString segmentText = segmentLines.join('\n');
-    if (segmentText.trimmed().isEmpty()) {
+    const ChapterSpans spans = collectSpans(startLine, endLine);
+    if (spans.isEmpty() || spansBlank(text, spans)) {
       return;
     }
-    out.texts.append(segmentText);
+    out.spans.append(spans);
     out.titles.append(title);
   };
 
   const int firstHeadingLine = filtered.first().line;
   if (firstHeadingLine > 0) {
-    QStringList introLines;
-    introLines.reserve(firstHeadingLine);
-    for (int lineIndex = 0; lineIndex < firstHeadingLine; ++lineIndex) {
-      if (skipLines.contains(lineIndex)) {
-        continue;
-      }
-      introLines.append(lines.at(lineIndex));
-    }
-    const QString introText = introLines.join('\n');
-    if (!introText.trimmed().isEmpty()) {
-      out.texts.append(introText);
-      out.titles.append("Intro");
-    }
+    appendChapter(0, firstHeadingLine, "Intro");
   }
 
   for (int i = 0; i < filtered.size(); ++i) {
@@ -325,8 +361,8 @@ ChapterSplit splitChaptersFromHeadings(const QString &text) {
     appendChapter(startLine, endLine, filtered.at(i).title);
   }
 
-  if (out.texts.size() < 2) {
-    out.texts.clear();
+  if (out.spans.size() < 2) {
+    out.spans.clear();
     out.titles.clear();
   }
   return out;
@@ -334,22 +370,41 @@ ChapterSplit splitChaptersFromHeadings(const QString &text) {
 
 class TxtDocument final : public FormatDocument {
 public:
-  TxtDocument(QString title, QString text, QStringList chapterTitles, QStringList chapterTexts)
+  TxtDocument(QString title, QString text, QStringList chapterTitles, QVector<ChapterSpans> chapterSpans)
       : m_title(std::move(title)),
         m_text(std::move(text)),
         m_chapterTitles(std::move(chapterTitles)),
-        m_chapterTexts(std::move(chapterTexts)) {}
+        m_chapterSpans(std::move(chapterSpans)) {}
 
   QString title() const override { return m_title; }
   QStringList chapterTitles() const override { return m_chapterTitles; }
   QString readAllText() const override { return m_text; }
-  QStringList chaptersText() const override { return m_chapterTexts; }
+  QStringList chaptersText() const override {
+    QStringList out;
+    out.reserve(m_chapterSpans.size());
+    for (const ChapterSpans &spans : m_chapterSpans) {
+      out.append(joinSpans(m_text, spans));
+    }
+    return out;
+  }
+  int chapterCount() const override { return m_chapterSpans.size(); }
+  QString chapterText(int index) const override {
+    if (index < 0 || index >= m_chapterSpans.size()) {
+      return {};
+    }
+    return joinSpans(m_text, m_chapterSpans.at(index));
+  }
+  QString chapterPlainText(int index) const override { return chapterText(index); }
+  qint64 approximateMemoryCost() const override {
+    return static_cast<qint64>(m_text.size()) * 2 +
+           static_cast<qint64>(m_chapterSpans.size()) * static_cast<qint64>(sizeof(TextSpan));
+  }
 
 private:
   QString m_title;
   QString m_text;
   QStringList m_chapterTitles;
-  QStringList m_chapterTexts;
+  QVector<ChapterSpans> m_chapterSpans;
 };
 } // namespace
 
@@ -361,7 +416,10 @@ QStringList TxtProvider::supportedExtensions() const {
   return {"txt"};
 }
 
-std::unique_ptr<FormatDocument> TxtProvider::open(const QString &path, QString *error) {
+std::unique_ptr<FormatDocument> TxtProvider::open(const QString &path,
+                                                  QString *error,
+                                                  const OpenOptions &options) {
+  const CancelToken &cancel = options.cancel;
   QFile file(path);
   if (!file.open(QIODevice::ReadOnly)) {
     if (error) {
@@ -370,9 +428,25 @@ std::unique_ptr<FormatDocument> TxtProvider::open(const QString &path, QString *
     return nullptr;
   }
 
+  const auto cancelled = [&cancel, error]() { return openCancelled(cancel, error); };
+
   const TxtSettings settings = loadTxtSettings();
-  const QByteArray bytes = file.readAll();
+  QByteArray bytes;
+  bytes.reserve(static_cast<qsizetype>(file.size()));
+  while (!file.atEnd()) {
+    if (cancelled()) {
+      return nullptr;
+    }
+    const QByteArray chunk = file.read(1 << 20);
+    if (chunk.isEmpty()) {
+      break;
+    }
+    bytes.append(chunk);
+  }
   const DecodedText decoded = decodeText(bytes, settings);
+  if (cancelled()) {
+    return nullptr;
+  }
   QString text = normalizeText(decoded.text, settings);
   const QString textForChapters = text;
   text.replace('\f', '\n');
@@ -382,24 +456,36 @@ std::unique_ptr<FormatDocument> TxtProvider::open(const QString &path, QString *
     qInfo() << "TxtProvider: decoded using" << decoded.encoding << "bytes" << bytes.size();
   }
 
-  QStringList chapterTexts;
+  QVector<ChapterSpans> chapterSpans;
   QStringList chapterTitles;
   if (settings.splitOnFormFeed && textForChapters.contains(QLatin1Char('\f'))) {
-    const QStringList parts = textForChapters.split(QLatin1Char('\f'));
+    // Form feeds became newlines in `text`, so offsets into textForChapters line up.
     int index = 0;
-    for (const QString &part : parts) {
-      if (part.trimmed().isEmpty()) {
-        continue;
+    int start = 0;
+    while (start <= textForChapters.size()) {
+      if (cancelled()) {
+        return nullptr;
+      }
+      int end = textForChapters.indexOf(QLatin1Char('\f'), start);
+      if (end < 0) {
+        end = textForChapters.size();
+      }
+      const ChapterSpans spans{{start, end - start}};
+      if (!spansBlank(text, spans)) {
+        chapterSpans.append(spans);
+        chapterTitles.append(QString("Page %1").arg(++index));
       }
-      chapterTexts.append(part);
-      chapterTitles.append(QString("Page %1").arg(++index));
+      start = end + 1;
     }
   }
-  if (chapterTexts.isEmpty() && settings.autoChapters) {
+  if (cancelled()) {
+    return nullptr;
+  }
+  if (chapterSpans.isEmpty() && settings.autoChapters) {
     const ChapterSplit split = splitChaptersFromHeadings(text);
-    chapterTexts = split.texts;
+    chapterSpans = split.spans;
     chapterTitles = split.titles;
   }
 
-  return std::make_unique<TxtDocument>(title, text, chapterTitles, chapterTexts);
+  return std::make_unique<TxtDocument>(title, text, chapterTitles, chapterSpans);
 }
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <QString>
+#include <memory>
+
+// Shared on-disk home for what providers extract from a book (EPUB/MOBI/FB2
+// images, comic pages, the PDF text index). Entries live under
+// CacheLocation/assets, one directory per (kind, content fingerprint), so a
+// book keeps its entry across restarts, renames and moves. Each use stamps
+// the entry; a background pass at startup, and again whenever a new entry is
+// created, removes the least recently used entries beyond `cache/assets_mb`.
+// The startup pass also clears the old per-book `ereader_*` temp directories.
+namespace AssetCache {
+
+// Keeps the entries of one book from being collected while it is alive.
+using Lease = std::shared_ptr<void>;
+
+// Directory for `sourcePath`'s assets of one `kind` ("epub", "pdf", ...),
+// created if needed and marked as used now. Only entries of books with a
+// live Lease are safe from collection.
+QString directoryFor(const QString &kind, const QString &sourcePath);
+
+// Held by whoever keeps a document of `sourcePath` open.
+Lease hold(const QString &sourcePath);
+
+// Runs garbage collection once on a low-priority thread.
+void startGarbageCollection();
+
+} // namespace AssetCache
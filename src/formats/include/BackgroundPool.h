@@ -0,0 +1,13 @@
+#pragma once
+
+#include <QThread>
+#include <QThreadPool>
+
+// A single lowest-priority thread for work that must stay out of the way of
+// rendering and the UI. The caller owns the returned pool.
+inline QThreadPool *makeBackgroundPool() {
+  auto *pool = new QThreadPool();
+  pool->setMaxThreadCount(1);
+  pool->setThreadPriority(QThread::LowestPriority);
+  return pool;
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+
+// Shared cancellation flag. Copies observe the same state, so the caller keeps
+// one copy and hands another to the worker doing the long-running job.
+class CancelToken {
+public:
+  CancelToken() : m_flag(std::make_shared<std::atomic_bool>(false)) {}
+
+  void cancel() const { m_flag->store(true); }
+  bool isCancelled() const { return m_flag->load(std::memory_order_relaxed); }
+
+private:
+  std::shared_ptr<std::atomic_bool> m_flag;
+};
@@ -1,10 +1,41 @@
 #pragma once
 
+#include <QImage>
+#include <QRectF>
+#include <QSize>
 #include <QString>
 #include <QStringList>
 #include <QVector>
 #include <functional>
 
+// Part of a zoomed-in page, served from PageImageCache under `key`; `rect` is
+// in pixels of the page's base image.
+struct PageTile {
+  QString key;
+  QRectF rect;
+};
+
+// A word of a page's text layer: `start`/`length` index pageText(index) and
+// `rect` is normalized to the page image (0..1, top-left origin).
+struct PageWord {
+  int start = 0;
+  int length = 0;
+  int line = 0;
+  QRectF rect;
+};
+
+// Renders thumbnails of a paged document for ThumbnailAtlas. `render` runs on
+// a background thread, may outlive the document (returning a null image once
+// it is closed) and returns page `index` scaled to `height` pixels tall.
+// `signature` names the settings the pages depend on (tint, rotation, ...);
+// an atlas saved under another signature is rendered again.
+struct ThumbnailSource {
+  QString atlasPath;
+  QString signature;
+  int pageCount = 0;
+  std::function<QImage(int index, int height)> render;
+};
+
 class FormatDocument {
 public:
   virtual ~FormatDocument() = default;
@@ -15,7 +46,35 @@ public:
   virtual QString readAllPlainText() const { return readAllText(); }
   virtual QStringList chaptersText() const { return {}; }
   virtual QStringList chaptersPlainText() const { return chaptersText(); }
+  virtual int chapterCount() const { return chaptersText().size(); }
+  virtual QString chapterText(int index) const { return chaptersText().value(index); }
+  virtual QString chapterPlainText(int index) const { return chaptersPlainText().value(index); }
+  // Delivers (index, text, plainText). Lazy formats run the conversion on a
+  // worker thread, so the callback must not assume it runs on the caller's thread.
+  virtual void requestChapter(int index, std::function<void(int, QString, QString)> callback) {
+    if (callback) {
+      callback(index, chapterText(index), chapterPlainText(index));
+    }
+  }
+  // Name of chapter `index` that still finds it when the index is not known
+  // yet (EPUB: the spine item); empty when only the index identifies it.
+  virtual QString chapterKey(int index) const { Q_UNUSED(index) return {}; }
+  // Index of the chapter named `key` among those discovered so far, or -1.
+  virtual int chapterIndexForKey(const QString &key) const { Q_UNUSED(key) return -1; }
   virtual QStringList imagePaths() const { return {}; }
+  // Text layer of one page of a paged format (PDF); may extract it on the spot.
+  virtual QString pageText(int index) const { Q_UNUSED(index) return {}; }
+  // Word boxes of pageText(index); empty when the format has no positions.
+  virtual QVector<PageWord> pageWords(int index) const { Q_UNUSED(index) return {}; }
+  // False while pageText(index) would still have to extract the page.
+  virtual bool isPageTextReady(int index) const { Q_UNUSED(index) return true; }
+  // Queues extraction of page `index` ahead of other text work; `callback`
+  // gets the index, possibly on a worker thread, once the page is in.
+  virtual void requestPageText(int index, std::function<void(int)> callback) {
+    if (callback) {
+      callback(index);
+    }
+  }
   virtual QString coverPath() const { return {}; }
   virtual QString authors() const { return {}; }
   virtual QString series() const { return {}; }
@@ -25,6 +84,41 @@ public:
   virtual QVector<int> tocChapterIndices() const { return {}; }
   virtual bool isRichText() const { return false; }
   virtual bool ttsDisabled() const { return false; }
-  virtual bool ensureImage(int index) { Q_UNUSED(index) return true; }
+  // True while the provider is still discovering chapters after open returned.
+  virtual bool isLoading() const { return false; }
+  // Called (possibly from a worker thread) when chapters/TOC grew or loading finished.
+  virtual void setStructureChangedCallback(std::function<void()> callback) { Q_UNUSED(callback) }
+  // Rough bytes held in memory (text, parser state, decoded data); drives
+  // eviction from the reader's recently-opened document cache.
+  virtual qint64 approximateMemoryCost() const { return 0; }
+  // Queues page `index` (and its prefetch window) for display. `targetSize`
+  // is the device-pixel box the page is shown in, 0 on an unconstrained side;
+  // paged formats render or decode at that size instead of a fixed DPI.
+  virtual bool ensureImage(int index, const QSize &targetSize = QSize()) {
+    Q_UNUSED(index)
+    Q_UNUSED(targetSize)
+    return true;
+  }
+  // The page now on screen; paged formats render it first and drop queued
+  // prefetches that are no longer near it.
+  virtual void setCurrentImage(int index) { Q_UNUSED(index) }
+  // PageImageCache key of a rendered page; empty when imagePaths() are plain files.
+  virtual QString pageImageKey(int index) const { Q_UNUSED(index) return {}; }
+  // Zoomed view of a page: `pageSize` is the base image size, `scale` how much
+  // it is magnified on screen and `viewport` the visible part in base image
+  // pixels. Returns the tiles covering the viewport and queues the missing
+  // ones; empty when the base image is sharp enough.
+  virtual QVector<PageTile> requestTiles(int index,
+                                         const QSize &pageSize,
+                                         qreal scale,
+                                         const QRectF &viewport) {
+    Q_UNUSED(index)
+    Q_UNUSED(pageSize)
+    Q_UNUSED(scale)
+    Q_UNUSED(viewport)
+    return {};
+  }
   virtual void setImageReadyCallback(std::function<void(int)> callback) { Q_UNUSED(callback) }
+  // Empty `render` when the format has no page thumbnails.
+  virtual ThumbnailSource thumbnailSource() const { return {}; }
 };
@@ -1,16 +1,39 @@
 #pragma once
 
+#include <QFileInfo>
 #include <QString>
 #include <QStringList>
 #include <memory>
 
+#include "CancelToken.h"
 #include "FormatDocument.h"
 
+// Off skips the parsed-book cache, ReadOnly reuses entries without queueing a
+// background build, ReadWrite does both.
+enum class ParsedCacheMode { Off, ReadOnly, ReadWrite };
+
+struct OpenOptions {
+  // Polled between units of work (spine items, pages, archive entries); a
+  // cancelled open removes its partial temp output and returns nullptr.
+  CancelToken cancel;
+  // Detected format key (e.g. "epub", "cbr"); differs from the suffix for
+  // mislabelled files. Empty means "use the suffix".
+  QString format;
+  ParsedCacheMode parsedCache = ParsedCacheMode::ReadWrite;
+};
+
+inline QString openFormatKey(const QString &path, const OpenOptions &options) {
+  return options.format.isEmpty() ? QFileInfo(path).suffix().toLower() : options.format;
+}
+
 class FormatProvider {
 public:
   virtual ~FormatProvider() = default;
 
   virtual QString name() const = 0;
   virtual QStringList supportedExtensions() const = 0;
-  virtual std::unique_ptr<FormatDocument> open(const QString &path, QString *error) = 0;
+  // Called concurrently from several threads; providers keep no per-open state.
+  virtual std::unique_ptr<FormatDocument> open(const QString &path,
+                                               QString *error,
+                                               const OpenOptions &options) = 0;
 };
@@ -1,17 +1,38 @@
 #pragma once
 
+#include <QHash>
 #include <memory>
 #include <vector>
 
 #include "FormatProvider.h"
 
+// Process-wide, immutable after construction, so open() may be called from
+// any thread.
 class FormatRegistry {
 public:
-  static std::unique_ptr<FormatRegistry> createDefault();
+  static const FormatRegistry &instance();
 
-  void registerProvider(std::unique_ptr<FormatProvider> provider);
-  std::unique_ptr<FormatDocument> open(const QString &path, QString *error) const;
+  // Format key for `path`: the suffix when it agrees with the file's magic
+  // bytes, otherwise the sniffed format (e.g. "epub" for a cached ".bin").
+  QString formatFor(const QString &path) const;
+  std::unique_ptr<FormatDocument> open(const QString &path,
+                                       QString *error,
+                                       const OpenOptions &options = OpenOptions()) const;
+  // Queues a lowest-priority build of the parsed-book cache entry of `path`
+  // unless one is fresh; for documents opened with ParsedCacheMode::ReadOnly
+  // that the reader ends up showing.
+  void buildParsedCache(const QString &path, const QString &format) const;
+  // Stops work an earlier open of `path` queued in the background (building
+  // its parsed-book cache entry); call when the book is closed.
+  void cancelBackgroundWork(const QString &path) const;
 
 private:
+  FormatRegistry();
+  FormatRegistry(const FormatRegistry &) = delete;
+  FormatRegistry &operator=(const FormatRegistry &) = delete;
+
+  void registerProvider(std::unique_ptr<FormatProvider> provider);
+
   std::vector<std::unique_ptr<FormatProvider>> m_providers;
+  QHash<QString, FormatProvider *> m_byExtension;
 };
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QPair>
+#include <QSize>
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <functional>
+#include <list>
+#include <unordered_map>
+
+// Process-wide page cache for every paged format (PDF, DjVu, comics). Render
+// workers insert decoded QImages and the QML "image://pages" provider hands
+// them to the scene graph. Keys are "<documentId>/<pageIndex>[/...]".
+//
+// Two tiers share one policy: a memory tier (`cache/page_images_mb`) and a
+// raw on-disk spill tier (`cache/page_disk_mb`) that evicted pages drop into,
+// so a page that fell out of memory reloads without a re-render. Both are
+// byte-budgeted LRUs with O(1) bookkeeping. When memory is over budget the
+// document holding more than its share (budget / open documents) loses its
+// least recently used page first, so one document of huge scans cannot flush
+// every other open book.
+class PageImageCache {
+public:
+  using Waiter = std::function<void(const QImage &)>;
+
+  struct Stats {
+    quint64 memoryHits = 0;
+    quint64 diskHits = 0;
+    quint64 misses = 0;
+    quint64 evictions = 0;
+    quint64 spills = 0;
+    qint64 memoryBytes = 0;
+    qint64 memoryBudget = 0;
+    qint64 diskBytes = 0;
+    qint64 diskBudget = 0;
+    int documents = 0;
+  };
+
+  static PageImageCache &instance();
+  static QString newDocumentId(const QString &prefix);
+  static QString key(const QString &documentId, int index);
+  // Rounds a view's device-pixel box up to 128 px steps so small resizes
+  // reuse renders. A 0 side is unconstrained (fit to width or height); the
+  // result is invalid when neither side is set.
+  static QSize targetBucket(const QSize &size);
+
+  void setBudget(qint64 bytes);
+  // 0 disables the disk tier.
+  void setDiskBudget(qint64 bytes);
+  void insert(const QString &key, const QImage &image);
+  // Looks in memory, then on disk; a disk hit is promoted back to memory.
+  QImage find(const QString &key);
+  // True when either tier holds `key`; does not count as a lookup.
+  bool contains(const QString &key) const;
+  void remove(const QString &key);
+  // Drops every page of a closed document; pending waiters get a null image.
+  void removeDocument(const QString &documentId);
+
+  // Calls `waiter` (on the inserting thread) with the next image stored under
+  // `key`, or right away when it is already cached. Returns 0 in that case.
+  quint64 subscribe(const QString &key, Waiter waiter);
+  void unsubscribe(quint64 ticket);
+
+  Stats stats() const;
+
+private:
+  struct Entry {
+    QImage image;
+    QString document;
+    qint64 bytes = 0;
+    std::list<QString>::iterator order;
+    std::list<QString>::iterator documentOrder;
+  };
+  struct DocumentUsage {
+    qint64 bytes = 0;
+    // Least recently used first.
+    std::list<QString> order;
+  };
+  struct DiskEntry {
+    QString path;
+    qint64 bytes = 0;
+    std::list<QString>::iterator order;
+  };
+  struct Spill {
+    QString key;
+    QString path;
+    QImage image;
+  };
+
+  PageImageCache();
+  static QString documentOf(const QString &key);
+  void touchLocked(Entry &entry);
+  void storeLocked(const QString &key, const QImage &image, QVector<Spill> &spills, QStringList &doomed);
+  void unlinkLocked(const QString &key);
+  void dropDiskLocked(const QString &key, QStringList &doomed);
+  QString victimLocked() const;
+  void evictLocked(QVector<Spill> &spills, QStringList &doomed);
+  // Memory lookup, falling back to pages being spilled and then to disk.
+  // Runs the disk read outside the lock and promotes the page.
+  QImage lookup(const QString &key, bool *found);
+  void finishSpills(const QVector<Spill> &spills, const QStringList &doomed);
+
+  mutable QMutex m_mutex;
+  QHash<QString, Entry> m_entries;
+  // Least recently used first, across documents.
+  std::list<QString> m_order;
+  std::unordered_map<QString, DocumentUsage> m_documents;
+  qint64 m_bytes = 0;
+  qint64 m_budget = 0;
+
+  QString m_diskDir;
+  QHash<QString, DiskEntry> m_disk;
+  std::list<QString> m_diskOrder;
+  // Evicted pages whose file is still being written; served from here.
+  QHash<QString, QImage> m_spilling;
+  qint64 m_diskBytes = 0;
+  qint64 m_diskBudget = 0;
+  quint64 m_nextFile = 1;
+
+  QHash<quint64, QPair<QString, Waiter>> m_waiters;
+  quint64 m_nextTicket = 1;
+
+  quint64 m_memoryHits = 0;
+  quint64 m_diskHits = 0;
+  quint64 m_misses = 0;
+  quint64 m_evictions = 0;
+  quint64 m_spills = 0;
+};
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <QHash>
+#include <QImage>
+#include <QMutex>
+#include <QPair>
+#include <QString>
+#include <functional>
+#include <memory>
+
+#include "FormatDocument.h"
+
+// Page overview for PDF, DjVu and comics. A lowest-priority background thread
+// renders every page `kHeight` px tall through the document's
+// ThumbnailSource and packs the results into sheets, written to one atlas file
+// per book (ThumbnailSource::atlasPath) so the next open shows the whole strip
+// at once. Kept apart from PageImageCache so scrubbing never evicts pages.
+class ThumbnailAtlas {
+public:
+  using Waiter = std::function<void(const QImage &)>;
+
+  static constexpr int kHeight = 96;
+
+  static ThumbnailAtlas &instance();
+
+  // Loads the atlas file and renders the missing pages; returns the id that
+  // thumbnails are requested with, or an empty string when `source` cannot
+  // render.
+  QString start(const ThumbnailSource &source);
+  // Stops rendering, saves what was rendered and frees the sheets.
+  void stop(const QString &id);
+
+  // Calls `waiter` with the thumbnail of page `index`, right away when it is
+  // ready (returns 0 then), otherwise once rendered; requested pages are
+  // rendered before the rest of the strip. Unknown ids get a null image.
+  quint64 subscribe(const QString &id, int index, Waiter waiter);
+  void unsubscribe(quint64 ticket);
+
+private:
+  struct Strip;
+
+  ThumbnailAtlas() = default;
+  void run(const std::shared_ptr<Strip> &strip);
+
+  QMutex m_mutex;
+  QHash<QString, std::shared_ptr<Strip>> m_strips;
+  // ticket -> (strip id, page); the waiter itself lives in the strip.
+  QHash<quint64, QPair<QString, int>> m_tickets;
+  quint64 m_nextTicket = 1;
+  quint64 m_nextId = 1;
+};